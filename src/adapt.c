@@ -0,0 +1,255 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Adaptive finetune (option adaptfinetune). During burn-in, the step lengths
+   of the gene tree SPR proposal of each locus, and of the theta and tau
+   proposals of each population, follow a Robbins-Monro recursion on the
+   log-scale
+
+     log(step) += gain_k * (acceptance - target)
+
+   with gain_k = 1/k^0.6 at burn-in iteration k. The gain is zero after
+   burn-in, such that the step lengths are frozen while sampling. The target
+   is 0.3 for the SPR move, which changes several node ages at once, and 0.4
+   for the one-dimensional theta and tau moves.
+
+   The gene tree age move is not adapted. Its proposals are reflected into
+   the interval between the parent and the oldest child, so its acceptance
+   rate stays above about 0.6 however large the step is, and the recursion
+   would only drive the step to ADAPT_MAXSTEP. It keeps opt_finetune_gtage.
+
+   The HMC branch rate move (option hmcsteps) is always tuned during burn-in.
+   Its leapfrog step length follows the same recursion with the acceptance
+   probability of the move and a target of 0.65. The burn-in is split into
+   four windows; at the start of the second, third and fourth window, the
+   scale of each coordinate is set to the (regularized) standard deviation of
+   the coordinate in the previous window, and the step recursion restarts. */
+
+#define ADAPT_TARGET_GTSPR  0.3
+#define ADAPT_TARGET_THETA  0.4
+#define ADAPT_TARGET_TAU    0.4
+#define ADAPT_DECAY     0.6
+#define ADAPT_MINSTEP   1e-8
+#define ADAPT_MAXSTEP   99
+
+#define ADAPT_HMC_TARGET  0.65
+#define ADAPT_HMC_WINDOWS 4
+
+static double adapt_gain = 0;
+static double adapt_hmc_gain = 0;
+static int adapt_hmc_newwindow = 0;
+
+void adapt_init(stree_t * stree, locus_t ** locus, long locus_count)
+{
+  long i;
+  unsigned int total_nodes = stree->tip_count + stree->inner_count +
+                             stree->hybrid_count;
+
+  for (i = 0; i < locus_count; ++i)
+    locus[i]->finetune_gtspr = opt_finetune_gtspr;
+
+  for (i = 0; i < total_nodes; ++i)
+  {
+    stree->nodes[i]->finetune_theta = opt_finetune_theta;
+    stree->nodes[i]->finetune_tau = opt_finetune_tau;
+  }
+}
+
+/* set the gain for MCMC iteration i, where burn-in spans [-opt_burnin,0) */
+void adapt_set_iteration(long i)
+{
+  long k = i + opt_burnin + 1;
+
+  if (i < 0)
+  {
+    /* window of burn-in iteration k and its first iteration */
+    long w = ADAPT_HMC_WINDOWS*(k-1) / opt_burnin;
+    long start = (w*opt_burnin + ADAPT_HMC_WINDOWS-1) / ADAPT_HMC_WINDOWS + 1;
+
+    adapt_gain = pow(k, -ADAPT_DECAY);
+    adapt_hmc_gain = pow(k - start + 1, -ADAPT_DECAY);
+    adapt_hmc_newwindow = (w > 0 && k == start);
+  }
+  else
+  {
+    adapt_gain = 0;
+    adapt_hmc_gain = 0;
+    adapt_hmc_newwindow = 0;
+  }
+}
+
+void adapt_update(double * step, int move, long accepted, long proposals)
+{
+  double target;
+
+  if (!adapt_gain || !proposals) return;
+
+  if (move == BPP_MOVE_GTSPR_INDEX)
+    target = ADAPT_TARGET_GTSPR;
+  else if (move == BPP_MOVE_THETA_INDEX)
+    target = ADAPT_TARGET_THETA;
+  else
+  {
+    assert(move == BPP_MOVE_TAU_INDEX);
+    target = ADAPT_TARGET_TAU;
+  }
+
+  *step *= exp(adapt_gain * ((double)accepted/proposals - target));
+
+  if (*step < ADAPT_MINSTEP)
+    *step = ADAPT_MINSTEP;
+  else if (*step > ADAPT_MAXSTEP)
+    *step = ADAPT_MAXSTEP;
+}
+
+/* positions of the HMC move are the log rates of the populations, log(mu_i)
+   and log(nu_i) */
+long adapt_hmc_dim(stree_t * stree)
+{
+  return stree->tip_count + stree->inner_count + stree->hybrid_count + 2;
+}
+
+void adapt_hmc_init(stree_t * stree, locus_t ** locus, long locus_count)
+{
+  long i,j;
+  long dim = adapt_hmc_dim(stree);
+
+  for (i = 0; i < locus_count; ++i)
+  {
+    locus[i]->hmc_step = opt_finetune_branchrate;
+    locus[i]->hmc_scale = (double *)xmalloc((size_t)dim * sizeof(double));
+    locus[i]->hmc_mean = (double *)xcalloc((size_t)dim, sizeof(double));
+    locus[i]->hmc_m2 = (double *)xcalloc((size_t)dim, sizeof(double));
+    locus[i]->hmc_count = 0;
+    for (j = 0; j < dim; ++j)
+      locus[i]->hmc_scale[j] = 1;
+  }
+}
+
+/* at the start of a new window set the scales from the moments of the
+   previous window, shrunk towards 0.001 as in Stan */
+void adapt_hmc_window(locus_t * locus, long dim)
+{
+  long j;
+  double n = (double)(locus->hmc_count);
+
+  if (!adapt_hmc_newwindow) return;
+
+  if (locus->hmc_count > 1)
+    for (j = 0; j < dim; ++j)
+    {
+      double var = locus->hmc_m2[j] / (n-1);
+      locus->hmc_scale[j] = sqrt((n/(n+5))*var + 0.001*(5/(n+5)));
+    }
+
+  memset(locus->hmc_mean, 0, (size_t)dim * sizeof(double));
+  memset(locus->hmc_m2, 0, (size_t)dim * sizeof(double));
+  locus->hmc_count = 0;
+}
+
+void adapt_hmc_update(locus_t * locus,
+                      const double * x,
+                      long dim,
+                      double acceptance)
+{
+  long j;
+
+  if (!adapt_hmc_gain) return;
+
+  locus->hmc_step *= exp(adapt_hmc_gain * (acceptance - ADAPT_HMC_TARGET));
+  if (locus->hmc_step < ADAPT_MINSTEP)
+    locus->hmc_step = ADAPT_MINSTEP;
+  else if (locus->hmc_step > ADAPT_MAXSTEP)
+    locus->hmc_step = ADAPT_MAXSTEP;
+
+  /* running moments of the coordinates (Welford) */
+  locus->hmc_count++;
+  for (j = 0; j < dim; ++j)
+  {
+    double d = x[j] - locus->hmc_mean[j];
+    locus->hmc_mean[j] += d / locus->hmc_count;
+    locus->hmc_m2[j] += d * (x[j] - locus->hmc_mean[j]);
+  }
+}
+
+static void print_range(FILE * fp, const char * label, double * x, long n)
+{
+  long i;
+  double min = x[0], max = x[0], logsum = 0;
+
+  for (i = 0; i < n; ++i)
+  {
+    min = MIN(min,x[i]);
+    max = MAX(max,x[i]);
+    logsum += log(x[i]);
+  }
+
+  fprintf(fp, "  %-6s  min %10.6f  geomean %10.6f  max %10.6f\n",
+          label, min, exp(logsum/n), max);
+}
+
+void adapt_print(FILE * fp, stree_t * stree, locus_t ** locus, long locus_count)
+{
+  long i,n;
+  unsigned int total_nodes = stree->tip_count + stree->inner_count +
+                             stree->hybrid_count;
+  double * x;
+
+  x = (double *)xmalloc((size_t)MAX(locus_count,total_nodes) * sizeof(double));
+
+  fprintf(fp, "Adapted finetune steps (frozen for sampling):\n");
+
+  if (opt_hmc_steps)
+  {
+    for (i = 0; i < locus_count; ++i)
+      x[i] = locus[i]->hmc_step;
+    print_range(fp, "HMC", x, locus_count);
+  }
+
+  if (!opt_finetune_adapt)
+  {
+    free(x);
+    return;
+  }
+
+  for (i = 0; i < locus_count; ++i)
+    x[i] = locus[i]->finetune_gtspr;
+  print_range(fp, "GTSPR", x, locus_count);
+
+  if (opt_est_theta)
+  {
+    for (i = 0, n = 0; i < total_nodes; ++i)
+      if (stree->nodes[i]->theta >= 0 && stree->nodes[i]->has_theta)
+        x[n++] = stree->nodes[i]->finetune_theta;
+    if (n)
+      print_range(fp, "THETA", x, n);
+  }
+
+  for (i = 0, n = 0; i < total_nodes; ++i)
+    if (stree->nodes[i]->tau > 0 && (!opt_msci || stree->nodes[i]->prop_tau))
+      x[n++] = stree->nodes[i]->finetune_tau;
+  if (n)
+    print_range(fp, "TAU", x, n);
+
+  free(x);
+}
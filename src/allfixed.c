@@ -26,6 +26,9 @@ static char * line = NULL;
 static size_t line_size = 0;
 static size_t line_maxsize = 0;
 
+/* number of autocorrelation lags computed directly before switching to FFT */
+#define EFF_DIRECT_LAGS 64
+
 /* used for creating FigTree.tre */
 typedef struct nodepinfo_s 
 {
@@ -40,6 +43,30 @@ typedef struct nodepinfo_s
   double theta;
 } nodepinfo_t; 
 
+/* summary statistics of one column of the MCMC sample */
+typedef struct colstats_s
+{
+  double mean;
+  double stdev;
+  double tint;
+  double median;
+  double min;
+  double max;
+  double q025;
+  double q975;
+  double hpd025;
+  double hpd975;
+} colstats_t;
+
+typedef struct colstats_work_s
+{
+  double ** matrix;
+  colstats_t * stats;
+  long col_count;
+  long thread_index;
+  long thread_count;
+} colstats_work_t;
+
 static void reallocline(size_t newmaxsize)
 {
   char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
@@ -182,79 +209,134 @@ static int cb_cmp_double(const void * a, const void * b)
   return 0;
 }
 
-#if 1
-static double eff_ict(double * y, long n, double mean, double stdev)
+/* in-place iterative radix-2 complex FFT of size n (power of two). If inverse
+   is set, the inverse transform is computed without the 1/n scaling */
+static void fft(double * re, double * im, long n, int inverse)
 {
-  /* This calculates Efficiency or Tint using Geyer's (1992) initial positive
-     sequence method */
+  long i,j,k,len;
 
-  long i,j;
-  double tint = 1;
-  double rho, rho0 = 0;
-  long maxlag = 2000;
-  long minNr = 10;
-
-  double * x = (double *)xmalloc((size_t)n * sizeof(double));
-  for (i = 0; i < n; ++i)
-    x[i] = (y[i]-mean)/stdev;
-
-  if (stdev/(fabs(mean)+1) < 1E-9)
+  /* bit-reversal permutation */
+  for (i = 1, j = 0; i < n; ++i)
   {
-   tint = n;
+    long bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      SWAP(re[i],re[j]);
+      SWAP(im[i],im[j]);
+    }
   }
-  else
+
+  for (len = 2; len <= n; len <<= 1)
   {
-    for (i = 1; i < MIN(maxlag,n-minNr); ++i)
+    double angle = 2*M_PI/len * (inverse ? 1 : -1);
+    double wre = cos(angle);
+    double wim = sin(angle);
+
+    for (i = 0; i < n; i += len)
     {
-      rho = 0;
-      for (j = 0; j < n - i; ++j)
-        rho += x[j]*x[i+j];
+      double ure = 1;
+      double uim = 0;
+      for (k = 0; k < len/2; ++k)
+      {
+        long a = i+k;
+        long b = i+k+len/2;
+        double tre = re[b]*ure - im[b]*uim;
+        double tim = re[b]*uim + im[b]*ure;
+
+        re[b] = re[a] - tre;
+        im[b] = im[a] - tim;
+        re[a] += tre;
+        im[a] += tim;
+
+        double t = ure*wre - uim*wim;
+        uim = ure*wim + uim*wre;
+        ure = t;
+      }
+    }
+  }
+}
 
-      rho /= (n-i);
+/* compute the sums sum_j x[j]*x[j+k] for lags k = 0..maxlag-1 using the
+   Wiener-Khinchin theorem, i.e. as the inverse FFT of the power spectrum of
+   the zero-padded series */
+static double * autocorr_fft(double * x, long n, long maxlag)
+{
+  long i;
+  long size = 1;
 
-      if (i > minNr && rho+rho0 < 0)
-        break;
+  while (size < 2*n)
+    size <<= 1;
 
-      tint += rho*2;
-      rho0 = rho;
-    }
+  double * re = (double *)xcalloc((size_t)size,sizeof(double));
+  double * im = (double *)xcalloc((size_t)size,sizeof(double));
+
+  memcpy(re,x,(size_t)n*sizeof(double));
+
+  fft(re,im,size,0);
+  for (i = 0; i < size; ++i)
+  {
+    re[i] = re[i]*re[i] + im[i]*im[i];
+    im[i] = 0;
   }
+  fft(re,im,size,1);
 
-  free(x);
+  double * acf = (double *)xmalloc((size_t)maxlag*sizeof(double));
+  for (i = 0; i < maxlag; ++i)
+    acf[i] = re[i] / size;
 
-  return tint;
+  free(re);
+  free(im);
+
+  return acf;
 }
-#else
+
 static double eff_ict(double * y, long n, double mean, double stdev)
 {
   /* This calculates Efficiency or Tint using Geyer's (1992) initial positive
-     sequence method */
+     sequence method. The first EFF_DIRECT_LAGS autocorrelations are computed
+     directly, as the sequence is typically truncated early for well-mixed
+     chains. If more lags are required, all remaining autocorrelations are
+     obtained at once with FFT in O(n log n) time */
 
   long i,j;
   double tint = 1;
   double rho, rho0 = 0;
+  long maxlag = 2000;
+  long minNr = 10;
+  double * acf = NULL;
 
-  /* TODO: ADDED NOW */
   double * x = (double *)xmalloc((size_t)n * sizeof(double));
   for (i = 0; i < n; ++i)
     x[i] = (y[i]-mean)/stdev;
 
-
   if (stdev/(fabs(mean)+1) < 1E-9)
   {
    tint = n;
   }
   else
   {
-    for (i = 1; i < n-10; ++i)
+    long lagcount = MIN(maxlag,n-minNr);
+    for (i = 1; i < lagcount; ++i)
     {
-      rho = 0;
-      for (j = 0; j < n - i; ++j)
-        rho += x[j]*x[i+j];
+      if (i == EFF_DIRECT_LAGS)
+        acf = autocorr_fft(x,n,lagcount);
+
+      if (acf)
+        rho = acf[i];
+      else
+      {
+        rho = 0;
+        for (j = 0; j < n - i; ++j)
+          rho += x[j]*x[i+j];
+      }
 
-      rho /= (n-1);
+      rho /= (n-i);
 
-      if (i > 10 && rho+rho0 < 0)
+      if (i > minNr && rho+rho0 < 0)
         break;
 
       tint += rho*2;
@@ -262,11 +344,50 @@ static double eff_ict(double * y, long n, double mean, double stdev)
     }
   }
 
+  if (acf)
+    free(acf);
   free(x);
 
   return tint;
 }
-#endif
+
+/* partially sort x[first..last] (inclusive) such that x[k] is the element
+   that would be at position k if the range was sorted, all elements at
+   positions smaller than k are not greater, and all elements at larger
+   positions are not smaller than x[k] */
+static void select_kth(double * x, long first, long last, long k)
+{
+  while (last > first)
+  {
+    long i = first;
+    long j = last;
+    long mid = first + (last-first)/2;
+
+    /* median-of-three pivot */
+    if (x[mid] < x[first]) SWAP(x[mid],x[first]);
+    if (x[last] < x[first]) SWAP(x[last],x[first]);
+    if (x[last] < x[mid]) SWAP(x[last],x[mid]);
+    double pivot = x[mid];
+
+    while (i <= j)
+    {
+      while (x[i] < pivot) ++i;
+      while (x[j] > pivot) --j;
+      if (i <= j)
+      {
+        SWAP(x[i],x[j]);
+        ++i; --j;
+      }
+    }
+
+    if (k <= j)
+      last = j;
+    else if (k >= i)
+      first = i;
+    else
+      return;
+  }
+}
 
 static void hpd_interval(double * x,
                          long n,
@@ -302,6 +423,119 @@ static void hpd_interval(double * x,
   *rtail = x[left + diffrow];
 }
 
+/* compute order statistics of x required for the summary. Only the two tails
+   of width n-diffrow that contain all candidate HPD intervals are sorted,
+   while the median is obtained by selection. The content of x is permuted */
+static void column_order_stats(double * x, long n, colstats_t * cs)
+{
+  long lrow = (long)(n*0.05/2);
+  long urow = (long)(n*(1-0.05/2));
+  long diffrow = urow - lrow;
+  long tail = n - diffrow;
+  long median_line = n / 2;
+
+  if (n < 4*EFF_DIRECT_LAGS || tail >= median_line || diffrow <= median_line)
+  {
+    /* small sample - sort everything */
+    qsort(x, n, sizeof(double), cb_cmp_double);
+  }
+  else
+  {
+    /* sort lower tail [0,tail) */
+    select_kth(x,0,n-1,tail-1);
+    qsort(x, tail, sizeof(double), cb_cmp_double);
+
+    /* sort upper tail [diffrow,n) */
+    select_kth(x,tail,n-1,diffrow);
+    qsort(x+diffrow, n-diffrow, sizeof(double), cb_cmp_double);
+
+    /* place median (and its left neighbour) */
+    select_kth(x,tail,diffrow-1,median_line);
+    select_kth(x,tail,median_line-1,median_line-1);
+  }
+
+  cs->median = x[median_line];
+  if ((n & 1) == 0)
+  {
+    cs->median += x[median_line-1];
+    cs->median /= 2;
+  }
+
+  cs->min  = x[0];
+  cs->max  = x[n-1];
+  cs->q025 = x[(long)(n*.025)];
+  cs->q975 = x[(long)(n*.975)];
+
+  hpd_interval(x,n,&cs->hpd025,&cs->hpd975,0.05);
+}
+
+static void * colstats_worker(void * vp)
+{
+  long i,j;
+  colstats_work_t * work = (colstats_work_t *)vp;
+
+  /* columns are distributed cyclically to threads */
+  for (i = work->thread_index; i < work->col_count; i += work->thread_count)
+  {
+    double * x = work->matrix[i];
+    colstats_t * cs = work->stats+i;
+
+    double sum = 0;
+    for (j = 0; j < opt_samples; ++j)
+      sum += x[j];
+    cs->mean = sum/opt_samples;
+
+    double sd = 0;
+    for (j = 0; j < opt_samples; ++j)
+      sd += (x[j]-cs->mean) * (x[j]-cs->mean);
+    cs->stdev = sqrt(sd/(opt_samples-1));
+
+    cs->tint = eff_ict(x,opt_samples,cs->mean,cs->stdev);
+
+    column_order_stats(x,opt_samples,cs);
+  }
+
+  return NULL;
+}
+
+/* compute summary statistics for each column of matrix in parallel */
+static void compute_colstats(double ** matrix, long col_count, colstats_t * stats)
+{
+  long t;
+  long thread_count = MIN(summary_threads_count(),col_count);
+  pthread_t * threads;
+  colstats_work_t * work;
+
+  work = (colstats_work_t *)xmalloc((size_t)thread_count *
+                                    sizeof(colstats_work_t));
+  for (t = 0; t < thread_count; ++t)
+  {
+    work[t].matrix = matrix;
+    work[t].stats = stats;
+    work[t].col_count = col_count;
+    work[t].thread_index = t;
+    work[t].thread_count = thread_count;
+  }
+
+  if (thread_count == 1)
+  {
+    colstats_worker((void *)work);
+    free(work);
+    return;
+  }
+
+  threads = (pthread_t *)xmalloc((size_t)thread_count*sizeof(pthread_t));
+  for (t = 0; t < thread_count; ++t)
+    if (pthread_create(threads+t, NULL, colstats_worker, (void *)(work+t)))
+      fatal("Cannot create thread");
+
+  for (t = 0; t < thread_count; ++t)
+    pthread_join(threads[t],NULL);
+
+  free(threads);
+  free(work);
+}
+
 static char * cb_attributes(const snode_t * node)
 {
   char * s = NULL;
@@ -476,9 +710,18 @@ static void write_figtree(FILE * fp_out,
 {
   long i, theta_count = 0, tau_count = 0;
   FILE * fp_tree = NULL;
+  char * filename = NULL;
   unsigned int snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
 
-  fp_tree = xopen(opt_msci ? "FakeTree.tre" : "FigTree.tre", "w");
+  /* each chain writes its own tree */
+  if (chains_index())
+    xasprintf(&filename, "%s.chain%ld",
+              opt_msci ? "FakeTree.tre" : "FigTree.tre", chains_index());
+  else
+    filename = xstrdup(opt_msci ? "FakeTree.tre" : "FigTree.tre");
+
+  fp_tree = xopen(filename, "w");
+  free(filename);
 
   for (i = 0; i < snodes_total; ++i)
     stree->nodes[i]->data = (void *)xmalloc(sizeof(nodepinfo_t));
@@ -612,7 +855,7 @@ static void write_figtree(FILE * fp_out,
 
 void allfixed_summary(FILE * fp_out, stree_t * stree)
 {
-  long i, j, count;
+  long i, count;
   long sample_num;
   long rc = 0;
   FILE * fp;
@@ -669,8 +912,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
 
   double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
   double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  colstats_t * stats = (colstats_t *)xmalloc((size_t)col_count *
+                                             sizeof(colstats_t));
 
   long line_count = 0;
   long bad_count = 0;
@@ -756,54 +999,33 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
 
   free(header);
 
-  /* compute means */
+  /* compute means, standard deviations, tint and order statistics */
+  compute_colstats(matrix,col_count,stats);
+  for (i = 0; i < col_count; ++i)
+  {
+    mean[i] = stats[i].mean;
+    hpd025[i] = stats[i].hpd025;
+    hpd975[i] = stats[i].hpd975;
+  }
+
+  /* print means */
   fprintf(stdout, "mean    ");
   fprintf(fp_out, "mean    ");
   for (i = 0; i < col_count; ++i)
   {
-    double sum = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sum += matrix[i][j];
-
-    mean[i] = sum/opt_samples;
     fprintf(stdout, "  %f", mean[i]);
     fprintf(fp_out, "  %f", mean[i]);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  /* compute standard deviation */
-  for (i = 0; i < col_count; ++i)
-  {
-    double sd = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sd += (matrix[i][j]-mean[i]) * (matrix[i][j]-mean[i]);
-
-    stdev[i] = sqrt(sd/(opt_samples-1));
-  }
-  
-  /* compute tint */
-  for (i = 0; i < col_count; ++i)
-    tint[i] = eff_ict(matrix[i],opt_samples,mean[i],stdev[i]);
-
-  /* compute and print medians */
+  /* print medians */
   fprintf(stdout, "median  ");
   fprintf(fp_out, "median  ");
-  long median_line = opt_samples / 2;
-
   for (i = 0; i < col_count; ++i)
   {
-    qsort(matrix[i], opt_samples, sizeof(double), cb_cmp_double);
-
-    double median = matrix[i][median_line];
-    if ((opt_samples & 1) == 0)
-    {
-      median += matrix[i][median_line-1];
-      median /= 2;
-    }
-
-    fprintf(stdout, "  %f", median);
-    fprintf(fp_out, "  %f", median);
+    fprintf(stdout, "  %f", stats[i].median);
+    fprintf(fp_out, "  %f", stats[i].median);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -813,8 +1035,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "S.D     ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", stdev[i]);
-    fprintf(fp_out, "  %f", stdev[i]);
+    fprintf(stdout, "  %f", stats[i].stdev);
+    fprintf(fp_out, "  %f", stats[i].stdev);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -824,8 +1046,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "min     ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", matrix[i][0]);
-    fprintf(fp_out, "  %f", matrix[i][0]);
+    fprintf(stdout, "  %f", stats[i].min);
+    fprintf(fp_out, "  %f", stats[i].min);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -835,8 +1057,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "max     ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", matrix[i][opt_samples-1]);
-    fprintf(fp_out, "  %f", matrix[i][opt_samples-1]);
+    fprintf(stdout, "  %f", stats[i].max);
+    fprintf(fp_out, "  %f", stats[i].max);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -846,8 +1068,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "2.5%%    ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.025)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.025)]);
+    fprintf(stdout, "  %f", stats[i].q025);
+    fprintf(fp_out, "  %f", stats[i].q025);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -857,16 +1079,12 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "97.5%%   ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.975)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.975)]);
+    fprintf(stdout, "  %f", stats[i].q975);
+    fprintf(fp_out, "  %f", stats[i].q975);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  /* compute and print HPD 2.5% and 97.5% */
-  for (i = 0; i < col_count; ++i)
-    hpd_interval(matrix[i],opt_samples,hpd025+i,hpd975+i,0.05);
-
   /* print 2.5% HPD */
   fprintf(stdout, "2.5%%HPD ");
   fprintf(fp_out, "2.5%%HPD ");
@@ -894,8 +1112,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "ESS*    ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", opt_samples/tint[i]);
-    fprintf(fp_out, "  %f", opt_samples/tint[i]);
+    fprintf(stdout, "  %f", opt_samples/stats[i].tint);
+    fprintf(fp_out, "  %f", opt_samples/stats[i].tint);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -905,8 +1123,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   fprintf(fp_out, "Eff*    ");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(stdout, "  %f", 1/tint[i]);
-    fprintf(fp_out, "  %f", 1/tint[i]);
+    fprintf(stdout, "  %f", 1/stats[i].tint);
+    fprintf(fp_out, "  %f", 1/stats[i].tint);
   }
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
@@ -932,8 +1150,7 @@ l_unwind:
   free(mean);
   free(hpd025);
   free(hpd975);
-  free(tint);
-  free(stdev);
+  free(stats);
   fclose(fp);
 
   if (!rc)
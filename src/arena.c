@@ -0,0 +1,172 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Per-thread scratch memory for MCMC proposals. Each thread owns one
+   contiguous block, sized once before the MCMC loop from the largest gene
+   tree and locus, from which proposals take temporary arrays with a bump
+   pointer. A proposal records the current position with arena_mark() and
+   gives everything back with arena_release(), so the system allocator is
+   never called inside the MCMC loop. */
+
+#define ARENA_ALIGNMENT PLL_ALIGNMENT_AVX
+
+#define ARENA_PAD(x) ((((x) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT) * \
+                      ARENA_ALIGNMENT)
+
+typedef struct arena_s
+{
+  char * mem;
+  size_t size;
+  size_t used;
+} arena_t;
+
+static arena_t * arena = NULL;
+static long arena_count = 0;
+
+static size_t locus_scratch_size(stree_t * stree,
+                                 gtree_t * gtree,
+                                 locus_t * locus)
+{
+  size_t nodes = gtree->tip_count + gtree->inner_count;
+  size_t snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  size_t size = 0;
+
+  /* gene tree SPR: node order, sources, source/target weights, hpath backups
+     and visited flags, and target populations */
+  size += ARENA_PAD(nodes * sizeof(unsigned int));
+  size += ARENA_PAD(gtree->edge_count * sizeof(gnode_t *));
+  size += 2*ARENA_PAD(nodes * sizeof(double));
+  size += 5*ARENA_PAD(stree->hybrid_count * sizeof(int));
+  size += ARENA_PAD(snodes * sizeof(snode_t *));
+
+  /* gene tree traversal and category rates (alpha, mixing) */
+  size += ARENA_PAD(nodes * sizeof(gnode_t *));
+  size += ARENA_PAD(locus->rate_cats * sizeof(double));
+
+  /* two CLVs and two p-matrices for likelihood-guided target selection */
+  if (opt_rev_gspr || opt_revolutionary_spr_method)
+  {
+    size += 2*ARENA_PAD((size_t)locus->sites * locus->states_padded *
+                        locus->rate_cats * sizeof(double));
+    size += 2*ARENA_PAD((size_t)locus->states * locus->states_padded *
+                        locus->rate_cats * sizeof(double));
+  }
+
+  /* transposed p-matrices for outside partials */
+  if (opt_exp_outside || opt_hmc_steps)
+    size += ARENA_PAD(((size_t)locus->states * locus->states_padded *
+                       locus->rate_cats + (locus->states_padded -
+                       locus->states) * locus->states_padded) * sizeof(double));
+
+  /* HMC branch rate move: outside partials of a tip, rate matrices and their
+     p-matrix products, branch derivatives, and positions, momenta, gradients
+     and old rates of the populations (plus mu_i and nu_i) */
+  if (opt_hmc_steps)
+  {
+    size += ARENA_PAD((size_t)locus->sites * locus->states_padded *
+                      locus->rate_cats * sizeof(double));
+    size += ARENA_PAD(locus->sites * sizeof(unsigned int));
+    size += 2*ARENA_PAD((size_t)locus->states * locus->states *
+                        locus->rate_cats * sizeof(double));
+    size += ARENA_PAD(nodes * sizeof(double));
+    size += 8*ARENA_PAD((snodes+2) * sizeof(double));
+  }
+
+  return size;
+}
+
+void arena_init(stree_t * stree, gtree_t ** gtree, locus_t ** locus)
+{
+  long i;
+  size_t size = 0;
+  size_t snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+
+  for (i = 0; i < stree->locus_count; ++i)
+    size = MAX(size, locus_scratch_size(stree,gtree[i],locus[i]));
+
+  /* species tree nodes and their old densities (mixing) */
+  size += ARENA_PAD(snodes * sizeof(snode_t *));
+  size += ARENA_PAD(snodes * sizeof(double));
+
+  /* per-locus log-density differences (theta) */
+  size += ARENA_PAD(stree->locus_count * sizeof(double));
+
+  arena_count = opt_threads;
+  #ifdef DEBUG_THREADS
+  arena_count = MAX(arena_count, DEBUG_THREADS_COUNT);
+  #endif
+
+  arena = (arena_t *)xmalloc((size_t)arena_count * sizeof(arena_t));
+  for (i = 0; i < arena_count; ++i)
+  {
+    arena[i].mem = (char *)pll_aligned_alloc(size, ARENA_ALIGNMENT);
+    if (!arena[i].mem)
+      fatal("Unable to allocate enough memory.");
+    arena[i].size = size;
+    arena[i].used = 0;
+  }
+}
+
+void * arena_alloc(long thread_index, size_t size)
+{
+  arena_t * a = arena + thread_index;
+  void * p;
+
+  assert(thread_index >= 0 && thread_index < arena_count);
+
+  size = ARENA_PAD(size);
+  if (a->used + size > a->size)
+    fatal("Internal error: scratch arena of thread %ld exhausted "
+          "(%ld of %ld bytes in use, %ld requested)",
+          thread_index, (long)(a->used), (long)(a->size), (long)size);
+
+  p = (void *)(a->mem + a->used);
+  a->used += size;
+
+  return p;
+}
+
+size_t arena_mark(long thread_index)
+{
+  assert(thread_index >= 0 && thread_index < arena_count);
+  return arena[thread_index].used;
+}
+
+void arena_release(long thread_index, size_t mark)
+{
+  assert(thread_index >= 0 && thread_index < arena_count);
+  assert(mark <= arena[thread_index].used);
+  arena[thread_index].used = mark;
+}
+
+void arena_fini(void)
+{
+  long i;
+
+  for (i = 0; i < arena_count; ++i)
+    pll_aligned_free(arena[i].mem);
+  free(arena);
+
+  arena = NULL;
+  arena_count = 0;
+}
@@ -43,6 +43,8 @@ long opt_checkpoint_current;
 long opt_checkpoint_initial;
 long opt_checkpoint_step;
 long opt_cleandata;
+long opt_chain_betas;
+long opt_chains;
 long opt_clock;
 long opt_comply;
 long opt_constraint_count;
@@ -71,6 +73,7 @@ long opt_debug_snl;
 long opt_debug_br;
 long opt_debug_bruce;
 long opt_debug_parser;
+long opt_debug_mc3;
 long opt_debug_counter;
 
 long opt_delimit_prior;
@@ -84,13 +87,22 @@ long opt_est_theta;
 long opt_exp_randomize;
 long opt_exp_theta;
 long opt_exp_sim;
+long opt_exp_outside;
+long opt_finetune_adapt;
 long opt_finetune_reset;
+long opt_gtree_init;
 long opt_help;
+long opt_heated_chains;
+long opt_heated_swapfreq;
+long opt_hmc_steps;
 long opt_load_balance;
+long opt_load_balance_override;
 long opt_locusrate_prior;
 long opt_locus_count;
 long opt_locus_simlen;
+long opt_lowmem;
 long opt_max_species_count;
+long opt_memlimit;
 long opt_method;
 long opt_migration;
 long opt_model;
@@ -104,6 +116,8 @@ long opt_print_locusrate;
 long opt_print_qmatrix;
 long opt_print_rates;
 long opt_print_samples;
+long opt_procs;
+long opt_procs_transport;
 long opt_qrates_fixed;
 long opt_quiet;
 long opt_rate_prior;
@@ -122,6 +136,9 @@ long opt_theta_dist;
 long opt_threads;
 long opt_threads_start;
 long opt_threads_step;
+long opt_site_repeats;
+long opt_site_threads;
+long opt_threads_override;
 long opt_usedata;
 long opt_version;
 double opt_alpha_alpha;
@@ -143,6 +160,7 @@ double opt_finetune_nubar;
 double opt_finetune_nui;
 double opt_finetune_tau;
 double opt_finetune_theta;
+double opt_heated_delta;
 double opt_heredity_alpha;
 double opt_heredity_beta;
 double opt_locusrate_mubar;
@@ -248,6 +266,10 @@ static struct option long_options[] =
   {"debug_bruce",  no_argument,       0, 0 },  /* 34 */
   {"exp_sim",      no_argument,       0, 0 },  /* 35 */
   {"summary",      required_argument, 0, 0 },  /* 36 */
+  {"threads",      required_argument, 0, 0 },  /* 37 */
+  {"exp_outside",  no_argument,       0, 0 },  /* 38 */
+  {"loadbalance",  required_argument, 0, 0 },  /* 39 */
+  {"debug_mc3",    optional_argument, 0, 0 },  /* 40 */
   { 0, 0, 0, 0 }
 };
 
@@ -362,6 +384,8 @@ void args_init(int argc, char ** argv)
   opt_vi_alpha = -1;
   opt_burnin = 100;
   opt_cfile = NULL;
+  opt_chain_betas = 1;
+  opt_chains = 1;
   opt_clock = BPP_CLOCK_GLOBAL;
   opt_clock_vbar = 0;
 
@@ -386,6 +410,7 @@ void args_init(int argc, char ** argv)
   opt_debug_hs = 0;
   opt_debug_gage = 0;
   opt_debug_gspr = 0;
+  opt_debug_mc3 = 0;
   opt_debug_mix = 0;
   opt_debug_mui = 0;
   opt_debug_parser = 0;
@@ -410,6 +435,7 @@ void args_init(int argc, char ** argv)
   opt_exp_randomize = 0;
   opt_exp_theta = 0;
   opt_exp_sim = 0;
+  opt_exp_outside = 0;
 #if(0)
   opt_revolutionary_spr_method = 1;
   opt_revolutionary_spr_debug = 2;
@@ -428,24 +454,33 @@ void args_init(int argc, char ** argv)
   opt_finetune_mubar = 0.1;
   opt_finetune_phi = 0.001;
   opt_finetune_qrates = 0.3;
+  opt_finetune_adapt = 0;
   opt_finetune_reset = 0;
   opt_finetune_nubar = 0.1;
   opt_finetune_nui = 0.1;
   opt_finetune_tau = 0.001;
   opt_finetune_theta = 0.001;
+  opt_gtree_init = BPP_GTREE_INIT_SIMULATE;
   opt_help = 0;
+  opt_heated_chains = 1;
+  opt_heated_delta = 0.1;
+  opt_heated_swapfreq = 10;
+  opt_hmc_steps = 0;
   opt_heredity_alpha = 0;
   opt_heredity_beta = 0;
   opt_heredity_filename = NULL;
   opt_load_balance = BPP_LB_ZIGZAG;
+  opt_load_balance_override = -1;
   opt_locusrate_filename = NULL;
   opt_locusrate_prior = -1;
   opt_locusrate_mubar = 1;
   opt_locus_count = 0;
   opt_locus_simlen = 0;
+  opt_lowmem = 0;
   opt_mapfile = NULL;
   opt_max_species_count = 0;
   opt_mcmcfile = NULL;
+  opt_memlimit = 0;
   opt_method = -1;
   opt_migration = 0;
   opt_migration_events = NULL;
@@ -470,6 +505,8 @@ void args_init(int argc, char ** argv)
   opt_print_qmatrix = 0;
   opt_print_rates = 0;
   opt_print_samples = 1;
+  opt_procs = 1;
+  opt_procs_transport = BPP_TRANSPORT_SOCKET;
   opt_prob_snl = 0.2;
   opt_prob_snl_shrink = 0.333;
   opt_qrates_fixed = -1;
@@ -506,8 +543,11 @@ void args_init(int argc, char ** argv)
   opt_theta_p = 0;
   opt_theta_q = 0;
   opt_threads = 1;
-  opt_threads_start = 1;
+  opt_threads_start = 0;
   opt_threads_step = 1;
+  opt_site_repeats = 0;
+  opt_site_threads = 0;
+  opt_threads_override = 0;
   opt_treefile = NULL;
   opt_usedata = 1;
   opt_version = 0;
@@ -700,6 +740,31 @@ void args_init(int argc, char ** argv)
         opt_onlysummary = 1;
         break;
 
+      case 37:
+        opt_threads_override = atol(optarg);
+        if (opt_threads_override < 1)
+          fatal("Option --threads requires a positive integer");
+        break;
+
+      case 38:
+        opt_exp_outside = 1;
+        break;
+
+      case 39:
+        if (!strcasecmp(optarg,"none"))
+          opt_load_balance_override = BPP_LB_NONE;
+        else if (!strcasecmp(optarg,"zigzag"))
+          opt_load_balance_override = BPP_LB_ZIGZAG;
+        else
+          fatal("Option --loadbalance must be either 'none' or 'zigzag'");
+        break;
+
+      case 40:
+        opt_debug_mc3 = 1;
+        if (optarg)
+          opt_debug_mc3 = atol(optarg);
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -738,6 +803,13 @@ void args_init(int argc, char ** argv)
   if (commands > 1)
     fatal("More than one command specified");
 
+  if (opt_threads_override && !opt_onlysummary && !opt_resume)
+    fatal("Option --threads can only be used together with --summary or "
+          "--resume");
+
+  if (opt_load_balance_override >= 0 && !opt_resume)
+    fatal("Option --loadbalance can only be used together with --resume");
+
   if (opt_prob_snl_shrink <= 0 || opt_prob_snl_shrink >= 1)
     fatal("Proportion of SHRINK moves must be between 0 and 1");
 
@@ -785,6 +857,11 @@ void cmd_help()
           "  --quiet            only output warnings and fatal errors to stderr\n"
           "  --cfile FILENAME   run analysis for the specified control file\n"
           "  --resume FILENAME  resume analysis from a specified checkpoint file\n"
+          "  --summary FILENAME summarize the MCMC sample of a specified control file\n"
+          "  --threads INT      number of threads used by --summary or --resume (default:\n"
+          "                     threads option of the control file or checkpoint)\n"
+          "  --loadbalance STR  load balancing scheme (none or zigzag) used by --resume\n"
+          "                     (default: that of the checkpoint)\n"
           "  --arch SIMD        force specific vector instruction set (default: auto)\n"
           "\n"
          );
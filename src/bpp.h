@@ -35,6 +35,7 @@
 #include <inttypes.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <signal.h>
 
 #ifdef _MSC_VER
 #include <pmmintrin.h>
@@ -84,6 +85,12 @@
 #define DEBUG_THREADS_COUNT 4
 #endif
 
+/* count calls to the system allocator and abort if a proposal that uses the
+   scratch arenas allocates memory */
+#if 0
+#define CHECK_ALLOC
+#endif
+
 /* constants */
 
 #define PROG_NAME "bpp"
@@ -97,7 +104,7 @@
 #define VERSION_PATCH 1
 
 /* checkpoint version */
-#define VERSION_CHKP 1
+#define VERSION_CHKP 5
 
 #define PROG_VERSION "v" PLL_C2S(VERSION_MAJOR) "." PLL_C2S(VERSION_MINOR) "." \
         PLL_C2S(VERSION_PATCH)
@@ -225,6 +232,9 @@ extern const char * global_freqs_strings[28];
 #define BPP_LOCRATE_PRIOR_MAX           1
 #define BPP_LOCRATE_PRIOR_DIR           2
 
+#define BPP_GTREE_INIT_SIMULATE         0
+#define BPP_GTREE_INIT_UPGMA            1
+
 #define BPP_BRATE_PRIOR_MIN             0
 #define BPP_BRATE_PRIOR_LOGNORMAL       0
 #define BPP_BRATE_PRIOR_GAMMA           1
@@ -245,8 +255,15 @@ extern const char * global_freqs_strings[28];
 #define BPP_LB_NONE                     0
 #define BPP_LB_ZIGZAG                   1
 
+#define BPP_TRANSPORT_SOCKET            0
+#define BPP_TRANSPORT_SHM               1
+
 #define BPP_PI  3.1415926535897932384626433832795
 
+#define OSTATS_QUANTILES                3
+#define OSTATS_BATCHES                  64
+#define OSTATS_EXACT                    200
+
 #define THREAD_WORK_GTAGE               1
 #define THREAD_WORK_GTSPR               2
 #define THREAD_WORK_TAU                 3
@@ -255,6 +272,26 @@ extern const char * global_freqs_strings[28];
 #define THREAD_WORK_RATES               6
 #define THREAD_WORK_FREQS               7
 #define THREAD_WORK_BRATE               8
+#define THREAD_WORK_FUSED               9
+#define THREAD_WORK_LRHT               10
+#define THREAD_WORK_PLACE              11
+
+/* unphased sites with more heterozygous sequences than BPP_PHASE_EXPAND_MAX
+   are not expanded into all resolved site patterns, but their resolutions are
+   enumerated in Gray-code order when computing the likelihood */
+#define BPP_PHASE_EXPAND_MAX           10
+#define BPP_PHASE_HETS_MAX             30
+
+/* minimum number of site patterns per thread for site-parallel likelihood */
+#define BPP_TEAM_MIN_SITES              256
+
+/* site repeats: size of the table of class pairs for a locus with s site
+   patterns, scratch space (in unsigned ints) for the locus, and largest
+   fraction of distinct sub-patterns at a node for which only the distinct
+   ones are computed */
+#define BPP_REPEATS_PAIRS(s)            ((size_t)(s) < 64 ? 1024 : 16*(size_t)(s))
+#define BPP_REPEATS_BUFFER_SIZE(s)      ((size_t)(s)+2*BPP_REPEATS_PAIRS(s))
+#define BPP_REPEATS_MAX_UNIQUE          0.75
 
 #define BPP_MOVE_INDEX_MIN              0
 #define BPP_MOVE_GTAGE_INDEX            0
@@ -274,6 +311,14 @@ extern const char * global_freqs_strings[28];
 #define BPP_MOVE_BRANCHRATE_INDEX       14
 #define BPP_MOVE_INDEX_MAX              14
 
+#define BPP_MEMORY_CLV                  0
+#define BPP_MEMORY_PMATRIX              1
+#define BPP_MEMORY_SCALER               2
+#define BPP_MEMORY_EVENTS               3
+#define BPP_MEMORY_GTREE                4
+#define BPP_MEMORY_CLONES               5
+#define BPP_MEMORY_COUNT                6
+
 #define BPP_MSCIDEFS_TREE               1
 #define BPP_MSCIDEFS_DEFINE             2
 #define BPP_MSCIDEFS_HYBRID             3
@@ -436,6 +481,10 @@ typedef struct snode_s
   long htau;                        /* tau parameter (1: yes, 0: no) */
   struct snode_s * hybrid;          /* linked hybridization node */
   long * hx;                        /* sum of events count and seqin_count (per msa) */
+
+  /* adaptive finetune: step lengths of theta and tau proposals */
+  double finetune_theta;
+  double finetune_tau;
 } snode_t;
 
 typedef struct stree_s
@@ -589,6 +638,44 @@ typedef struct partition_s
   long model;
 } partition_t;
 
+/* unphased sites of a locus whose resolutions are enumerated at likelihood
+   time (see diploid.c) */
+typedef struct phase_s
+{
+  long site_count;
+
+  /* indices of the sites in the unphased alignment A1 */
+  long * site;
+
+  /* heterozygotes of site i are het_tip[het_offset[i]..het_offset[i+1]), each
+     given by the first of its two tips */
+  long * het_offset;
+  unsigned int * het_tip;
+
+  /* tip states of each site (tips per site) for the first resolution */
+  unsigned char * tipstate;
+} phase_t;
+
+/* substitution model parameters and eigen decomposition shared by loci with
+   identical models (see locus_share_models) */
+typedef struct model_shared_s
+{
+  long refcount;
+  unsigned long hash;
+
+  unsigned int dtype;
+  unsigned int model;
+  unsigned int states;
+  unsigned int rate_matrices;
+
+  double ** frequencies;
+  double ** subst_params;
+  int * eigen_decomp_valid;
+  double ** eigenvecs;
+  double ** inv_eigenvecs;
+  double ** eigenvals;
+} model_shared_t;
+
 typedef struct locus_s
 {
   unsigned int tips;
@@ -644,6 +731,63 @@ typedef struct locus_s
   double * likelihood_vector;
   int unphased_length;
 
+  /* unphased sites resolved by enumeration, and the single-site partials,
+     their sums over resolutions, tip transition probabilities, scalers, tip
+     states, tip nodes, and the heterozygotes linked to each inner node used
+     for their likelihood */
+  phase_t * phase;
+  double * phase_clv;
+  double * phase_sum;
+  double * phase_tipclv;
+  unsigned int * phase_scaler;
+  unsigned char * phase_state;
+  gnode_t ** phase_tipnode;
+  long * phase_lca;
+  unsigned long * phase_mark;
+  unsigned long phase_stamp;
+
+  /* scratch space for computing p-matrices (exponentials and one matrix) */
+  double * pmat_scratch;
+
+  /* outside (pre-order) partials and scalers, one per inner gene tree node */
+  double ** outside;
+  unsigned int ** outside_scaler;
+
+  /* helper threads for site-parallel likelihood and per-site log-likelihoods
+     of the last evaluation */
+  struct team_s * team;
+  double * team_persite_lnl;
+
+  /* registry entry if the model parameters are shared with other loci */
+  model_shared_t * model_shared;
+
+  /* low-memory mode: CLV index held by each inner node buffer, and space for
+     a traversal of the CLVs that must be recomputed */
+  unsigned int * clv_owner;
+  struct gnode_s ** clv_stale_trav;
+
+  /* site repeats: class of each site pattern restricted to the tips below
+     each CLV, number of classes per CLV, scratch space for computing them,
+     and the number of site patterns computed and covered by partial updates */
+  unsigned int ** repeats_id;
+  unsigned int * repeats_count;
+  unsigned int * repeats_buffer;
+  unsigned int repeats_stamp;
+  unsigned long repeats_computed;
+  unsigned long repeats_sites;
+
+  /* adaptive finetune: step length of gene tree SPR proposals */
+  double finetune_gtspr;
+
+  /* HMC branch rate move: leapfrog step length, scales of the coordinates
+     (square roots of the inverse masses), and moments of the coordinates and
+     number of moves in the current burn-in window */
+  double hmc_step;
+  double * hmc_scale;
+  double * hmc_mean;
+  double * hmc_m2;
+  long hmc_count;
+
   int original_index;
 
 } locus_t;
@@ -730,11 +874,19 @@ typedef struct ht_item_s
   void * value;
 } ht_item_t;
 
+typedef struct ht_slot_s
+{
+  unsigned long key;            /* cached hash of the item */
+  unsigned long index;          /* 1-based index in entries, 0 if empty */
+} ht_slot_t;
+
 typedef struct hashtable_s
 {
-  unsigned long table_size;
+  unsigned long table_size;     /* number of slots (power of two) */
   unsigned long entries_count;
-  list_t ** entries;
+  unsigned long entries_alloc;
+  ht_item_t * entries;          /* items in insertion order */
+  ht_slot_t * slots;            /* open-addressing index into entries */
 } hashtable_t;
 
 typedef struct pair_s
@@ -743,6 +895,46 @@ typedef struct pair_s
   void * data;
 } pair_t;
 
+typedef struct strbuf_s
+{
+  char * s;
+  size_t len;
+  size_t alloc;
+} strbuf_t;
+
+typedef struct stree_reader_s
+{
+  /* species tree filled by each call to stree_reader_parse() */
+  stree_t * stree;
+  snode_t * pool;
+  long pool_used;
+  long max_tips;
+
+  /* pair_t elements (species label, data) for looking up tip labels */
+  hashtable_t * ht_species;
+} stree_reader_t;
+
+typedef struct summary_chunk_s
+{
+  /* range of MCMC file processed by one thread when summarizing */
+  FILE * fp;
+  long offset;
+  long offset_end;
+
+  /* line buffer */
+  char * line;
+  size_t line_maxsize;
+
+  /* number of species and species labels (pair_t) for reading trees */
+  long species_count;
+  hashtable_t * ht_species;
+
+  /* results */
+  long line_count;
+  hashtable_t * ht_trees;
+  hashtable_t * ht_biparts;
+} summary_chunk_t;
+
 typedef struct thread_data_s
 {
   /* contains common data that are passed to all threads, and variables that
@@ -780,8 +972,34 @@ typedef struct thread_data_s
   /* return values for mixing proposal */
   double lnacceptance;
 
+  /* arguments for locus rate proposals (pairs of loci) */
+  unsigned int * pairs;
+  long pair_count;
+
+  /* arguments (mask of move indices) and return values for a fused sequence
+     of per-locus moves */
+  long moves;
+  long move_proposals[BPP_MOVE_INDEX_MAX+1];
+  long move_accepted[BPP_MOVE_INDEX_MAX+1];
+
 } thread_data_t;
 
+/* results of a parallel step exchanged between processes, one per thread.
+   Only values are exchanged, as the processes do not share addresses */
+typedef struct thread_result_s
+{
+  long proposals;
+  long accepted;
+  unsigned int count_above;
+  unsigned int count_below;
+  double logl_diff;
+  double logpr_diff;
+  double lnacceptance;
+  long move_proposals[BPP_MOVE_INDEX_MAX+1];
+  long move_accepted[BPP_MOVE_INDEX_MAX+1];
+  unsigned int rndu_status;
+} thread_result_t;
+
 typedef struct thread_info_s
 {
   pthread_t thread;
@@ -799,6 +1017,59 @@ typedef struct thread_info_s
 
 } thread_info_t;
 
+/* helper threads computing the likelihood of one locus in parallel over
+   blocks of site patterns, together with the thread owning the locus */
+typedef struct team_s
+{
+  long size;
+  pthread_t * thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_work;
+  pthread_cond_t cond_done;
+
+  /* current task */
+  unsigned long generation;
+  long pending;
+  long blocks;
+  int quit;
+  unsigned int sites;
+  void (*cb_range)(void *, unsigned int, unsigned int);
+  void * data;
+
+} team_t;
+
+typedef struct p2_s
+{
+  /* P^2 quantile sketch: heights, positions, desired positions and their
+     increments for the five markers */
+  double q[5];
+  double n[5];
+  double np[5];
+  double dn[5];
+} p2_t;
+
+typedef struct ostats_s
+{
+  /* Welford accumulator */
+  long n;
+  double mean;
+  double m2;
+  double min;
+  double max;
+
+  /* 2.5%, 50% and 97.5% quantile sketches, and the first OSTATS_EXACT
+     observations from which quantiles are computed exactly until then */
+  p2_t quant[OSTATS_QUANTILES];
+  double exact[OSTATS_EXACT];
+
+  /* batch means for the effective sample size */
+  long batch_size;
+  long batch_count;
+  long batch_fill;
+  double batch_sum;
+  double batch_mean[2*OSTATS_BATCHES];
+} ostats_t;
+
 
 /* macros */
 
@@ -856,6 +1127,8 @@ extern long opt_checkpoint_current;
 extern long opt_checkpoint_initial;
 extern long opt_checkpoint_step;
 extern long opt_cleandata;
+extern long opt_chain_betas;
+extern long opt_chains;
 extern long opt_clock;
 extern long opt_comply;
 extern long opt_constraint_count;
@@ -871,6 +1144,7 @@ extern long opt_debug_full;
 extern long opt_debug_gage;
 extern long opt_debug_gspr;
 extern long opt_debug_hs;
+extern long opt_debug_mc3;
 extern long opt_debug_mix;
 extern long opt_debug_mui;
 extern long opt_debug_parser;
@@ -894,13 +1168,22 @@ extern long opt_est_theta;
 extern long opt_exp_randomize;
 extern long opt_exp_theta;
 extern long opt_exp_sim;
+extern long opt_exp_outside;
+extern long opt_finetune_adapt;
 extern long opt_finetune_reset;
+extern long opt_gtree_init;
 extern long opt_help;
+extern long opt_heated_chains;
+extern long opt_heated_swapfreq;
+extern long opt_hmc_steps;
 extern long opt_load_balance;
+extern long opt_load_balance_override;
 extern long opt_locusrate_prior;
 extern long opt_locus_count;
 extern long opt_locus_simlen;
+extern long opt_lowmem;
 extern long opt_max_species_count;
+extern long opt_memlimit;
 extern long opt_method;
 extern long opt_migration;
 extern long opt_model;
@@ -914,6 +1197,8 @@ extern long opt_print_locusrate;
 extern long opt_print_qmatrix;
 extern long opt_print_rates;
 extern long opt_print_samples;
+extern long opt_procs;
+extern long opt_procs_transport;
 extern long opt_qrates_fixed;
 extern long opt_quiet;
 extern long opt_rate_prior;
@@ -932,6 +1217,9 @@ extern long opt_theta_dist;
 extern long opt_threads;
 extern long opt_threads_start;
 extern long opt_threads_step;
+extern long opt_site_repeats;
+extern long opt_site_threads;
+extern long opt_threads_override;
 extern long opt_usedata;
 extern long opt_version;
 extern double opt_alpha_alpha;
@@ -952,6 +1240,7 @@ extern double opt_finetune_nubar;
 extern double opt_finetune_nui;
 extern double opt_finetune_tau;
 extern double opt_finetune_theta;
+extern double opt_heated_delta;
 extern double opt_heredity_alpha;
 extern double opt_heredity_beta;
 extern double opt_snl_lambda_expand;
@@ -1096,7 +1385,14 @@ long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
 void * pll_aligned_alloc(size_t size, size_t alignment);
 void pll_aligned_free(void * ptr);
+#ifdef CHECK_ALLOC
+long debug_alloc_count(void);
+#endif
 int xtolower(int c);
+void strbuf_init(strbuf_t * sb);
+void strbuf_putc(strbuf_t * sb, char c);
+void strbuf_puts(strbuf_t * sb, const char * s);
+void strbuf_putf(strbuf_t * sb, double x);
 
 /* functions in bpp.c */
 
@@ -1133,6 +1429,10 @@ void stree_show_ascii(const snode_t * root, int options);
 
 char * stree_export_newick(const snode_t * root, char * (*cb_serialize)(const snode_t *));
 
+void stree_write_newick(strbuf_t * sb,
+                        const snode_t * root,
+                        void (*cb_write)(strbuf_t *, const snode_t *));
+
 char* msci_export_newick(const snode_t* root, char* (*cb_serialize)(const snode_t*));
 
 int stree_traverse(snode_t * root,
@@ -1237,6 +1537,13 @@ void propose_tau_update_gtrees(locus_t ** loci,
 
 double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index);
 
+void lnprior_rates_gradient(gtree_t * gtree,
+                            stree_t * stree,
+                            long msa_index,
+                            double * grad,
+                            double * grad_mui,
+                            double * grad_nui);
+
 void stree_reset_leaves(stree_t * stree);
 
 /* functions in arch.c */
@@ -1321,6 +1628,8 @@ void hashtable_insert_force(hashtable_t * ht,
 
 void hashtable_destroy(hashtable_t * ht, void (*cb_dealloc)(void *));
 
+void * hashtable_iterate(hashtable_t * ht, unsigned long * pos);
+
 int cb_cmp_pairlabel(void * a, void * b);
 
 /* functions in random.c */
@@ -1354,6 +1663,7 @@ void gtree_alloc_internals(gtree_t ** gtree, long msa_count);
 gtree_t ** gtree_init(stree_t * stree,
                       msa_t ** msalist,
                       list_t * maplist,
+                      unsigned int ** weights,
                       int msa_count);
 void gtree_simulate_init(stree_t * stree, list_t * maplist);
 void gtree_simulate_fini(void);
@@ -1361,6 +1671,10 @@ void gtree_simulate_fini(void);
 char * gtree_export_newick(const gnode_t * root,
                            char * (*cb_serialize)(const gnode_t *));
 
+void gtree_write_newick(strbuf_t * sb,
+                        const gnode_t * root,
+                        char * (*cb_serialize)(const gnode_t *));
+
 void gtree_destroy(gtree_t * tree, void (*cb_destroy)(void *));
 
 int gtree_traverse(gnode_t * root,
@@ -1424,7 +1738,21 @@ double prop_locusrate_and_heredity(gtree_t ** gtree,
                                    locus_t ** locus,
                                    long thread_index);
 
-gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index);
+void prop_locusrate_and_heredity_parallel(gtree_t ** gtree,
+                                          stree_t * stree,
+                                          locus_t ** locus,
+                                          unsigned int * pairs,
+                                          long pair_count,
+                                          long locus_start,
+                                          long locus_count,
+                                          long thread_index,
+                                          long * p_proposal_count,
+                                          long * p_accepted);
+
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         long thread_index);
 
 double prop_branch_rates_serial(gtree_t ** gtree,
                                 stree_t * stree,
@@ -1514,6 +1842,7 @@ locus_t * locus_create(unsigned int dtype,
 
 void locus_destroy(locus_t * locus);
 
+
 int pll_set_tip_states(locus_t * locus,
                        unsigned int tip_index,
                        const unsigned int * map,
@@ -1533,13 +1862,29 @@ void pll_set_frequencies(locus_t * locus,
                          const double * frequencies);
 
 void locus_set_frequencies_and_rates(locus_t * locus);
+void locus_share_models(locus_t ** locus, long locus_count);
+
+void locus_first_touch(locus_t * locus);
+
+long locus_numa_pages(locus_t * locus, long node, long * local);
+void locus_unshare_model(locus_t * locus);
 void pll_set_category_rates(locus_t * locus, const double * rates);
 void locus_set_heredity_scalers(locus_t * locus, const double * heredity);
+void locus_set_phase(locus_t * locus, phase_t * phase);
 
 void locus_update_partials(locus_t * locus, gnode_t ** traversal, unsigned int count);
 
 void locus_update_all_partials(locus_t * locus, gtree_t * gtree);
 
+void locus_clv_validate(locus_t * locus, gnode_t * node);
+
+void locus_repeats_init(locus_t * locus);
+
+void locus_repeats_summary(FILE * fp,
+                           locus_t ** locus,
+                           long locus_count,
+                           int per_locus);
+
 void pll_set_pattern_weights(locus_t * locus,
                              const unsigned int * pattern_weights);
 
@@ -1560,6 +1905,22 @@ double locus_root_loglikelihood(locus_t * locus,
                                 const unsigned int * freqs_indices,
                                 double * persite_lnl);
 
+void locus_update_outside(locus_t * locus, gnode_t * node, long thread_index);
+
+double locus_outside_loglikelihood(locus_t * locus, gnode_t * node);
+
+void locus_branch_derivatives(locus_t * locus,
+                              gtree_t * gtree,
+                              double * dlnl,
+                              long thread_index);
+
+void locus_brate_derivatives(locus_t * locus,
+                             gtree_t * gtree,
+                             stree_t * stree,
+                             long msa_index,
+                             double * dlnl,
+                             long thread_index);
+
 double locus_propose_qrates_serial(stree_t * stree,
                                    locus_t ** locus,
                                    gtree_t ** gtree);
@@ -1602,6 +1963,101 @@ unsigned long * compress_site_patterns_diploid(char ** sequence,
 
 void allfixed_summary(FILE * fp_out, stree_t * stree);
 
+/* functions in arena.c */
+
+void arena_init(stree_t * stree, gtree_t ** gtree, locus_t ** locus);
+void * arena_alloc(long thread_index, size_t size);
+size_t arena_mark(long thread_index);
+void arena_release(long thread_index, size_t mark);
+void arena_fini(void);
+
+/* functions in memory.c */
+
+void memory_estimate(stree_t * stree,
+                     msa_t ** msa,
+                     long msa_count,
+                     int lowmem,
+                     size_t * mem);
+
+void memory_usage(stree_t * stree,
+                  gtree_t ** gtree,
+                  locus_t ** locus,
+                  long locus_count,
+                  size_t * mem);
+
+size_t memory_total(const size_t * mem);
+
+void memory_print(FILE * fp, const char * title, const size_t * mem);
+
+/* functions in adapt.c */
+
+void adapt_init(stree_t * stree, locus_t ** locus, long locus_count);
+void adapt_set_iteration(long i);
+void adapt_update(double * step, int move, long accepted, long proposals);
+void adapt_print(FILE * fp, stree_t * stree, locus_t ** locus, long locus_count);
+long adapt_hmc_dim(stree_t * stree);
+void adapt_hmc_init(stree_t * stree, locus_t ** locus, long locus_count);
+void adapt_hmc_window(locus_t * locus, long dim);
+void adapt_hmc_update(locus_t * locus,
+                      const double * x,
+                      long dim,
+                      double acceptance);
+
+/* functions in topology.c */
+
+void topology_init(void);
+void topology_fini(void);
+long topology_cpu_count(void);
+long topology_node_count(void);
+long topology_cpu(long s);
+long topology_cpu_node(long cpu);
+void topology_print(FILE * fp);
+int topology_pages_on_node(const void * p,
+                           size_t size,
+                           long node,
+                           long * local,
+                           long * total);
+
+/* functions in chains.c */
+
+void chains_start(stree_t * stree,
+                  gtree_t ** gtree,
+                  FILE * fp_out,
+                  FILE * fp_mcmc);
+long chains_index(void);
+int chains_cold(void);
+void chains_update(long step, gtree_t ** gtree, double mean_logl, int sampled);
+void chains_swap(long step, gtree_t ** gtree);
+void chains_finish(FILE * fp_out);
+
+/* functions in mproc.c */
+
+void mproc_start(FILE * fp_out, FILE * fp_mcmc);
+void mproc_finish(void);
+long mproc_thread_first(void);
+long mproc_thread_end(void);
+long mproc_locus_first(void);
+long mproc_locus_end(void);
+void mproc_gather_threads(thread_result_t * results);
+void mproc_gather_loci(void * buf, size_t size);
+void mproc_sync_gtrees(gtree_t ** gtree);
+void mproc_sync_finetune(locus_t ** locus);
+
+/* functions in ostats.c */
+
+long ostats_columns(stree_t * stree,
+                    gtree_t ** gtree,
+                    double * x,
+                    char ** names);
+
+void ostats_init(stree_t * stree, gtree_t ** gtree);
+void ostats_update(stree_t * stree, gtree_t ** gtree);
+void ostats_print(FILE * fp);
+ostats_t * ostats_cols(long * count);
+const char * ostats_label(long i);
+void ostats_set_cols(ostats_t * c, long count);
+void ostats_fini(void);
+
 /* functions in summary.c */
 
 void bipartitions_init(char ** species, long species_count);
@@ -1614,9 +2070,23 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count);
 
 long getlinecount(const char * filename);
 
+long summary_threads_count(void);
+
+summary_chunk_t * summary_chunks_create(const char * filename, long count);
+
+char * summary_chunk_getline(summary_chunk_t * chunk);
+
+void summary_chunks_run(summary_chunk_t * chunks,
+                        long count,
+                        void * (*cb)(void *));
+
+void summary_chunks_destroy(summary_chunk_t * chunks, long count);
+
+void stree_sort_labels(stree_t * stree, char ** buffer, size_t * size);
+
 /* functions in summary11.c */
 
-void mixed_summary(FILE * fp_out, unsigned int sp_count);
+void mixed_summary(FILE * fp_out, stree_t * stree);
 
 /* functions in hardware.c */
 
@@ -1638,7 +2108,10 @@ unsigned long ** diploid_resolve(stree_t * stree,
                                  msa_t ** msa_list,
                                  list_t * maplist,
                                  unsigned int ** weights,
-                                 int msa_count);
+                                 int msa_count,
+                                 phase_t ** phase);
+
+void phase_destroy(phase_t * phase);
 
 /* functions in dump.c */
 
@@ -1766,6 +2239,18 @@ void pll_core_update_partial_ii(unsigned int states,
                                 const unsigned int * right_scaler,
                                 unsigned int attrib);
 
+void pll_core_update_outside_root(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  double * outside_clv,
+                                  unsigned int * outside_scaler,
+                                  const double * clv,
+                                  const unsigned int * clv_scaler,
+                                  const double * pmatrix,
+                                  double * const * frequencies,
+                                  const unsigned int * freqs_indices,
+                                  unsigned int attrib);
+
 void pll_core_create_lookup_4x4(unsigned int rate_cats,
                                 double * lookup,
                                 const double * left_matrix,
@@ -1845,6 +2330,20 @@ void pll_core_root_likelihood_vector(unsigned int states,
                                      const unsigned int * freqs_indices,
                                      double * persite_lnl,
                                      unsigned int attrib);
+
+double pll_core_edge_loglikelihood_ii(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      const double * parent_clv,
+                                      const unsigned int * parent_scaler,
+                                      const double * child_clv,
+                                      const unsigned int * child_scaler,
+                                      const double * pmatrix,
+                                      const double * rate_weights,
+                                      const unsigned int * pattern_weights,
+                                      double * persite_lh,
+                                      unsigned int attrib);
+
 /* functions in output.c */
 
 void pll_show_pmatrix(const locus_t * locus,
@@ -1864,14 +2363,16 @@ void revolutionary_spr_tselect_logl(gnode_t * mnode,
                                gnode_t ** target_list,
                                long target_count,
                                locus_t * locus,
-                               double * weights);
+                               double * weights,
+                               long thread_index);
 
 void rev_spr_tselect(gnode_t * mnode,
                      double t,
                      gnode_t ** targets,
                      unsigned int target_count,
                      locus_t * locus,
-                     double * weights);
+                     double * weights,
+                     long thread_index);
 
 
 /* functions in method.c */
@@ -2298,14 +2799,22 @@ double QuantileChi2(double prob, double v);
 
 /* functions in threads.c */
 
+long * threads_layout(const long * load);
 long * threads_load_balance(msa_t ** msa_list);
 void threads_lb_stats(locus_t ** locus, FILE * fp_out);
+void threads_split(long threads);
 void threads_init(void);
 void threads_wakeup(int work_type, thread_data_t * tp);
 void threads_exit(void);
 void threads_pin_master(void);
+void threads_set_slot_offset(long offset);
 thread_info_t * threads_ti(void);
-void threads_set_ti(thread_info_t * tip);
+void threads_teams_init(locus_t ** locus, long locus_count, FILE * fp_out);
+int threads_team_run(locus_t * locus,
+                     void (*cb_range)(void *, unsigned int, unsigned int),
+                     void * data);
+void threads_teams_exit(locus_t ** locus, long locus_count);
+void threads_first_touch(locus_t ** locus, FILE * fp_out);
 
 /* functions in treeparse.c */
 
@@ -2318,6 +2827,9 @@ stree_t * bpp_parse_newick_string(const char * line);
 ntree_t * bpp_parse_newick_string_ntree(const char * line);
 ntree_t * ntree_wraptree(node_t * root, int tip_count, int inner_count);
 stree_t * stree_from_ntree(ntree_t * ntree);
+stree_reader_t * stree_reader_create(long max_tips, hashtable_t * ht_species);
+void stree_reader_destroy(stree_reader_t * reader);
+stree_t * stree_reader_parse(stree_reader_t * reader, char * s, char ** endp);
 
 /* functions in parsemap.c */
 
@@ -1453,6 +1453,138 @@ l_unwind:
 
 }
 
+static long parse_processes(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+  char * transport = NULL;
+
+  long count;
+
+  /* read number of processes */
+  count = get_long(p, &opt_procs);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_procs < 1) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read transport */
+  count = get_delstring(p," \t\r\n*#",&transport);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (!is_emptyline(p)) goto l_unwind;
+
+  ret = 1;
+  if (!strcasecmp(transport, "socket"))
+    opt_procs_transport = BPP_TRANSPORT_SOCKET;
+  else if (!strcasecmp(transport, "shm"))
+    opt_procs_transport = BPP_TRANSPORT_SHM;
+  else
+    ret = 0;
+
+l_unwind:
+  free(s);
+  if (transport)
+    free(transport);
+  return ret;
+}
+
+static long parse_chains(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  /* read number of replicate chains */
+  count = get_long(p, &opt_chains);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_chains < 1) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read number of beta values */
+  count = get_long(p, &opt_chain_betas);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_chain_betas < 1) goto l_unwind;
+  if (!is_emptyline(p)) goto l_unwind;
+
+  ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
+static long parse_heatedchains(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  /* read number of chains */
+  count = get_long(p, &opt_heated_chains);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_heated_chains < 1) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read heating increment */
+  count = get_double(p, &opt_heated_delta);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_heated_delta <= 0) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read swap frequency */
+  count = get_long(p, &opt_heated_swapfreq);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_heated_swapfreq < 1) goto l_unwind;
+  if (!is_emptyline(p)) goto l_unwind;
+
+  ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
 static long parse_tauprior(const char * line)
 {
   long ret = 0;
@@ -2234,6 +2366,68 @@ static void check_validity()
   if (opt_threads > 1 && !opt_est_theta)
     fatal("Cannot use multiple threads when *not* estimating theta parameters."
           " Please either estimate theta or set threads=1");
+
+  /* processes split the loci along thread boundaries and replicate the
+     species-level moves, hence moves that change all gene trees at once or
+     sample per-locus parameters on the species tree are not supported */
+  if (opt_procs > 1)
+  {
+    if (opt_threads < opt_procs)
+      fatal("Option 'processes' requires at least as many threads");
+    if (opt_threads > opt_locus_count)
+      fatal("Option 'processes' requires at most as many threads as loci");
+    if (opt_est_delimit || opt_est_stree)
+      fatal("Option 'processes' cannot be used with species delimitation or "
+            "species tree inference");
+    if (opt_est_locusrate == MUTRATE_ESTIMATE ||
+        opt_est_heredity == HEREDITY_ESTIMATE || opt_clock != BPP_CLOCK_GLOBAL)
+      fatal("Option 'processes' cannot be used with locus rates, heredity "
+            "scalars or relaxed clocks");
+    if (opt_checkpoint)
+      fatal("Option 'processes' cannot be used with checkpoints");
+    if (opt_print_genetrees || opt_print_rates || opt_print_locusrate ||
+        opt_print_hscalars || opt_print_qmatrix)
+      fatal("Option 'processes' cannot be used when printing per-locus "
+            "samples");
+  }
+
+  /* chains are forked after the data are processed and write their own
+     output files */
+  if (opt_chains * opt_chain_betas > 1)
+  {
+    if (opt_procs > 1)
+      fatal("Option 'chains' cannot be used with option 'processes'");
+    if (opt_checkpoint)
+      fatal("Option 'chains' cannot be used with checkpoints");
+    if (opt_print_genetrees || opt_print_rates || opt_print_locusrate ||
+        opt_print_hscalars || opt_print_qmatrix)
+      fatal("Option 'chains' cannot be used when printing per-locus samples");
+    if (opt_chain_betas > 1 && (!opt_usedata || opt_bfbeta != 1))
+      fatal("Option 'chains' with more than one beta value requires "
+            "usedata = 1 and no BayesFactorBeta");
+  }
+
+  /* heated chains exchange positions in the ladder of powers of the
+     likelihood and take turns in writing to the MCMC file */
+  if (opt_heated_chains > 1)
+  {
+    if (!opt_est_stree)
+      fatal("Option 'heatedchains' requires species tree inference "
+            "(A01 or A11)");
+    if (!opt_usedata || opt_bfbeta != 1)
+      fatal("Option 'heatedchains' requires usedata = 1 and no "
+            "BayesFactorBeta");
+    if (opt_chains * opt_chain_betas > 1)
+      fatal("Options 'heatedchains' and 'chains' cannot be combined");
+    if (opt_procs > 1)
+      fatal("Option 'heatedchains' cannot be used with option 'processes'");
+    if (opt_checkpoint)
+      fatal("Option 'heatedchains' cannot be used with checkpoints");
+  }
+
+  /* threads exceeding the number of loci evaluate site patterns of the
+     largest loci in parallel */
+  threads_split(opt_threads);
   
   if (opt_theta_dist < BPP_THETA_PRIOR_MIN || opt_theta_dist > BPP_THETA_PRIOR_MAX)
     fatal("Internal error: invalid theta prior distribution");
@@ -2305,6 +2499,11 @@ static void check_validity()
   /* check clock and locusrate/branchrate */
   if (opt_clock < BPP_CLOCK_MIN || opt_clock > BPP_CLOCK_MAX)
     fatal("Invalid 'clock' value");
+
+  if (opt_hmc_steps && opt_clock == BPP_CLOCK_GLOBAL)
+    fatal("Option 'hmcsteps' requires a relaxed clock (clock = 2 or 3)");
+  if (opt_hmc_steps && opt_lowmem)
+    fatal("Option 'hmcsteps' cannot be used with 'lowmem'");
 }
 
 static void update_locusrate_information()
@@ -2344,7 +2543,7 @@ static void set_debug_flags()
     &opt_debug_sim,   &opt_debug_gage, &opt_debug_gspr, &opt_debug_mui,
     &opt_debug_hs,    &opt_debug_mix,  &opt_debug_rj,   &opt_debug_theta,
     &opt_debug_tau,   &opt_debug_sspr, &opt_debug_br,   &opt_debug_snl,
-    &opt_debug_parser, NULL
+    &opt_debug_parser, &opt_debug_mc3, NULL
   };
 
   if (opt_debug)
@@ -2487,6 +2686,20 @@ void load_cfile()
                  line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"lowmem",6))
+      {
+        if (!parse_long(value,&opt_lowmem) ||
+            (opt_lowmem != 0 && opt_lowmem != 1))
+          fatal("Option 'lowmem' expects value 0 or 1 (line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"chains",6))
+      {
+        if (!parse_chains(value))
+          fatal("Option 'chains' expects a positive integer optionally "
+                "followed by the number of beta values (line %ld)", line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 7)
     {
@@ -2592,10 +2805,31 @@ void load_cfile()
                 line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"memlimit",8))
+      {
+        if (!parse_long(value,&opt_memlimit) || opt_memlimit < 0)
+          fatal("Option 'memlimit' expects a positive integer (megabytes) "
+                "(line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"hmcsteps",8))
+      {
+        if (!parse_long(value,&opt_hmc_steps) || opt_hmc_steps < 0)
+          fatal("Option 'hmcsteps' expects a positive integer (or zero) "
+                "(line %ld)", line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 9)
     {
-      if (!strncasecmp(token,"cleandata",9))
+      if (!strncasecmp(token,"processes",9))
+      {
+        if (!parse_processes(value))
+          fatal("Option 'processes' expects a positive integer optionally "
+                "followed by 'socket' or 'shm' (line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"cleandata",9))
       {
         if (!parse_long(value,&opt_cleandata) ||
             (opt_cleandata != 0 && opt_cleandata != 1))
@@ -2609,6 +2843,24 @@ void load_cfile()
           fatal("Erroneous format of 'locusrate' (line %ld)", line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"gtreeinit",9))
+      {
+        char * temp;
+        if (!get_string(value,&temp))
+          fatal("Option %s expects a string (line %ld)", token, line_count);
+
+        if (!strcasecmp(temp,"simulate"))
+          opt_gtree_init = BPP_GTREE_INIT_SIMULATE;
+        else if (!strcasecmp(temp,"upgma"))
+          opt_gtree_init = BPP_GTREE_INIT_UPGMA;
+        else
+          fatal("Option 'gtreeinit' expects 'simulate' or 'upgma' (line %ld)",
+                line_count);
+
+        free(temp);
+
+        valid = 1;
+      }
     }
     else if (token_len == 10)
     {
@@ -2654,6 +2906,14 @@ void load_cfile()
           fatal("Invalid load balance option (line %ld)", line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"siterepeats",11))
+      {
+        if (!parse_long(value,&opt_site_repeats) ||
+            (opt_site_repeats != 0 && opt_site_repeats != 1))
+          fatal("Option 'siterepeats' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 12)
     {
@@ -2719,6 +2979,14 @@ void load_cfile()
         }
         valid = 1;
       }
+      else if (!strncasecmp(token,"heatedchains",12))
+      {
+        if (!parse_heatedchains(value))
+          fatal("Option 'heatedchains' expects a positive integer optionally "
+                "followed by a positive heating increment and a positive swap "
+                "frequency (line %ld)", line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 13)
     {
@@ -2727,6 +2995,14 @@ void load_cfile()
         fatal("Not implemented (%s)", token);
         valid = 1;
       }
+      else if (!strncasecmp(token,"adaptfinetune",13))
+      {
+        if (!parse_long(value,&opt_finetune_adapt) ||
+            (opt_finetune_adapt != 0 && opt_finetune_adapt != 1))
+          fatal("Option 'adaptfinetune' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 14)
     {
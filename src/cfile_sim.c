@@ -1268,6 +1268,13 @@ void load_cfile_sim()
           fatal("Option '%s' expects a string (line %ld)", token, line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"threads",7))
+      {
+        if (!get_long(value,&opt_threads) || opt_threads <= 0)
+          fatal("Option 'threads' requires a positive integer (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 8)
     {
@@ -0,0 +1,847 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Several MCMC chains on the same data (chains = K [L]): K replicates for
+   each of L values of the power b of the likelihood. With L > 1 the values
+   of b are the nodes of an L-point Gauss-Legendre rule on (0,1), and the log
+   marginal likelihood is estimated by thermodynamic integration (Rannala and
+   Yang, 2017). The data are read, compressed and placed in the locus
+   structures once, and the chains are forked from that state, such that the
+   read-only locus data (site patterns, tip states, pattern weights and
+   diploid resolutions) are shared between them. Each chain writes its own
+   output and MCMC files, and publishes its progress and running moments in
+   a shared memory region, from which the parent process reports the mean
+   log-likelihood for each b and the potential scale reduction factor R-hat
+   (Gelman and Rubin, 1992) among the replicates as the run progresses.
+
+   The same processes run Metropolis-coupled MCMC (heatedchains = H [delta
+   [swapfreq]]). Chain k of the ladder samples with the likelihood raised to
+   b_k = 1/(1 + k*delta). Every swapfreq iterations the chains meet at a
+   barrier and a swap of the states of two adjacent chains of the ladder is
+   proposed. The states are not copied; the two processes exchange their
+   positions in the ladder instead, and only the process that currently
+   holds the cold chain (b = 1) logs samples. During burn-in delta is
+   adapted towards a swap acceptance rate of MC3_TARGET. */
+
+typedef struct chain_s
+{
+  long step;
+  long done;
+  long cols;
+  long n;
+  double mean_logl;
+  double beta;
+  double weight;
+  long seed;
+  long heat;
+  double logl;
+  double * mean;
+  double * m2;
+} chain_t;
+
+static chain_t * chains = NULL;
+static long chain_count = 0;
+static long chain_cur = -1;
+
+long chains_index()
+{
+  return chain_cur + 1;
+}
+
+/* zero when the current process holds a heated chain */
+int chains_cold()
+{
+  return chain_cur < 0 || chains[chain_cur].heat == 0;
+}
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define CHAINS_POLL_MS          200
+
+#define MC3_WINDOW              50
+#define MC3_TARGET              0.3
+#define MC3_DELTA_MIN           1e-5
+#define MC3_DELTA_MAX           10
+
+typedef struct mc3_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  long arrived;
+  long generation;
+  long sampling;
+  double delta;
+  unsigned int rndu;
+  long window_tried;
+  long window_accepted;
+  long * tried;
+  long * accepted;
+} mc3_t;
+
+static mc3_t * mc3 = NULL;
+static pid_t parent_pid;
+static int stdout_fd = -1;
+static char * main_outfile = NULL;
+
+/* nodes and weights of the n-point Gauss-Legendre rule on (0,1) */
+static void gauss_legendre(long n, double * x, double * w)
+{
+  long i,j;
+
+  for (i = 0; i < (n+1)/2; ++i)
+  {
+    double z = cos(BPP_PI*(i+0.75)/(n+0.5));
+    double z1, p1, p2, p3, pp;
+
+    /* Newton iterations on the Legendre polynomial P_n */
+    do
+    {
+      p1 = 1;
+      p2 = 0;
+      for (j = 0; j < n; ++j)
+      {
+        p3 = p2;
+        p2 = p1;
+        p1 = ((2*j+1)*z*p2 - j*p3) / (j+1);
+      }
+      pp = n*(z*p1 - p2) / (z*z - 1);
+      z1 = z;
+      z = z1 - p1/pp;
+    }
+    while (fabs(z-z1) > 1e-15);
+
+    x[i]     = (1 - z) / 2;
+    x[n-1-i] = (1 + z) / 2;
+    w[i] = w[n-1-i] = 1 / ((1-z*z)*pp*pp);
+  }
+}
+
+static void copy_file(const char * src, const char * dst)
+{
+  char buf[4096];
+  size_t n;
+  FILE * fp_src = xopen(src, "r");
+  FILE * fp_dst = xopen(dst, "w");
+
+  while ((n = fread(buf, 1, sizeof(buf), fp_src)) > 0)
+    if (fwrite(buf, 1, n, fp_dst) != n)
+      fatal("Cannot write to file %s", dst);
+
+  fclose(fp_src);
+  fclose(fp_dst);
+}
+
+static void redirect(FILE * fp, const char * filename, int flags)
+{
+  int fd = open(filename, flags, 0644);
+
+  if (fd < 0)
+    fatal("Cannot open file %s for writing...", filename);
+  if (dup2(fd, fileno(fp)) < 0)
+    fatal("Cannot redirect output to %s", filename);
+  close(fd);
+}
+
+static double heat_beta(long k)
+{
+  return 1 / (1 + k*mc3->delta);
+}
+
+/* propose to swap the chains at positions k and k+1 of the ladder, with k
+   drawn from a random stream shared by all chains; called by the last chain
+   to arrive at the barrier */
+static void mc3_propose(long step)
+{
+  long a,b,k;
+  int accepted;
+  unsigned int own;
+  double u,rate,lnacceptance;
+
+  /* acceptance rates are reported for the sampling phase */
+  if (step >= 0 && !mc3->sampling)
+  {
+    for (k = 0; k < chain_count-1; ++k)
+      mc3->tried[k] = mc3->accepted[k] = 0;
+    mc3->sampling = 1;
+  }
+
+  own = get_legacy_rndu_status(0);
+  set_legacy_rndu_status(0, mc3->rndu);
+  k = (long)(legacy_rndu(0) * (chain_count-1));
+  k = MIN(k, chain_count-2);
+  u = legacy_rndu(0);
+  mc3->rndu = get_legacy_rndu_status(0);
+  set_legacy_rndu_status(0, own);
+
+  for (a = 0; chains[a].heat != k; ++a);
+  for (b = 0; chains[b].heat != k+1; ++b);
+
+  lnacceptance = (heat_beta(k) - heat_beta(k+1)) *
+                 (chains[b].logl - chains[a].logl);
+
+  mc3->tried[k]++;
+  mc3->window_tried++;
+  accepted = (lnacceptance >= -1e-10 || log(u) < lnacceptance);
+  if (accepted)
+  {
+    chains[a].heat = k+1;
+    chains[b].heat = k;
+    mc3->accepted[k]++;
+    mc3->window_accepted++;
+  }
+
+  /* stdout of the chains is redirected, hence the swaps are traced on
+     stderr */
+  if (opt_debug_mc3)
+    fprintf(stderr, "[Debug] (mc3) step = %ld k = %ld delta = %.10f "
+            "b1 = %.10f b2 = %.10f lnL1 = %.10f lnL2 = %.10f "
+            "lnacceptance = %.10f %s\n", step, k, mc3->delta, heat_beta(k),
+            heat_beta(k+1), chains[a].logl, chains[b].logl, lnacceptance,
+            accepted ? "accepted" : "rejected");
+
+  /* adapt the ladder during burn-in */
+  if (step < 0 && mc3->window_tried == MC3_WINDOW)
+  {
+    rate = (double)mc3->window_accepted / mc3->window_tried;
+    mc3->delta *= exp(2*(rate - MC3_TARGET));
+    mc3->delta = MAX(mc3->delta, MC3_DELTA_MIN);
+    mc3->delta = MIN(mc3->delta, MC3_DELTA_MAX);
+    mc3->window_tried = mc3->window_accepted = 0;
+  }
+}
+
+/* wait for all chains; the last one to arrive proposes a swap if requested */
+static void mc3_barrier(long step, int swap)
+{
+  long generation;
+  struct timespec ts;
+
+  pthread_mutex_lock(&mc3->mutex);
+  generation = mc3->generation;
+  if (++mc3->arrived == chain_count)
+  {
+    if (swap)
+      mc3_propose(step);
+    mc3->arrived = 0;
+    mc3->generation++;
+    pthread_cond_broadcast(&mc3->cond);
+  }
+  else
+  {
+    while (generation == mc3->generation)
+    {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      pthread_cond_timedwait(&mc3->cond, &mc3->mutex, &ts);
+
+      /* the parent terminates the chains if one of them fails */
+      if (getppid() != parent_pid)
+      {
+        pthread_mutex_unlock(&mc3->mutex);
+        fatal("Lost contact with the process monitoring the chains");
+      }
+    }
+  }
+  pthread_mutex_unlock(&mc3->mutex);
+}
+
+/* potential scale reduction factor of column k among the chains of one b */
+static double rhat(chain_t ** group, long m, long k)
+{
+  long j;
+  double n = 0, w = 0, mean = 0, b = 0;
+
+  for (j = 0; j < m; ++j)
+  {
+    if (group[j]->n < 2 || k >= group[j]->cols) return 0;
+
+    n    += group[j]->n;
+    w    += group[j]->m2[k] / (group[j]->n - 1);
+    mean += group[j]->mean[k];
+  }
+  n /= m;
+  w /= m;
+  mean /= m;
+
+  for (j = 0; j < m; ++j)
+    b += (group[j]->mean[k] - mean) * (group[j]->mean[k] - mean);
+  b /= (m-1);
+
+  if (w <= 0) return 0;
+
+  return sqrt(((n-1)/n*w + b) / w);
+}
+
+/* largest R-hat over the columns for chains with the g-th value of b */
+static double group_rhat(long g, long * col)
+{
+  long j,k;
+  double r, rmax = 0;
+  chain_t ** group = (chain_t **)xmalloc((size_t)opt_chains *
+                                         sizeof(chain_t *));
+
+  for (j = 0; j < opt_chains; ++j)
+    group[j] = chains + g*opt_chains + j;
+
+  *col = 0;
+  for (k = 0; opt_chains > 1 && k < group[0]->cols; ++k)
+  {
+    r = rhat(group, opt_chains, k);
+    if (r > rmax)
+    {
+      rmax = r;
+      *col = k;
+    }
+  }
+
+  free(group);
+  return rmax;
+}
+
+static double group_mean_logl(long g)
+{
+  long j;
+  double sum = 0;
+
+  for (j = 0; j < opt_chains; ++j)
+    sum += chains[g*opt_chains+j].mean_logl;
+
+  return sum / opt_chains;
+}
+
+static const char * column_label(long k)
+{
+  return (opt_method == METHOD_00) ? ostats_label(k) : "lnL";
+}
+
+static void print_progress(FILE * fp, double progress)
+{
+  long g,col;
+  double r, rmax = 0;
+
+  fprintf(fp, "%4.0f%% ", progress*100);
+
+  if (mc3)
+  {
+    long tried = 0, accepted = 0;
+
+    for (g = 0; g < chain_count-1; ++g)
+    {
+      tried += mc3->tried[g];
+      accepted += mc3->accepted[g];
+    }
+    fprintf(fp, "  delta %8.6f  swaps %ld/%ld\n",
+            mc3->delta, accepted, tried);
+    return;
+  }
+
+  for (g = 0; g < opt_chain_betas; ++g)
+    fprintf(fp, " %11.4f", group_mean_logl(g));
+
+  if (opt_chains > 1)
+  {
+    for (g = 0; g < opt_chain_betas; ++g)
+    {
+      r = group_rhat(g, &col);
+      rmax = MAX(rmax, r);
+    }
+    if (rmax > 0)
+      fprintf(fp, "   R-hat %7.4f", rmax);
+  }
+  fprintf(fp, "\n");
+}
+
+static void print_summary(FILE * fp)
+{
+  long c,g,col;
+  double r;
+  double lnml = 0;
+
+  if (mc3)
+  {
+    fprintf(fp, "\nSwaps between heated chains (sampling phase), "
+            "delta = %8.6f:\n", mc3->delta);
+    fprintf(fp, "  Beta 1    Beta 2     Proposed  Accepted  Rate\n");
+    for (g = 0; g < chain_count-1; ++g)
+      fprintf(fp, "  %8.6f  %8.6f  %9ld  %8ld  %6.4f\n",
+              heat_beta(g), heat_beta(g+1), mc3->tried[g], mc3->accepted[g],
+              mc3->tried[g] ? (double)mc3->accepted[g] / mc3->tried[g] : 0);
+    for (c = 0; chains[c].heat; ++c);
+    fprintf(fp, "Chain %ld holds the cold chain at the end of the run\n", c+1);
+    return;
+  }
+
+  fprintf(fp, "\nSummary of chains:\n");
+  fprintf(fp, "  Chain  Beta      E_b(lnf(X))\n");
+  for (c = 0; c < chain_count; ++c)
+    fprintf(fp, "  %5ld  %8.6f  %11.4f\n",
+            c+1, chains[c].beta, chains[c].mean_logl);
+
+  fprintf(fp, "\n  Beta      Weight    E_b(lnf(X))");
+  if (opt_chains > 1)
+    fprintf(fp, "  R-hat    Column");
+  fprintf(fp, "\n");
+  for (g = 0; g < opt_chain_betas; ++g)
+  {
+    chain_t * first = chains + g*opt_chains;
+
+    fprintf(fp, "  %8.6f  %8.6f  %11.4f",
+            first->beta, first->weight, group_mean_logl(g));
+    if (opt_chains > 1)
+    {
+      r = group_rhat(g, &col);
+      if (r > 0)
+        fprintf(fp, "  %7.4f  %s", r, column_label(col));
+    }
+    fprintf(fp, "\n");
+    lnml += first->weight * group_mean_logl(g);
+  }
+
+  if (opt_chain_betas > 1)
+    fprintf(fp,
+            "\nlog marginal likelihood (%ld-point Gauss-Legendre thermodynamic "
+            "integration) = %.4f\n", opt_chain_betas, lnml);
+}
+
+/* the parent process only monitors the chains and reports when they finish */
+static void monitor(pid_t * pid, FILE * fp_out)
+{
+  long c;
+  long running = chain_count;
+  long reported = 0;
+  long total = opt_burnin + opt_samples*opt_samplefreq;
+  int status;
+  struct timespec ts;
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = CHAINS_POLL_MS * 1000000l;
+
+  if (mc3)
+  {
+    fprintf(stdout, "\nProgress, ladder increment and accepted swaps");
+    fprintf(fp_out, "\nProgress, ladder increment and accepted swaps");
+  }
+  else
+  {
+    fprintf(stdout, "\nProgress and mean log-likelihood for each beta");
+    fprintf(fp_out, "\nProgress and mean log-likelihood for each beta");
+  }
+  if (opt_chains > 1)
+  {
+    fprintf(stdout, ", largest R-hat among replicates");
+    fprintf(fp_out, ", largest R-hat among replicates");
+  }
+  fprintf(stdout, ":\n");
+  fprintf(fp_out, ":\n");
+
+  while (running)
+  {
+    pid_t p;
+    long step = total;
+
+    while ((p = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      for (c = 0; c < chain_count && pid[c] != p; ++c);
+      if (c == chain_count) continue;
+
+      if (!WIFEXITED(status) || WEXITSTATUS(status))
+      {
+        long k;
+
+        for (k = 0; k < chain_count; ++k)
+          if (k != c && !chains[k].done)
+            kill(pid[k], SIGTERM);
+        fatal("Chain %ld terminated abnormally", c+1);
+      }
+      chains[c].done = 1;
+      --running;
+    }
+
+    for (c = 0; c < chain_count; ++c)
+      step = MIN(step, chains[c].step);
+
+    /* one line for every 5% of the slowest chain; the last one is printed
+       when all chains have exited, after the summary of the cold chain */
+    if (step < total && step * 20 / total > reported)
+    {
+      reported = step * 20 / total;
+      print_progress(stdout, (double)step / total);
+      print_progress(fp_out, (double)step / total);
+      fflush(NULL);
+    }
+
+    if (running)
+      nanosleep(&ts, NULL);
+  }
+
+  print_progress(stdout, 1);
+  print_progress(fp_out, 1);
+  print_summary(stdout);
+  print_summary(fp_out);
+}
+
+void chains_start(stree_t * stree, gtree_t ** gtree, FILE * fp_out, FILE * fp_mcmc)
+{
+  long c,i;
+  long cols_max;
+  long base_seed;
+  size_t size;
+  char * p;
+  pid_t * pid;
+  char ** outfile;
+  char ** mcmcfile = NULL;
+  double * x;
+  double * w;
+
+  chain_count = (opt_heated_chains > 1) ?
+                  opt_heated_chains : opt_chains * opt_chain_betas;
+
+  /* values of b */
+  x = (double *)xmalloc((size_t)opt_chain_betas * sizeof(double));
+  w = (double *)xmalloc((size_t)opt_chain_betas * sizeof(double));
+  if (opt_chain_betas > 1)
+    gauss_legendre(opt_chain_betas, x, w);
+  else
+  {
+    x[0] = opt_bfbeta;
+    w[0] = 1;
+  }
+
+  /* upper bound on the number of columns summarized for R-hat */
+  cols_max = 2*(stree->tip_count + stree->inner_count + stree->hybrid_count) +
+             stree->hybrid_count + 3;
+
+  size = (size_t)chain_count * (sizeof(chain_t) + 2*cols_max*sizeof(double));
+  if (opt_heated_chains > 1)
+    size += sizeof(mc3_t) + 2*(size_t)chain_count*sizeof(long);
+  p = (char *)mmap(NULL,
+                   size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS,
+                   -1,
+                   0);
+  if (p == MAP_FAILED)
+    fatal("Cannot allocate %ld bytes of shared memory", (long)size);
+
+  /* chains after the first are restarted from consecutive seeds */
+  base_seed = (opt_seed > 0) ?
+                opt_seed : 1 + (long)(get_legacy_rndu_status(0) % 1000000000);
+
+  chains = (chain_t *)p;
+  p += (size_t)chain_count * sizeof(chain_t);
+  for (c = 0; c < chain_count; ++c)
+  {
+    chains[c].step = 0;
+    chains[c].done = 0;
+    chains[c].cols = 0;
+    chains[c].n = 0;
+    chains[c].mean_logl = 0;
+    chains[c].beta = x[(c / opt_chains) % opt_chain_betas];
+    chains[c].weight = w[(c / opt_chains) % opt_chain_betas];
+    chains[c].seed = c ? base_seed + c : opt_seed;
+    chains[c].heat = 0;
+    chains[c].logl = 0;
+    chains[c].mean = (double *)p;
+    chains[c].m2 = chains[c].mean + cols_max;
+    p += 2*cols_max*sizeof(double);
+  }
+  free(x);
+  free(w);
+
+  if (opt_heated_chains > 1)
+  {
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+
+    mc3 = (mc3_t *)p;
+    p += sizeof(mc3_t);
+    mc3->tried = (long *)p;
+    mc3->accepted = mc3->tried + chain_count;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&mc3->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&mc3->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    mc3->arrived = 0;
+    mc3->generation = 0;
+    mc3->sampling = 0;
+    mc3->delta = opt_heated_delta;
+    mc3->rndu = (unsigned int)(base_seed + chain_count);
+    mc3->window_tried = mc3->window_accepted = 0;
+    for (c = 0; c < chain_count; ++c)
+    {
+      mc3->tried[c] = mc3->accepted[c] = 0;
+      chains[c].heat = c;
+      chains[c].beta = heat_beta(c);
+    }
+    parent_pid = getpid();
+  }
+
+  /* output of the data processing so far is the start of every chain file;
+     heated chains share the MCMC file and take turns in writing to it */
+  fflush(NULL);
+  outfile = (char **)xmalloc((size_t)chain_count * sizeof(char *));
+  if (!mc3)
+    mcmcfile = (char **)xmalloc((size_t)chain_count * sizeof(char *));
+  for (c = 0; c < chain_count; ++c)
+  {
+    xasprintf(outfile+c, "%s.chain%ld", opt_outfile, c+1);
+    copy_file(opt_outfile, outfile[c]);
+    if (mc3) continue;
+
+    xasprintf(mcmcfile+c, "%s.chain%ld", opt_mcmcfile, c+1);
+    copy_file(opt_mcmcfile, mcmcfile[c]);
+  }
+
+  if (mc3)
+  {
+    fprintf(stdout, "\nRunning %ld heated chains (swap every %ld iterations, "
+            "initial delta = %f):\n", chain_count, opt_heated_swapfreq,
+            opt_heated_delta);
+    fprintf(fp_out, "\nRunning %ld heated chains (swap every %ld iterations, "
+            "initial delta = %f):\n", chain_count, opt_heated_swapfreq,
+            opt_heated_delta);
+  }
+  else
+  {
+    fprintf(stdout, "\nRunning %ld chains (%ld replicates for each of %ld "
+            "beta values):\n", chain_count, opt_chains, opt_chain_betas);
+    fprintf(fp_out, "\nRunning %ld chains (%ld replicates for each of %ld "
+            "beta values):\n", chain_count, opt_chains, opt_chain_betas);
+  }
+  for (c = 0; c < chain_count; ++c)
+  {
+    fprintf(stdout, "  Chain %ld: beta = %8.6f  seed = %ld  %s  %s\n",
+            c+1, chains[c].beta, chains[c].seed, outfile[c],
+            mc3 ? opt_mcmcfile : mcmcfile[c]);
+    fprintf(fp_out, "  Chain %ld: beta = %8.6f  seed = %ld  %s  %s\n",
+            c+1, chains[c].beta, chains[c].seed, outfile[c],
+            mc3 ? opt_mcmcfile : mcmcfile[c]);
+  }
+  fflush(NULL);
+
+  pid = (pid_t *)xmalloc((size_t)chain_count * sizeof(pid_t));
+  for (c = 0; c < chain_count; ++c)
+  {
+    pid[c] = fork();
+    if (pid[c] < 0)
+      fatal("Cannot create process for chain %ld", c+1);
+
+    if (pid[c] == 0)
+    {
+      chain_cur = c;
+      break;
+    }
+  }
+
+  if (chain_cur < 0)
+  {
+    fclose(fp_mcmc);
+    if (mc3)
+    {
+      /* the summary of the cold chain is appended to the output file */
+      redirect(fp_out, opt_outfile, O_WRONLY | O_APPEND);
+    }
+    else
+    {
+      /* the file with the MCMC header only is not needed */
+      remove(opt_mcmcfile);
+    }
+
+    ostats_init(stree,gtree);
+    monitor(pid, fp_out);
+    fclose(fp_out);
+    exit(EXIT_SUCCESS);
+  }
+
+  /* chain process */
+  if (mc3)
+    stdout_fd = dup(fileno(stdout));
+  redirect(stdout, "/dev/null", O_WRONLY);
+  redirect(fp_out, outfile[chain_cur], O_WRONLY | O_APPEND);
+  if (!mc3)
+    redirect(fp_mcmc, mcmcfile[chain_cur], O_WRONLY | O_APPEND);
+
+  if (mc3)
+    main_outfile = opt_outfile;
+  else
+    free(opt_outfile);
+  opt_outfile = outfile[chain_cur];
+  if (!mc3)
+  {
+    free(opt_mcmcfile);
+    opt_mcmcfile = mcmcfile[chain_cur];
+  }
+  for (c = 0; c < chain_count; ++c)
+  {
+    if (c == chain_cur) continue;
+    free(outfile[c]);
+    if (!mc3)
+      free(mcmcfile[c]);
+  }
+  free(outfile);
+  if (mcmcfile)
+    free(mcmcfile);
+  free(pid);
+
+  /* the stored log-likelihoods are multiplied by b */
+  for (i = 0; i < opt_locus_count; ++i)
+    gtree[i]->logl = gtree[i]->logl / opt_bfbeta * chains[chain_cur].beta;
+  opt_bfbeta = chains[chain_cur].beta;
+
+  if (chain_cur)
+  {
+    opt_seed = chains[chain_cur].seed;
+    legacy_init();
+  }
+
+  /* each chain takes its own set of CPUs */
+  if (opt_threads > 1)
+    threads_set_slot_offset(chain_cur * (opt_threads + opt_site_threads));
+}
+
+/* Called after every iteration. Every opt_heated_swapfreq iterations the
+   heated chains meet and may exchange their positions in the ladder, after
+   which each chain rescales its log-likelihoods to its (new) value of b */
+void chains_swap(long step, gtree_t ** gtree)
+{
+  long i;
+  double logl = 0;
+  double beta;
+  chain_t * chain;
+
+  if (!mc3 || (step+1) % opt_heated_swapfreq) return;
+
+  chain = chains + chain_cur;
+  for (i = 0; i < opt_locus_count; ++i)
+    logl += gtree[i]->logl;
+  chain->logl = logl / opt_bfbeta;
+
+  /* samples of the cold chain must be written before the next cold chain
+     continues the MCMC file */
+  fflush(NULL);
+  mc3_barrier(step, 1);
+
+  beta = heat_beta(chain->heat);
+  if (beta != opt_bfbeta)
+  {
+    for (i = 0; i < opt_locus_count; ++i)
+      gtree[i]->logl = gtree[i]->logl / opt_bfbeta * beta;
+    opt_bfbeta = beta;
+  }
+  chain->beta = beta;
+}
+
+/* At the end of the MCMC the heated chains exit, and the process that holds
+   the cold chain writes the summary to the original output file */
+void chains_finish(FILE * fp_out)
+{
+  if (!mc3) return;
+
+  fflush(NULL);
+  mc3_barrier(0, 0);
+
+  if (chains[chain_cur].heat)
+    exit(EXIT_SUCCESS);
+
+  if (dup2(stdout_fd, fileno(stdout)) < 0)
+    fatal("Cannot restore standard output");
+  close(stdout_fd);
+  redirect(fp_out, main_outfile, O_WRONLY | O_APPEND);
+  free(opt_outfile);
+  opt_outfile = main_outfile;
+  main_outfile = NULL;
+}
+
+#else
+
+void chains_start(stree_t * stree, gtree_t ** gtree, FILE * fp_out, FILE * fp_mcmc)
+{
+  fatal("Options 'chains' and 'heatedchains' are not supported on Windows");
+}
+
+void chains_swap(long step, gtree_t ** gtree)
+{
+}
+
+void chains_finish(FILE * fp_out)
+{
+}
+
+#endif
+
+/* publish the progress of the current chain; step counts all iterations
+   including burn-in, and sampled is set when a sample was just logged */
+void chains_update(long step, gtree_t ** gtree, double mean_logl, int sampled)
+{
+  long i,count;
+  chain_t * chain;
+  ostats_t * cols;
+
+  if (chain_cur < 0) return;
+
+  chain = chains + chain_cur;
+
+  if (sampled && opt_heated_chains <= 1)
+  {
+    cols = ostats_cols(&count);
+    if (cols)
+    {
+      /* A00: moments of all columns of the MCMC file */
+      for (i = 0; i < count; ++i)
+      {
+        chain->mean[i] = cols[i].mean;
+        chain->m2[i] = cols[i].m2;
+      }
+      chain->n = cols[0].n;
+      chain->cols = count;
+    }
+    else if (opt_usedata)
+    {
+      /* otherwise the log-likelihood only */
+      double logl = 0;
+      double delta;
+
+      for (i = 0; i < opt_locus_count; ++i)
+        logl += gtree[i]->logl;
+      logl /= opt_bfbeta;
+
+      chain->n++;
+      delta = logl - chain->mean[0];
+      chain->mean[0] += delta / chain->n;
+      chain->m2[0] += delta * (logl - chain->mean[0]);
+      chain->cols = 1;
+    }
+  }
+
+  chain->mean_logl = mean_logl;
+  chain->step = step;
+}
@@ -340,3 +340,75 @@ void pll_core_root_likelihood_vector(unsigned int states,
   }
 }
 
+
+/* Log-likelihood evaluated at an edge. parent_clv holds the outside partials
+   of the edge (conditional probabilities of all data outside the subtree
+   below the edge, given the state at the parent end, with the root
+   frequencies already applied), child_clv the partials of the child node and
+   pmatrix the transition probabilities along the edge. If persite_lh is not
+   NULL, the (unscaled) per-site likelihoods are stored in it, as in
+   pll_core_root_likelihood_vector() */
+double pll_core_edge_loglikelihood_ii(unsigned int states,
+                                      unsigned int sites,
+                                      unsigned int rate_cats,
+                                      const double * parent_clv,
+                                      const unsigned int * parent_scaler,
+                                      const double * child_clv,
+                                      const unsigned int * child_scaler,
+                                      const double * pmatrix,
+                                      const double * rate_weights,
+                                      const unsigned int * pattern_weights,
+                                      double * persite_lh,
+                                      unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+  unsigned int scale_factors;
+  unsigned int states_padded = states;
+  double logl = 0;
+  double term, term_r, terma;
+  double site_lk;
+  const double * pmat;
+
+  if (attrib & PLL_ATTRIB_ARCH_SSE)
+    states_padded = (states+1) & 0xFFFFFFFE;
+  if (attrib & (PLL_ATTRIB_ARCH_AVX | PLL_ATTRIB_ARCH_AVX2))
+    states_padded = (states+3) & 0xFFFFFFFC;
+
+  for (n = 0; n < sites; ++n)
+  {
+    pmat = pmatrix;
+    term = 0;
+    for (k = 0; k < rate_cats; ++k)
+    {
+      term_r = 0;
+      for (i = 0; i < states; ++i)
+      {
+        terma = 0;
+        for (j = 0; j < states; ++j)
+          terma += pmat[j] * child_clv[j];
+        term_r += parent_clv[i] * terma;
+
+        pmat += states_padded;
+      }
+
+      term += term_r * rate_weights[k];
+
+      parent_clv += states_padded;
+      child_clv  += states_padded;
+    }
+
+    if (persite_lh)
+      persite_lh[n] = term;
+
+    scale_factors = (parent_scaler) ? parent_scaler[n] : 0;
+    scale_factors += (child_scaler) ? child_scaler[n] : 0;
+
+    site_lk = log(term);
+    if (scale_factors)
+      site_lk += scale_factors * log(PLL_SCALE_THRESHOLD);
+
+    logl += site_lk * pattern_weights[n];
+  }
+
+  return logl;
+}
@@ -662,6 +662,81 @@ void pll_core_update_partial_ii(unsigned int states,
   }
 }
 
+/* Outside partials of a child of the root. The state at the root is drawn
+   from the stationary frequencies and the only other data outside the
+   subtree of the child are those of its sibling, whose partials are given
+   in clv, with the sibling branch transition probabilities in pmatrix */
+void pll_core_update_outside_root(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  double * outside_clv,
+                                  unsigned int * outside_scaler,
+                                  const double * clv,
+                                  const unsigned int * clv_scaler,
+                                  const double * pmatrix,
+                                  double * const * frequencies,
+                                  const unsigned int * freqs_indices,
+                                  unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+  unsigned int site_scale;
+  unsigned int states_padded = states;
+  double term;
+  const double * pmat;
+  const double * freqs;
+
+  if (attrib & PLL_ATTRIB_ARCH_SSE)
+    states_padded = (states+1) & 0xFFFFFFFE;
+  if (attrib & (PLL_ATTRIB_ARCH_AVX | PLL_ATTRIB_ARCH_AVX2))
+    states_padded = (states+3) & 0xFFFFFFFC;
+
+  unsigned int span = states_padded * rate_cats;
+
+  if (outside_scaler)
+    fill_parent_scaler(sites, outside_scaler, clv_scaler, NULL);
+
+  for (n = 0; n < sites; ++n)
+  {
+    pmat = pmatrix;
+    site_scale = outside_scaler ? 1 : 0;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_scale = 1;
+
+      freqs = frequencies[freqs_indices[k]];
+      for (i = 0; i < states; ++i)
+      {
+        term = 0;
+        for (j = 0; j < states; ++j)
+          term += pmat[j] * clv[j];
+        outside_clv[i] = freqs[i] * term;
+
+        rate_scale &= (outside_clv[i] < PLL_SCALE_THRESHOLD);
+
+        pmat += states_padded;
+      }
+      for (i = states; i < states_padded; ++i)
+        outside_clv[i] = 0;
+
+      site_scale = site_scale && rate_scale;
+
+      outside_clv += states_padded;
+      clv += states_padded;
+    }
+
+    /* scale if *all* entries of the site were below the threshold */
+    if (site_scale)
+    {
+      outside_clv -= span;
+      for (i = 0; i < span; ++i)
+        outside_clv[i] *= PLL_SCALE_FACTOR;
+      outside_clv += span;
+      outside_scaler[n] += 1;
+    }
+  }
+}
+
 void pll_core_create_lookup_4x4(unsigned int rate_cats,
                                 double * lookup,
                                 const double * left_matrix,
@@ -697,9 +697,9 @@ void bpp_core_update_pmatrix(locus_t * locus,
 
   gnode_t * node;
 
-
-  expd = (double *)xmalloc(states * sizeof(double));
-  temp = (double *)xmalloc(states*states*sizeof(double));
+  /* exponentials and temporary matrix use the locus scratch space */
+  expd = locus->pmat_scratch;
+  temp = locus->pmat_scratch + states;
 
   unsigned int * param_indices = locus->param_indices;
 
@@ -806,9 +806,6 @@ void bpp_core_update_pmatrix(locus_t * locus,
       #endif
     }
   }
-
-  free(expd);
-  free(temp);
 }
 
 int pll_core_update_pmatrix(double ** pmatrix,
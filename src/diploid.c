@@ -237,11 +237,21 @@ static unsigned int findmax(const unsigned int * map)
   return max;
 }
 
+void phase_destroy(phase_t * phase)
+{
+  free(phase->site);
+  free(phase->het_offset);
+  free(phase->het_tip);
+  free(phase->tipstate);
+  free(phase);
+}
+
 static unsigned long * diploid_resolve_locus(msa_t * msa,
                                              int msa_index,
                                              unsigned int * weight,
                                              int * cleandata,
-                                             const unsigned int * map)
+                                             const unsigned int * map,
+                                             phase_t ** phase_ptr)
 {
   int card;
   long i,j,k,n,m;
@@ -260,6 +270,9 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   unsigned int * diploid;
   char ** newlabel;
   unsigned long * resolution_count;
+  phase_t * phase = NULL;
+  long phase_count = 0;
+  long phase_hets = 0;
 
   *cleandata = 1;
 
@@ -414,13 +427,25 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   resolution_count = (unsigned long *)xmalloc((size_t)msa->length *
                                               sizeof(unsigned long));
 
-  /* 4a. Determine number of sites for new alignment A2 */
+  /* 4a. Determine number of sites for new alignment A2. Sites with more than
+     BPP_PHASE_EXPAND_MAX heterozygotes are kept as a single pattern, and
+     their resolutions are enumerated when computing the likelihood */
   size_t patterns = (size_t)(msa->length);
   for (i = 0; i < msa->length; ++i)
   {
     assert(sitehets[i] >= 0);
-    assert((size_t)sitehets[i] <= sizeof(long) * CHAR_BIT);
-    if (sitehets[i])
+    if (sitehets[i] > BPP_PHASE_HETS_MAX)
+      fatal("Site %ld of locus %d has %ld unresolved heterozygous sequences "
+            "(maximum supported is %d)",
+            i+1, msa_index+1, sitehets[i], BPP_PHASE_HETS_MAX);
+
+    if (sitehets[i] > BPP_PHASE_EXPAND_MAX)
+    {
+      resolution_count[i] = 1;
+      phase_count++;
+      phase_hets += sitehets[i];
+    }
+    else if (sitehets[i])
     {
       size_t temp = patterns;   /* overflow check */
       patterns += (1ul << sitehets[i]) - 1;
@@ -470,6 +495,22 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   printf("npatt in A2 after expansion = %ld\n", patterns);
   #endif
 
+  if (phase_count)
+  {
+    phase = (phase_t *)xmalloc(sizeof(phase_t));
+    phase->site_count = phase_count;
+    phase->site = (long *)xmalloc((size_t)phase_count * sizeof(long));
+    phase->het_offset = (long *)xmalloc((size_t)(phase_count+1) *
+                                        sizeof(long));
+    phase->het_tip = (unsigned int *)xmalloc((size_t)phase_hets *
+                                             sizeof(unsigned int));
+    phase->tipstate = (unsigned char *)xmalloc((size_t)phase_count *
+                                               (size_t)newseq_count *
+                                               sizeof(unsigned char));
+    phase->het_offset[0] = 0;
+    phase_count = 0;
+  }
+
   /* 4c. loop through sites in heterogenous alignment A1 to generate resolved
      site patterns for alignment A2 */
   long * hets = (long *)xmalloc((size_t)(msa->count) * sizeof(long));
@@ -515,7 +556,7 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
     assert(n == sitehets[i]);
 
     /* generate resolved site patterns in A2 */
-    for (j = 0; j < (1ul << n); ++j)
+    for (j = 0; j < (long)resolution_count[i]; ++j)
     {
       for (k=0,m=j; k < n; ++k)
       {
@@ -539,6 +580,22 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
       for (k = 0; k < newseq_count; ++k) newseq[k][q] = newsite[k];
       ++q;
     }
+
+    /* store the tip states of the first resolution and the heterozygotes of
+       sites resolved by enumeration */
+    if (n > BPP_PHASE_EXPAND_MAX)
+    {
+      long * offset = phase->het_offset + phase_count;
+
+      phase->site[phase_count] = i;
+      offset[1] = offset[0] + n;
+      for (k = 0; k < n; ++k)
+        phase->het_tip[offset[0]+k] = (unsigned int)mapping[hets[k]];
+      for (k = 0; k < newseq_count; ++k)
+        phase->tipstate[phase_count*newseq_count+k] =
+          (unsigned char)map[(int)(newsite[k])];
+      ++phase_count;
+    }
   }
 
   /* add terminating zero to phased sequences */
@@ -574,6 +631,8 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   free(single_indices);
   free(hmat);
 
+  *phase_ptr = phase;
+
   return resolution_count;
 }
 
@@ -581,7 +640,8 @@ unsigned long ** diploid_resolve(stree_t * stree,
                                  msa_t ** msa_list,
                                  list_t * maplist,
                                  unsigned int ** weights,
-                                 int msa_count)
+                                 int msa_count,
+                                 phase_t ** phase)
 {
   long i;
   int * cleandata;
@@ -615,7 +675,8 @@ unsigned long ** diploid_resolve(stree_t * stree,
                                                 (int)i,
                                                 weights[i],
                                                 cleandata+i,
-                                                map);
+                                                map,
+                                                phase+i);
   }
 
   /* update map file with new labels */
@@ -29,6 +29,21 @@
 
 static BYTE dummy[256] = {0};
 
+/* position of each locus in the current thread layout, in the original order
+   of the loci; all per-locus data are written in the original order such
+   that a run can be resumed with any number of threads */
+static long * order = NULL;
+
+static void dump_loci(const void * x, size_t size, FILE * fp)
+{
+  long k;
+
+  for (k = 0; k < opt_locus_count; ++k)
+    fwrite((const char *)x + order[k]*size, size, 1, fp);
+}
+
+#define DUMP_LOCI(x,fp) dump_loci((x),sizeof(*(x)),fp)
+
 static void dump_chk_header(FILE * fp, stree_t * stree)
 {
   long i;
@@ -88,6 +103,9 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
   DUMP(&opt_threads,1,fp);
   DUMP(&opt_threads_start,1,fp);
   DUMP(&opt_threads_step,1,fp);
+  DUMP(&opt_site_threads,1,fp);
+  DUMP(&opt_lowmem,1,fp);
+  DUMP(&opt_site_repeats,1,fp);
   unsigned int * rng = get_legacy_rndu_array();
   DUMP(rng,opt_threads,fp);
 
@@ -166,6 +184,7 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
 
 static void dump_chk_section_1(FILE * fp,
                                stree_t * stree,
+                               locus_t ** locus_list,
                                double * pjump,
                                long curstep,
                                long ft_round,
@@ -338,6 +357,8 @@ static void dump_chk_section_1(FILE * fp,
 
   /* write finetune */
   DUMP(&opt_finetune_reset,1,fp);
+  DUMP(&opt_finetune_adapt,1,fp);
+  DUMP(&opt_hmc_steps,1,fp);
   DUMP(&opt_finetune_phi,1,fp);
   DUMP(&opt_finetune_gtage,1,fp);
   DUMP(&opt_finetune_gtspr,1,fp);
@@ -398,10 +419,10 @@ static void dump_chk_section_1(FILE * fp,
 
   /* write gtree file offset if available*/
   if (opt_print_genetrees)
-    DUMP(gtree_offset,opt_locus_count,fp);
+    DUMP_LOCI(gtree_offset,fp);
 
   if (opt_print_locusfile)
-    DUMP(rates_offset,opt_locus_count,fp);
+    DUMP_LOCI(rates_offset,fp);
 
   DUMP(&dparam_count,1,fp);
 
@@ -430,17 +451,20 @@ static void dump_chk_section_1(FILE * fp,
   DUMP(&prec_logpg,1,fp);
   DUMP(&prec_logl,1,fp);
 
+  /* streaming summary accumulators (A00) */
+  long ostats_count;
+  ostats_t * ostats = ostats_cols(&ostats_count);
+  DUMP(&ostats_count,1,fp);
+  if (ostats_count)
+    DUMP(ostats,ostats_count,fp);
+
   DUMP(&opt_load_balance,1,fp);
 
-  if (opt_threads > 1)
+  /* write locus loads from which the thread layout is recomputed */
+  for (i = 0; i < (size_t)opt_locus_count; ++i)
   {
-    thread_info_t * ti = threads_ti();
-    for (i = 0; i < opt_threads; ++i)
-    {
-      thread_info_t * tip = ti+i;
-      DUMP(&(tip->locus_first),1,fp);
-      DUMP(&(tip->locus_count),1,fp);
-    }
+    long load = locus_list[order[i]]->tips * locus_list[order[i]]->sites;
+    DUMP(&load,1,fp);
   }
 }
 
@@ -504,6 +528,13 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   for (i = 0; i < total_nodes; ++i)
     DUMP(&(stree->nodes[i]->tau),1,fp);
 
+  /* write adaptive finetune steps */
+  for (i = 0; i < total_nodes; ++i)
+  {
+    DUMP(&(stree->nodes[i]->finetune_theta),1,fp);
+    DUMP(&(stree->nodes[i]->finetune_tau),1,fp);
+  }
+
   /* write support */
   for (i = 0; i < total_nodes; ++i)
     DUMP(&(stree->nodes[i]->support),1,fp);
@@ -519,7 +550,7 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   /* write number of coalescent events */
   assert(opt_locus_count == stree->locus_count);
   for (i = 0; i < total_nodes; ++i)
-    DUMP(stree->nodes[i]->event_count,opt_locus_count,fp);
+    DUMP_LOCI(stree->nodes[i]->event_count,fp);
 
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
@@ -529,7 +560,7 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
       {
         valid = 1;
         DUMP(&valid,1,fp);
-        DUMP(stree->nodes[i]->brate,opt_locus_count,fp);
+        DUMP_LOCI(stree->nodes[i]->brate,fp);
       }
       else
       {
@@ -551,7 +582,7 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
     DUMP(&(stree->notheta_sfactor),1,fp);
     for (i = 0; i < total_nodes; ++i)
     {
-      DUMP(stree->nodes[i]->t2h,opt_locus_count,fp);
+      DUMP_LOCI(stree->nodes[i]->t2h,fp);
       DUMP(&(stree->nodes[i]->t2h_sum),1,fp);
       DUMP(&(stree->nodes[i]->event_count_sum),1,fp);
       DUMP(&(stree->nodes[i]->notheta_logpr_contrib),1,fp);
@@ -564,8 +595,8 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
         unsigned int index = stree->tip_count+stree->inner_count;
         snode_t * x = stree->nodes[index+i];
 
-        DUMP(x->notheta_phi_contrib, opt_locus_count, fp);
-        DUMP(x->hybrid->notheta_phi_contrib, opt_locus_count, fp);
+        DUMP_LOCI(x->notheta_phi_contrib,fp);
+        DUMP_LOCI(x->hybrid->notheta_phi_contrib,fp);
         DUMP(&(x->hphi_sum),1,fp);
         DUMP(&(x->hybrid->hphi_sum),1,fp);
       }
@@ -577,14 +608,14 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   /* TODO : Perhaps write only seqin_count for tips? */
   /* write number of incoming sequences for each node */
   for (i = 0; i < total_nodes; ++i)
-    DUMP(stree->nodes[i]->seqin_count,opt_locus_count,fp);
+    DUMP_LOCI(stree->nodes[i]->seqin_count,fp);
 
   /* write event indices for each node */
   for (i = 0; i < total_nodes; ++i)
   {
     for (j = 0; j < opt_locus_count; ++j)
     {
-      dlist_item_t * di = stree->nodes[i]->event[j]->head;
+      dlist_item_t * di = stree->nodes[i]->event[order[j]]->head;
       while (di)
       {
         gnode_t * gnode = (gnode_t *)(di->data);
@@ -656,7 +687,10 @@ static void dump_gene_tree(FILE * fp, gtree_t * gtree, unsigned int hybrid_count
   DUMP(&(gtree->original_index),1,fp);
 }
 
-static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
+static void dump_locus(FILE * fp,
+                       gtree_t * gtree,
+                       locus_t * locus,
+                       long hmc_dim)
 {
 
   long i;
@@ -738,6 +772,19 @@ static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
 
     /* write pattern weights for original diploid A1 alignment */
     DUMP(locus->pattern_weights,locus->unphased_length,fp);
+
+    /* write unphased sites resolved by enumeration */
+    long phase_count = locus->phase ? locus->phase->site_count : 0;
+    DUMP(&phase_count,1,fp);
+    if (phase_count)
+    {
+      phase_t * phase = locus->phase;
+
+      DUMP(phase->site,phase_count,fp);
+      DUMP(phase->het_offset,phase_count+1,fp);
+      DUMP(phase->het_tip,phase->het_offset[phase_count],fp);
+      DUMP(phase->tipstate,phase_count*locus->tips,fp);
+    }
   }
   else
   {
@@ -753,6 +800,19 @@ static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
     DUMP(locus->clv[clv_index],span,fp);
   }
 
+  /* write adaptive finetune step */
+  DUMP(&(locus->finetune_gtspr),1,fp);
+
+  /* write HMC step length, scales and moments of the current window */
+  if (opt_hmc_steps)
+  {
+    DUMP(&(locus->hmc_step),1,fp);
+    DUMP(&(locus->hmc_count),1,fp);
+    DUMP(locus->hmc_scale,hmc_dim,fp);
+    DUMP(locus->hmc_mean,hmc_dim,fp);
+    DUMP(locus->hmc_m2,hmc_dim,fp);
+  }
+
   DUMP(&(locus->original_index),1,fp);
 }
 
@@ -762,20 +822,22 @@ static void dump_chk_section_3(FILE * fp, gtree_t ** gtree_list, stree_t * stree
 
   for (i = 0; i < msa_count; ++i)
   {
-    dump_gene_tree(fp,gtree_list[i],stree->hybrid_count);
+    dump_gene_tree(fp,gtree_list[order[i]],stree->hybrid_count);
   }
 }
 
 static void dump_chk_section_4(FILE * fp,
                                gtree_t ** gtree_list,
                                locus_t ** locus_list,
+                               stree_t * stree,
                                long msa_count)
 {
   long i;
+  long hmc_dim = adapt_hmc_dim(stree);
 
   for (i = 0; i < msa_count; ++i)
   {
-    dump_locus(fp,gtree_list[i], locus_list[i]);
+    dump_locus(fp,gtree_list[order[i]], locus_list[order[i]], hmc_dim);
   }
 
 }
@@ -810,6 +872,7 @@ int checkpoint_dump(stree_t * stree,
                     int prec_logpg,
                     int prec_logl)
 {
+  long i;
   FILE * fp;
   char * s = NULL;
 
@@ -826,12 +889,17 @@ int checkpoint_dump(stree_t * stree,
   }
 
 
+  order = (long *)xmalloc((size_t)opt_locus_count * sizeof(long));
+  for (i = 0; i < opt_locus_count; ++i)
+    order[gtree_list[i]->original_index] = i;
+
   /* write checkpoint header */
   dump_chk_header(fp,stree);
 
   /* write section 1 */
   dump_chk_section_1(fp,
                      stree,
+                     locus_list,
                      pjump,
                      curstep,
                      ft_round,
@@ -866,9 +934,11 @@ int checkpoint_dump(stree_t * stree,
   dump_chk_section_3(fp,gtree_list,stree,stree->locus_count);
 
   /* write section 4 */
-  dump_chk_section_4(fp,gtree_list,locus_list,stree->locus_count);
+  dump_chk_section_4(fp,gtree_list,locus_list,stree,stree->locus_count);
 
   fclose(fp);
+  free(order);
+  order = NULL;
   
   return 1;
 }
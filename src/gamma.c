@@ -258,7 +258,10 @@ int pll_compute_gamma_cats(double alpha,
   }
   else if (rates_mode == PLL_GAMMA_RATES_MEAN)
   {
-    gammaProbs = (double *)xmalloc((size_t)categories * sizeof(double));
+    /* the category probabilities are computed in place in output_rates, and
+       the rates are then filled from the last category backwards, so that
+       no temporary storage is needed */
+    gammaProbs = output_rates;
 
     lnga1 = LnGamma(alpha+1);
 
@@ -268,14 +271,12 @@ int pll_compute_gamma_cats(double alpha,
     for (i = 0; i < categories - 1; i++)
       gammaProbs[i] = IncompleteGamma(gammaProbs[i] * beta, alpha+1, lnga1);
 
-    output_rates[0] = gammaProbs[0] * mean*categories;
-
     output_rates[categories - 1] = (1-gammaProbs[categories-2])*mean*categories;
 
-    for (i=1; i < categories-1; i++)
+    for (i = categories-2; i > 0; i--)
       output_rates[i] = (gammaProbs[i] - gammaProbs[i-1])*mean*categories;
 
-    free(gammaProbs);
+    output_rates[0] = gammaProbs[0] * mean*categories;
   }
   else
     fatal("Invalid GAMMA disrcretization mode (%d)", rates_mode);
@@ -50,6 +50,9 @@ static hashtable_t * mht;
    computing MSC density) to avoid reallocation */
 static double ** sortbuffer_r = NULL;
 
+/* pairs of loci for parallel locus rate proposals */
+static unsigned int * lrht_pairs = NULL;
+
 __THREAD gnode_t * dbg_msci_y = NULL;
 __THREAD gnode_t * dbg_msci_a = NULL;
 __THREAD gnode_t * dbg_msci_s = NULL;
@@ -272,122 +275,55 @@ void gtree_destroy(gtree_t * tree,
   free(tree);
 }
 
-static char * export_newick_recursive(const gnode_t * root,
-                                      char * (*cb_serialize)(const gnode_t *))
+static void gtree_newick_recursive(strbuf_t * sb,
+                                   const gnode_t * node,
+                                   char * (*cb_serialize)(const gnode_t *))
 {
-  char * newick;
-  long size_alloced;
-  assert(root != NULL);
+  if (node->left && node->right)
+  {
+    strbuf_putc(sb,'(');
+    gtree_newick_recursive(sb,node->left,cb_serialize);
+    strbuf_putc(sb,',');
+    gtree_newick_recursive(sb,node->right,cb_serialize);
+    strbuf_putc(sb,')');
+  }
 
-  if (!(root->left) || !(root->right))
+  if (cb_serialize)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    char * temp = cb_serialize(node);
+    strbuf_puts(sb,temp);
+    free(temp);
   }
   else
   {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
-
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%f",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
+    strbuf_puts(sb, node->label ? node->label : "");
+    strbuf_putc(sb,':');
+    strbuf_putf(sb,node->length);
   }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed.");
+}
 
-  return newick;
+/* append the newick string of the tree rooted at root to sb */
+void gtree_write_newick(strbuf_t * sb,
+                        const gnode_t * root,
+                        char * (*cb_serialize)(const gnode_t *))
+{
+  gtree_newick_recursive(sb,root,cb_serialize);
+
+  if (!cb_serialize && root->left && root->right)
+    strbuf_putc(sb,';');
 }
 
 char * gtree_export_newick(const gnode_t * root,
                            char * (*cb_serialize)(const gnode_t *))
 {
-  char * newick;
-  long size_alloced;
-  if (!root) return NULL;
+  strbuf_t sb;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
-  }
-  else
-  {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-      fatal("Unable to allocate enough memory.");
+  if (!root) return NULL;
 
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-      fatal("Unable to allocate enough memory.");
+  strbuf_init(&sb);
+  gtree_write_newick(&sb,root,cb_serialize);
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%f;",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed");
-
-  return newick;
+  return sb.s;
 }
 
 static void fill_nodes_recursive(gnode_t * node, gnode_t ** array)
@@ -1178,7 +1114,38 @@ static void epoch_reorder(snode_t ** epoch,
   }
 }
 
-gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
+/* constant terms of the log-density when theta is integrated out, computed
+   from the number of sequences of each locus */
+static void notheta_init_logpr(stree_t * stree)
+{
+  long i;
+  unsigned int j;
+
+  stree->notheta_logpr = 0;
+  if (opt_est_heredity)
+    stree->notheta_logpr += stree->notheta_hfactor;
+
+  stree->notheta_old_logpr = 0;
+
+  stree->notheta_sfactor = 0;
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    long seqs = 0;
+    for (j = 0; j < stree->tip_count; ++j)
+      seqs += stree->nodes[j]->seqin_count[i];
+
+    stree->notheta_logpr   += (seqs-1)*0.6931471805599453;
+    stree->notheta_sfactor += (seqs-1)*0.6931471805599453;
+  }
+}
+
+/* simulate a gene tree for locus msa_index using the random number stream
+   thread_index. Migration events are counted in the matrix of the calling
+   thread, i.e. opt_migration_events holds one matrix per thread */
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         long thread_index)
 {
   int lineage_count = 0;
   int scaler_index = 0;
@@ -1190,7 +1157,6 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
   pop_t * pop;
   snode_t ** epoch;
   gnode_t * inner = NULL;
-  const long thread_index = 0;
 
   if (opt_migration)
     migrate = (double *)xmalloc((size_t)stree->tip_count * sizeof(double));
@@ -1277,24 +1243,7 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
     stree->nodes[i]->seqin_count[msa_index] = pop[i].seq_count;
 
   if (!opt_est_theta)
-  {
-    stree->notheta_logpr = 0;
-    if (opt_est_heredity)
-      stree->notheta_logpr += stree->notheta_hfactor;
-
-    stree->notheta_old_logpr = 0;
-
-    stree->notheta_sfactor = 0;
-    for (i = 0; i < opt_locus_count; ++i)
-    {
-      long seqs = 0;
-      for (j = 0; j < stree->tip_count; ++j)
-        seqs += stree->nodes[j]->seqin_count[i];
-
-      stree->notheta_logpr   += (seqs-1)*0.6931471805599453;
-      stree->notheta_sfactor += (seqs-1)*0.6931471805599453;
-    }
-  }
+    notheta_init_logpr(stree);
   /* start at present time */
   t = 0;
 
@@ -1540,7 +1489,8 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
         }
         mindexk = pop[k].snode->node_index;
 
-        opt_migration_events[mindexk * matrix_span + mindexj] += 1;
+        opt_migration_events[thread_index * matrix_span * matrix_span +
+                             mindexk * matrix_span + mindexj] += 1;
 
         /* i is a migrant from population k to j */
         i = (long)(pop[j].seq_count * legacy_rndu(thread_index));
@@ -1848,6 +1798,303 @@ void gtree_alloc_internals(gtree_t ** gtree, long msa_count)
   #endif
 }
 
+/* Data-informed starting gene trees. Each locus is built by UPGMA on pairwise
+   JC69 distances, constrained such that two clusters can only coalesce in a
+   population ancestral to both of them, at a time not younger than the
+   population age. Coalescent times are half the average distances, pushed up
+   where necessary to respect the population taus and the ages of the two
+   child nodes */
+
+#define UPGMA_EPSILON 1e-6
+
+typedef struct upgma_work_s
+{
+  stree_t * stree;
+  msa_t ** msalist;
+  unsigned int ** weights;
+  gtree_t ** gtree;
+  long msa_count;
+  long thread_index;
+  long thread_count;
+} upgma_work_t;
+
+static snode_t * snode_lca(snode_t * a, snode_t * b)
+{
+  snode_t * x;
+
+  for (; a; a = a->parent)
+    for (x = b; x; x = x->parent)
+      if (x == a)
+        return a;
+
+  assert(0);
+  return NULL;
+}
+
+/* JC69 (or Poisson for amino acids) distance between sequences j and k,
+   ignoring sites where either sequence has a gap or missing data */
+static double upgma_distance(msa_t * msa, unsigned int * weights, int j, int k)
+{
+  long n;
+  double diff = 0;
+  double sites = 0;
+  double p;
+  const unsigned int * map;
+  unsigned int full;
+  double b;
+  const unsigned char * x = (const unsigned char *)(msa->sequence[j]);
+  const unsigned char * y = (const unsigned char *)(msa->sequence[k]);
+
+  if (msa->dtype == BPP_DATA_AA)
+  {
+    map = pll_map_aa;
+    full = 0xFFFFF;
+    b = 19/20.;
+  }
+  else
+  {
+    map = pll_map_nt;
+    full = 0xF;
+    b = 3/4.;
+  }
+
+  for (n = 0; n < msa->length; ++n)
+  {
+    unsigned int xs = map[x[n]];
+    unsigned int ys = map[y[n]];
+
+    if (xs == full || ys == full)
+      continue;
+
+    sites += weights[n];
+    if (!(xs & ys))
+      diff += weights[n];
+  }
+
+  if (!sites)
+    return 0;
+
+  p = MIN(diff/sites, 0.99*b);
+
+  return -b*log(1 - p/b);
+}
+
+static gtree_t * gtree_upgma(stree_t * stree,
+                             msa_t * msa,
+                             unsigned int * weights,
+                             int msa_index)
+{
+  unsigned int i,j,k;
+  unsigned int n = (unsigned int)(msa->count);
+  unsigned int snodes = stree->tip_count + stree->inner_count;
+  unsigned int clv_index = n;
+  int scaler_index = 0;
+  pop_t * pop;
+  gnode_t * inner = NULL;
+
+  /* map each sequence to its species */
+  pop = (pop_t *)xcalloc((size_t)(stree->tip_count), sizeof(pop_t));
+  fill_pop(pop,stree,msa,msa_index);
+
+  for (i = 0; i < stree->tip_count; ++i)
+    stree->nodes[i]->seqin_count[msa_index] = pop[i].seq_count;
+
+  /* one cluster per sequence, indexed by sequence */
+  gnode_t ** cluster = (gnode_t **)xmalloc((size_t)n * sizeof(gnode_t *));
+  unsigned int * active = (unsigned int *)xmalloc((size_t)n *
+                                                  sizeof(unsigned int));
+  for (i = 0; i < stree->tip_count; ++i)
+  {
+    for (j = 0; j < pop[i].seq_count; ++j)
+    {
+      int index = pop[i].seq_indices[j];
+      gnode_t * tip = (gnode_t *)xcalloc(1,sizeof(gnode_t));
+
+      tip->label = xstrdup(msa->label[index]);
+      tip->clv_index = index;
+      tip->pmatrix_index = index;
+      tip->scaler_index = PLL_SCALE_BUFFER_NONE;
+      tip->leaves = 1;
+      tip->pop = pop[i].snode;
+      cluster[index] = tip;
+    }
+    free(pop[i].seq_indices);
+    free(pop[i].nodes);
+  }
+  free(pop);
+
+  for (i = 0; i < n; ++i)
+    active[i] = i;
+
+  /* species LCA of each pair of populations */
+  snode_t ** lca = (snode_t **)xmalloc((size_t)snodes * snodes *
+                                       sizeof(snode_t *));
+  for (i = 0; i < snodes; ++i)
+    for (j = 0; j < snodes; ++j)
+      lca[i*snodes+j] = snode_lca(stree->nodes[i], stree->nodes[j]);
+
+  /* pairwise distances, indexed by sequence */
+  double * dist = (double *)xmalloc((size_t)n * n * sizeof(double));
+  for (i = 0; i < n; ++i)
+  {
+    dist[i*n+i] = 0;
+    for (j = i+1; j < n; ++j)
+      dist[i*n+j] = dist[j*n+i] = upgma_distance(msa,weights,i,j);
+  }
+
+  /* join the pair with the smallest coalescent time that is compatible with
+     the species tree */
+  for (k = n; k > 1; --k)
+  {
+    unsigned int bi = 0, bj = 1;
+    double bkey = 0;
+    snode_t * bpop = NULL;
+
+    for (i = 0; i < k; ++i)
+    {
+      gnode_t * x = cluster[active[i]];
+      for (j = i+1; j < k; ++j)
+      {
+        gnode_t * y = cluster[active[j]];
+        snode_t * p = lca[x->pop->node_index*snodes + y->pop->node_index];
+        double key = MAX(dist[active[i]*n+active[j]]/2, p->tau);
+
+        if (!bpop || key < bkey)
+        {
+          bi = i; bj = j;
+          bkey = key;
+          bpop = p;
+        }
+      }
+    }
+
+    gnode_t * x = cluster[active[bi]];
+    gnode_t * y = cluster[active[bj]];
+
+    double t = bkey;
+    if (bpop->tau > 0)
+      t = MAX(t, bpop->tau + UPGMA_EPSILON);
+    t = MAX(t, x->time + UPGMA_EPSILON);
+    t = MAX(t, y->time + UPGMA_EPSILON);
+
+    /* move to the population spanning time t */
+    while (bpop->parent && t >= bpop->parent->tau)
+      bpop = bpop->parent;
+
+    inner = (gnode_t *)xcalloc(1,sizeof(gnode_t));
+    inner->left = x;
+    inner->right = y;
+    inner->clv_index = clv_index;
+    inner->pmatrix_index = clv_index;
+    if (opt_scaling)
+      inner->scaler_index = scaler_index++;
+    else
+      inner->scaler_index = PLL_SCALE_BUFFER_NONE;
+    inner->time = t;
+    inner->pop = bpop;
+    inner->leaves = x->leaves + y->leaves;
+    x->parent = inner;
+    y->parent = inner;
+    clv_index++;
+
+    bpop->event_count[msa_index]++;
+    inner->event = dlist_append(bpop->event[msa_index],inner);
+
+    /* average linkage; the new cluster takes the slot of x */
+    unsigned int a = active[bi];
+    unsigned int b = active[bj];
+    for (i = 0; i < k; ++i)
+    {
+      unsigned int c = active[i];
+      if (c == a || c == b) continue;
+
+      double d = (dist[a*n+c]*x->leaves + dist[b*n+c]*y->leaves) /
+                 inner->leaves;
+      dist[a*n+c] = dist[c*n+a] = d;
+    }
+    cluster[a] = inner;
+    active[bj] = active[k-1];
+  }
+
+  gtree_t * gtree = gtree_wraptree(inner, n);
+
+  free(dist);
+  free(lca);
+  free(active);
+  free(cluster);
+
+  fill_seqin_counts(stree,gtree,msa_index);
+
+  return gtree;
+}
+
+static void * upgma_worker(void * vp)
+{
+  long i;
+  upgma_work_t * work = (upgma_work_t *)vp;
+
+  /* loci are distributed cyclically to threads */
+  for (i = work->thread_index; i < work->msa_count; i += work->thread_count)
+    work->gtree[i] = gtree_upgma(work->stree,
+                                 work->msalist[i],
+                                 work->weights[i],
+                                 (int)i);
+
+  return NULL;
+}
+
+static void gtree_upgma_all(stree_t * stree,
+                            msa_t ** msalist,
+                            unsigned int ** weights,
+                            gtree_t ** gtree,
+                            long msa_count)
+{
+  long t;
+  long thread_count = MIN(MAX(opt_threads,1),msa_count);
+  pthread_t * threads;
+  upgma_work_t * work;
+
+  work = (upgma_work_t *)xmalloc((size_t)thread_count * sizeof(upgma_work_t));
+  for (t = 0; t < thread_count; ++t)
+  {
+    work[t].stree = stree;
+    work[t].msalist = msalist;
+    work[t].weights = weights;
+    work[t].gtree = gtree;
+    work[t].msa_count = msa_count;
+    work[t].thread_index = t;
+    work[t].thread_count = thread_count;
+  }
+
+  if (thread_count == 1)
+    upgma_worker((void *)work);
+  else
+  {
+    threads = (pthread_t *)xmalloc((size_t)thread_count*sizeof(pthread_t));
+    for (t = 0; t < thread_count; ++t)
+      if (pthread_create(threads+t, NULL, upgma_worker, (void *)(work+t)))
+        fatal("Cannot create thread");
+
+    for (t = 0; t < thread_count; ++t)
+      pthread_join(threads[t],NULL);
+
+    free(threads);
+  }
+  free(work);
+
+  /* per-node event totals and constant terms of the density when theta is
+     integrated out (gtree_simulate updates these as it goes) */
+  if (!opt_est_theta)
+  {
+    unsigned int j;
+    for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+      for (t = 0; t < msa_count; ++t)
+        stree->nodes[j]->event_count_sum += stree->nodes[j]->event_count[t];
+
+    notheta_init_logpr(stree);
+  }
+}
+
 void gtree_simulate_init(stree_t * stree, list_t * maplist)
 {
   if (stree->tip_count == 1)
@@ -1874,10 +2121,12 @@ void gtree_simulate_fini()
 gtree_t ** gtree_init(stree_t * stree,
                       msa_t ** msalist,
                       list_t * maplist,
+                      unsigned int ** weights,
                       int msa_count)
 {
   int i;
   gtree_t ** gtree;
+  long upgma = (opt_gtree_init == BPP_GTREE_INIT_UPGMA);
 
   assert(msa_count > 0);
 
@@ -1895,11 +2144,29 @@ gtree_t ** gtree_init(stree_t * stree,
     mht = maplist_hash(maplist,sht);
   }
 
-  /* generate random starting gene trees for each alignment */
-  printf("Generating gene trees....");
+  /* data-informed trees are not supported for networks and migration */
+  if (upgma && (opt_msci || opt_migration))
+  {
+    fprintf(stdout, "Note: gtreeinit = upgma is not supported with %s; "
+            "using simulated gene trees\n", opt_msci ? "MSci" : "migration");
+    upgma = 0;
+  }
+
+  if (upgma)
+  {
+    /* build starting gene trees from the pairwise distances of each locus */
+    printf("Generating gene trees (UPGMA)....");
+    gtree_upgma_all(stree,msalist,weights,gtree,msa_count);
+  }
+  else
+  {
+    /* generate random starting gene trees for each alignment */
+    printf("Generating gene trees....");
+  }
   for (i = 0; i < msa_count; ++i)
   {
-    gtree[i] = gtree_simulate(stree, msalist[i],i);
+    if (!upgma)
+      gtree[i] = gtree_simulate(stree, msalist[i],i,0);
 
     /* in the gene tree SPR it is possible that this scenario happens:
 
@@ -2377,7 +2644,10 @@ static double sample_hpath(stree_t * stree, gnode_t * x, long thread_index)
   }
 
   /* array to keep track of which hybridization nodes were visited */
-  int * visited = (int *)xcalloc((size_t)stree->hybrid_count,sizeof(int));
+  size_t scratch = arena_mark(thread_index);
+  int * visited = (int *)arena_alloc(thread_index,
+                                     (size_t)stree->hybrid_count*sizeof(int));
+  memset(visited,0,(size_t)stree->hybrid_count*sizeof(int));
 
   assert(start->parent);
 
@@ -2469,7 +2739,7 @@ static double sample_hpath(stree_t * stree, gnode_t * x, long thread_index)
   for (i = 0; i < stree->hybrid_count; ++i)
     if (!visited[i])
       x->hpath[i] = BPP_HPATH_NONE;
-  free(visited);
+  arena_release(thread_index,scratch);
 
   return contrib;
 }
@@ -2717,6 +2987,24 @@ static snode_t * network_mrca_desc_population(stree_t * stree,
   return mrca;
 }
 
+static int cb_trav_inner(gnode_t * node)
+{
+  return node->left ? 1 : 0;
+}
+
+/* recompute the partials of inner nodes in the subtree of node that were
+   invalidated by accepted age proposals in their descendants */
+static void outside_refresh_partials(locus_t * locus, gnode_t * node)
+{
+  if (!node->left || node->clv_valid) return;
+
+  outside_refresh_partials(locus,node->left);
+  outside_refresh_partials(locus,node->right);
+
+  locus_update_partials(locus,&node,1);
+  node->clv_valid = 1;
+}
+
 static long propose_ages(locus_t * locus,
                          gtree_t * gtree,
                          stree_t * stree,
@@ -2740,19 +3028,58 @@ static long propose_ages(locus_t * locus,
   double hphi_contrib_reverse = 0;
   double hpop_contrib = 0;
   double hpop_contrib_reverse = 0;
+  gnode_t ** order = NULL;
+  size_t mark = arena_mark(thread_index);
+  size_t scratch;
+  double finetune = opt_finetune_gtage;
 
   stree_total_nodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
 
   gnode_t ** travbuffer = gtree->travbuffer;
 
+  /* With outside partials the nodes are visited in pre-order, and the
+     likelihood of a proposed age is computed at the branch above the node
+     from its outside partials and its recomputed partials. Partials of the
+     ancestors of accepted nodes are recomputed lazily, only once they are
+     needed for computing the outside partials of a sibling subtree or at the
+     end of the sweep. Diploid loci with scaling fall back to recomputing the
+     root path, as their root likelihood vector is not scaled */
+  int outside = opt_exp_outside && opt_usedata && !opt_lowmem &&
+                !(locus->diploid && opt_scaling);
+  if (outside)
+  {
+    order = (gnode_t **)arena_alloc(thread_index,
+                                    (size_t)(gtree->inner_count) *
+                                    sizeof(gnode_t *));
+    gtree_traverse(gtree->root,TREE_TRAVERSE_PREORDER,cb_trav_inner,order,&k);
+    assert(k == gtree->inner_count);
+
+    for (i = 0; i < gtree->inner_count; ++i)
+      order[i]->clv_valid = 1;
+  }
+  scratch = arena_mark(thread_index);
+
   /* TODO: Instead of traversing the gene tree nodes this way, traverse the
      coalescent events for each population in the species tree instead. This
      will reduce the amount of required quick-sorts.
   */
 
-  for (i = gtree->tip_count; i < gtree->inner_count+gtree->tip_count; ++i)
+  for (i = 0; i < gtree->inner_count; ++i)
   {
-    gnode_t * node = gtree->nodes[i];
+    gnode_t * node = outside ? order[i] : gtree->nodes[gtree->tip_count+i];
+
+    /* release temporary arrays of the previous node */
+    arena_release(thread_index,scratch);
+
+    if (outside && node->parent)
+    {
+      /* the sibling subtree must be up-to-date before computing the outside
+         partials. Only a left sibling may have been visited already */
+      if (node->parent->right == node)
+        outside_refresh_partials(locus,node->parent->left);
+
+      locus_update_outside(locus,node,thread_index);
+    }
 
     if (opt_msci)
     {
@@ -2822,7 +3149,7 @@ static long propose_ages(locus_t * locus,
 
     assert(maxage > minage);
 
-    tnew = node->time + opt_finetune_gtage*legacy_rnd_symmetrical(thread_index);
+    tnew = node->time + finetune*legacy_rnd_symmetrical(thread_index);
     tnew = reflect(tnew, minage, maxage, thread_index);
 
     assert(tnew != 0);
@@ -2835,8 +3162,9 @@ static long propose_ages(locus_t * locus,
     {
       /* allocate temporary storage */
       long cand_count = 0;
-      snode_t ** candidates = (snode_t **)xmalloc((size_t)stree_total_nodes *
-                                                  sizeof(snode_t *));
+      snode_t ** candidates = (snode_t **)arena_alloc(thread_index,
+                                                      (size_t)stree_total_nodes *
+                                                      sizeof(snode_t *));
       snode_t * lpop = node->left->pop;
       snode_t * rpop = node->right->pop;
 
@@ -2885,8 +3213,6 @@ static long propose_ages(locus_t * locus,
       }
 
       hpop_contrib_reverse = log(1.0 / cand_count);
-
-      free(candidates);
     }
     else
     {   /* not a network */
@@ -2898,9 +3224,10 @@ static long propose_ages(locus_t * locus,
     if (opt_msci)
     {
       /* Save old flags for the three nodes, to be used for rollback */
-      old_hpath_x  = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-      old_hpath_c1 = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-      old_hpath_c2 = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
+      size_t hpath_size = (size_t)(stree->hybrid_count)*sizeof(int);
+      old_hpath_x  = (int *)arena_alloc(thread_index,hpath_size);
+      old_hpath_c1 = (int *)arena_alloc(thread_index,hpath_size);
+      old_hpath_c2 = (int *)arena_alloc(thread_index,hpath_size);
 
       memcpy(old_hpath_x,  node->hpath, stree->hybrid_count*sizeof(int));
       memcpy(old_hpath_c1, node->left->hpath, stree->hybrid_count*sizeof(int));
@@ -3208,13 +3535,19 @@ static long propose_ages(locus_t * locus,
       if (opt_scaling)
         temp->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,
                                                temp->scaler_index);
+
+      /* with outside partials only the current node is recomputed */
+      if (outside) break;
     }
 
     /* update partials */
     locus_update_partials(locus,travbuffer,k);
     
     /* compute log-likelihood */
-    logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
+    if (outside && node->parent)
+      logl = locus_outside_loglikelihood(locus,node);
+    else
+      logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
 
     if (opt_msci)
     {
@@ -3245,6 +3578,11 @@ static long propose_ages(locus_t * locus,
         stree->notheta_logpr = logpr;
 
       gtree->logl = logl;
+
+      /* invalidate the partials of the ancestors */
+      if (outside)
+        for (temp = node->parent; temp && temp->clv_valid; temp = temp->parent)
+          temp->clv_valid = 0;
     }
     else
     {
@@ -3422,13 +3760,19 @@ static long propose_ages(locus_t * locus,
         }
       }
     }
-    if (opt_msci)
-    {
-      free(old_hpath_x);
-      free(old_hpath_c1);
-      free(old_hpath_c2);
-    }
   }
+  if (outside)
+  {
+    /* bring the root partials up-to-date and recompute the log-likelihood at
+       the root, such that other moves start from identical values */
+    outside_refresh_partials(locus,gtree->root);
+    gtree->logl = locus_root_loglikelihood(locus,
+                                           gtree->root,
+                                           locus->param_indices,
+                                           NULL);
+  }
+
+  arena_release(thread_index,mark);
   return accepted;
 }
 
@@ -3678,6 +4022,10 @@ void gtree_fini(int msa_count)
     free(sortbuffer_r[i]);
   free(sortbuffer_r);
   #endif
+
+  if (lrht_pairs)
+    free(lrht_pairs);
+  lrht_pairs = NULL;
 }
 
 static int branch_compat(stree_t * stree,
@@ -3748,6 +4096,7 @@ static gnode_t * network_fill_targets(stree_t * stree,
   unsigned int snodes_count;
   gnode_t * p;
   snode_t ** ptarget_list = NULL;
+  size_t scratch = arena_mark(thread_index);
 
   *pop_target = NULL;
 
@@ -3777,7 +4126,9 @@ static gnode_t * network_fill_targets(stree_t * stree,
   }
 
   /* fill a list with target populations */
-  ptarget_list = (snode_t **)xmalloc((size_t)ptarget_count*sizeof(snode_t *));
+  ptarget_list = (snode_t **)arena_alloc(thread_index,
+                                         (size_t)ptarget_count *
+                                         sizeof(snode_t *));
   for (k = 0, j = 0; j < snodes_count; ++j)
   {
     if (stree->nodes[j]->mark[thread_index])
@@ -3823,8 +4174,9 @@ static gnode_t * network_fill_targets(stree_t * stree,
   if (opt_rev_gspr)
   {
     /* REVOLUTIONARY SPR MOVE */
-    gnode_t ** sources = (gnode_t **)xmalloc((size_t)gtree->edge_count *
-                                             sizeof(gnode_t *));
+    gnode_t ** sources = (gnode_t **)arena_alloc(thread_index,
+                                                 (size_t)gtree->edge_count *
+                                                 sizeof(gnode_t *));
     sources[0] = sibling;
     if (father != gtree->root)
     {
@@ -3846,8 +4198,15 @@ static gnode_t * network_fill_targets(stree_t * stree,
     }
 
     /* get weights (log-L) for each source */
-    double * sweight = (double *)xmalloc(*source_count * sizeof(double));
-    rev_spr_tselect(curnode, father->time, sources, *source_count, locus, sweight);
+    double * sweight = (double *)arena_alloc(thread_index,
+                                             *source_count * sizeof(double));
+    rev_spr_tselect(curnode,
+                    father->time,
+                    sources,
+                    *source_count,
+                    locus,
+                    sweight,
+                    thread_index);
 
     /* turn log-L weights into probabilities */
     double maxw = sweight[0];
@@ -3862,9 +4221,6 @@ static gnode_t * network_fill_targets(stree_t * stree,
     }
 
     *swgt = sweight[0] / sum;
-
-    free(sources);
-    free(sweight);
   }
   else
   {
@@ -3894,8 +4250,15 @@ static gnode_t * network_fill_targets(stree_t * stree,
   if (opt_rev_gspr)
   {
     /* REVOLUTIONARY SPR MOVE */
-    double * tweight = (double *)xmalloc(*target_count * sizeof(double));
-    rev_spr_tselect(curnode, tnew, travbuffer, *target_count, locus, tweight);
+    double * tweight = (double *)arena_alloc(thread_index,
+                                             *target_count * sizeof(double));
+    rev_spr_tselect(curnode,
+                    tnew,
+                    travbuffer,
+                    *target_count,
+                    locus,
+                    tweight,
+                    thread_index);
     double maxw = tweight[0];
     for (j = 1; j < *target_count; ++j)
       if (maxw < tweight[j])
@@ -3919,8 +4282,6 @@ static gnode_t * network_fill_targets(stree_t * stree,
 
     /* proposal distribution */
     *twgt = tweight[j] / sum;
-
-    free(tweight);
   }
   else
     target = travbuffer[(int)(*target_count * legacy_rndu(thread_index))];
@@ -3963,8 +4324,7 @@ static gnode_t * network_fill_targets(stree_t * stree,
   assert(pop);
   *pop_target = pop;
 
-  if (ptarget_list)
-    free(ptarget_list);
+  arena_release(thread_index,scratch);
 
   return target;
 }
@@ -4018,6 +4378,7 @@ static long propose_spr(locus_t * locus,
   unsigned int * indices = NULL;
   double twgt = 0;
   double swgt = 0;
+  size_t scratch, node_scratch;
 
   gnode_t ** travbuffer = gtree->travbuffer;
 
@@ -4038,18 +4399,27 @@ static long propose_spr(locus_t * locus,
 
   stree_total_nodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
 
+  /* temporary arrays come from the thread scratch arena, and are released
+     after each node is processed */
+  scratch = arena_mark(thread_index);
+
   /* randomize order of nodes to traverse for SPR */
   if (opt_exp_randomize)
   {
-    indices = (unsigned int *)xmalloc((size_t)(gtree->tip_count+gtree->inner_count) *
-                              sizeof(unsigned int));
+    indices = (unsigned int *)arena_alloc(thread_index,
+                                          (size_t)(gtree->tip_count +
+                                                   gtree->inner_count) *
+                                          sizeof(unsigned int));
     for (i = 0; i < gtree->tip_count+gtree->inner_count; ++i)
       indices[i] = i;
     shuffle(indices,gtree->tip_count+gtree->inner_count,thread_index); 
   }
+  node_scratch = arena_mark(thread_index);
 
   for (q = 0; q < gtree->tip_count + gtree->inner_count; ++q)
   {
+    arena_release(thread_index,node_scratch);
+
     /* randomize order or keep original order of nodes to traverse for spr */
     if (opt_exp_randomize)
     {
@@ -4061,6 +4431,10 @@ static long propose_spr(locus_t * locus,
     curnode = gtree->nodes[i];
     if (curnode == gtree->root) continue;
 
+    /* target selection reads CLVs of the unpruned tree */
+    if (opt_rev_gspr && opt_lowmem)
+      locus_clv_validate(locus,gtree->root);
+
     sibling = (curnode->parent->left == curnode) ? 
                 curnode->parent->right : curnode->parent->left;
     father  = curnode->parent;
@@ -4122,7 +4496,11 @@ static long propose_spr(locus_t * locus,
     minage = MAX(curnode->time, pop->tau);
     maxage = 999;
 
-    tnew = father->time+opt_finetune_gtspr*legacy_rnd_symmetrical(thread_index);
+    if (opt_finetune_adapt)
+      tnew = father->time +
+             locus->finetune_gtspr*legacy_rnd_symmetrical(thread_index);
+    else
+      tnew = father->time+opt_finetune_gtspr*legacy_rnd_symmetrical(thread_index);
     tnew = reflect(tnew,minage,maxage,thread_index);
 
     if (!opt_msci)
@@ -4183,8 +4561,9 @@ static long propose_spr(locus_t * locus,
       if (opt_rev_gspr)
       {
         /* REVOLUTIONARY SPR MOVE */
-        gnode_t ** sources = (gnode_t **)xmalloc((size_t)gtree->edge_count *
-                                                 sizeof(gnode_t *));
+        gnode_t ** sources = (gnode_t **)arena_alloc(thread_index,
+                                                     (size_t)gtree->edge_count *
+                                                     sizeof(gnode_t *));
         sources[0] = sibling;
         if (father != gtree->root)
         {
@@ -4200,8 +4579,15 @@ static long propose_spr(locus_t * locus,
           }
         }
         /* get weights (log-L) for each source */
-        double * sweight = (double *)xmalloc(source_count * sizeof(double));
-        rev_spr_tselect(curnode, father->time, sources, source_count, locus, sweight);
+        double * sweight = (double *)arena_alloc(thread_index,
+                                                 source_count * sizeof(double));
+        rev_spr_tselect(curnode,
+                        father->time,
+                        sources,
+                        source_count,
+                        locus,
+                        sweight,
+                        thread_index);
 
         /* turn log-L weights into probabilities */
         double maxw = sweight[0];
@@ -4216,9 +4602,6 @@ static long propose_spr(locus_t * locus,
         }
 
         swgt = sweight[0] / sum;
-
-        free(sources);
-        free(sweight);
       }
       else
       {
@@ -4244,8 +4627,15 @@ static long propose_spr(locus_t * locus,
       /* randomly select a target node */
       if (opt_rev_gspr)
       {
-        double * tweight = (double *)xmalloc(target_count * sizeof(double));
-        rev_spr_tselect(curnode, tnew, travbuffer, target_count, locus, tweight);
+        double * tweight = (double *)arena_alloc(thread_index,
+                                                 target_count * sizeof(double));
+        rev_spr_tselect(curnode,
+                        tnew,
+                        travbuffer,
+                        target_count,
+                        locus,
+                        tweight,
+                        thread_index);
         double maxw = tweight[0];
         for (j = 1; j < target_count; ++j)
           if (maxw < tweight[j])
@@ -4269,8 +4659,6 @@ static long propose_spr(locus_t * locus,
 
         /* proposal distribution */
         twgt = tweight[j] / sum;
-
-        free(tweight);
       }
       else
         target = travbuffer[(int)(target_count * legacy_rndu(thread_index))];
@@ -4279,10 +4667,11 @@ static long propose_spr(locus_t * locus,
     if (opt_msci)
     {
       /* Save old flags for the three nodes, to be used for rollback */
-      old_hpath_y = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-      old_hpath_a = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-      old_hpath_s = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-      old_hpath_t = (int *)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
+      size_t hpath_size = (size_t)(stree->hybrid_count)*sizeof(int);
+      old_hpath_y = (int *)arena_alloc(thread_index,hpath_size);
+      old_hpath_a = (int *)arena_alloc(thread_index,hpath_size);
+      old_hpath_s = (int *)arena_alloc(thread_index,hpath_size);
+      old_hpath_t = (int *)arena_alloc(thread_index,hpath_size);
 
       memcpy(old_hpath_y, father->hpath,  stree->hybrid_count*sizeof(int));
       memcpy(old_hpath_a, curnode->hpath, stree->hybrid_count*sizeof(int));
@@ -4953,18 +5342,16 @@ static long propose_spr(locus_t * locus,
         assert(target->hpath[0] == old_hpath_t[0]);
       }
     }
-
-    /* delete rollback */
-    if (opt_msci)
-    {
-      free(old_hpath_y);
-      free(old_hpath_a);
-      free(old_hpath_s);
-      free(old_hpath_t);
-    }
   }
-  if (opt_exp_randomize)
-    free(indices);
+
+  /* each locus is handled by a single thread */
+  if (opt_finetune_adapt)
+    adapt_update(&(locus->finetune_gtspr),
+                 BPP_MOVE_GTSPR_INDEX,
+                 accepted,
+                 gtree->edge_count);
+
+  arena_release(thread_index,scratch);
   return accepted;
 }
 
@@ -5055,13 +5442,17 @@ void gtree_propose_spr_parallel(locus_t ** locus,
   *p_accepted = accepted;
 }
 
-static long prop_locusrate(gtree_t ** gtree,
-                           stree_t * stree,
-                           locus_t ** locus,
-                           long thread_index)
+/* propose new rates for loci i and ref, keeping their sum constant, and
+   accept or reject. Only the data of the two loci are modified, such that
+   pairs of disjoint loci can be processed concurrently */
+static long prop_locusrate_pair(gtree_t ** gtree,
+                                stree_t * stree,
+                                locus_t ** locus,
+                                long i,
+                                long ref,
+                                long thread_index)
 {
-  long i,j;
-  long ref;
+  long j;
   long accepted = 0;
   double lnacceptance; 
   double new_locrate;
@@ -5082,64 +5473,129 @@ static long prop_locusrate(gtree_t ** gtree,
      For relaxed clock, this changes mu_i, and consequently changes the rate
      prior but not the likelihood (with the exception of the correlated model)*/
 
-  /* set reference locus as the one with the highest number of site patterns */
-  for (i = 1, ref = 0; i < opt_locus_count; ++i)
-    if (locus[i]->sites > locus[ref]->sites)
-      ref = i;
+  if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
+  {
+    refnodes = gtree[ref]->nodes;
+    for (j = 0; j < gtree[ref]->tip_count + gtree[ref]->inner_count; ++j)
+      if (refnodes[j]->parent)
+        SWAP_PMAT_INDEX(gtree[ref]->edge_count, refnodes[j]->pmatrix_index);
+
+    locnodes = gtree[i]->nodes;
+    for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
+      if (locnodes[j]->parent)
+        SWAP_PMAT_INDEX(gtree[i]->edge_count,locnodes[j]->pmatrix_index);
+  }
 
-  for (i = 0; i < opt_locus_count; ++i)
+  old_locrate = gtree[i]->rate_mui;
+  old_refrate = gtree[ref]->rate_mui;
+
+
+  double r = old_locrate + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
+  new_locrate = reflect(r, 0, old_locrate + old_refrate, thread_index);
+  new_refrate = gtree[ref]->rate_mui - (new_locrate - old_locrate);
+
+  gtree[i]->rate_mui   = new_locrate;
+  gtree[ref]->rate_mui = new_refrate;
+
+  lnacceptance = (opt_mui_alpha - 1) *
+                 log((new_locrate*new_refrate) / (old_locrate*old_refrate));
+
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
   {
-    if (i == ref) continue;
+    /* relaxed clock */
 
-    if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
+    if (opt_clock == BPP_CLOCK_CORR)
     {
-      refnodes = gtree[ref]->nodes;
-      for (j = 0; j < gtree[ref]->tip_count + gtree[ref]->inner_count; ++j)
-        if (refnodes[j]->parent)
-          SWAP_PMAT_INDEX(gtree[ref]->edge_count, refnodes[j]->pmatrix_index);
-
-      locnodes = gtree[i]->nodes;
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-        if (locnodes[j]->parent)
-          SWAP_PMAT_INDEX(gtree[i]->edge_count,locnodes[j]->pmatrix_index);
+      stree->root->brate[i] = new_locrate;
+      stree->root->brate[ref] = new_refrate;
     }
+    new_locprior = lnprior_rates(gtree[i],stree,i);
+    new_refprior = lnprior_rates(gtree[ref],stree,ref);
 
-    old_locrate = gtree[i]->rate_mui;
-    old_refrate = gtree[ref]->rate_mui;
+    lnacceptance += new_locprior - gtree[i]->lnprior_rates +
+                    new_refprior - gtree[ref]->lnprior_rates;
+  }
+
+  if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
+  {
+    /* update selected locus */
+    locus_update_all_matrices(locus[i],gtree[i],stree,i);
+
+    gnodeptr = gtree[i]->nodes;
+    for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
+    {
+      gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
+                                              gnodeptr[j]->clv_index);
+      if (opt_scaling)
+        gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
+                                                      gnodeptr[j]->scaler_index);
+    }
 
+    locus_update_all_partials(locus[i],gtree[i]);
 
-    double r = old_locrate + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
-    new_locrate = reflect(r, 0, old_locrate + old_refrate, thread_index);
-    new_refrate = gtree[ref]->rate_mui - (new_locrate - old_locrate);
+    /* update reference locus */
+    locus_update_all_matrices(locus[ref],gtree[ref],stree,ref);
 
-    gtree[i]->rate_mui   = new_locrate;
-    gtree[ref]->rate_mui = new_refrate;
+    gnodeptr = gtree[ref]->nodes;
+    for (j = gtree[ref]->tip_count; j < gtree[ref]->tip_count+gtree[ref]->inner_count; ++j)
+    {
+      gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[ref]->tip_count,
+                                              gnodeptr[j]->clv_index);
+      if (opt_scaling)
+         gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
+                                                      gnodeptr[j]->scaler_index);
+    }
+    locus_update_all_partials(locus[ref],gtree[ref]);
+
+    loc_logl = locus_root_loglikelihood(locus[i],
+                                        gtree[i]->root,
+                                        locus[i]->param_indices,
+                                        NULL);
+    ref_logl = locus_root_loglikelihood(locus[ref],
+                                        gtree[ref]->root,
+                                        locus[ref]->param_indices,
+                                        NULL);
+
+    lnacceptance += loc_logl - gtree[i]->logl + ref_logl - gtree[ref]->logl;
+  }
 
-    lnacceptance = (opt_mui_alpha - 1) *
-                   log((new_locrate*new_refrate) / (old_locrate*old_refrate));
+  if (opt_debug_mui)
+    fprintf(stdout, "[Debug] (locusrate) lnacceptance = %f\n", lnacceptance);
 
+  if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
+  {
+    /* accept */
+    accepted = 1;
 
+    if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
+    {
+      /* update log-L */
+      gtree[i]->logl = loc_logl;
+      gtree[ref]->logl = ref_logl;
+    }
     if (opt_clock != BPP_CLOCK_GLOBAL)
     {
-      /* relaxed clock */
-
-      if (opt_clock == BPP_CLOCK_CORR)
-      {
-        stree->root->brate[i] = new_locrate;
-        stree->root->brate[ref] = new_refrate;
-      }
-      new_locprior = lnprior_rates(gtree[i],stree,i);
-      new_refprior = lnprior_rates(gtree[ref],stree,ref);
+      /* update prior */
+      gtree[i]->lnprior_rates   = new_locprior;
+      gtree[ref]->lnprior_rates = new_refprior;
+    }
+  }
+  else
+  {
+    /* reject */
+    gtree[i]->rate_mui   = old_locrate;
+    gtree[ref]->rate_mui = old_refrate;
 
-      lnacceptance += new_locprior - gtree[i]->lnprior_rates +
-                      new_refprior - gtree[ref]->lnprior_rates;
+    if (opt_clock == BPP_CLOCK_CORR)
+    {
+      stree->root->brate[i] = old_locrate;
+      stree->root->brate[ref] = old_refrate;
     }
 
     if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
     {
-      /* update selected locus */
-      locus_update_all_matrices(locus[i],gtree[i],stree,i);
-
+      /* reset selected locus */
       gnodeptr = gtree[i]->nodes;
       for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
       {
@@ -5150,109 +5606,61 @@ static long prop_locusrate(gtree_t ** gtree,
                                                         gnodeptr[j]->scaler_index);
       }
 
-      locus_update_all_partials(locus[i],gtree[i]);
-
-      /* update reference locus */
-      locus_update_all_matrices(locus[ref],gtree[ref],stree,ref);
-
+      /* reset reference locus */
       gnodeptr = gtree[ref]->nodes;
       for (j = gtree[ref]->tip_count; j < gtree[ref]->tip_count+gtree[ref]->inner_count; ++j)
       {
         gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[ref]->tip_count,
                                                 gnodeptr[j]->clv_index);
         if (opt_scaling)
-           gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
+          gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
                                                         gnodeptr[j]->scaler_index);
       }
-      locus_update_all_partials(locus[ref],gtree[ref]);
-
-      loc_logl = locus_root_loglikelihood(locus[i],
-                                          gtree[i]->root,
-                                          locus[i]->param_indices,
-                                          NULL);
-      ref_logl = locus_root_loglikelihood(locus[ref],
-                                          gtree[ref]->root,
-                                          locus[ref]->param_indices,
-                                          NULL);
-
-      lnacceptance += loc_logl - gtree[i]->logl + ref_logl - gtree[ref]->logl;
+      
+      for (j = 0; j < gtree[ref]->tip_count + gtree[ref]->inner_count; ++j)
+        if (refnodes[j]->parent)
+          SWAP_PMAT_INDEX(gtree[ref]->edge_count,refnodes[j]->pmatrix_index);
+      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
+        if (locnodes[j]->parent)
+          SWAP_PMAT_INDEX(gtree[i]->edge_count,locnodes[j]->pmatrix_index);
     }
+  }
+  return accepted;
+}
 
-    if (opt_debug_mui)
-      fprintf(stdout, "[Debug] (locusrate) lnacceptance = %f\n", lnacceptance);
-
-    if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
-    {
-      /* accept */
-      accepted++;
-
-      if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
-      {
-        /* update log-L */
-        gtree[i]->logl = loc_logl;
-        gtree[ref]->logl = ref_logl;
-      }
-      if (opt_clock != BPP_CLOCK_GLOBAL)
-      {
-        /* update prior */
-        gtree[i]->lnprior_rates   = new_locprior;
-        gtree[ref]->lnprior_rates = new_refprior;
-      }
-    }
-    else
-    {
-      /* reject */
-      gtree[i]->rate_mui   = old_locrate;
-      gtree[ref]->rate_mui = old_refrate;
+static long prop_locusrate(gtree_t ** gtree,
+                           stree_t * stree,
+                           locus_t ** locus,
+                           long thread_index)
+{
+  long i;
+  long ref;
+  long accepted = 0;
 
-      if (opt_clock == BPP_CLOCK_CORR)
-      {
-        stree->root->brate[i] = old_locrate;
-        stree->root->brate[ref] = old_refrate;
-      }
+  /* set reference locus as the one with the highest number of site patterns */
+  for (i = 1, ref = 0; i < opt_locus_count; ++i)
+    if (locus[i]->sites > locus[ref]->sites)
+      ref = i;
 
-      if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
-      {
-        /* reset selected locus */
-        gnodeptr = gtree[i]->nodes;
-        for (j = gtree[i]->tip_count; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-        {
-          gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[i]->tip_count,
-                                                  gnodeptr[j]->clv_index);
-          if (opt_scaling)
-            gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[i]->tip_count,
-                                                          gnodeptr[j]->scaler_index);
-        }
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    if (i == ref) continue;
 
-        /* reset reference locus */
-        gnodeptr = gtree[ref]->nodes;
-        for (j = gtree[ref]->tip_count; j < gtree[ref]->tip_count+gtree[ref]->inner_count; ++j)
-        {
-          gnodeptr[j]->clv_index = SWAP_CLV_INDEX(gtree[ref]->tip_count,
-                                                  gnodeptr[j]->clv_index);
-          if (opt_scaling)
-            gnodeptr[j]->scaler_index = SWAP_SCALER_INDEX(gtree[ref]->tip_count,
-                                                          gnodeptr[j]->scaler_index);
-        }
-        
-        for (j = 0; j < gtree[ref]->tip_count + gtree[ref]->inner_count; ++j)
-          if (refnodes[j]->parent)
-            SWAP_PMAT_INDEX(gtree[ref]->edge_count,refnodes[j]->pmatrix_index);
-        for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-          if (locnodes[j]->parent)
-            SWAP_PMAT_INDEX(gtree[i]->edge_count,locnodes[j]->pmatrix_index);
-      }
-    }
+    accepted += prop_locusrate_pair(gtree,stree,locus,i,ref,thread_index);
   }
   return accepted;
 }
 
-static long prop_heredity(gtree_t ** gtree,
-                          stree_t * stree,
-                          locus_t ** locus,
-                          long thread_index)
+/* propose a new heredity scaler for locus i. When theta is estimated only
+   the data of locus i are modified, such that loci can be processed
+   concurrently */
+static long prop_heredity_locus(gtree_t ** gtree,
+                                stree_t * stree,
+                                locus_t ** locus,
+                                long i,
+                                long thread_index)
 {
-  long i,j;
+  long j;
   long accepted = 0;
   double hnew,hold;
   double lnacceptance;
@@ -5260,82 +5668,147 @@ static long prop_heredity(gtree_t ** gtree,
 
   double hfactor = 0;
 
-  for (i = 0; i < opt_locus_count; ++i)
-  {
-    if (!opt_est_theta)
-      logpr = stree->notheta_logpr;
+  if (!opt_est_theta)
+    logpr = stree->notheta_logpr;
 
 
-    hold = locus[i]->heredity[0];
-    hnew = hold + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
-    if (hnew < 0) hnew *= -1;
-    
-    locus[i]->heredity[0] = hnew;
-    lnacceptance = (opt_heredity_alpha-1)*log(hnew/hold) -
-                   opt_heredity_beta*(hnew-hold);
+  hold = locus[i]->heredity[0];
+  hnew = hold + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
+  if (hnew < 0) hnew *= -1;
+  
+  locus[i]->heredity[0] = hnew;
+  lnacceptance = (opt_heredity_alpha-1)*log(hnew/hold) -
+                 opt_heredity_beta*(hnew-hold);
 
-    if (opt_est_theta)
-      logpr = gtree_logprob(stree,locus[i]->heredity[0],i, thread_index);
-    else
+  if (opt_est_theta)
+    logpr = gtree_logprob(stree,locus[i]->heredity[0],i, thread_index);
+  else
+  {
+    for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
     {
-      for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
-      {
-        logpr -= stree->nodes[j]->notheta_logpr_contrib;
-        logpr += gtree_update_logprob_contrib(stree->nodes[j],locus[i]->heredity[0],i,thread_index);
-      }
+      logpr -= stree->nodes[j]->notheta_logpr_contrib;
+      logpr += gtree_update_logprob_contrib(stree->nodes[j],locus[i]->heredity[0],i,thread_index);
     }
+  }
 
-    /* TODO: Perhaps we can avoid the check every 100-th term by using the log
-       of heredity scaler from the beginning. E.g. if this loop is replaced by
-       
-       for (j = 0; j < opt_locus_count; ++j)
-         logpr -= log(locus[j]->heredity[0]);
+  /* TODO: Perhaps we can avoid the check every 100-th term by using the log
+     of heredity scaler from the beginning. E.g. if this loop is replaced by
+     
+     for (j = 0; j < opt_locus_count; ++j)
+       logpr -= log(locus[j]->heredity[0]);
 
-       then we only need to add and subtract the two corresponding heredity
-       multipliers (the old and new)
-    */
-    if (!opt_est_theta)
-    {
-      hfactor = 0;
-      for (j = 0; j < opt_locus_count; ++j)
-        hfactor -= (gtree[j]->tip_count-1)*log(locus[j]->heredity[0]);
-      logpr += hfactor - stree->notheta_hfactor;
-    }
+     then we only need to add and subtract the two corresponding heredity
+     multipliers (the old and new)
+  */
+  if (!opt_est_theta)
+  {
+    hfactor = 0;
+    for (j = 0; j < opt_locus_count; ++j)
+      hfactor -= (gtree[j]->tip_count-1)*log(locus[j]->heredity[0]);
+    logpr += hfactor - stree->notheta_hfactor;
+  }
+
+  if (opt_est_theta)
+    lnacceptance += logpr - gtree[i]->logpr;
+  else
+    lnacceptance += logpr - stree->notheta_logpr;
+
+  if (opt_debug_hs)
+    fprintf(stdout, "[Debug] (heredity) lnacceptance = %f\n", lnacceptance);
+  if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
+  {
+    /* accepted */
+    accepted = 1;
 
     if (opt_est_theta)
-      lnacceptance += logpr - gtree[i]->logpr;
+      gtree[i]->logpr = logpr;
     else
-      lnacceptance += logpr - stree->notheta_logpr;
-
-    if (opt_debug_hs)
-      fprintf(stdout, "[Debug] (heredity) lnacceptance = %f\n", lnacceptance);
-    if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
     {
-      /* accepted */
-      accepted++;
-
+      stree->notheta_logpr = logpr;
+      stree->notheta_hfactor = hfactor;
+    }
+  }
+  else
+  {
+    /* rejected */
+    locus[i]->heredity[0] = hold;
+    for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+    {
       if (opt_est_theta)
-        gtree[i]->logpr = logpr;
+        stree->nodes[j]->logpr_contrib[i] = stree->nodes[j]->old_logpr_contrib[i];
       else
-      {
-        stree->notheta_logpr = logpr;
-        stree->notheta_hfactor = hfactor;
-      }
+        logprob_revert_notheta(stree->nodes[j],i);
     }
-    else
+  }
+  return accepted;
+}
+
+static long prop_heredity(gtree_t ** gtree,
+                          stree_t * stree,
+                          locus_t ** locus,
+                          long thread_index)
+{
+  long i;
+  long accepted = 0;
+
+  for (i = 0; i < opt_locus_count; ++i)
+    accepted += prop_heredity_locus(gtree,stree,locus,i,thread_index);
+
+  return accepted;
+}
+
+/* Locus rate and heredity proposals of the loci assigned to one worker. Locus
+   rates are proposed on the disjoint pairs of loci of a random perfect
+   matching. Each pair is proposed by the thread owning its first locus, such
+   that one of the two loci is always in the memory of the thread; as the
+   matching is random, the expected number of pairs of a thread is half its
+   number of loci. Heredity scalers are proposed
+   for the loci of the thread (multiple threads require estimated theta, hence
+   the MSC density of each locus is independent). The two moves modify
+   different quantities (rate, likelihood and rate prior, versus heredity and
+   MSC density), hence a thread may propose a heredity scaler for a locus whose
+   rate is being proposed by another thread */
+void prop_locusrate_and_heredity_parallel(gtree_t ** gtree,
+                                          stree_t * stree,
+                                          locus_t ** locus,
+                                          unsigned int * pairs,
+                                          long pair_count,
+                                          long locus_start,
+                                          long locus_count,
+                                          long thread_index,
+                                          long * p_proposal_count,
+                                          long * p_accepted)
+{
+  long i;
+  long proposal_count = 0;
+  long accepted = 0;
+
+  if (opt_est_locusrate == MUTRATE_ESTIMATE)
+  {
+    for (i = 0; i < pair_count; ++i)
     {
-      /* rejected */
-      locus[i]->heredity[0] = hold;
-      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-      {
-        if (opt_est_theta)
-          stree->nodes[j]->logpr_contrib[i] = stree->nodes[j]->old_logpr_contrib[i];
-        else
-          logprob_revert_notheta(stree->nodes[j],i);
-      }
+      if (pairs[2*i] < locus_start || pairs[2*i] >= locus_start+locus_count)
+        continue;
+
+      accepted += prop_locusrate_pair(gtree,
+                                      stree,
+                                      locus,
+                                      pairs[2*i],
+                                      pairs[2*i+1],
+                                      thread_index);
+      ++proposal_count;
     }
   }
-  return accepted;
+
+  if (opt_est_heredity == HEREDITY_ESTIMATE)
+  {
+    for (i = locus_start; i < locus_start+locus_count; ++i)
+      accepted += prop_heredity_locus(gtree,stree,locus,i,thread_index);
+    proposal_count += locus_count;
+  }
+
+  *p_proposal_count = proposal_count;
+  *p_accepted = accepted;
 }
 
 double prop_locusrate_and_heredity(gtree_t ** gtree,
@@ -5346,6 +5819,40 @@ double prop_locusrate_and_heredity(gtree_t ** gtree,
   long accepted = 0;
   double divisor = 0;
 
+  if (opt_threads > 1)
+  {
+    long i;
+    thread_data_t tp;
+
+    tp.gtree = gtree;
+    tp.stree = stree;
+    tp.locus = locus;
+    tp.pairs = NULL;
+    tp.pair_count = 0;
+
+    /* random perfect matching of loci into disjoint pairs. The matching does
+       not depend on the current state, and each pair move preserves the
+       posterior, hence so does their composition */
+    if (opt_est_locusrate == MUTRATE_ESTIMATE)
+    {
+      if (!lrht_pairs)
+        lrht_pairs = (unsigned int *)xmalloc((size_t)opt_locus_count *
+                                             sizeof(unsigned int));
+      for (i = 0; i < opt_locus_count; ++i)
+        lrht_pairs[i] = (unsigned int)i;
+      shuffle(lrht_pairs,(unsigned int)opt_locus_count,thread_index);
+
+      tp.pairs = lrht_pairs;
+      tp.pair_count = opt_locus_count / 2;
+    }
+    threads_wakeup(THREAD_WORK_LRHT,&tp);
+
+    accepted = tp.accepted;
+    divisor = tp.proposals;
+
+    return (accepted / divisor);
+  }
+
   if (opt_est_locusrate == MUTRATE_ESTIMATE)
     accepted = prop_locusrate(gtree,stree,locus,thread_index);
 
@@ -49,15 +49,11 @@ unsigned long hash_fnv(char * s)
   return hash;
 }
 
-static ht_item_t * hashitem_create(unsigned long key, void * value)
-{
-  ht_item_t * hi = (ht_item_t *)xmalloc(sizeof(ht_item_t));
-  
-  hi->key   = key;
-  hi->value = value;
-
-  return hi;
-}
+/* Open-addressing hash table with linear probing. Items are stored in a flat
+   array in insertion order, while the (power of two sized) slot array holds
+   the cached hash of each item together with its position in the item array.
+   Probing therefore only touches the slot array until the hashes match, and
+   the table doubles in size whenever it becomes half full. */
 
 int hashtable_strcmp(void * x, void * y)
 {
@@ -69,22 +65,60 @@ int hashtable_ptrcmp(void * x, void * y)
   return (x == y);
 }
 
+static void hashtable_rehash(hashtable_t * ht, unsigned long size)
+{
+  unsigned long i,j;
+  unsigned long mask = size-1;
+
+  free(ht->slots);
+  ht->slots = (ht_slot_t *)xcalloc(size,sizeof(ht_slot_t));
+  ht->table_size = size;
+
+  /* re-insert all items in insertion order; no comparisons required */
+  for (i = 0; i < ht->entries_count; ++i)
+  {
+    j = ht->entries[i].key & mask;
+    while (ht->slots[j].index)
+      j = (j+1) & mask;
+
+    ht->slots[j].key   = ht->entries[i].key;
+    ht->slots[j].index = i+1;
+  }
+}
+
+static void hashtable_grow(hashtable_t * ht)
+{
+  /* keep load factor at most 0.5 */
+  if ((ht->entries_count+1) << 1 > ht->table_size)
+    hashtable_rehash(ht, ht->table_size << 1);
+
+  if (ht->entries_count == ht->entries_alloc)
+  {
+    ht->entries_alloc <<= 1;
+    ht->entries = (ht_item_t *)xrealloc(ht->entries,
+                                        ht->entries_alloc*sizeof(ht_item_t));
+  }
+}
+
 void * hashtable_find(hashtable_t * ht,
                       void * x,
                       unsigned long hash,
                       int (*cb_cmp)(void *, void *))
 {
-  unsigned long index = hash & (ht->table_size-1);
-  list_item_t * li = (list_item_t *)(ht->entries[index]->head);
+  unsigned long mask = ht->table_size-1;
+  unsigned long index = hash & mask;
+  ht_slot_t * slots = ht->slots;
 
-  while (li)
+  while (slots[index].index)
   {
-    ht_item_t * hi = (ht_item_t *)(li->data);
+    if (slots[index].key == hash)
+    {
+      ht_item_t * hi = ht->entries + slots[index].index - 1;
+      if (cb_cmp(hi->value, x))
+        return hi->value;
+    }
 
-    if ((hash == hi->key) && cb_cmp(hi->value, x))
-      return hi->value;
-    
-    li = li->next; 
+    index = (index+1) & mask;
   }
 
   return NULL;
@@ -93,8 +127,7 @@ void * hashtable_find(hashtable_t * ht,
 
 hashtable_t * hashtable_create(unsigned long items_count)
 {
-  unsigned long i;
-  unsigned long size = 1;
+  unsigned long size = 2;
 
   if (!items_count) return NULL;
 
@@ -110,66 +143,70 @@ hashtable_t * hashtable_create(unsigned long items_count)
   hashtable_t * ht = (hashtable_t *)xmalloc(sizeof(hashtable_t));
   ht->table_size = size;
   ht->entries_count = 0;
+  ht->entries_alloc = size >> 1;
 
-  /* allocate and init entries array */
-  ht->entries = (list_t **)xmalloc(size*sizeof(list_t *));
-  for (i = 0; i < size; ++i)
-  {
-    ht->entries[i] = (list_t *)xmalloc(sizeof(list_t));
-    memset(ht->entries[i], 0, sizeof(list_t));
-  }
+  /* allocate slots and item array */
+  ht->slots = (ht_slot_t *)xcalloc(size,sizeof(ht_slot_t));
+  ht->entries = (ht_item_t *)xmalloc(ht->entries_alloc*sizeof(ht_item_t));
 
   return ht;
 }
 
+void hashtable_insert_force(hashtable_t * ht,
+                            void * x,
+                            unsigned long hash)
+{
+  unsigned long mask;
+  unsigned long index;
+
+  hashtable_grow(ht);
+
+  mask = ht->table_size-1;
+  index = hash & mask;
+  while (ht->slots[index].index)
+    index = (index+1) & mask;
+
+  ht->entries[ht->entries_count].key   = hash;
+  ht->entries[ht->entries_count].value = x;
+
+  ht->slots[index].key   = hash;
+  ht->slots[index].index = ++ht->entries_count;
+}
+
 int hashtable_insert(hashtable_t * ht,
                      void * x,
                      unsigned long hash,
                      int (*cb_cmp)(void *, void *))
 {
-  /* size is always a multiple of 2 and greater than 2 */
-  unsigned long index = hash & (ht->table_size-1);
-
-  list_t * list = ht->entries[index];
-
-
   if (hashtable_find(ht, x, hash, cb_cmp))
     return 0;
 
-  ht_item_t * item = hashitem_create(hash,x);
-  list_append(list, item);
-
-  ht->entries_count++;
+  hashtable_insert_force(ht,x,hash);
 
   return 1;
 }
 
+/* return the next item (in insertion order) starting from position *pos, and
+   advance *pos. Returns NULL when all items have been visited. Start with
+   *pos = 0 */
+void * hashtable_iterate(hashtable_t * ht, unsigned long * pos)
+{
+  if (*pos >= ht->entries_count)
+    return NULL;
+
+  return ht->entries[(*pos)++].value;
+}
+
 void hashtable_destroy(hashtable_t * ht, void (*cb_dealloc)(void *))
 {
   unsigned long i;
 
   if (cb_dealloc)
-  {
-    for (i = 0; i < ht->table_size; ++i)
-    {
-      list_t * list = ht->entries[i];
-      
-      list_item_t * head = list->head;
-      while (head)
-      {
-        ht_item_t * hi = (ht_item_t *)(head->data);
-        cb_dealloc(hi->value);
-        head = head->next;
-      }
-    }
-  }
+    for (i = 0; i < ht->entries_count; ++i)
+      cb_dealloc(ht->entries[i].value);
 
-  for (i = 0; i < ht->table_size; ++i)
-  {
-    list_clear(ht->entries[i], free);
-    free(ht->entries[i]);
-  }
   free(ht->entries);
+  free(ht->slots);
   free(ht); 
 }
 
@@ -180,18 +217,3 @@ int cb_cmp_pairlabel(void * a, void * b)
 
   return (!strcmp(pair->label,label));
 }
-
-void hashtable_insert_force(hashtable_t * ht,
-                            void * x,
-                            unsigned long hash)
-{
-  /* size is always a multiple of 2 and greater than 2 */
-  unsigned long index = hash & (ht->table_size-1);
-
-  list_t * list = ht->entries[index];
-
-  ht_item_t * item = hashitem_create(hash,x);
-  list_append(list, item);
-
-  ht->entries_count++;
-}
@@ -37,6 +37,95 @@ static stree_t * stree;
 static gtree_t ** gtree;
 static locus_t ** locus;
 
+/* per-locus data are stored in the original order of the loci; slot[k] is
+   the position of the k-th locus in the thread layout of the resumed run */
+static long * slot = NULL;
+
+/* threads and random number streams of the run that wrote the checkpoint */
+static long chk_threads;
+static long chk_site_threads;
+static unsigned int * chk_rng = NULL;
+
+static int load_loci(void * x, size_t size, FILE * fp)
+{
+  long k;
+
+  for (k = 0; k < opt_locus_count; ++k)
+    if (fread((char *)x + slot[k]*size, size, 1, fp) != 1)
+      return 0;
+
+  return 1;
+}
+
+#define LOAD_LOCI(x,fp) load_loci((x),sizeof(*(x)),fp)
+
+/* move an array read in the original order of the loci to the layout */
+static void place_loci(void * x, size_t size)
+{
+  long k;
+  char * tmp = (char *)xmalloc((size_t)opt_locus_count * size);
+
+  memcpy(tmp, x, (size_t)opt_locus_count * size);
+  for (k = 0; k < opt_locus_count; ++k)
+    memcpy((char *)x + slot[k]*size, tmp + k*size, size);
+  free(tmp);
+}
+
+/* Distribute the loci to the threads of the resumed run. The number of
+   threads and the load balancing scheme of the checkpoint are used unless
+   given on the command line (--threads, --loadbalance); with the same
+   settings the layout and the random number streams are those of the
+   original run, which then continues exactly as if it had not been stopped */
+static void load_thread_layout(const long * load)
+{
+  long i;
+  long * indices;
+  unsigned int * rng;
+
+  if (opt_threads_override)
+  {
+    threads_split(opt_threads_override);
+
+    /* explicit thread slots refer to the machine of the original run */
+    if (opt_threads + opt_site_threads != chk_threads + chk_site_threads)
+      opt_threads_start = opt_threads_step = 0;
+  }
+  if (opt_load_balance_override >= 0)
+    opt_load_balance = opt_load_balance_override;
+
+  if (opt_threads != chk_threads || opt_site_threads != chk_site_threads)
+    fprintf(stdout, "Resuming with %ld threads (checkpoint written with %ld)\n\n",
+            opt_threads + opt_site_threads, chk_threads + chk_site_threads);
+
+  slot = (long *)xmalloc((size_t)opt_locus_count * sizeof(long));
+  for (i = 0; i < opt_locus_count; ++i)
+    slot[i] = i;
+
+  if (opt_threads > 1)
+  {
+    indices = threads_layout(load);
+    if (indices)
+    {
+      for (i = 0; i < opt_locus_count; ++i)
+        slot[indices[i]] = i;
+      free(indices);
+    }
+
+    /* Pin master thread for NUMA first touch policy */
+    threads_pin_master();
+  }
+
+  /* one random number stream per thread; additional threads continue the
+     stream of thread i mod chk_threads (as in legacy_init(), which seeds all
+     streams with the same value) */
+  rng = (unsigned int *)xmalloc((size_t)opt_threads * sizeof(unsigned int));
+  for (i = 0; i < opt_threads; ++i)
+    rng[i] = chk_rng[i % chk_threads];
+  set_legacy_rndu_array(rng);
+  free(chk_rng);
+  chk_rng = NULL;
+}
+
 static void alloc_gtree()
 {
   long i,j;
@@ -128,7 +217,8 @@ void load_chk_header(FILE * fp)
   if (memcmp(magic,BPP_MAGIC,BPP_MAGIC_BYTES))
     fatal("File %s is not a BPP checkpoint file...", opt_resume);
 
-  if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) || (version_patch != VERSION_PATCH))
+  if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) ||
+      (version_patch != VERSION_PATCH) || (version_chkp != VERSION_CHKP))
     fatal("Incompatible CHKP: Checkpoint file version %ld, BPP version %ld",
           version_chkp, VERSION_CHKP);
 
@@ -161,17 +251,19 @@ void load_chk_header(FILE * fp)
     fatal("Cannot read first thread slot");
   if (!LOAD(&opt_threads_step,1,fp))
     fatal("Cannot read thread stepping");
-
-  /* Pin master thread for NUMA first touch policy */
-  if (opt_threads > 1)
-    threads_pin_master();
-
-  
-  unsigned int * rng = (unsigned int *)xmalloc((size_t)opt_threads *
-                                               sizeof(unsigned int));
-  if (!LOAD(rng,opt_threads,fp))
+  if (!LOAD(&opt_site_threads,1,fp))
+    fatal("Cannot read number of site threads");
+  if (!LOAD(&opt_lowmem,1,fp))
+    fatal("Cannot read low-memory mode flag");
+  if (!LOAD(&opt_site_repeats,1,fp))
+    fatal("Cannot read site repeats flag");
+
+  /* the thread layout is decided once the number of loci is known */
+  chk_threads = opt_threads;
+  chk_site_threads = opt_site_threads;
+  chk_rng = (unsigned int *)xmalloc((size_t)chk_threads * sizeof(unsigned int));
+  if (!LOAD(chk_rng,chk_threads,fp))
     fatal("Cannot read RNG states");
-  set_legacy_rndu_array(rng);
 
   if (!LOAD(&sections,1,fp))
     fatal("Cannot read number of sections");
@@ -540,6 +632,10 @@ static void load_chk_section_1(FILE * fp,
   /* read finetune */
   if (!LOAD(&opt_finetune_reset,1,fp))
     fatal("Cannot read 'finetune' tag");
+  if (!LOAD(&opt_finetune_adapt,1,fp))
+    fatal("Cannot read adaptive finetune flag");
+  if (!LOAD(&opt_hmc_steps,1,fp))
+    fatal("Cannot read number of HMC leapfrog steps");
   if (!LOAD(&opt_finetune_phi,1,fp))
     fatal("Cannot read gene tree phi finetune parameter");
   if (!LOAD(&opt_finetune_gtage,1,fp))
@@ -755,23 +851,32 @@ static void load_chk_section_1(FILE * fp,
   if (!LOAD(prec_logl,1,fp))
     fatal("Cannot read logL digits precision");
 
+  long ostats_count;
+  if (!LOAD(&ostats_count,1,fp))
+    fatal("Cannot read number of streaming summary columns");
+  if (ostats_count)
+  {
+    ostats_t * ostats = (ostats_t *)xmalloc((size_t)ostats_count *
+                                            sizeof(ostats_t));
+    if (!LOAD(ostats,ostats_count,fp))
+      fatal("Cannot read streaming summary accumulators");
+    ostats_set_cols(ostats,ostats_count);
+  }
+
   if (!LOAD(&opt_load_balance,1,fp))
     fatal("Cannot read load balance scheme");
 
-  if (opt_threads > 1)
-  {
-    thread_info_t * ti = (thread_info_t *)xmalloc((size_t)opt_threads *
-                                                  sizeof(thread_info_t));
-    for (i = 0; i < opt_threads; ++i)
-    {
-      thread_info_t * tip = ti+i;
-      if (!LOAD(&(tip->locus_first),1,fp))
-        fatal("Cannot load thread_info");
-      if (!LOAD(&(tip->locus_count),1,fp))
-        fatal("Cannot load thread_info");
-    }
-    threads_set_ti(ti);
-  }
+  /* read locus loads and distribute the loci to threads */
+  long * load = (long *)xmalloc((size_t)opt_locus_count * sizeof(long));
+  if (!LOAD(load,opt_locus_count,fp))
+    fatal("Cannot read locus loads");
+  load_thread_layout(load);
+  free(load);
+
+  if (opt_print_genetrees)
+    place_loci(*gtree_offset,sizeof(long));
+  if (opt_print_locusfile)
+    place_loci(*rates_offset,sizeof(long));
 
   #if 0
   fprintf(stdout, " Burnin: %ld\n", opt_burnin);
@@ -880,7 +985,7 @@ void load_chk_section_2(FILE * fp)
 {
   unsigned int total_nodes;
   unsigned int hoffset;
-  long i,j,k;
+  long i,j,k,l;
   unsigned int * hindices; 
 
   total_nodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
@@ -1040,6 +1145,15 @@ void load_chk_section_2(FILE * fp)
     if (!LOAD(&(stree->nodes[i]->tau),1,fp))
       fatal("Cannot read species nodes tau");
 
+  /* read adaptive finetune steps */
+  for (i = 0; i < total_nodes; ++i)
+  {
+    if (!LOAD(&(stree->nodes[i]->finetune_theta),1,fp))
+      fatal("Cannot read species nodes theta finetune step");
+    if (!LOAD(&(stree->nodes[i]->finetune_tau),1,fp))
+      fatal("Cannot read species nodes tau finetune step");
+  }
+
   /* read support */
   for (i = 0; i < total_nodes; ++i)
     if (!LOAD(&(stree->nodes[i]->support),1,fp))
@@ -1057,7 +1171,7 @@ void load_chk_section_2(FILE * fp)
 
   /* read number of coalescent events */
   for (i = 0; i < total_nodes; ++i)
-    if (!LOAD(stree->nodes[i]->event_count,opt_locus_count,fp))
+    if (!LOAD_LOCI(stree->nodes[i]->event_count,fp))
         fatal("Cannot read species event counts");
 
   /* read branch rates */
@@ -1074,7 +1188,7 @@ void load_chk_section_2(FILE * fp)
 
       snode_t * node = stree->nodes[i];
       node->brate = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
-      if (!LOAD(node->brate,opt_locus_count,fp))
+      if (!LOAD_LOCI(node->brate,fp))
         fatal("Cannot read branch rates");
     }
   }
@@ -1099,7 +1213,7 @@ void load_chk_section_2(FILE * fp)
 
     for (i = 0; i < total_nodes; ++i)
     {
-      if (!LOAD(stree->nodes[i]->t2h,opt_locus_count,fp))
+      if (!LOAD_LOCI(stree->nodes[i]->t2h,fp))
         fatal("Cannot read per-locus t2h contributions");
 
       if (!LOAD(&(stree->nodes[i]->t2h_sum),1,fp))
@@ -1128,9 +1242,9 @@ void load_chk_section_2(FILE * fp)
                                                            sizeof(double));
         x->hybrid->notheta_old_phi_contrib = (double *)xcalloc((size_t)opt_locus_count,
                                                                sizeof(double));
-        if (!LOAD(x->notheta_phi_contrib, opt_locus_count, fp))
+        if (!LOAD_LOCI(x->notheta_phi_contrib,fp))
           fatal("Cannot read per-locus phi contributions");
-        if (!LOAD(x->hybrid->notheta_phi_contrib, opt_locus_count, fp))
+        if (!LOAD_LOCI(x->hybrid->notheta_phi_contrib,fp))
           fatal("Cannot read per-locus phi contributions");
         if (!LOAD(&(x->hphi_sum),1,fp))
           fatal("Cannot read hphi sum");
@@ -1146,7 +1260,7 @@ void load_chk_section_2(FILE * fp)
 
   /* read number of incoming sequences for each node node */
   for (i = 0; i < total_nodes; ++i)
-    if (!LOAD(stree->nodes[i]->seqin_count,opt_locus_count,fp))
+    if (!LOAD_LOCI(stree->nodes[i]->seqin_count,fp))
         fatal("Cannot read incoming sequence counts");
 
   alloc_gtree();
@@ -1174,9 +1288,12 @@ void load_chk_section_2(FILE * fp)
     snode_t * snode = stree->nodes[i];
 
     for (j = 0; j < opt_locus_count; ++j)
-    {
       snode->event[j] = dlist_create();
 
+    for (l = 0; l < opt_locus_count; ++l)
+    {
+      j = slot[l];
+
       if (!LOAD(buffer,snode->event_count[j],fp))
         fatal("Cannot read coalescent events");
 
@@ -1357,7 +1474,7 @@ static void load_chk_section_3(FILE * fp, long msa_count)
 
   for (i = 0; i < msa_count; ++i)
   {
-    load_gene_tree(fp,i);
+    load_gene_tree(fp,slot[i]);
   }
 }
 
@@ -1517,6 +1634,35 @@ static void load_locus(FILE * fp, long index)
                                     sizeof(unsigned int));
     if (!LOAD(locus[index]->pattern_weights,locus[index]->unphased_length,fp))
       fatal("Cannot read pattern weights");
+
+    /* load unphased sites resolved by enumeration */
+    long phase_count;
+    if (!LOAD(&phase_count,1,fp))
+      fatal("Cannot read locus %ld enumerated sites", index);
+    if (phase_count)
+    {
+      size_t tips = locus[index]->tips;
+      phase_t * phase = (phase_t *)xmalloc(sizeof(phase_t));
+
+      phase->site_count = phase_count;
+      phase->site = (long *)xmalloc((size_t)phase_count * sizeof(long));
+      phase->het_offset = (long *)xmalloc((size_t)(phase_count+1) *
+                                          sizeof(long));
+      if (!LOAD(phase->site,phase_count,fp) ||
+          !LOAD(phase->het_offset,phase_count+1,fp))
+        fatal("Cannot read locus %ld enumerated sites", index);
+
+      phase->het_tip = (unsigned int *)xmalloc((size_t)
+                                               phase->het_offset[phase_count] *
+                                               sizeof(unsigned int));
+      phase->tipstate = (unsigned char *)xmalloc((size_t)phase_count * tips *
+                                                 sizeof(unsigned char));
+      if (!LOAD(phase->het_tip,phase->het_offset[phase_count],fp) ||
+          !LOAD(phase->tipstate,phase_count*tips,fp))
+        fatal("Cannot read locus %ld enumerated sites", index);
+
+      locus_set_phase(locus[index],phase);
+    }
   }
   else
   {
@@ -1536,6 +1682,33 @@ static void load_locus(FILE * fp, long index)
       fatal("Cannot read gene tree %ld tip CLV", index);
   }
 
+  /* load adaptive finetune step */
+  if (!LOAD(&(locus[index]->finetune_gtspr),1,fp))
+    fatal("Cannot read locus gene tree SPR finetune step");
+
+  /* load HMC step length, scales and moments of the current window */
+  if (opt_hmc_steps)
+  {
+    long hmc_dim = adapt_hmc_dim(stree);
+
+    locus[index]->hmc_scale = (double *)xmalloc((size_t)hmc_dim *
+                                                sizeof(double));
+    locus[index]->hmc_mean = (double *)xmalloc((size_t)hmc_dim *
+                                               sizeof(double));
+    locus[index]->hmc_m2 = (double *)xmalloc((size_t)hmc_dim * sizeof(double));
+
+    if (!LOAD(&(locus[index]->hmc_step),1,fp))
+      fatal("Cannot read locus HMC step length");
+    if (!LOAD(&(locus[index]->hmc_count),1,fp))
+      fatal("Cannot read locus HMC sample count");
+    if (!LOAD(locus[index]->hmc_scale,hmc_dim,fp))
+      fatal("Cannot read locus HMC scales");
+    if (!LOAD(locus[index]->hmc_mean,hmc_dim,fp))
+      fatal("Cannot read locus HMC means");
+    if (!LOAD(locus[index]->hmc_m2,hmc_dim,fp))
+      fatal("Cannot read locus HMC sums of squares");
+  }
+
   if (!LOAD(&(locus[index]->original_index),1,fp))
     fatal("Cannot read locus original index");
 }
@@ -1546,7 +1719,7 @@ void load_chk_section_4(FILE * fp)
 
   locus = (locus_t **)xmalloc((size_t)opt_locus_count * sizeof(locus_t));
   for (i = 0; i < opt_locus_count; ++i)
-    load_locus(fp,i);
+    load_locus(fp,slot[i]);
 
 }
 
@@ -1646,6 +1819,7 @@ int checkpoint_load(gtree_t *** gtreep,
   {
     gtree_reset_leaves(gtree[i]->root);
     locus_update_all_matrices(locus[i],gtree[i],stree,i);
+    locus_repeats_init(locus[i]);
     locus_update_all_partials(locus[i],gtree[i]);
 
     gtree[i]->logl = locus_root_loglikelihood(locus[i],
@@ -1662,6 +1836,9 @@ int checkpoint_load(gtree_t *** gtreep,
   #endif
   fclose(fp);
 
+  free(slot);
+  slot = NULL;
+
 
   *streep = stree;
   *gtreep = gtree;
@@ -55,6 +55,274 @@ static void gtree_all_partials(gnode_t * root,
   all_partials_recursive(root, trav_size, travbuffer);
 }
 
+/* Registry of substitution models shared among loci. Loci whose model,
+   frequencies and exchangeabilities are identical point to one copy of these
+   and of the eigen decomposition, which is computed once when the registry
+   is built. A locus gets its own copy before its parameters are changed for
+   the first time (e.g. when frequencies or rates are estimated). */
+
+static pthread_mutex_t model_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_model_arrays(unsigned int rate_matrices,
+                              double ** frequencies,
+                              double ** subst_params,
+                              int * eigen_decomp_valid,
+                              double ** eigenvecs,
+                              double ** inv_eigenvecs,
+                              double ** eigenvals)
+{
+  unsigned int i;
+
+  free(eigen_decomp_valid);
+
+  if (subst_params)
+    for (i = 0; i < rate_matrices; ++i)
+      pll_aligned_free(subst_params[i]);
+  free(subst_params);
+
+  if (eigenvecs)
+    for (i = 0; i < rate_matrices; ++i)
+      pll_aligned_free(eigenvecs[i]);
+  free(eigenvecs);
+
+  if (inv_eigenvecs)
+    for (i = 0; i < rate_matrices; ++i)
+      pll_aligned_free(inv_eigenvecs[i]);
+  free(inv_eigenvecs);
+
+  if (eigenvals)
+    for (i = 0; i < rate_matrices; ++i)
+      pll_aligned_free(eigenvals[i]);
+  free(eigenvals);
+
+  if (frequencies)
+    for (i = 0; i < rate_matrices; ++i)
+      pll_aligned_free(frequencies[i]);
+  free(frequencies);
+}
+
+static void model_release(model_shared_t * ms)
+{
+  long refcount;
+
+  pthread_mutex_lock(&model_shared_mutex);
+  refcount = --ms->refcount;
+  pthread_mutex_unlock(&model_shared_mutex);
+
+  if (refcount) return;
+
+  free_model_arrays(ms->rate_matrices,
+                    ms->frequencies,
+                    ms->subst_params,
+                    ms->eigen_decomp_valid,
+                    ms->eigenvecs,
+                    ms->inv_eigenvecs,
+                    ms->eigenvals);
+  free(ms);
+}
+
+static double ** clone_model_array(locus_t * locus,
+                                   double ** src,
+                                   size_t size)
+{
+  unsigned int i;
+  double ** dst;
+
+  dst = (double **)xcalloc(locus->rate_matrices,sizeof(double *));
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    dst[i] = pll_aligned_alloc(size * sizeof(double), locus->alignment);
+    if (!dst[i])
+      fatal("Unable to allocate enough memory.");
+    memcpy(dst[i], src[i], size * sizeof(double));
+  }
+
+  return dst;
+}
+
+static unsigned long model_hash(locus_t * locus)
+{
+  unsigned int i;
+  size_t j;
+  size_t params = (locus->states*locus->states - locus->states) / 2;
+  unsigned long h = 5381;
+  const unsigned char * p;
+
+  h = h*33 + locus->dtype;
+  h = h*33 + locus->model;
+  h = h*33 + locus->states;
+  h = h*33 + locus->rate_matrices;
+
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    p = (const unsigned char *)(locus->frequencies[i]);
+    for (j = 0; j < locus->states*sizeof(double); ++j)
+      h = h*33 + p[j];
+    p = (const unsigned char *)(locus->subst_params[i]);
+    for (j = 0; j < params*sizeof(double); ++j)
+      h = h*33 + p[j];
+  }
+
+  return h;
+}
+
+static int model_equal(model_shared_t * ms, locus_t * locus)
+{
+  unsigned int i;
+  size_t params = (locus->states*locus->states - locus->states) / 2;
+
+  if (ms->dtype != locus->dtype || ms->model != locus->model ||
+      ms->states != locus->states || ms->rate_matrices != locus->rate_matrices)
+    return 0;
+
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    if (memcmp(ms->frequencies[i],
+               locus->frequencies[i],
+               locus->states*sizeof(double)))
+      return 0;
+    if (memcmp(ms->subst_params[i],
+               locus->subst_params[i],
+               params*sizeof(double)))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Build the registry of shared models. Must be called while no other thread
+   accesses the loci, i.e. before the MCMC loop */
+void locus_share_models(locus_t ** locus, long locus_count)
+{
+  long i,j;
+  long entries_count = 0;
+  unsigned int k;
+  model_shared_t ** entries;
+  model_shared_t * ms;
+
+  if (!opt_usedata) return;
+
+  entries = (model_shared_t **)xmalloc((size_t)locus_count *
+                                       sizeof(model_shared_t *));
+
+  for (i = 0; i < locus_count; ++i)
+  {
+    locus_t * loc = locus[i];
+    unsigned long h;
+
+    if (loc->model_shared) continue;
+
+    h = model_hash(loc);
+    for (j = 0; j < entries_count; ++j)
+      if (entries[j]->hash == h && model_equal(entries[j],loc))
+        break;
+
+    if (j < entries_count)
+    {
+      /* identical model found - drop own copy and point to the shared one */
+      ms = entries[j];
+      free_model_arrays(loc->rate_matrices,
+                        loc->frequencies,
+                        loc->subst_params,
+                        loc->eigen_decomp_valid,
+                        loc->eigenvecs,
+                        loc->inv_eigenvecs,
+                        loc->eigenvals);
+      ++ms->refcount;
+    }
+    else
+    {
+      /* new model - the registry takes over the arrays of this locus */
+      ms = (model_shared_t *)xmalloc(sizeof(model_shared_t));
+      ms->refcount = 1;
+      ms->hash = h;
+      ms->dtype = loc->dtype;
+      ms->model = loc->model;
+      ms->states = loc->states;
+      ms->rate_matrices = loc->rate_matrices;
+      ms->frequencies = loc->frequencies;
+      ms->subst_params = loc->subst_params;
+      ms->eigen_decomp_valid = loc->eigen_decomp_valid;
+      ms->eigenvecs = loc->eigenvecs;
+      ms->inv_eigenvecs = loc->inv_eigenvecs;
+      ms->eigenvals = loc->eigenvals;
+
+      /* decompose now, as shared decompositions are never updated lazily */
+      for (k = 0; k < ms->rate_matrices; ++k)
+        if (!ms->eigen_decomp_valid[k])
+        {
+          pll_update_eigen(ms->eigenvecs[k],
+                           ms->inv_eigenvecs[k],
+                           ms->eigenvals[k],
+                           ms->frequencies[k],
+                           ms->subst_params[k],
+                           loc->states,
+                           loc->states_padded);
+          ms->eigen_decomp_valid[k] = 1;
+        }
+
+      entries[entries_count++] = ms;
+    }
+
+    loc->model_shared = ms;
+    loc->frequencies = ms->frequencies;
+    loc->subst_params = ms->subst_params;
+    loc->eigen_decomp_valid = ms->eigen_decomp_valid;
+    loc->eigenvecs = ms->eigenvecs;
+    loc->inv_eigenvecs = ms->inv_eigenvecs;
+    loc->eigenvals = ms->eigenvals;
+  }
+
+  free(entries);
+}
+
+/* Give the locus its own copy of the model parameters and eigen
+   decomposition, such that they can be modified */
+void locus_unshare_model(locus_t * locus)
+{
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+  model_shared_t * ms = locus->model_shared;
+
+  if (!ms) return;
+
+  pthread_mutex_lock(&model_shared_mutex);
+  if (ms->refcount == 1)
+  {
+    /* last user of this model takes over the arrays */
+    pthread_mutex_unlock(&model_shared_mutex);
+    free(ms);
+    locus->model_shared = NULL;
+    return;
+  }
+
+  locus->frequencies = clone_model_array(locus,
+                                         ms->frequencies,
+                                         states_padded);
+  locus->subst_params = clone_model_array(locus,
+                                          ms->subst_params,
+                                          (states*states - states) / 2);
+  locus->eigenvecs = clone_model_array(locus,
+                                       ms->eigenvecs,
+                                       states*states_padded);
+  locus->inv_eigenvecs = clone_model_array(locus,
+                                           ms->inv_eigenvecs,
+                                           states*states_padded);
+  locus->eigenvals = clone_model_array(locus,
+                                       ms->eigenvals,
+                                       states_padded);
+  locus->eigen_decomp_valid = (int *)xmalloc(locus->rate_matrices *
+                                             sizeof(int));
+  memcpy(locus->eigen_decomp_valid,
+         ms->eigen_decomp_valid,
+         locus->rate_matrices*sizeof(int));
+
+  --ms->refcount;
+  pthread_mutex_unlock(&model_shared_mutex);
+
+  locus->model_shared = NULL;
+}
+
 static void dealloc_locus_data(locus_t * locus)
 {
   unsigned int i;
@@ -63,12 +331,13 @@ static void dealloc_locus_data(locus_t * locus)
 
   free(locus->rates);
   free(locus->rate_weights);
-  free(locus->eigen_decomp_valid);
+  free(locus->pmat_scratch);
   if (!locus->pattern_weights)
     free(locus->pattern_weights);
 
   if (locus->scale_buffer)
-    for (i = 0; i < locus->scale_buffers; ++i)
+    for (i = 0; i < (locus->clv_owner ?
+                     locus->scale_buffers/2 : locus->scale_buffers); ++i)
       free(locus->scale_buffer[i]);
   free(locus->scale_buffer);
 
@@ -90,10 +359,30 @@ static void dealloc_locus_data(locus_t * locus)
   {
     int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ?
                     locus->tips : 0;
-    for (i = start; i < locus->clv_buffers + locus->tips; ++i)
+    unsigned int clv_alloc = locus->clv_owner ?
+                               locus->clv_buffers/2 : locus->clv_buffers;
+    for (i = start; i < clv_alloc + locus->tips; ++i)
       pll_aligned_free(locus->clv[i]);
   }
   free(locus->clv);
+  free(locus->clv_owner);
+  free(locus->clv_stale_trav);
+
+  if (locus->repeats_id)
+    free(locus->repeats_id[0]);
+  free(locus->repeats_id);
+  free(locus->repeats_count);
+  free(locus->repeats_buffer);
+
+  if (locus->outside)
+    for (i = 0; i < locus->tips-1; ++i)
+      pll_aligned_free(locus->outside[i]);
+  free(locus->outside);
+
+  if (locus->outside_scaler)
+    for (i = 0; i < locus->tips-1; ++i)
+      free(locus->outside_scaler[i]);
+  free(locus->outside_scaler);
 
   if (locus->pmatrix)
   {
@@ -102,30 +391,16 @@ static void dealloc_locus_data(locus_t * locus)
   }
   free(locus->pmatrix);
 
-  if (locus->subst_params)
-    for (i = 0; i < locus->rate_matrices; ++i)
-      pll_aligned_free(locus->subst_params[i]);
-  free(locus->subst_params);
-
-  if (locus->eigenvecs)
-    for (i = 0; i < locus->rate_matrices; ++i)
-      pll_aligned_free(locus->eigenvecs[i]);
-  free(locus->eigenvecs);
-
-  if (locus->inv_eigenvecs)
-    for (i = 0; i < locus->rate_matrices; ++i)
-      pll_aligned_free(locus->inv_eigenvecs[i]);
-  free(locus->inv_eigenvecs);
-
-  if (locus->eigenvals)
-    for (i = 0; i < locus->rate_matrices; ++i)
-      pll_aligned_free(locus->eigenvals[i]);
-  free(locus->eigenvals);
-
-  if (locus->frequencies)
-    for (i = 0; i < locus->rate_matrices; ++i)
-      pll_aligned_free(locus->frequencies[i]);
-  free(locus->frequencies);
+  if (locus->model_shared)
+    model_release(locus->model_shared);
+  else
+    free_model_arrays(locus->rate_matrices,
+                      locus->frequencies,
+                      locus->subst_params,
+                      locus->eigen_decomp_valid,
+                      locus->eigenvecs,
+                      locus->inv_eigenvecs,
+                      locus->eigenvals);
 
   free(locus->param_indices);
   free(locus->heredity);
@@ -140,6 +415,23 @@ static void dealloc_locus_data(locus_t * locus)
     free(locus->likelihood_vector);
   }
 
+  if (locus->phase)
+  {
+    phase_destroy(locus->phase);
+    free(locus->phase_clv);
+    free(locus->phase_sum);
+    free(locus->phase_lca);
+    free(locus->phase_tipclv);
+    free(locus->phase_scaler);
+    free(locus->phase_mark);
+    free(locus->phase_state);
+    free(locus->phase_tipnode);
+  }
+
+  free(locus->hmc_scale);
+  free(locus->hmc_mean);
+  free(locus->hmc_m2);
+
   free(locus);
 }
 
@@ -737,7 +1029,12 @@ locus_t * locus_create(unsigned int dtype,
      for the tip nodes */
   int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ? locus->tips : 0;
 
-  for (i = start; i < locus->tips + locus->clv_buffers; ++i)
+  /* in low-memory mode the two CLVs of each inner node (current and proposed)
+     share one buffer (see locus_clv_validate) */
+  unsigned int clv_alloc = opt_lowmem ?
+                             locus->clv_buffers/2 : locus->clv_buffers;
+
+  for (i = start; i < locus->tips + clv_alloc; ++i)
   {
     locus->clv[i] = pll_aligned_alloc(sites_alloc * states_padded * rate_cats *
                                       sizeof(double),
@@ -749,6 +1046,79 @@ locus_t * locus_create(unsigned int dtype,
            (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
   }
 
+  locus->clv_owner = NULL;
+  locus->clv_stale_trav = NULL;
+  if (opt_lowmem)
+  {
+    for (i = locus->tips + clv_alloc; i < locus->tips + locus->clv_buffers; ++i)
+      locus->clv[i] = locus->clv[i-clv_alloc];
+
+    /* no buffer holds a valid CLV yet */
+    locus->clv_owner = (unsigned int *)xmalloc(clv_alloc*sizeof(unsigned int));
+    for (i = 0; i < clv_alloc; ++i)
+      locus->clv_owner[i] = (unsigned int)-1;
+    locus->clv_stale_trav = (gnode_t **)xmalloc(clv_alloc * sizeof(gnode_t *));
+  }
+
+  /* site repeat classes, one array per CLV (aliased as CLVs in low-memory
+     mode) allocated in one block */
+  locus->repeats_id = NULL;
+  locus->repeats_count = NULL;
+  locus->repeats_buffer = NULL;
+  locus->repeats_stamp = 0;
+  locus->repeats_computed = 0;
+  locus->repeats_sites = 0;
+  if (opt_site_repeats)
+  {
+    locus->repeats_id = (unsigned int **)xmalloc((locus->tips +
+                                                  locus->clv_buffers) *
+                                                 sizeof(unsigned int *));
+    locus->repeats_id[0] = (unsigned int *)xmalloc((size_t)(locus->tips +
+                                                            clv_alloc) *
+                                                   sites_alloc *
+                                                   sizeof(unsigned int));
+    for (i = 1; i < locus->tips + clv_alloc; ++i)
+      locus->repeats_id[i] = locus->repeats_id[i-1] + sites_alloc;
+    for (i = locus->tips + clv_alloc; i < locus->tips + locus->clv_buffers; ++i)
+      locus->repeats_id[i] = locus->repeats_id[i-clv_alloc];
+
+    locus->repeats_count = (unsigned int *)xcalloc(locus->tips +
+                                                   locus->clv_buffers,
+                                                   sizeof(unsigned int));
+    locus->repeats_buffer = (unsigned int *)xcalloc(BPP_REPEATS_BUFFER_SIZE(
+                                                      sites_alloc),
+                                                    sizeof(unsigned int));
+  }
+
+  /* outside partials for gene tree age proposals and branch rate gradients,
+     one per inner node */
+  locus->outside = NULL;
+  locus->outside_scaler = NULL;
+  locus->team = NULL;
+  locus->team_persite_lnl = NULL;
+  locus->model_shared = NULL;
+  if ((opt_exp_outside || opt_hmc_steps) && !opt_lowmem)
+  {
+    locus->outside = (double **)xcalloc(locus->tips-1, sizeof(double *));
+    for (i = 0; i < locus->tips-1; ++i)
+    {
+      locus->outside[i] = pll_aligned_alloc(sites_alloc * states_padded *
+                                            rate_cats * sizeof(double),
+                                            locus->alignment);
+      memset(locus->outside[i],
+             0,
+             (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
+    }
+    if (scale_buffers)
+    {
+      locus->outside_scaler = (unsigned int **)xcalloc(locus->tips-1,
+                                                       sizeof(unsigned int *));
+      for (i = 0; i < locus->tips-1; ++i)
+        locus->outside_scaler[i] = (unsigned int *)xcalloc(sites_alloc,
+                                                           sizeof(unsigned int));
+    }
+  }
+
   /* pmatrix */
   locus->pmatrix = (double **)xcalloc(locus->prob_matrices, sizeof(double *));
 
@@ -836,6 +1206,10 @@ locus_t * locus_create(unsigned int dtype,
     locus->rates[i] = 1;
   #endif
 
+  /* p-matrix scratch */
+  locus->pmat_scratch = (double *)xmalloc((size_t)(states + states*states) *
+                                          sizeof(double));
+
   /* rate weights */
   locus->rate_weights = (double *)xcalloc(locus->rate_cats,sizeof(double));
     /* initialize to 1/n_rates */
@@ -850,20 +1224,154 @@ locus_t * locus_create(unsigned int dtype,
     locus->pattern_weights[i] = 1;
   locus->pattern_weights_sum = sites;
 
-  /* scale_buffer */
+  /* scale_buffer (shared by the two scalers of each node in low-memory mode,
+     as CLVs) */
+  unsigned int scale_alloc = opt_lowmem ?
+                               locus->scale_buffers/2 : locus->scale_buffers;
   locus->scale_buffer = (unsigned int **)xcalloc(locus->scale_buffers,
                                                  sizeof(unsigned int *));
-  for (i = 0; i < locus->scale_buffers; ++i)
+  for (i = 0; i < scale_alloc; ++i)
   {
     size_t scaler_size = (attributes & PLL_ATTRIB_RATE_SCALERS) ?
                              sites_alloc * rate_cats : sites_alloc;
     locus->scale_buffer[i] = (unsigned int *)xcalloc(scaler_size,
                                                      sizeof(unsigned int));
   }
+  for (i = scale_alloc; i < locus->scale_buffers; ++i)
+    locus->scale_buffer[i] = locus->scale_buffer[i-scale_alloc];
 
   return locus;
 }
 
+static double * touch_copy_aligned(double * src,
+                                   size_t count,
+                                   unsigned int alignment)
+{
+  double * dst = pll_aligned_alloc(count * sizeof(double), alignment);
+
+  if (!dst)
+    fatal("Unable to allocate enough memory.");
+
+  memcpy(dst, src, count * sizeof(double));
+  pll_aligned_free(src);
+
+  return dst;
+}
+
+static unsigned int * touch_copy_uint(unsigned int * src, size_t count)
+{
+  unsigned int * dst = (unsigned int *)xmalloc(count * sizeof(unsigned int));
+
+  memcpy(dst, src, count * sizeof(unsigned int));
+  free(src);
+
+  return dst;
+}
+
+/* Move the CLVs, outside partials, p-matrices, scalers and site repeat classes
+   of a locus to new buffers allocated and first written by the calling
+   thread. Called by the thread that owns the locus, such that with the
+   first-touch policy of the OS the pages end up on its NUMA node */
+void locus_first_touch(locus_t * locus)
+{
+  unsigned int i;
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+  size_t span = (size_t)locus->sites * states_padded * locus->rate_cats;
+  int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ? locus->tips : 0;
+  unsigned int clv_alloc = opt_lowmem ?
+                             locus->clv_buffers/2 : locus->clv_buffers;
+  unsigned int scale_alloc = opt_lowmem ?
+                               locus->scale_buffers/2 : locus->scale_buffers;
+
+  for (i = start; i < locus->tips + clv_alloc; ++i)
+    locus->clv[i] = touch_copy_aligned(locus->clv[i], span, locus->alignment);
+  for (i = locus->tips + clv_alloc; i < locus->tips + locus->clv_buffers; ++i)
+    locus->clv[i] = locus->clv[i-clv_alloc];
+
+  if (locus->repeats_id)
+  {
+    locus->repeats_id[0] = touch_copy_uint(locus->repeats_id[0],
+                                           (size_t)(locus->tips + clv_alloc) *
+                                           locus->sites);
+    for (i = 1; i < locus->tips + clv_alloc; ++i)
+      locus->repeats_id[i] = locus->repeats_id[i-1] + locus->sites;
+    for (i = locus->tips + clv_alloc; i < locus->tips + locus->clv_buffers; ++i)
+      locus->repeats_id[i] = locus->repeats_id[i-clv_alloc];
+  }
+
+  if (locus->outside)
+    for (i = 0; i < locus->tips-1; ++i)
+      locus->outside[i] = touch_copy_aligned(locus->outside[i],
+                                             span,
+                                             locus->alignment);
+  if (locus->outside_scaler)
+    for (i = 0; i < locus->tips-1; ++i)
+      locus->outside_scaler[i] = touch_copy_uint(locus->outside_scaler[i],
+                                                 locus->sites);
+
+  /* p-matrices are one contiguous block (see locus_create) */
+  locus->pmatrix[0] = touch_copy_aligned(locus->pmatrix[0],
+                                         (size_t)locus->prob_matrices *
+                                         states * states_padded *
+                                         locus->rate_cats +
+                                         (states_padded - states) *
+                                         states_padded,
+                                         locus->alignment);
+  for (i = 1; i < locus->prob_matrices; ++i)
+    locus->pmatrix[i] = locus->pmatrix[i-1] +
+                        states * states_padded * locus->rate_cats;
+
+  for (i = 0; i < scale_alloc; ++i)
+  {
+    size_t scaler_size = (locus->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           (size_t)locus->sites * locus->rate_cats :
+                           locus->sites;
+    locus->scale_buffer[i] = touch_copy_uint(locus->scale_buffer[i],
+                                             scaler_size);
+  }
+  for (i = scale_alloc; i < locus->scale_buffers; ++i)
+    locus->scale_buffer[i] = locus->scale_buffer[i-scale_alloc];
+}
+
+#if (defined(__linux__) && !defined(DISABLE_COREPIN))
+/* Number of pages of the CLVs, p-matrices and scalers of a locus, and in
+   local the number of those on NUMA node 'node'. Returns -1 if the page
+   locations cannot be queried */
+long locus_numa_pages(locus_t * locus, long node, long * local)
+{
+  unsigned int i;
+  long total = 0;
+  int ok = 1;
+  size_t span = (size_t)locus->sites * locus->states_padded *
+                locus->rate_cats * sizeof(double);
+  int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ? locus->tips : 0;
+  unsigned int clv_alloc = opt_lowmem ?
+                             locus->clv_buffers/2 : locus->clv_buffers;
+  unsigned int scale_alloc = opt_lowmem ?
+                               locus->scale_buffers/2 : locus->scale_buffers;
+
+  *local = 0;
+
+  for (i = start; ok && i < locus->tips + clv_alloc; ++i)
+    ok = topology_pages_on_node(locus->clv[i], span, node, local, &total);
+
+  if (ok)
+    ok = topology_pages_on_node(locus->pmatrix[0],
+                                (size_t)locus->prob_matrices * locus->states *
+                                locus->states_padded * locus->rate_cats *
+                                sizeof(double),
+                                node, local, &total);
+
+  for (i = 0; ok && i < scale_alloc; ++i)
+    ok = topology_pages_on_node(locus->scale_buffer[i],
+                                locus->sites * sizeof(unsigned int),
+                                node, local, &total);
+
+  return ok ? total : -1;
+}
+#endif
+
 void locus_destroy(locus_t * locus)
 {
   dealloc_locus_data(locus);
@@ -875,6 +1383,8 @@ void pll_set_subst_params(locus_t * locus,
 {
   unsigned int count = (locus->states * (locus->states-1)) / 2;
 
+  locus_unshare_model(locus);
+
   memcpy(locus->subst_params[param_index], params, count*sizeof(double));
   locus->eigen_decomp_valid[param_index] = 0;
 
@@ -885,6 +1395,8 @@ void pll_set_frequencies(locus_t * locus,
                          unsigned int freqs_index,
                          const double * frequencies)
 {
+  locus_unshare_model(locus);
+
   memcpy(locus->frequencies[freqs_index],
          frequencies,
          locus->states*sizeof(double));
@@ -1097,6 +1609,30 @@ void locus_set_heredity_scalers(locus_t * locus, const double * heredity)
   memcpy(locus->heredity, heredity, locus->rate_matrices*sizeof(double));
 }
 
+/* attach the unphased sites resolved by enumeration and allocate the
+   single-site partials for the inner nodes of the gene tree */
+void locus_set_phase(locus_t * locus, phase_t * phase)
+{
+  size_t inner = locus->tips - 1;
+
+  locus->phase = phase;
+  locus->phase_clv = (double *)xmalloc(inner * locus->rate_cats *
+                                       locus->states * sizeof(double));
+  locus->phase_sum = (double *)xmalloc(inner * locus->rate_cats *
+                                       locus->states * sizeof(double));
+  locus->phase_tipclv = (double *)xmalloc((size_t)locus->tips *
+                                          locus->rate_cats * locus->states *
+                                          sizeof(double));
+  locus->phase_lca = (long *)xmalloc(inner * sizeof(long));
+  locus->phase_scaler = (unsigned int *)xmalloc(inner * sizeof(unsigned int));
+  locus->phase_mark = (unsigned long *)xcalloc(inner,sizeof(unsigned long));
+  locus->phase_stamp = 0;
+  locus->phase_state = (unsigned char *)xmalloc((size_t)locus->tips *
+                                                sizeof(unsigned char));
+  locus->phase_tipnode = (gnode_t **)xmalloc((size_t)locus->tips *
+                                             sizeof(gnode_t *));
+}
+
 static double update_branchlength_relaxed_clock(stree_t * stree,
                                                 gnode_t * node,
                                                 long msa_index)
@@ -2377,40 +2913,51 @@ void locus_update_matrices(locus_t * locus,
 }
 
 
-static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
+typedef struct partials_task_s
+{
+  locus_t * locus;
+  gnode_t ** traversal;
+  unsigned int count;
+} partials_task_t;
+
+typedef struct root_task_s
+{
+  locus_t * locus;
+  gnode_t * root;
+  const unsigned int * freqs_indices;
+  double * persite;
+} root_task_t;
+
+/* compute the partials of node for the site patterns [start,start+count) */
+static void update_partial_block(locus_t * locus,
+                                 gnode_t * node,
+                                 unsigned int start,
+                                 unsigned int count)
 {
   unsigned int * scaler;
   unsigned int * lscaler;
   unsigned int * rscaler;
-  gnode_t * lnode;
-  gnode_t * rnode;
-
-
-  if (!(root->left)) return;
-
-  locus_update_all_partials_recursive(locus,root->left);
-  locus_update_all_partials_recursive(locus,root->right);
-
-  lnode = root->left;
-  rnode = root->right;
+  gnode_t * lnode = node->left;
+  gnode_t * rnode = node->right;
+  size_t offset = (size_t)start * locus->rate_cats * locus->states_padded;
 
   /* check if we use scalers */
-  scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-             NULL : locus->scale_buffer[root->scaler_index];
+  scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+             NULL : locus->scale_buffer[node->scaler_index] + start;
 
   lscaler = (lnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-              NULL : locus->scale_buffer[lnode->scaler_index];
+              NULL : locus->scale_buffer[lnode->scaler_index] + start;
 
   rscaler = (rnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-              NULL : locus->scale_buffer[rnode->scaler_index];
+              NULL : locus->scale_buffer[rnode->scaler_index] + start;
 
   pll_core_update_partial_ii(locus->states,
-                             locus->sites,
+                             count,
                              locus->rate_cats,
-                             locus->clv[root->clv_index],
+                             locus->clv[node->clv_index] + offset,
                              scaler,
-                             locus->clv[lnode->clv_index],
-                             locus->clv[rnode->clv_index],
+                             locus->clv[lnode->clv_index] + offset,
+                             locus->clv[rnode->clv_index] + offset,
                              locus->pmatrix[lnode->pmatrix_index],
                              locus->pmatrix[rnode->pmatrix_index],
                              lscaler,
@@ -2418,113 +2965,1228 @@ static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
                              locus->attributes);
 }
 
-void locus_update_all_partials(locus_t * locus, gtree_t * gtree)
+/* Site repeats: site patterns that are identical when restricted to the tips
+   below a node have identical CLVs and scalers at that node. Each CLV keeps
+   the class of every site pattern, with classes numbered in order of first
+   occurrence such that the first site of a class is its representative. The
+   classes of an inner node are the distinct pairs of classes of its children.
+   Only representatives are computed and then copied to the other sites of
+   their class, which gives the same values as computing every site. Classes
+   are computed together with the partials, hence they follow the changes of
+   the gene tree and are restored with the CLV index of a rejected proposal */
+
+static unsigned int * repeats_rep(locus_t * locus)
 {
-  if (!opt_usedata) return;
-
-  locus_update_all_partials_recursive(locus,gtree->root);
+  return locus->repeats_buffer;
 }
 
-void locus_update_partials(locus_t * locus, gnode_t ** traversal, unsigned int count)
+/* compute the classes of node from those of its children and store the
+   representative of each class in repeats_rep(); returns the number of
+   classes. A node has at least as many classes as each of its children, so
+   once the classes are too many to be worth exploiting the node is marked as
+   having all site patterns distinct (without storing the classes), which
+   also stops the computation of classes towards the root */
+static unsigned int repeats_classify(locus_t * locus, gnode_t * node)
 {
-  unsigned int i;
-  unsigned int * scaler;
-  unsigned int * lscaler;
-  unsigned int * rscaler;
-  gnode_t * node;
-  gnode_t * lnode;
-  gnode_t * rnode;
+  unsigned int i,j;
+  unsigned int sites = locus->sites;
+  unsigned int classes = 0;
+  unsigned int lcount = locus->repeats_count[node->left->clv_index];
+  unsigned int rcount = locus->repeats_count[node->right->clv_index];
+  const unsigned int * lid = locus->repeats_id[node->left->clv_index];
+  const unsigned int * rid = locus->repeats_id[node->right->clv_index];
+  unsigned int * id = locus->repeats_id[node->clv_index];
+  unsigned int * rep = repeats_rep(locus);
+  unsigned int * pair_stamp = rep + sites;
+  unsigned int * pair = pair_stamp + BPP_REPEATS_PAIRS(sites);
+  unsigned int max_classes = (unsigned int)(BPP_REPEATS_MAX_UNIQUE * sites);
+
+  if (lcount > max_classes || rcount > max_classes ||
+      (size_t)lcount * rcount > BPP_REPEATS_PAIRS(sites))
+  {
+    locus->repeats_count[node->clv_index] = sites;
+    return sites;
+  }
 
-  if (!opt_usedata) return;
+  /* entries of the table of class pairs are valid only if their stamp is the
+     current one */
+  if (++locus->repeats_stamp == 0)
+  {
+    memset(pair_stamp, 0, BPP_REPEATS_PAIRS(sites)*sizeof(unsigned int));
+    locus->repeats_stamp = 1;
+  }
 
-  for (i = 0; i < count; ++i)
+  for (i = 0; i < sites; ++i)
   {
-    node  = traversal[i];
-    lnode = traversal[i]->left;
-    rnode = traversal[i]->right;
+    j = lid[i]*rcount + rid[i];
+    if (pair_stamp[j] != locus->repeats_stamp)
+    {
+      pair_stamp[j] = locus->repeats_stamp;
+      pair[j] = classes;
+      rep[classes++] = i;
+    }
+    id[i] = pair[j];
+  }
+
+  if (classes > max_classes)
+    classes = sites;
+
+  locus->repeats_count[node->clv_index] = classes;
+  return classes;
+}
 
-    /* check if we use scalers */
-    scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-               NULL : locus->scale_buffer[node->scaler_index];
+static void update_partial_repeats(locus_t * locus, gnode_t * node)
+{
+  unsigned int i,j;
+  size_t k;
+  unsigned int classes;
+  unsigned int sites = locus->sites;
+  size_t span = (size_t)(locus->rate_cats) * locus->states_padded;
+  size_t scaler_span = (locus->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                         (size_t)(locus->rate_cats) : 1;
+  double * clv = locus->clv[node->clv_index];
+  unsigned int * scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                            NULL : locus->scale_buffer[node->scaler_index];
+  const unsigned int * id = locus->repeats_id[node->clv_index];
+  const unsigned int * rep = repeats_rep(locus);
+
+  classes = repeats_classify(locus,node);
+
+  locus->repeats_sites += sites;
+  if (classes == sites)
+  {
+    locus->repeats_computed += sites;
+    update_partial_block(locus,node,0,sites);
+    return;
+  }
+  locus->repeats_computed += classes;
 
-    lscaler = (lnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                NULL : locus->scale_buffer[lnode->scaler_index];
+  /* compute representatives, in runs of consecutive site patterns */
+  for (i = 0; i < classes; i = j)
+  {
+    j = i+1;
+    while (j < classes && rep[j] == rep[j-1]+1)
+      ++j;
+    update_partial_block(locus,node,rep[i],j-i);
+  }
 
-    rscaler = (rnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                NULL : locus->scale_buffer[rnode->scaler_index];
+  /* and copy them to the remaining site patterns of their classes */
+  for (i = 0; i < sites; ++i)
+  {
+    j = rep[id[i]];
+    if (j == i) continue;
+
+    for (k = 0; k < span; ++k)
+      clv[i*span+k] = clv[j*span+k];
+    if (scaler)
+      for (k = 0; k < scaler_span; ++k)
+        scaler[i*scaler_span+k] = scaler[j*scaler_span+k];
+  }
+}
 
-    pll_core_update_partial_ii(locus->states,
-                               locus->sites,
-                               locus->rate_cats,
-                               locus->clv[node->clv_index],
-                               scaler,
-                               locus->clv[lnode->clv_index],
-                               locus->clv[rnode->clv_index],
-                               locus->pmatrix[lnode->pmatrix_index],
-                               locus->pmatrix[rnode->pmatrix_index],
-                               lscaler,
-                               rscaler,
-                               locus->attributes);
+/* update the partials of node for the site patterns [start,start+count).
+   Site repeats are not used for loci computed by a team of threads, which
+   update partials in blocks of site patterns */
+static void update_partial_range(locus_t * locus,
+                                 gnode_t * node,
+                                 unsigned int start,
+                                 unsigned int count)
+{
+  if (locus->repeats_id && !locus->team)
+  {
+    assert(start == 0 && count == locus->sites);
+    update_partial_repeats(locus,node);
   }
+  else
+    update_partial_block(locus,node,start,count);
 }
 
-double locus_root_loglikelihood(locus_t * locus,
-                                gnode_t * root,
-                                const unsigned int * freqs_indices,
-                                double * persite_lnl)
+/* classes of the site patterns at the tips, from the tip states. Sites whose
+   tip CLV is not an indicator of a set of states get a class of their own */
+void locus_repeats_init(locus_t * locus)
 {
-  double logl;
-  unsigned int * scaler;
+  unsigned int i,j,k;
+  unsigned int sites = locus->sites;
+  size_t span = (size_t)(locus->rate_cats) * locus->states_padded;
+  size_t hsize = 1;
+  unsigned int * hkey;
+  unsigned int * hval;
 
-  if (!opt_usedata) return 0;
+  if (!locus->repeats_id) return;
 
-  scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-             NULL : locus->scale_buffer[root->scaler_index];
+  /* open addressing table mapping sets of states to classes */
+  while (hsize < 2*(size_t)sites)
+    hsize <<= 1;
+  hkey = (unsigned int *)xmalloc(hsize*sizeof(unsigned int));
+  hval = (unsigned int *)xmalloc(hsize*sizeof(unsigned int));
 
-  if (locus->diploid)
+  for (i = 0; i < locus->tips; ++i)
   {
-    pll_core_root_likelihood_vector(locus->states,
-                                    locus->sites,
-                                    locus->rate_cats,
-                                    locus->clv[root->clv_index],
-                                    scaler,
-                                    locus->frequencies,
-                                    locus->rate_weights,
-                                    locus->pattern_weights,
-                                    freqs_indices,
-                                    locus->likelihood_vector,
-                                    locus->attributes);
-    
-    long i,j,k=0;
-    logl = 0;
+    unsigned int * id = locus->repeats_id[i];
+    unsigned int count = 0;
 
-    for (i = 0; i < locus->unphased_length; ++i)
+    for (k = 0; k < hsize; ++k)
+      hval[k] = (unsigned int)-1;
+
+    for (j = 0; j < sites; ++j)
     {
-      double meanl = 0;
+      unsigned int key = 0;
+      int indicator = (locus->states <= 32);
 
-      for (j = 0; j < locus->diploid_resolution_count[i]; ++j)
-        meanl += locus->likelihood_vector[locus->diploid_mapping[k++]];
+      if (locus->attributes & PLL_ATTRIB_PATTERN_TIP)
+        key = locus->tipchars[i][j];
+      else
+      {
+        const double * clv = locus->clv[i] + j*span;
+        for (k = 0; indicator && k < span; ++k)
+        {
+          if (clv[k] != clv[k % locus->states_padded] ||
+              (clv[k] != 0 && clv[k] != 1))
+            indicator = 0;
+          else if (k < locus->states && clv[k] == 1)
+            key |= 1u << k;
+        }
+      }
 
-      meanl /= locus->diploid_resolution_count[i];
+      if (!indicator)
+      {
+        /* class of its own, never found again in the table */
+        id[j] = count++;
+        continue;
+      }
 
-      logl += log(meanl) * locus->pattern_weights[i];
+      k = (unsigned int)((key * 2654435761u) & (hsize-1));
+      while (hval[k] != (unsigned int)-1 && hkey[k] != key)
+        k = (k+1) & (hsize-1);
+      if (hval[k] == (unsigned int)-1)
+      {
+        hkey[k] = key;
+        hval[k] = count++;
+      }
+      id[j] = hval[k];
     }
+    locus->repeats_count[i] = count;
   }
-  else
+
+  free(hkey);
+  free(hval);
+}
+
+/* fraction of site patterns computed by partial updates since the start */
+void locus_repeats_summary(FILE * fp,
+                           locus_t ** locus,
+                           long locus_count,
+                           int per_locus)
+{
+  long i;
+  unsigned long computed = 0;
+  unsigned long sites = 0;
+
+  if (per_locus)
   {
-    logl = pll_core_root_loglikelihood(locus->states,
-                                       locus->sites,
-                                       locus->rate_cats,
-                                       locus->clv[root->clv_index],
-                                       scaler,
-                                       locus->frequencies,
-                                       locus->rate_weights,
-                                       locus->pattern_weights,
-                                       freqs_indices,
-                                       persite_lnl,
-                                       locus->attributes);
+    fprintf(fp, "Site repeats (site patterns computed in partial updates):\n");
+    fprintf(fp, "   Locus   Patterns   Computed\n");
   }
-  return opt_bfbeta * logl;
+  for (i = 0; i < locus_count; ++i)
+  {
+    if (!locus[i]->repeats_sites) continue;
+
+    computed += locus[i]->repeats_computed;
+    sites += locus[i]->repeats_sites;
+    if (per_locus)
+      fprintf(fp, "  %6d %10u %9.1f%%\n",
+              locus[i]->original_index+1,
+              locus[i]->sites,
+              100.0 * locus[i]->repeats_computed / locus[i]->repeats_sites);
+  }
+  if (!sites) return;
+
+  fprintf(fp, "Site repeats: %.1f%% of site patterns computed in partial "
+          "updates\n\n", 100.0 * computed / sites);
+}
+
+static void locus_update_all_partials_recursive(locus_t * locus,
+                                                gnode_t * root,
+                                                unsigned int start,
+                                                unsigned int count)
+{
+  if (!(root->left)) return;
+
+  locus_update_all_partials_recursive(locus,root->left,start,count);
+  locus_update_all_partials_recursive(locus,root->right,start,count);
+
+  update_partial_range(locus,root,start,count);
+}
+
+static void cb_all_partials_range(void * data,
+                                  unsigned int start,
+                                  unsigned int count)
+{
+  partials_task_t * task = (partials_task_t *)data;
+
+  locus_update_all_partials_recursive(task->locus,
+                                      task->traversal[0],
+                                      start,
+                                      count);
+}
+
+/* Low-memory mode: the current and proposed CLV of an inner node share one
+   buffer and clv_owner records which of the two CLV indices the buffer holds.
+   A rejected proposal gives the node back its old index while the buffer
+   still holds the proposed CLV. Such stale CLVs are recomputed (from the same
+   inputs, hence giving the same values) the next time they are read */
+
+static unsigned int clv_slot(locus_t * locus, gnode_t * node)
+{
+  return (node->clv_index - locus->tips) % (locus->clv_buffers/2);
+}
+
+static int clv_stale(locus_t * locus, gnode_t * node)
+{
+  if (!node->left) return 0;
+
+  return locus->clv_owner[clv_slot(locus,node)] != node->clv_index;
+}
+
+/* post-order traversal of the stale CLVs in the subtree of node */
+static void clv_stale_collect(locus_t * locus,
+                              gnode_t * node,
+                              unsigned int * count)
+{
+  if (!clv_stale(locus,node)) return;
+
+  clv_stale_collect(locus,node->left,count);
+  clv_stale_collect(locus,node->right,count);
+
+  locus->clv_owner[clv_slot(locus,node)] = node->clv_index;
+  locus->clv_stale_trav[(*count)++] = node;
+}
+
+void locus_update_all_partials(locus_t * locus, gtree_t * gtree)
+{
+  unsigned int i;
+  partials_task_t task;
+
+  if (!opt_usedata) return;
+
+  task.locus = locus;
+  task.traversal = &gtree->root;
+  task.count = 1;
+
+  if (!threads_team_run(locus,cb_all_partials_range,&task))
+    locus_update_all_partials_recursive(locus,gtree->root,0,locus->sites);
+
+  if (locus->clv_owner)
+    for (i = gtree->tip_count; i < gtree->tip_count+gtree->inner_count; ++i)
+      locus->clv_owner[clv_slot(locus,gtree->nodes[i])] =
+        gtree->nodes[i]->clv_index;
+}
+
+static void cb_partials_range(void * data, unsigned int start, unsigned int count)
+{
+  unsigned int i;
+  partials_task_t * task = (partials_task_t *)data;
+
+  for (i = 0; i < task->count; ++i)
+    update_partial_range(task->locus,task->traversal[i],start,count);
+}
+
+static void update_partials(locus_t * locus,
+                            gnode_t ** traversal,
+                            unsigned int count)
+{
+  partials_task_t task;
+
+  task.locus = locus;
+  task.traversal = traversal;
+  task.count = count;
+
+  /* site patterns are independent, hence each thread of the team processes
+     the whole traversal for its own block of patterns */
+  if (!threads_team_run(locus,cb_partials_range,&task))
+    cb_partials_range(&task,0,locus->sites);
+}
+
+/* recompute the stale CLVs in the subtree of node (low-memory mode) */
+void locus_clv_validate(locus_t * locus, gnode_t * node)
+{
+  unsigned int count = 0;
+
+  if (!opt_usedata || !locus->clv_owner) return;
+
+  clv_stale_collect(locus,node,&count);
+  if (count)
+    update_partials(locus,locus->clv_stale_trav,count);
+}
+
+void locus_update_partials(locus_t * locus, gnode_t ** traversal, unsigned int count)
+{
+  unsigned int i;
+  unsigned int stale_count = 0;
+
+  if (!opt_usedata) return;
+
+  if (locus->clv_owner)
+  {
+    /* nodes in the traversal are about to be computed, and their children
+       that are not in the traversal must hold valid CLVs */
+    for (i = 0; i < count; ++i)
+      locus->clv_owner[clv_slot(locus,traversal[i])] = traversal[i]->clv_index;
+    for (i = 0; i < count; ++i)
+    {
+      clv_stale_collect(locus,traversal[i]->left,&stale_count);
+      clv_stale_collect(locus,traversal[i]->right,&stale_count);
+    }
+    if (stale_count)
+      update_partials(locus,locus->clv_stale_trav,stale_count);
+  }
+
+  update_partials(locus,traversal,count);
+}
+
+/* transition probabilities from each state at the parent to the current
+   state of a tip (summed over ambiguous states) */
+static void phase_update_tip(locus_t * locus, gnode_t * tip)
+{
+  unsigned int n,i,j;
+  unsigned int states = locus->states;
+  unsigned int state = locus->phase_state[tip->clv_index];
+  const double * pmat = locus->pmatrix[tip->pmatrix_index];
+  double * v = locus->phase_tipclv + tip->clv_index*states*locus->rate_cats;
+
+  for (n = 0; n < locus->rate_cats; ++n)
+  {
+    for (i = 0; i < states; ++i)
+    {
+      double term = 0;
+      for (j = 0; j < states; ++j)
+        if (state & (1u << j))
+          term += pmat[j];
+      *v++ = term;
+      pmat += states;
+    }
+  }
+}
+
+/* contribution of a child node to the single-site partials of its parent */
+static void phase_child_term(locus_t * locus,
+                             gnode_t * child,
+                             double * clv,
+                             unsigned int * scaler)
+{
+  unsigned int n,i,j;
+  unsigned int states = locus->states;
+  unsigned int span = states * locus->rate_cats;
+  const double * pmat = locus->pmatrix[child->pmatrix_index];
+  const double * cclv;
+
+  if (!child->left)
+  {
+    const double * v = locus->phase_tipclv + child->clv_index*span;
+    for (i = 0; i < span; ++i)
+      clv[i] *= v[i];
+    return;
+  }
+
+  cclv = locus->phase_clv + (child->node_index - locus->tips)*span;
+  *scaler += locus->phase_scaler[child->node_index - locus->tips];
+
+  if (states == 4)
+  {
+    for (n = 0; n < locus->rate_cats; ++n)
+    {
+      clv[0] *= pmat[0]*cclv[0] + pmat[1]*cclv[1] +
+                pmat[2]*cclv[2] + pmat[3]*cclv[3];
+      clv[1] *= pmat[4]*cclv[0] + pmat[5]*cclv[1] +
+                pmat[6]*cclv[2] + pmat[7]*cclv[3];
+      clv[2] *= pmat[8]*cclv[0] + pmat[9]*cclv[1] +
+                pmat[10]*cclv[2] + pmat[11]*cclv[3];
+      clv[3] *= pmat[12]*cclv[0] + pmat[13]*cclv[1] +
+                pmat[14]*cclv[2] + pmat[15]*cclv[3];
+      clv += 4;
+      cclv += 4;
+      pmat += 16;
+    }
+    return;
+  }
+
+  for (n = 0; n < locus->rate_cats; ++n)
+  {
+    for (i = 0; i < states; ++i)
+    {
+      double term = 0;
+      for (j = 0; j < states; ++j)
+        term += pmat[j] * cclv[j];
+      clv[i] *= term;
+      pmat += states;
+    }
+    clv += states;
+    cclv += states;
+  }
+}
+
+/* single-site partials of an inner node from the partials of its children,
+   scaled by 2^256 on underflow */
+static void phase_combine(locus_t * locus, gnode_t * node)
+{
+  unsigned int i;
+  unsigned int span = locus->states * locus->rate_cats;
+  unsigned int scaler = 0;
+  double max = 0;
+  double * clv = locus->phase_clv + (node->node_index - locus->tips)*span;
+
+  for (i = 0; i < span; ++i)
+    clv[i] = 1;
+
+  phase_child_term(locus,node->left,clv,&scaler);
+  phase_child_term(locus,node->right,clv,&scaler);
+
+  for (i = 0; i < span; ++i)
+    if (clv[i] > max)
+      max = clv[i];
+
+  if (max < PLL_SCALE_THRESHOLD)
+  {
+    for (i = 0; i < span; ++i)
+      clv[i] *= PLL_SCALE_FACTOR;
+    ++scaler;
+  }
+
+  locus->phase_scaler[node->node_index - locus->tips] = scaler;
+}
+
+/* Partials of an inner node averaged over the resolutions of the
+   heterozygotes whose two tips have their most recent common ancestor at the
+   node. The likelihood is linear in the partials of any node, hence the
+   average can be taken at the node instead of at the root. The resolutions
+   are visited in Gray-code order, such that two consecutive ones differ in
+   the phase of a single heterozygote, and only the partials on the paths from
+   its two tips to the node are recomputed (recursively averaging over the
+   heterozygotes of the nodes on the paths) */
+static void phase_update_partial(locus_t * locus,
+                                 gnode_t * node,
+                                 const unsigned int * het_tip,
+                                 const long * het_next)
+{
+  unsigned int g,i;
+  unsigned int k = 0;
+  unsigned int span = locus->states * locus->rate_cats;
+  unsigned int scaler, sumscaler;
+  unsigned int tip[BPP_PHASE_HETS_MAX];
+  long h;
+  double max = 0;
+  double * clv = locus->phase_clv + (node->node_index - locus->tips)*span;
+  double * sum = locus->phase_sum + (node->node_index - locus->tips)*span;
+  gnode_t * x;
+
+  phase_combine(locus,node);
+
+  for (h = locus->phase_lca[node->node_index - locus->tips]; h >= 0;
+       h = het_next[h])
+    tip[k++] = het_tip[h];
+
+  if (!k) return;
+
+  memcpy(sum, clv, span*sizeof(double));
+  sumscaler = locus->phase_scaler[node->node_index - locus->tips];
+
+  for (g = 1; g < (1u << k); ++g)
+  {
+    unsigned int a = tip[PLL_CTZ(g)];
+    unsigned char tmp = locus->phase_state[a];
+
+    locus->phase_state[a] = locus->phase_state[a+1];
+    locus->phase_state[a+1] = tmp;
+    phase_update_tip(locus,locus->phase_tipnode[a]);
+    phase_update_tip(locus,locus->phase_tipnode[a+1]);
+
+    for (x = locus->phase_tipnode[a]->parent; x != node; x = x->parent)
+      phase_update_partial(locus,x,het_tip,het_next);
+    for (x = locus->phase_tipnode[a+1]->parent; x != node; x = x->parent)
+      phase_update_partial(locus,x,het_tip,het_next);
+
+    phase_combine(locus,node);
+
+    /* accumulate the sum relative to the smallest scaler */
+    scaler = locus->phase_scaler[node->node_index - locus->tips];
+    if (scaler == sumscaler)
+      for (i = 0; i < span; ++i)
+        sum[i] += clv[i];
+    else if (scaler > sumscaler)
+    {
+      double f = pow(PLL_SCALE_THRESHOLD, scaler - sumscaler);
+      for (i = 0; i < span; ++i)
+        sum[i] += clv[i] * f;
+    }
+    else
+    {
+      double f = pow(PLL_SCALE_THRESHOLD, sumscaler - scaler);
+      for (i = 0; i < span; ++i)
+        sum[i] = sum[i] * f + clv[i];
+      sumscaler = scaler;
+    }
+  }
+
+  for (i = 0; i < span; ++i)
+  {
+    clv[i] = sum[i] / (1u << k);
+    if (clv[i] > max)
+      max = clv[i];
+  }
+
+  if (max < PLL_SCALE_THRESHOLD)
+  {
+    for (i = 0; i < span; ++i)
+      clv[i] *= PLL_SCALE_FACTOR;
+    ++sumscaler;
+  }
+  locus->phase_scaler[node->node_index - locus->tips] = sumscaler;
+}
+
+static void phase_update_subtree(locus_t * locus,
+                                 gnode_t * node,
+                                 const unsigned int * het_tip,
+                                 const long * het_next)
+{
+  if (!node->left) return;
+
+  phase_update_subtree(locus,node->left,het_tip,het_next);
+  phase_update_subtree(locus,node->right,het_tip,het_next);
+  phase_update_partial(locus,node,het_tip,het_next);
+}
+
+static void phase_init_nodes(locus_t * locus, gnode_t * node)
+{
+  if (!node->left)
+  {
+    locus->phase_tipnode[node->clv_index] = node;
+    phase_update_tip(locus,node);
+    return;
+  }
+
+  locus->phase_lca[node->node_index - locus->tips] = -1;
+  phase_init_nodes(locus,node->left);
+  phase_init_nodes(locus,node->right);
+}
+
+/* log of the mean likelihood over all resolutions of an unphased site */
+static double phase_site_loglikelihood(locus_t * locus,
+                                       gnode_t * root,
+                                       const unsigned int * freqs_indices,
+                                       long p)
+{
+  unsigned int n,i;
+  unsigned int states = locus->states;
+  long h;
+  long het_next[BPP_PHASE_HETS_MAX];
+  phase_t * phase = locus->phase;
+  const unsigned int * het_tip = phase->het_tip + phase->het_offset[p];
+  const double * clv;
+  double lk = 0;
+
+  memcpy(locus->phase_state,
+         phase->tipstate + (size_t)p*locus->tips,
+         locus->tips * sizeof(unsigned char));
+
+  /* link each heterozygote to the most recent common ancestor of its tips */
+  phase_init_nodes(locus,root);
+  for (h = 0; h < phase->het_offset[p+1] - phase->het_offset[p]; ++h)
+  {
+    unsigned long stamp = ++locus->phase_stamp;
+    gnode_t * x;
+
+    for (x = locus->phase_tipnode[het_tip[h]+1]->parent; x; x = x->parent)
+      locus->phase_mark[x->node_index - locus->tips] = stamp;
+    for (x = locus->phase_tipnode[het_tip[h]]->parent;
+         locus->phase_mark[x->node_index - locus->tips] != stamp;
+         x = x->parent);
+
+    het_next[h] = locus->phase_lca[x->node_index - locus->tips];
+    locus->phase_lca[x->node_index - locus->tips] = h;
+  }
+
+  phase_update_subtree(locus,root,het_tip,het_next);
+
+  clv = locus->phase_clv + (root->node_index - locus->tips)*states*
+                           locus->rate_cats;
+  for (n = 0; n < locus->rate_cats; ++n)
+  {
+    const double * freqs = locus->frequencies[freqs_indices[n]];
+    double term = 0;
+
+    for (i = 0; i < states; ++i)
+      term += freqs[i] * clv[i];
+
+    lk += term * locus->rate_weights[n];
+    clv += states;
+  }
+
+  return log(lk) +
+         locus->phase_scaler[root->node_index - locus->tips] *
+         log(PLL_SCALE_THRESHOLD);
+}
+
+static double diploid_loglikelihood(locus_t * locus,
+                                    gnode_t * root,
+                                    const unsigned int * freqs_indices)
+{
+  long i,j,k=0;
+  long p = 0;
+  double logl = 0;
+
+  /* average the site likelihoods over the resolutions of each unphased site */
+  for (i = 0; i < locus->unphased_length; ++i)
+  {
+    double meanl = 0;
+
+    /* enumerated site; its single expanded pattern is a placeholder */
+    if (locus->phase && p < locus->phase->site_count &&
+        locus->phase->site[p] == i)
+    {
+      logl += phase_site_loglikelihood(locus,root,freqs_indices,p++) *
+              locus->pattern_weights[i];
+      k += locus->diploid_resolution_count[i];
+      continue;
+    }
+
+    for (j = 0; j < locus->diploid_resolution_count[i]; ++j)
+      meanl += locus->likelihood_vector[locus->diploid_mapping[k++]];
+
+    meanl /= locus->diploid_resolution_count[i];
+
+    logl += log(meanl) * locus->pattern_weights[i];
+  }
+
+  return logl;
+}
+
+/* per-site log-likelihoods (or likelihoods for diploid loci) for the site
+   patterns [start,start+count) */
+static void cb_root_range(void * data, unsigned int start, unsigned int count)
+{
+  root_task_t * task = (root_task_t *)data;
+  locus_t * locus = task->locus;
+  gnode_t * root = task->root;
+  unsigned int * scaler;
+  size_t offset = (size_t)start * locus->rate_cats * locus->states_padded;
+
+  scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+             NULL : locus->scale_buffer[root->scaler_index] + start;
+
+  if (locus->diploid)
+    pll_core_root_likelihood_vector(locus->states,
+                                    count,
+                                    locus->rate_cats,
+                                    locus->clv[root->clv_index] + offset,
+                                    scaler,
+                                    locus->frequencies,
+                                    locus->rate_weights,
+                                    locus->pattern_weights + start,
+                                    task->freqs_indices,
+                                    locus->likelihood_vector + start,
+                                    locus->attributes);
+  else
+    pll_core_root_loglikelihood(locus->states,
+                                count,
+                                locus->rate_cats,
+                                locus->clv[root->clv_index] + offset,
+                                scaler,
+                                locus->frequencies,
+                                locus->rate_weights,
+                                locus->pattern_weights + start,
+                                task->freqs_indices,
+                                task->persite + start,
+                                locus->attributes);
+}
+
+double locus_root_loglikelihood(locus_t * locus,
+                                gnode_t * root,
+                                const unsigned int * freqs_indices,
+                                double * persite_lnl)
+{
+  unsigned int i;
+  double logl;
+  unsigned int * scaler;
+  root_task_t task;
+
+  if (!opt_usedata) return 0;
+
+  locus_clv_validate(locus,root);
+
+  task.locus = locus;
+  task.root = root;
+  task.freqs_indices = freqs_indices;
+  task.persite = persite_lnl ? persite_lnl : locus->team_persite_lnl;
+
+  if (threads_team_run(locus,cb_root_range,&task))
+  {
+    /* sum up per-site log-likelihoods in the same order as the serial
+       kernels, such that the result does not depend on the number of
+       threads */
+    if (locus->diploid)
+      logl = diploid_loglikelihood(locus,root,freqs_indices);
+    else
+      for (logl = 0, i = 0; i < locus->sites; ++i)
+        logl += task.persite[i];
+
+    return opt_bfbeta * logl;
+  }
+
+  scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+             NULL : locus->scale_buffer[root->scaler_index];
+
+  if (locus->diploid)
+  {
+    pll_core_root_likelihood_vector(locus->states,
+                                    locus->sites,
+                                    locus->rate_cats,
+                                    locus->clv[root->clv_index],
+                                    scaler,
+                                    locus->frequencies,
+                                    locus->rate_weights,
+                                    locus->pattern_weights,
+                                    freqs_indices,
+                                    locus->likelihood_vector,
+                                    locus->attributes);
+    
+    logl = diploid_loglikelihood(locus,root,freqs_indices);
+  }
+  else
+  {
+    logl = pll_core_root_loglikelihood(locus->states,
+                                       locus->sites,
+                                       locus->rate_cats,
+                                       locus->clv[root->clv_index],
+                                       scaler,
+                                       locus->frequencies,
+                                       locus->rate_weights,
+                                       locus->pattern_weights,
+                                       freqs_indices,
+                                       persite_lnl,
+                                       locus->attributes);
+  }
+  return opt_bfbeta * logl;
+}
+
+/* Compute the outside partials of a non-root node into outside (and scaler)
+   from the outside partials of its parent and the partials of its sibling.
+   Outside partials of the root children are computed directly from the root
+   frequencies */
+static void outside_compute(locus_t * locus,
+                            gnode_t * node,
+                            double * outside,
+                            unsigned int * scaler,
+                            long thread_index)
+{
+  unsigned int i,j,k;
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+  size_t tmat_size;
+  double * pmat;
+  double * tmat;
+  unsigned int * pscaler;
+  unsigned int * sscaler;
+  gnode_t * parent = node->parent;
+  gnode_t * sibling;
+
+  assert(parent);
+
+  sibling = (parent->left == node) ? parent->right : parent->left;
+
+  sscaler = (sibling->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+              NULL : locus->scale_buffer[sibling->scaler_index];
+
+  if (!parent->parent)
+  {
+    pll_core_update_outside_root(states,
+                                 locus->sites,
+                                 locus->rate_cats,
+                                 outside,
+                                 scaler,
+                                 locus->clv[sibling->clv_index],
+                                 sscaler,
+                                 locus->pmatrix[sibling->pmatrix_index],
+                                 locus->frequencies,
+                                 locus->param_indices,
+                                 locus->attributes);
+    return;
+  }
+
+  /* the outside partials of the parent are conditioned on the state at the
+     grandparent, hence they are carried down the parent branch with the
+     transposed transition probability matrices */
+  size_t mark = arena_mark(thread_index);
+  tmat_size = (size_t)states*states_padded*locus->rate_cats +
+              (states_padded - states)*states_padded;
+  tmat = (double *)arena_alloc(thread_index, tmat_size*sizeof(double));
+  memset(tmat, 0, tmat_size*sizeof(double));
+
+  pmat = locus->pmatrix[parent->pmatrix_index];
+  for (k = 0; k < locus->rate_cats; ++k)
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        tmat[(k*states+i)*states_padded+j] = pmat[(k*states+j)*states_padded+i];
+
+  pscaler = locus->outside_scaler ?
+              locus->outside_scaler[parent->node_index - locus->tips] : NULL;
+
+  pll_core_update_partial_ii(states,
+                             locus->sites,
+                             locus->rate_cats,
+                             outside,
+                             scaler,
+                             locus->outside[parent->node_index - locus->tips],
+                             locus->clv[sibling->clv_index],
+                             tmat,
+                             locus->pmatrix[sibling->pmatrix_index],
+                             pscaler,
+                             sscaler,
+                             locus->attributes);
+
+  arena_release(thread_index,mark);
+}
+
+/* Compute the outside partials of an inner non-root node */
+void locus_update_outside(locus_t * locus, gnode_t * node, long thread_index)
+{
+  long index = node->node_index - locus->tips;
+
+  if (!opt_usedata) return;
+
+  assert(node->parent && node->node_index >= locus->tips);
+
+  outside_compute(locus,
+                  node,
+                  locus->outside[index],
+                  locus->outside_scaler ? locus->outside_scaler[index] : NULL,
+                  thread_index);
+}
+
+/* Log-likelihood of the locus computed at the branch above an inner non-root
+   node, from its outside partials and its partials */
+double locus_outside_loglikelihood(locus_t * locus, gnode_t * node)
+{
+  double logl;
+  unsigned int * oscaler;
+  unsigned int * scaler;
+
+  if (!opt_usedata) return 0;
+
+  assert(node->parent && node->node_index >= locus->tips);
+
+  oscaler = locus->outside_scaler ?
+              locus->outside_scaler[node->node_index - locus->tips] : NULL;
+  scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+             NULL : locus->scale_buffer[node->scaler_index];
+
+  logl = pll_core_edge_loglikelihood_ii(locus->states,
+                                        locus->sites,
+                                        locus->rate_cats,
+                                        locus->outside[node->node_index -
+                                                       locus->tips],
+                                        oscaler,
+                                        locus->clv[node->clv_index],
+                                        scaler,
+                                        locus->pmatrix[node->pmatrix_index],
+                                        locus->rate_weights,
+                                        locus->pattern_weights,
+                                        locus->diploid ?
+                                          locus->likelihood_vector : NULL,
+                                        locus->attributes);
+
+  if (locus->diploid)
+  {
+    gnode_t * root = node;
+
+    while (root->parent)
+      root = root->parent;
+    logl = diploid_loglikelihood(locus,root,locus->param_indices);
+  }
+
+  return opt_bfbeta * logl;
+}
+
+/* Rate matrix Q (states x states) of the substitution model with parameters
+   param_index, such that the transition probability matrices of the locus
+   are P(t) = exp(Qt). For GTR and protein models the exchangeabilities are
+   normalized to a mean rate of one as in pll_update_eigen(); the other DNA
+   models follow the scaling of their closed-form p-matrices */
+static void locus_rate_matrix(locus_t * locus,
+                              unsigned int param_index,
+                              double * q)
+{
+  unsigned int i,j,k;
+  unsigned int states = locus->states;
+  const double * freqs = locus->frequencies[param_index];
+  const double * qrates = locus->subst_params[param_index];
+  const double * exch = qrates;
+  double dna[6] = {1,1,1,1,1,1};
+  double scale = 0;
+  double mean;
+
+  if (locus->dtype == BPP_DATA_DNA && locus->model != BPP_DNA_MODEL_GTR)
+  {
+    /* exchangeabilities in the order AC, AG, AT, CG, CT, GT */
+    double A = freqs[0], C = freqs[1], G = freqs[2], T = freqs[3];
+    double Y = T + C;
+    double R = A + G;
+    double kappa;
+
+    switch (locus->model)
+    {
+      case BPP_DNA_MODEL_JC69:
+      case BPP_DNA_MODEL_F81:
+        break;
+
+      case BPP_DNA_MODEL_K80:
+      case BPP_DNA_MODEL_HKY:
+        dna[1] = dna[4] = qrates[0] / qrates[1];
+        break;
+
+      case BPP_DNA_MODEL_F84:
+        kappa = qrates[0] / qrates[1];
+        scale = 1 / (2*T*C*kappa + 2*A*G*kappa + 2*Y*R);
+        dna[1] = 1 + kappa / R;
+        dna[4] = 1 + kappa / Y;
+        break;
+
+      case BPP_DNA_MODEL_TN93:
+        scale = 1 / (2*T*C*qrates[0]+ 2*A*G*qrates[1] + 2*Y*R);
+        dna[1] = qrates[1] / qrates[2];
+        dna[4] = qrates[0] / qrates[2];
+        break;
+
+      default:
+        fatal("Internal error - no rate matrix for substitution model");
+    }
+    exch = dna;
+  }
+
+  for (i = 0; i < states; ++i)
+    q[i*states+i] = 0;
+
+  k = 0;
+  for (i = 0; i < states; ++i)
+    for (j = i+1; j < states; ++j)
+    {
+      q[i*states+j] = exch[k] * freqs[j];
+      q[j*states+i] = exch[k] * freqs[i];
+      q[i*states+i] -= q[i*states+j];
+      q[j*states+j] -= q[j*states+i];
+      ++k;
+    }
+
+  if (!scale)
+  {
+    mean = 0;
+    for (i = 0; i < states; ++i)
+      mean -= freqs[i] * q[i*states+i];
+    scale = 1 / mean;
+  }
+
+  for (i = 0; i < states*states; ++i)
+    q[i] *= scale;
+}
+
+static void outside_preorder(locus_t * locus, gnode_t * node, long thread_index)
+{
+  if (!node->left) return;
+
+  if (node->parent)
+    locus_update_outside(locus,node,thread_index);
+
+  outside_preorder(locus,node->left,thread_index);
+  outside_preorder(locus,node->right,thread_index);
+}
+
+/* Derivatives of the log-likelihood with respect to the length of the branch
+   above each gene tree node, stored in dlnl[node_index]. Outside partials are
+   computed in pre-order, and each derivative is evaluated at its branch as in
+   pll_core_edge_loglikelihood_ii(), with the transition probability matrix
+   replaced by its derivative dP(t)/dt = rQP(t), r being the category rate.
+   Scalers are common to the likelihood and its derivative and cancel out in
+   their per-site ratio. Not applicable to unphased diploid sequences or to
+   the T92 model */
+void locus_branch_derivatives(locus_t * locus,
+                              gtree_t * gtree,
+                              double * dlnl,
+                              long thread_index)
+{
+  unsigned int i,j,k,m,n;
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+  unsigned int rate_cats = locus->rate_cats;
+  unsigned int span = states_padded * rate_cats;
+  unsigned int total_nodes = gtree->tip_count + gtree->inner_count;
+  unsigned int * param_indices = locus->param_indices;
+  unsigned int * scaler;
+  double * qmat;
+  double * dmat;
+  double * tipoutside;
+  double term, dterm, terma, termb;
+  double sum;
+  size_t mark;
+
+  memset(dlnl, 0, total_nodes*sizeof(double));
+  if (!opt_usedata) return;
+
+  assert(!locus->diploid && locus->outside);
+
+  mark = arena_mark(thread_index);
+  qmat = (double *)arena_alloc(thread_index,
+                               (size_t)rate_cats*states*states*sizeof(double));
+  dmat = (double *)arena_alloc(thread_index,
+                               (size_t)rate_cats*states*states*sizeof(double));
+  tipoutside = (double *)arena_alloc(thread_index,
+                                     (size_t)locus->sites*span*sizeof(double));
+  scaler = locus->outside_scaler ?
+             (unsigned int *)arena_alloc(thread_index,
+                                         locus->sites*sizeof(unsigned int)) :
+             NULL;
+
+  /* rate matrix of each category, scaled by the category rate */
+  for (k = 0; k < rate_cats; ++k)
+  {
+    double * q = qmat + k*states*states;
+
+    locus_rate_matrix(locus,param_indices[k],q);
+    for (i = 0; i < states*states; ++i)
+      q[i] *= locus->rates[k];
+  }
+
+  outside_preorder(locus,gtree->root,thread_index);
+
+  for (i = 0; i < total_nodes; ++i)
+  {
+    gnode_t * node = gtree->nodes[i];
+    const double * outside;
+    const double * clv;
+    const double * pmat;
+    const unsigned int * pw = locus->pattern_weights;
+
+    if (!node->parent) continue;
+
+    if (node->left)
+      outside = locus->outside[node->node_index - locus->tips];
+    else
+    {
+      outside_compute(locus,node,tipoutside,scaler,thread_index);
+      outside = tipoutside;
+    }
+
+    /* derivative of the transition probability matrix of each category */
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * q = qmat + k*states*states;
+      pmat = locus->pmatrix[node->pmatrix_index] + k*states*states_padded;
+      for (j = 0; j < states; ++j)
+        for (m = 0; m < states; ++m)
+        {
+          sum = 0;
+          for (n = 0; n < states; ++n)
+            sum += q[j*states+n] * pmat[n*states_padded+m];
+          dmat[(k*states+j)*states+m] = sum;
+        }
+    }
+
+    clv = locus->clv[node->clv_index];
+    sum = 0;
+    for (n = 0; n < locus->sites; ++n)
+    {
+      const double * d = dmat;
+
+      pmat = locus->pmatrix[node->pmatrix_index];
+      term = dterm = 0;
+      for (k = 0; k < rate_cats; ++k)
+      {
+        double term_r = 0, dterm_r = 0;
+        for (j = 0; j < states; ++j)
+        {
+          terma = termb = 0;
+          for (m = 0; m < states; ++m)
+          {
+            terma += pmat[m] * clv[m];
+            termb += d[m] * clv[m];
+          }
+          term_r  += outside[j] * terma;
+          dterm_r += outside[j] * termb;
+
+          pmat += states_padded;
+          d += states;
+        }
+        term  += term_r * locus->rate_weights[k];
+        dterm += dterm_r * locus->rate_weights[k];
+
+        outside += states_padded;
+        clv += states_padded;
+      }
+      if (term > 0)
+        sum += pw[n] * dterm / term;
+    }
+    dlnl[node->node_index] = opt_bfbeta * sum;
+  }
+
+  arena_release(thread_index,mark);
+}
+
+/* Derivatives of the log-likelihood with respect to the branch rates of the
+   populations under a relaxed clock, stored in dlnl[snode_index]. A gene tree
+   branch length is the sum of the times spent in each population multiplied
+   by the population rate, as in update_branchlength_relaxed_clock() */
+void locus_brate_derivatives(locus_t * locus,
+                             gtree_t * gtree,
+                             stree_t * stree,
+                             long msa_index,
+                             double * dlnl,
+                             long thread_index)
+{
+  unsigned int i;
+  unsigned int total_nodes = gtree->tip_count + gtree->inner_count;
+  double t;
+  double * dbranch;
+  size_t mark;
+
+  memset(dlnl,
+         0,
+         (stree->tip_count+stree->inner_count+stree->hybrid_count) *
+           sizeof(double));
+
+  mark = arena_mark(thread_index);
+  dbranch = (double *)arena_alloc(thread_index, total_nodes*sizeof(double));
+
+  locus_branch_derivatives(locus,gtree,dbranch,thread_index);
+
+  for (i = 0; i < total_nodes; ++i)
+  {
+    gnode_t * node = gtree->nodes[i];
+    double d = dbranch[node->node_index];
+
+    if (!node->parent) continue;
+
+    snode_t * start = node->pop;
+    snode_t * end   = node->parent->pop;
+
+    t = node->time;
+    while (start != end)
+    {
+      snode_t * pop = start;
+      start = start->parent;
+
+      if (start->hybrid)
+      {
+        unsigned int hindex = GET_HINDEX(stree,start);
+        if (node->hpath[hindex] == BPP_HPATH_RIGHT)
+          start = start->hybrid;
+      }
+
+      if (!(pop->hybrid && pop->htau == 0))
+        dlnl[pop->node_index] += d * (start->tau - t);
+      t = start->tau;
+    }
+    dlnl[end->node_index] += d * (node->parent->time - t);
+  }
+
+  arena_release(thread_index,mark);
 }
 
 #if 0
@@ -2696,6 +4358,9 @@ static void propose_freqs(stree_t * stree,
   unsigned int * param_indices = locus->param_indices;
   gnode_t ** gt_nodes;
 
+  /* frequencies are modified in place */
+  locus_unshare_model(locus);
+
   /* allocate temporary space for gene tree traversal */
   gt_nodes = (gnode_t **)xmalloc((gtree->tip_count+gtree->inner_count) *
                                  sizeof(gnode_t *));
@@ -3091,6 +4756,9 @@ static void propose_qrates(stree_t * stree,
   assert(locus->dtype == BPP_DATA_DNA);
   assert(locus->states == 4);
 
+  /* rates are modified in place */
+  locus_unshare_model(locus);
+
   switch (locus->model)
   {
     case BPP_DNA_MODEL_K80:
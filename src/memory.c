@@ -0,0 +1,288 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Memory footprint of the data structures whose size grows with the data, per
+   subsystem. memory_estimate() predicts it from the parsed alignments before
+   gene trees and loci are created, and memory_usage() measures it from the
+   allocated structures at the end of the run. Both use the same accounting as
+   gtree_init(), stree_init(), stree_clone_init(), gtree_clone_init() and
+   locus_create(), such that the two reports can be compared directly. */
+
+static const char * memory_label[BPP_MEMORY_COUNT] =
+ {
+   "Conditional likelihood vectors",
+   "Transition probability matrices",
+   "Scalers",
+   "Coalescent event lists",
+   "Gene trees",
+   "Species/gene tree clones"
+ };
+
+static unsigned int padded_states(unsigned int states, unsigned int attributes)
+{
+  if (attributes & PLL_ATTRIB_ARCH_SSE)
+    return (states+1) & 0xFFFFFFFE;
+  if (attributes & (PLL_ATTRIB_ARCH_AVX | PLL_ATTRIB_ARCH_AVX2))
+    return (states+3) & 0xFFFFFFFC;
+
+  return states;
+}
+
+/* CLVs, scalers and p-matrices of one locus. clv_count and scaler_count are
+   the numbers of physically allocated buffers (aliased buffers in low-memory
+   mode are not counted), outside_count the number of outside partials */
+static void locus_bytes(size_t * mem,
+                        unsigned int tips,
+                        unsigned int sites,
+                        unsigned int states,
+                        unsigned int states_padded,
+                        unsigned int rate_cats,
+                        unsigned int attributes,
+                        size_t clv_count,
+                        size_t scaler_count,
+                        size_t outside_count,
+                        size_t pmatrix_count)
+{
+  size_t clv_size = (size_t)sites * states_padded * rate_cats * sizeof(double);
+  size_t scaler_size = (size_t)sites * sizeof(unsigned int);
+
+  if (attributes & PLL_ATTRIB_RATE_SCALERS)
+    scaler_size *= rate_cats;
+
+  if (attributes & PLL_ATTRIB_PATTERN_TIP)
+    mem[BPP_MEMORY_CLV] += (size_t)tips * sites;
+  else
+    clv_count += tips;
+
+  mem[BPP_MEMORY_CLV] += (clv_count + outside_count) * clv_size;
+
+  mem[BPP_MEMORY_SCALER] += scaler_count * scaler_size;
+  if (scaler_count)
+    mem[BPP_MEMORY_SCALER] += outside_count * sites * sizeof(unsigned int);
+
+  mem[BPP_MEMORY_PMATRIX] += pmatrix_count * states * states_padded *
+                             rate_cats * sizeof(double) +
+                             (states_padded - states) * states_padded *
+                             sizeof(double);
+}
+
+/* per-locus arrays of one species tree node (see stree_init) */
+static size_t snode_locus_bytes(void)
+{
+  size_t size = sizeof(dlist_t *) + sizeof(dlist_t) + 2*sizeof(int) +
+                sizeof(unsigned int) + 2*sizeof(double);
+
+  if (!opt_est_theta)
+    size += 2*sizeof(double);
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+    size += sizeof(double);
+
+  return size;
+}
+
+/* gene tree structure, nodes, traversal buffers and coalescent times (see
+   gtree_init and stree_alloc_internals) */
+static size_t gtree_bytes(unsigned int tips, unsigned int hybrids)
+{
+  size_t nodes = 2*(size_t)tips - 1;
+  size_t size = sizeof(gtree_t);
+
+  size += nodes * (sizeof(gnode_t) + 2*sizeof(gnode_t *) + sizeof(double));
+  if (opt_msci)
+    size += nodes * hybrids * sizeof(int);
+
+  return size;
+}
+
+/* cloned gene tree, its coalescent events and SPR workspace (see
+   gtree_clone_init and stree_alloc_internals) */
+static size_t gtree_clone_bytes(unsigned int tips)
+{
+  size_t nodes = 2*(size_t)tips - 1;
+  size_t size = sizeof(gtree_t);
+
+  size += nodes * (sizeof(gnode_t) + 2*sizeof(gnode_t *));
+  size += (tips-1) * (sizeof(dlist_item_t) + 2*sizeof(gnode_t *));
+  size += nodes * sizeof(gnode_t *);
+
+  return size;
+}
+
+static size_t stree_clone_bytes(stree_t * stree, long locus_count)
+{
+  size_t snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+
+  return sizeof(stree_t) +
+         snodes * (sizeof(snode_t) + sizeof(snode_t *) + snodes*sizeof(int)) +
+         snodes * locus_count * (snode_locus_bytes() + sizeof(snode_t *));
+}
+
+void memory_estimate(stree_t * stree,
+                     msa_t ** msa,
+                     long msa_count,
+                     int lowmem,
+                     size_t * mem)
+{
+  long i;
+  size_t snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  unsigned int attributes = (unsigned int)opt_arch;
+
+  memset(mem, 0, BPP_MEMORY_COUNT*sizeof(size_t));
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    unsigned int tips = (unsigned int)(msa[i]->count);
+    unsigned int sites = (unsigned int)(msa[i]->length);
+    unsigned int states = msa[i]->dtype == BPP_DATA_AA ? 20 : 4;
+    size_t inner_buffers = (size_t)(lowmem ? 1 : 2) * (tips-1);
+    size_t outside = ((opt_exp_outside || opt_hmc_steps) && !lowmem) ?
+                       tips-1 : 0;
+
+    if (opt_site_repeats)
+      mem[BPP_MEMORY_CLV] += ((tips + inner_buffers) * sites +
+                              BPP_REPEATS_BUFFER_SIZE(sites)) *
+                             sizeof(unsigned int);
+
+    locus_bytes(mem,
+                tips,
+                sites,
+                states,
+                padded_states(states,attributes),
+                (unsigned int)opt_alpha_cats,
+                attributes,
+                inner_buffers,
+                opt_scaling ? inner_buffers : 0,
+                outside,
+                (size_t)2 * (2*tips-2));
+
+    /* one list item per coalescent event */
+    mem[BPP_MEMORY_EVENTS] += (tips-1) * sizeof(dlist_item_t);
+
+    mem[BPP_MEMORY_GTREE] += gtree_bytes(tips, stree->hybrid_count);
+
+    if (opt_est_stree)
+      mem[BPP_MEMORY_CLONES] += gtree_clone_bytes(tips);
+  }
+
+  mem[BPP_MEMORY_EVENTS] += snodes * msa_count * snode_locus_bytes();
+
+  if (opt_est_stree)
+    mem[BPP_MEMORY_CLONES] += stree_clone_bytes(stree, msa_count);
+}
+
+void memory_usage(stree_t * stree,
+                  gtree_t ** gtree,
+                  locus_t ** locus,
+                  long locus_count,
+                  size_t * mem)
+{
+  long i;
+  unsigned int j;
+  size_t snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  size_t items = 0;
+
+  memset(mem, 0, BPP_MEMORY_COUNT*sizeof(size_t));
+
+  for (i = 0; i < locus_count; ++i)
+  {
+    locus_t * loc = locus[i];
+    size_t clv_count = opt_lowmem ? loc->clv_buffers/2 : loc->clv_buffers;
+    size_t scaler_count = opt_lowmem ?
+                            loc->scale_buffers/2 : loc->scale_buffers;
+
+    locus_bytes(mem,
+                loc->tips,
+                loc->sites,
+                loc->states,
+                loc->states_padded,
+                loc->rate_cats,
+                loc->attributes,
+                clv_count,
+                scaler_count,
+                loc->outside ? loc->tips-1 : 0,
+                loc->prob_matrices);
+
+    if (loc->repeats_id)
+      mem[BPP_MEMORY_CLV] += ((loc->tips + clv_count) * loc->sites +
+                              BPP_REPEATS_BUFFER_SIZE(loc->sites)) *
+                             sizeof(unsigned int);
+
+    /* root likelihood vector of diploid loci and per-site log-likelihoods of
+       site-parallel loci */
+    if (loc->likelihood_vector)
+      mem[BPP_MEMORY_CLV] += (size_t)loc->sites * sizeof(double);
+    if (loc->team_persite_lnl)
+      mem[BPP_MEMORY_CLV] += (size_t)loc->sites * sizeof(double);
+
+    /* single-site partials and tip states of unphased sites resolved by
+       enumeration */
+    if (loc->phase)
+      mem[BPP_MEMORY_CLV] += (size_t)(3*loc->tips-2) * loc->rate_cats *
+                             loc->states * sizeof(double) +
+                             (size_t)loc->phase->site_count * loc->tips;
+
+    mem[BPP_MEMORY_GTREE] += gtree_bytes(gtree[i]->tip_count,
+                                         stree->hybrid_count);
+    if (opt_est_stree)
+      mem[BPP_MEMORY_CLONES] += gtree_clone_bytes(gtree[i]->tip_count);
+  }
+
+  /* count the items currently in the coalescent event lists */
+  for (j = 0; j < snodes; ++j)
+  {
+    long k;
+    dlist_item_t * item;
+
+    for (k = 0; k < locus_count; ++k)
+      for (item = stree->nodes[j]->event[k]->head; item; item = item->next)
+        ++items;
+  }
+  mem[BPP_MEMORY_EVENTS] += items * sizeof(dlist_item_t);
+  mem[BPP_MEMORY_EVENTS] += snodes * locus_count * snode_locus_bytes();
+
+  if (opt_est_stree)
+    mem[BPP_MEMORY_CLONES] += stree_clone_bytes(stree, locus_count);
+}
+
+size_t memory_total(const size_t * mem)
+{
+  long i;
+  size_t total = 0;
+
+  for (i = 0; i < BPP_MEMORY_COUNT; ++i)
+    total += mem[i];
+
+  return total;
+}
+
+void memory_print(FILE * fp, const char * title, const size_t * mem)
+{
+  long i;
+
+  fprintf(fp, "%s\n", title);
+  for (i = 0; i < BPP_MEMORY_COUNT; ++i)
+    fprintf(fp, "  %-33s %10.1f MB\n",
+            memory_label[i], mem[i] / (1024.0*1024.0));
+  fprintf(fp, "  %-33s %10.1f MB\n",
+          "Total", memory_total(mem) / (1024.0*1024.0));
+}
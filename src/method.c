@@ -786,50 +786,33 @@ static void reset_finetune(FILE * fp_out, double * pjump)
   fprintf(fp_out, "\n");
 }
 
-static char * cb_serialize_branch(const snode_t * node)
+static void cb_write_branch(strbuf_t * sb, const snode_t * node)
 {
-  char * s = NULL;
-
   /* inner node */
   if (node->left)
   {
-    if (node->parent)
+    if (opt_est_theta && node->theta > 0)
     {
-      if (opt_est_theta && node->theta > 0)
-        xasprintf(&s, " #%f: %f", node->theta, node->parent->tau - node->tau);
-      else
-        xasprintf(&s, ": %f", node->parent->tau - node->tau);
+      strbuf_puts(sb," #");
+      strbuf_putf(sb,node->theta);
     }
-    else
+    if (node->parent)
     {
-      if (opt_est_theta && node->theta > 0)
-        xasprintf(&s, " #%f", node->theta);
-      else
-      {
-        /* replacement to keep GCC warning from showing up when executing
-           the following:
-           
-           xasprintf(&s, "");
-        */
-
-        s = (char *)xmalloc(sizeof(char));
-        *s = 0;
-
-      }
+      strbuf_puts(sb,": ");
+      strbuf_putf(sb,node->parent->tau - node->tau);
     }
-      
   }
   else
   {
+    strbuf_puts(sb,node->label);
     if (opt_est_theta && node->theta > 0)
-      xasprintf(&s, "%s #%f: %f",
-               node->label, node->theta, node->parent->tau - node->tau);
-    else
-      xasprintf(&s, "%s: %f", node->label, node->parent->tau - node->tau);
+    {
+      strbuf_puts(sb," #");
+      strbuf_putf(sb,node->theta);
+    }
+    strbuf_puts(sb,": ");
+    strbuf_putf(sb,node->parent->tau - node->tau);
   }
-    
-
-  return s;
 }
 
 static void status_print_pjump(FILE * fp,
@@ -894,100 +877,40 @@ static void status_print_pjump(FILE * fp,
   fprintf(fp, "  ");
 }
 
+/* set asynchronously (SIGUSR1) to request printing the streaming summary */
+static volatile sig_atomic_t ostats_print_request = 0;
+
+#ifdef SIGUSR1
+static void cb_ostats_signal(int sig)
+{
+  (void)sig;
+  ostats_print_request = 1;
+}
+#endif
+
 static void mcmc_printheader(FILE * fp, stree_t * stree)
 {
-  int print_labels = 1;
-  unsigned int i;
-  unsigned int snodes_total;
-  
-  if (opt_msci)
-    snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
-  else
-    snodes_total = stree->tip_count + stree->inner_count;
+  long i;
+  long count;
+  char ** names;
 
   if (opt_method == METHOD_10)          /* species delimitation */
     fprintf(fp, "Gen\tnp\ttree");
   else
     fprintf(fp, "Gen");
 
-  /* TODO: If number of species > 10 do not print labels */
-
-  if (stree->tip_count > 10)
-    print_labels = 0;
-
-  /* 1. Print thetas */
-  if (opt_est_theta)
+  /* thetas, taus, phis, mu_bar, nu_bar and lnL as listed in ostats.c */
+  count = ostats_columns(stree,NULL,NULL,NULL);
+  names = (char **)xmalloc((size_t)(count+1)*sizeof(char *));
+  ostats_columns(stree,NULL,NULL,names);
+  for (i = 0; i < count; ++i)
   {
-    for (i = 0; i < snodes_total; ++i)
-    {
-      /* TODO: Is the 'has_theta' check also necessary ? */
-      if (stree->nodes[i]->theta >= 0)
-      {
-        if (print_labels)
-          fprintf(fp, "\ttheta_%d%s", i+1, stree->nodes[i]->label);
-        else
-          fprintf(fp, "\ttheta_%d", i+1);
-      }
-    }
-  }
-
-  /* 2. Print taus for inner nodes */
-  for (i = stree->tip_count; i < stree->tip_count+stree->inner_count; ++i)
-  {
-    if (stree->nodes[i]->tau)
-    {
-      if (print_labels)
-        fprintf(fp, "\ttau_%d%s", i+1, stree->nodes[i]->label);
-      else
-        fprintf(fp, "\ttau_%d", i+1);
-    }
-  }
-
-  if (opt_msci)
-  {
-    unsigned int offset=stree->tip_count+stree->inner_count;
-    for (i = 0; i < stree->hybrid_count; ++i)
-    {
-      if (node_is_bidirection(stree->nodes[offset+i]))
-        fprintf(fp, "\tphi_%s", stree->nodes[offset+i]->label);
-      else
-      {
-        /* hybridization node */
-
-        /* if main node htau==0 and mirror node htau==1 then that is the only
-           case we use the phi from the main node */
-        snode_t * tmpnode = stree->nodes[offset+i];
-        if (tmpnode->hybrid->htau == 0 && tmpnode->htau == 1)
-          tmpnode = tmpnode->hybrid;
-
-        fprintf(fp,
-                "\tphi_%s<-%s",
-                tmpnode->label,
-                tmpnode->parent->label);
-      }
-
-    }
+    fprintf(fp, "\t%s", names[i]);
+    free(names[i]);
   }
+  free(names);
 
-  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
-      opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL &&
-      opt_est_mubar)
-    fprintf(fp, "\tmu_bar");
-    
-  if (opt_clock != BPP_CLOCK_GLOBAL)
-  {
-    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-      fprintf(fp, "\tnu_bar");
-    else
-      fprintf(fp, "\tnu");
-  }
-
-  /* 5. Print log likelihood */
-  if (opt_usedata)
-    fprintf(fp, "\tlnL\n"); 
-  else
-    fprintf(fp, "\n");
-
+  fprintf(fp, "\n");
 }
 
 static void mcmc_printheader_rates(FILE ** fp_locus,
@@ -1116,9 +1039,12 @@ static void mcmc_printheader_rates(FILE ** fp_locus,
 
 static void mcmc_printinitial(FILE * fp, stree_t * stree)
 {
-  char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-  fprintf(fp, "%s\n", newick);
-  free(newick);
+  strbuf_t sb;
+
+  strbuf_init(&sb);
+  stree_write_newick(&sb, stree->root, cb_write_branch);
+  fprintf(fp, "%s\n", sb.s);
+  free(sb.s);
 }
 
 static void print_rates(FILE ** fp_locus,
@@ -1281,27 +1207,22 @@ static void mcmc_logsample(FILE * fp,
                            long dparam_count,
                            long ndspecies)
 {
-  unsigned int i;
-  unsigned int snodes_total;
-  
-  if (opt_msci)
-    snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
-  else
-    snodes_total = stree->tip_count + stree->inner_count;
+  long k;
+  long count;
+  double * x;
 
-  if (opt_method == METHOD_01)          /* species tree inference */
+  if (opt_method == METHOD_01 || opt_method == METHOD_11)
   {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s\n", newick);
-    free(newick);
-    return;
-  }
+    /* species tree inference (and delimitation) */
+    strbuf_t sb;
 
-  if (opt_method == METHOD_11)    /* species tree inference and delimitation */
-  {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s %ld\n", newick, ndspecies);
-    free(newick);
+    strbuf_init(&sb);
+    stree_write_newick(&sb, stree->root, cb_write_branch);
+    if (opt_method == METHOD_01)
+      fprintf(fp, "%s\n", sb.s);
+    else
+      fprintf(fp, "%s %ld\n", sb.s, ndspecies);
+    free(sb.s);
     return;
   }
 
@@ -1313,90 +1234,38 @@ static void mcmc_logsample(FILE * fp,
     fprintf(fp, "\t%s", delimitation_getparam_string());
   }
 
-  /* 1. Print thetas */
-
-  /* TODO: Combine the next two loops? */
-
-  /* first print thetas for tips */
-  if (opt_est_theta)
-  {
-    for (i = 0; i < stree->tip_count; ++i)
-      if (stree->nodes[i]->theta >= 0)
-        fprintf(fp, "\t%.6f", stree->nodes[i]->theta);
-  }
-
-  /* then for inner nodes */
-  if (opt_est_theta)
+  /* thetas, taus, phis, mu_bar, nu_bar and lnL as listed in ostats.c */
+  count = ostats_columns(stree,gtree,NULL,NULL);
+  x = (double *)xmalloc((size_t)(count+1)*sizeof(double));
+  ostats_columns(stree,gtree,x,NULL);
+  for (k = 0; k < count; ++k)
   {
-    /* TODO: Is the 'has_theta' check also necessary ? */
-    for (i = stree->tip_count; i < snodes_total; ++i)
-      if (stree->nodes[i]->theta >= 0)
-        fprintf(fp, "\t%.6f", stree->nodes[i]->theta);
-  }
-
-  /* 2. Print taus for inner nodes */
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
-    if (stree->nodes[i]->tau)
-      fprintf(fp, "\t%.6f", stree->nodes[i]->tau);
-
-  /* 2a. Print phi for hybridization nodes */
-  if (opt_msci)
-  {
-    unsigned int offset=stree->tip_count+stree->inner_count;
-
-    for (i = 0; i < stree->hybrid_count; ++i)
-    {
-      snode_t * tmpnode = stree->nodes[offset+i];
-      if (!node_is_bidirection(tmpnode))
-      {
-        /* hybridization node */
-
-        /* if main node htau==0 and mirror node htau==1 then that is the only
-           case we use the phi from the main node */
-        if (tmpnode->hybrid->htau == 0 && tmpnode->htau == 1)
-          tmpnode = tmpnode->hybrid;
-      }
-
-      fprintf(fp, "\t%.6f", tmpnode->hphi);
-    }
-  }
-
-  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
-      opt_est_mubar &&
-      opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-    fprintf(fp,"\t%.6f",stree->locusrate_mubar);
-  if (opt_clock != BPP_CLOCK_GLOBAL)
-  {
-    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-      fprintf(fp,"\t%.6f", stree->locusrate_nubar);
+    /* the log-likelihood is the last column */
+    if (opt_usedata && k == count-1)
+      fprintf(fp, "\t%.3f", x[k]);
     else
-      fprintf(fp,"\t%.6f", stree->nui_sum / opt_locus_count);
+      fprintf(fp, "\t%.6f", x[k]);
   }
+  free(x);
 
-  /* 5. print log-likelihood if usedata=1 */
-  if (opt_usedata)
-  {
-    double logl = 0;
-
-    for (i = 0; i < stree->locus_count; ++i)
-      logl += gtree[i]->logl;
-
-    fprintf(fp, "\t%.3f\n", logl/opt_bfbeta);
-  }
-  else
-    fprintf(fp, "\n");
+  fprintf(fp, "\n");
 }
 
 static void print_gtree(FILE ** fp, gtree_t ** gtree)
 {
   long i;
+  strbuf_t sb;
 
+  /* one buffer for all loci */
+  strbuf_init(&sb);
   for (i = 0; i < opt_locus_count; ++i)
   {
-    char * newick = gtree_export_newick(gtree[i]->root,NULL);
-    fprintf(fp[i], "%s\n", newick);
-    free(newick);
+    sb.len = 0;
+    gtree_write_newick(&sb,gtree[i]->root,NULL);
+    strbuf_putc(&sb,'\n');
+    fwrite(sb.s, 1, sb.len, fp[i]);
   }
+  free(sb.s);
 }
 
 static void empirical_base_freqs_dna(msa_t * msa,
@@ -1773,6 +1642,50 @@ static FILE * resume(stree_t ** ptr_stree,
   return fp_mcmc;
 }
 
+/* print the estimated memory requirements and switch to low-memory mode, or
+   stop, if they exceed option memlimit */
+static void memory_check(stree_t * stree,
+                         msa_t ** msa_list,
+                         long msa_count,
+                         FILE * fp_out)
+{
+  size_t mem[BPP_MEMORY_COUNT];
+  size_t lowmem[BPP_MEMORY_COUNT];
+  double total, total_lowmem;
+
+  memory_estimate(stree,msa_list,msa_count,(int)opt_lowmem,mem);
+  total = memory_total(mem) / (1024.0*1024.0);
+
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+  memory_print(stdout, "Estimated memory requirements:", mem);
+  memory_print(fp_out, "Estimated memory requirements:", mem);
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+
+  if (!opt_memlimit || total <= opt_memlimit)
+    return;
+
+  if (opt_lowmem)
+    fatal("Estimated memory (%.1f MB) exceeds memlimit (%ld MB)",
+          total, opt_memlimit);
+
+  /* keep a single CLV per gene tree node if that fits within the limit */
+  memory_estimate(stree,msa_list,msa_count,1,lowmem);
+  total_lowmem = memory_total(lowmem) / (1024.0*1024.0);
+  if (total_lowmem > opt_memlimit)
+    fatal("Estimated memory (%.1f MB, or %.1f MB in low-memory mode) exceeds "
+          "memlimit (%ld MB)", total, total_lowmem, opt_memlimit);
+
+  opt_lowmem = 1;
+  fprintf(stdout, "Estimated memory (%.1f MB) exceeds memlimit (%ld MB) - "
+          "using low-memory mode (%.1f MB)\n\n",
+          total, opt_memlimit, total_lowmem);
+  fprintf(fp_out, "Estimated memory (%.1f MB) exceeds memlimit (%ld MB) - "
+          "using low-memory mode (%.1f MB)\n\n",
+          total, opt_memlimit, total_lowmem);
+}
+
 /* initialize everything - species tree, gene trees, locus structures etc.
    NOTE: *ALL* parameters of this function are output parameters, therefore
    do not concentrate on them when reading this function - they are filled
@@ -2051,6 +1964,7 @@ static FILE * init(stree_t ** ptr_stree,
   unsigned long ** mapping = NULL;
   unsigned long ** resolution_count = NULL;
   int * unphased_length = NULL;
+  phase_t ** phase = NULL;
 
   if (opt_diploid)
   {
@@ -2062,12 +1976,15 @@ static FILE * init(stree_t ** ptr_stree,
     /* compute and replace msa_list with alignments A3. resolution_count
        contains the number of resolved sites in A2 for each site in A1,
        i.e. resolution_count[0][3] contains the number of resolved sites in A2
-       for the fourth site of locus 0 */
+       for the fourth site of locus 0. phase lists the sites of each locus
+       whose resolutions are enumerated instead */
+    phase = (phase_t **)xmalloc((size_t)msa_count * sizeof(phase_t *));
     resolution_count = diploid_resolve(stree,
                                        msa_list,
                                        map_list,
                                        weights,
-                                       msa_count);
+                                       msa_count,
+                                       phase);
 
     /* TODO: KEEP WEIGHTS */
     //for (i = 0; i < msa_count; ++i) free(weights[i]);
@@ -2126,6 +2043,9 @@ static FILE * init(stree_t ** ptr_stree,
     msa_summary(fp_out, msa_list,msa_count);
   }
 
+  /* predict memory required by gene trees and loci before allocating them */
+  memory_check(stree,msa_list,msa_count,fp_out);
+
   /* Pin master thread for NUMA first policy touch
      TODO: Perhaps move this to an earlier point */
   if (opt_threads > 1)
@@ -2139,6 +2059,7 @@ static FILE * init(stree_t ** ptr_stree,
       unsigned long ** tmp_rescount = NULL;
       unsigned int ** tmp_weights = NULL;
       int * tmp_unphased_length = NULL;
+      phase_t ** tmp_phase = NULL;
 
       /* allocate temporary arrays */
       if (opt_diploid)
@@ -2148,6 +2069,7 @@ static FILE * init(stree_t ** ptr_stree,
         tmp_rescount = (unsigned long **)xmalloc((size_t)msa_count *
                                                  sizeof(unsigned int long *));
         tmp_unphased_length = (int *)xmalloc((size_t)msa_count * sizeof(int));
+        tmp_phase = (phase_t **)xmalloc((size_t)msa_count * sizeof(phase_t *));
       }
       tmp_weights = (unsigned int **)xmalloc((size_t)msa_count *
                                              sizeof(unsigned int *));
@@ -2160,6 +2082,7 @@ static FILE * init(stree_t ** ptr_stree,
           tmp_mapping[i]         = mapping[indices[i]];
           tmp_rescount[i]        = resolution_count[indices[i]];
           tmp_unphased_length[i] = unphased_length[indices[i]];
+          tmp_phase[i]           = phase[indices[i]];
         }
         tmp_weights[i]         = weights[indices[i]];
       }
@@ -2169,6 +2092,7 @@ static FILE * init(stree_t ** ptr_stree,
         memmove(mapping,tmp_mapping,opt_locus_count * sizeof(unsigned long *));
         memmove(resolution_count,tmp_rescount,opt_locus_count * sizeof(unsigned long *));
         memmove(unphased_length,tmp_unphased_length,opt_locus_count*sizeof(int));
+        memmove(phase,tmp_phase,opt_locus_count*sizeof(phase_t *));
       }
       memmove(weights,tmp_weights,opt_locus_count*sizeof(unsigned int *));
 
@@ -2177,6 +2101,7 @@ static FILE * init(stree_t ** ptr_stree,
         free(tmp_mapping);
         free(tmp_rescount);
         free(tmp_unphased_length);
+        free(tmp_phase);
       }
       free(tmp_weights);
 
@@ -2355,7 +2280,7 @@ static FILE * init(stree_t ** ptr_stree,
     stree_rootdist(stree,map_list,msa_list,weights);
   }
 
-  gtree = gtree_init(stree,msa_list,map_list,msa_count);
+  gtree = gtree_init(stree,msa_list,map_list,weights,msa_count);
   for (i = 0; i < opt_locus_count; ++i)
     gtree[i]->original_index = msa_list[i]->original_index;
 
@@ -2511,6 +2436,8 @@ static FILE * init(stree_t ** ptr_stree,
       locus[i]->likelihood_vector = (double *)xmalloc((size_t)(msa->length) *
                                                       sizeof(double));
       locus[i]->unphased_length = unphased_length[i];
+      if (phase[i])
+        locus_set_phase(locus[i],phase[i]);
     }
     else
     {
@@ -2521,6 +2448,7 @@ static FILE * init(stree_t ** ptr_stree,
     /* set tip sequences */
     for (j = 0; j < (int)(gtree[i]->tip_count); ++j)
       pll_set_tip_states(locus[i], j, pll_map, msa_list[i]->sequence[j]);
+    locus_repeats_init(locus[i]);
 
     if (opt_est_locusrate == MUTRATE_ESTIMATE &&
         opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
@@ -2638,6 +2566,7 @@ static FILE * init(stree_t ** ptr_stree,
     free(mapping);
     free(unphased_length);
     free(resolution_count);
+    free(phase);
   }
 
   #if 0
@@ -2660,6 +2589,14 @@ static FILE * init(stree_t ** ptr_stree,
   if (opt_est_delimit)          /* species delimitation */
     rj_init(gtree,stree,msa_count);
 
+  /* per-locus and per-population steps for adaptive finetune */
+  if (opt_finetune_adapt)
+    adapt_init(stree,locus,msa_count);
+
+  /* per-locus step lengths and scales of the HMC branch rate move */
+  if (opt_hmc_steps)
+    adapt_hmc_init(stree,locus,msa_count);
+
   /* initialize pjump and finetune rounds */
   pjump = (double *)xcalloc(PROP_COUNT+GTR_PROP_COUNT+CLOCK_PROP_COUNT+1+1,
                             sizeof(double));
@@ -2836,6 +2773,16 @@ static void check_logl(stree_t * stree, gtree_t ** gtree, locus_t ** locus, long
   }
 }
 
+#endif
+#ifdef CHECK_ALLOC
+static void check_alloc(long alloc_count, long iter, const char * move)
+{
+  long count = debug_alloc_count() - alloc_count;
+
+  if (count)
+    fatal("[DBG] %ld system allocations iter: %ld move: %s",
+          count, iter, move);
+}
 #endif
 #ifdef CHECK_LNPRIOR
 static void check_lnprior(stree_t * stree, gtree_t ** gtree, long iter, const char * move)
@@ -2915,6 +2862,9 @@ void cmd_run()
   gtree_t ** gclones;
 
   unsigned long curstep = 0;
+  #ifdef CHECK_ALLOC
+  long dbg_alloc_count = 0;
+  #endif
 
   printf("\nStarting timer..\n");
   timer_start();
@@ -3051,12 +3001,21 @@ void cmd_run()
   assert(!(enabled_mui && enabled_lrht));
 
 
+  /* from here on each chain continues in its own process */
+  if (opt_chains * opt_chain_betas > 1 || opt_heated_chains > 1)
+    chains_start(stree, gtree, fp_out, fp_mcmc);
+
   if (opt_threads > 1)
   {
     threads_lb_stats(locus, fp_out);
+    if (opt_procs > 1)
+      mproc_start(fp_out, fp_mcmc);
     threads_init();
+    threads_first_touch(locus, fp_out);
     memset(&td,0,sizeof(td));
   }
+  if (opt_site_threads)
+    threads_teams_init(locus, opt_locus_count, fp_out);
 
   /* flush all open files */
   fflush(NULL);
@@ -3105,6 +3064,22 @@ void cmd_run()
 
   printk = opt_samplefreq * opt_samples;
 
+  /* streaming posterior summaries (restored from the checkpoint if resuming),
+     printed on screen whenever the process receives SIGUSR1 */
+  ostats_init(stree,gtree);
+
+  /* loci with identical substitution models share parameters and eigen
+     decompositions */
+  locus_share_models(locus,opt_locus_count);
+
+  /* per-thread scratch memory for proposals */
+  arena_init(stree,gtree,locus);
+
+  #ifdef SIGUSR1
+  if (!opt_onlysummary)
+    signal(SIGUSR1, cb_ostats_signal);
+  #endif
+
   /* check if summary only was requested (no MCMC) and initialize counter
      for MCMC loop appropriately */
   if (opt_onlysummary)
@@ -3169,6 +3144,17 @@ void cmd_run()
         reset_finetune(fp_out, pjump);
       }
 
+      /* report the adapted steps that are used for sampling */
+      if ((opt_finetune_adapt || opt_hmc_steps) && i == 0 && opt_burnin)
+      {
+        if (!opt_finetune_reset || opt_burnin < 200)
+          fprintf(stdout, "\n");
+        if (opt_finetune_adapt)
+          mproc_sync_finetune(locus);
+        adapt_print(stdout,stree,locus,opt_locus_count);
+        adapt_print(fp_out,stree,locus,opt_locus_count);
+      }
+
       /* reset pjump and number of steps since last finetune reset to zero */
       ft_round = 0;
       memset(pjump, 0, pjump_size * sizeof(double));
@@ -3192,6 +3178,10 @@ void cmd_run()
 
     ++ft_round;
 
+    /* Robbins-Monro gain of adaptive finetune, zero after burn-in */
+    if (opt_finetune_adapt || opt_hmc_steps)
+      adapt_set_iteration(i);
+
     /* propose delimitation through merging/splitting of nodes */
     if (opt_est_delimit)        /* species delimitation */
     {
@@ -3255,17 +3245,57 @@ void cmd_run()
       debug_validate_logpg(stree, gtree, locus, "GAGE-1");
       #endif
 
-    /* propose gene tree ages */
-    if (opt_threads == 1)
-      ratio = gtree_propose_ages_serial(locus, gtree, stree);
-    else
+    /* with multiple threads, gene tree age and SPR proposals of each thread's
+       loci are performed in a single dispatch, and the state can only be
+       checked after both moves */
+    if (opt_threads > 1)
     {
+      #ifdef CHECK_ALLOC
+      dbg_alloc_count = debug_alloc_count();
+      #endif
       td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTAGE,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+      td.moves = (1l << BPP_MOVE_GTAGE_INDEX) | (1l << BPP_MOVE_GTSPR_INDEX);
+      threads_wakeup(THREAD_WORK_FUSED,&td);
+
+      ratio = td.move_accepted[BPP_MOVE_GTAGE_INDEX] ?
+                ((double)(td.move_accepted[BPP_MOVE_GTAGE_INDEX]) /
+                 td.move_proposals[BPP_MOVE_GTAGE_INDEX]) : 0;
+      pjump[BPP_MOVE_GTAGE_INDEX] = (pjump[BPP_MOVE_GTAGE_INDEX]*(ft_round-1)+ratio) /
+                                    (double)ft_round;
+
+      ratio = td.move_accepted[BPP_MOVE_GTSPR_INDEX] ?
+                ((double)(td.move_accepted[BPP_MOVE_GTSPR_INDEX]) /
+                 td.move_proposals[BPP_MOVE_GTSPR_INDEX]) : 0;
+      pjump[BPP_MOVE_GTSPR_INDEX] = (pjump[BPP_MOVE_GTSPR_INDEX]*(ft_round-1)+ratio) /
+                                    (double)ft_round;
+
+      #ifdef CHECK_ALLOC
+      check_alloc(dbg_alloc_count, i, "GAGE+GSPR");
+      #endif
+      #ifdef CHECK_LOGL
+      check_logl(stree, gtree, locus, i, "GAGE+GSPR");
+      #endif
+      #ifdef CHECK_LOGPR
+      debug_validate_logpg(stree, gtree, locus, "GAGE+GSPR");
+      #endif
+      #ifdef CHECK_LNPRIOR
+      check_lnprior(stree, gtree, i, "GAGE+GSPR");
+      #endif
+      if (opt_debug_bruce)
+        debug_bruce(stree,gtree,"GAGE+GSPR", i, fp_debug);
     }
-    pjump[BPP_MOVE_GTAGE_INDEX] = (pjump[BPP_MOVE_GTAGE_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
+    else
+    {
+      /* propose gene tree ages */
+      #ifdef CHECK_ALLOC
+      dbg_alloc_count = debug_alloc_count();
+      #endif
+      ratio = gtree_propose_ages_serial(locus, gtree, stree);
+      pjump[BPP_MOVE_GTAGE_INDEX] = (pjump[BPP_MOVE_GTAGE_INDEX]*(ft_round-1)+ratio) /
+                                    (double)ft_round;
+      #ifdef CHECK_ALLOC
+      check_alloc(dbg_alloc_count, i, "GAGE");
+      #endif
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "GAGE");
       #endif
@@ -3278,18 +3308,16 @@ void cmd_run()
       if (opt_debug_bruce)
         debug_bruce(stree,gtree,"GAGE", i, fp_debug);
 
-    /* propose gene tree topologies using SPR */
-    if (opt_threads == 1)
+      /* propose gene tree topologies using SPR */
+      #ifdef CHECK_ALLOC
+      dbg_alloc_count = debug_alloc_count();
+      #endif
       ratio = gtree_propose_spr_serial(locus,gtree,stree);
-    else
-    {
-      td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTSPR,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
-    }
-    pjump[BPP_MOVE_GTSPR_INDEX] = (pjump[BPP_MOVE_GTSPR_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-
+      pjump[BPP_MOVE_GTSPR_INDEX] = (pjump[BPP_MOVE_GTSPR_INDEX]*(ft_round-1)+ratio) /
+                                    (double)ft_round;
+      #ifdef CHECK_ALLOC
+      check_alloc(dbg_alloc_count, i, "GSPR");
+      #endif
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "GSPR");
       #endif
@@ -3301,6 +3329,7 @@ void cmd_run()
       #endif
       if (opt_debug_bruce)
         debug_bruce(stree,gtree,"GSPR", i, fp_debug);
+    }
 
     /* propose population sizes on species tree */
     if (opt_est_theta)
@@ -3337,9 +3366,15 @@ void cmd_run()
     }
 
     /* mixing step */
+    #ifdef CHECK_ALLOC
+    dbg_alloc_count = debug_alloc_count();
+    #endif
     ratio = proposal_mixing(gtree,stree,locus);
     pjump[BPP_MOVE_MIX_INDEX] = (pjump[BPP_MOVE_MIX_INDEX]*(ft_round-1)+ratio) /
                                 (double)ft_round;
+      #ifdef CHECK_ALLOC
+      check_alloc(dbg_alloc_count, i, "MIXING");
+      #endif
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "MIXING");
       #endif
@@ -3382,16 +3417,32 @@ void cmd_run()
       #endif
     }
 
+    /* substitution model proposals of each thread's loci in one dispatch */
+    #ifdef CHECK_ALLOC
+    dbg_alloc_count = debug_alloc_count();
+    #endif
+    if (opt_threads > 1 &&
+        (enabled_prop_freqs || enabled_prop_qrates || enabled_prop_alpha))
+    {
+      td.locus = locus; td.gtree = gtree; td.stree = stree;
+      td.moves = 0;
+      if (enabled_prop_freqs)
+        td.moves |= 1l << BPP_MOVE_FREQS_INDEX;
+      if (enabled_prop_qrates)
+        td.moves |= 1l << BPP_MOVE_QRATES_INDEX;
+      if (enabled_prop_alpha)
+        td.moves |= 1l << BPP_MOVE_ALPHA_INDEX;
+      threads_wakeup(THREAD_WORK_FUSED,&td);
+    }
+
     if (enabled_prop_freqs)
     {
       if (opt_threads == 1)
         ratio = locus_propose_freqs_serial(stree,locus,gtree);
       else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_FREQS,&td);
-        ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
-      }
+        ratio = td.move_proposals[BPP_MOVE_FREQS_INDEX] ?
+                  ((double)(td.move_accepted[BPP_MOVE_FREQS_INDEX]) /
+                   td.move_proposals[BPP_MOVE_FREQS_INDEX]) : 0;
       pjump[BPP_MOVE_FREQS_INDEX] = (pjump[BPP_MOVE_FREQS_INDEX]*(ft_round-1)+ratio) /
                                     (double)ft_round;
     }
@@ -3401,27 +3452,33 @@ void cmd_run()
       if (opt_threads == 1)
         ratio = locus_propose_qrates_serial(stree,locus,gtree);
       else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_RATES,&td);
-        ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
-      }
+        ratio = td.move_proposals[BPP_MOVE_QRATES_INDEX] ?
+                  ((double)(td.move_accepted[BPP_MOVE_QRATES_INDEX]) /
+                   td.move_proposals[BPP_MOVE_QRATES_INDEX]) : 0;
       pjump[BPP_MOVE_QRATES_INDEX] = (pjump[BPP_MOVE_QRATES_INDEX]*(ft_round-1)+ratio) /
                                     (double)ft_round;
     }
 
     if (enabled_prop_alpha)
     {
+      #ifdef CHECK_ALLOC
+      if (opt_threads == 1)
+        dbg_alloc_count = debug_alloc_count();
+      #endif
       if (opt_threads == 1)
         ratio = locus_propose_alpha_serial(stree,locus,gtree);
       else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_ALPHA,&td);
-        ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
-      }
+        ratio = td.move_accepted[BPP_MOVE_ALPHA_INDEX] ?
+                  ((double)(td.move_accepted[BPP_MOVE_ALPHA_INDEX]) /
+                   td.move_proposals[BPP_MOVE_ALPHA_INDEX]) : 0;
       pjump[BPP_MOVE_ALPHA_INDEX] = (pjump[BPP_MOVE_ALPHA_INDEX]*(ft_round-1)+ratio) /
                                     (double)ft_round;
+      #ifdef CHECK_ALLOC
+      /* with threads, the alpha proposals ran in the dispatch above together
+         with the frequency and rate proposals, which allocate memory */
+      if (opt_threads == 1 || (!enabled_prop_freqs && !enabled_prop_qrates))
+        check_alloc(dbg_alloc_count, i, "ALPHA");
+      #endif
     }
 
     /* TODO: Delete after debugging */
@@ -3507,12 +3564,19 @@ void cmd_run()
       #endif
     }
 
+    /* log-densities of the loci of other processes */
+    mproc_sync_gtrees(gtree);
+
+    /* propose swaps between heated chains */
+    chains_swap(i, gtree);
+
     /* log sample into file (dparam_count is only used in method 10) */
     if ((i + 1) % (opt_samplefreq*5) == 0)
        fflush(NULL);
-    if (i >= 0 && (i+1)%opt_samplefreq == 0)
+    if (i >= 0 && (i+1)%opt_samplefreq == 0 && chains_cold())
     {
       mcmc_logsample(fp_mcmc,i+1,stree,gtree,locus,dparam_count,ndspecies);
+      ostats_update(stree,gtree);
 
       /* log gene trees */
       if (opt_print_genetrees)
@@ -3638,6 +3702,12 @@ void cmd_run()
       mean_logl = (mean_logl * (ft_round-1) + logl_sum / opt_bfbeta)/ft_round;
     }
 
+    /* report progress to the process monitoring the chains */
+    chains_update(i + opt_burnin + 1,
+                  gtree,
+                  mean_logl,
+                  i >= 0 && (i+1)%opt_samplefreq == 0);
+
     /* print MCMC status on screen */
     if (printk <= 500 || (i+1) % (printk / 200) == 0)
     {
@@ -3822,21 +3892,58 @@ void cmd_run()
                         prec_logl);
       }
     }
+    if (ostats_print_request)
+    {
+      ostats_print_request = 0;
+      fprintf(stdout, "\n");
+      ostats_print(stdout);
+    }
     if (opt_debug_abort == opt_debug_counter)
       fatal("[DBG] Aborting debugging (reached step %ld)", opt_debug_abort);
   }
+  #ifdef SIGUSR1
+  if (!opt_onlysummary)
+    signal(SIGUSR1, SIG_DFL);
+  #endif
+  ostats_fini();
+  arena_fini();
   if (!opt_onlysummary)
     timer_print("\n", " spent in MCMC\n\n", fp_out);
 
+  /* report memory used by each subsystem */
+  if (!opt_onlysummary)
+  {
+    size_t mem[BPP_MEMORY_COUNT];
+
+    memory_usage(stree,gtree,locus,opt_locus_count,mem);
+    memory_print(stdout, "Memory used:", mem);
+    memory_print(fp_out, "Memory used:", mem);
+    fprintf(stdout, "  %-33s %10.1f MB\n\n", "Peak resident set size",
+            arch_get_memused() / (1024.0*1024.0));
+    fprintf(fp_out, "  %-33s %10.1f MB\n\n", "Peak resident set size",
+            arch_get_memused() / (1024.0*1024.0));
+  }
+  if (opt_site_repeats && !opt_onlysummary)
+  {
+    locus_repeats_summary(stdout,locus,opt_locus_count,0);
+    locus_repeats_summary(fp_out,locus,opt_locus_count,1);
+  }
+
   #if 0
   progress_done();
   #endif
 
   free(pjump);
 
+  if (opt_site_threads)
+    threads_teams_exit(locus, opt_locus_count);
   if (opt_threads > 1)
     threads_exit();
 
+  /* worker processes terminate here */
+  mproc_finish();
+  chains_finish(fp_out);
+
   if (opt_bfbeta != 1 && !opt_onlysummary)
   {
     fprintf(stdout, "\nBFbeta = %8.6f  E_b(lnf(X)) = %9.4f\n\n", opt_bfbeta, mean_logl);
@@ -3916,7 +4023,7 @@ void cmd_run()
   }
   else if (opt_method == METHOD_11)
   {
-    mixed_summary(fp_out,stree->tip_count);
+    mixed_summary(fp_out,stree);
     delimitations_fini();
     rj_fini();
     free(pspecies);
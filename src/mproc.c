@@ -0,0 +1,523 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Locus-sharded MCMC on several processes. The loci are split into
+   contiguous shards along the thread boundaries computed by the load
+   balancer, and each process creates only the locus threads of its own
+   shard. Every process keeps a replica of the species tree and executes the
+   species-level moves identically, drawing the same random numbers, while
+   the results of each parallel step (acceptance counts, log-density
+   differences and the random number generator states of the threads) and
+   the per-locus log-densities are exchanged between the processes. Process 0
+   is the coordinator and the only one that writes output. Gene trees of
+   other shards are never modified in a process, and since the processes are
+   forked after all data is read, their pages remain shared.
+
+   The exchange is an all-gather of the slices owned by each process, and is
+   implemented by a transport: either a Unix domain socket between each
+   worker and the coordinator, or a shared memory region with a barrier. */
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define MPROC_SHM_HEADER        4096
+
+typedef struct transport_s
+{
+  const char * name;
+  void (*open)(size_t capacity);
+  void (*attach)(void);
+  void (*allgather)(char * buf, const size_t * offset);
+  void (*close)(void);
+} transport_t;
+
+typedef struct shm_header_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  long arrived;
+  unsigned long generation;
+} shm_header_t;
+
+static long rank = 0;
+static long procs = 1;
+static long * thread_bound = NULL;
+static long * locus_bound = NULL;
+static size_t * offsets = NULL;
+static double * locus_buffer = NULL;
+static pid_t * pid = NULL;
+static pid_t coordinator_pid = 0;
+static const transport_t * transport = NULL;
+
+/* socket transport: sock_fd[2r] is the coordinator end and sock_fd[2r+1] the
+   worker end of the socket pair of worker r */
+static int * sock_fd = NULL;
+
+/* shared memory transport */
+static shm_header_t * shm = NULL;
+static char * shm_data = NULL;
+static size_t shm_size = 0;
+
+/* check whether the other processes are still running */
+static int peers_alive()
+{
+  int status;
+
+  if (rank)
+    return getppid() == coordinator_pid;
+
+  return waitpid(-1, &status, WNOHANG) <= 0;
+}
+
+static void peer_lost()
+{
+  if (rank)
+    fatal("Process %ld: lost connection to the coordinator process", rank);
+
+  fatal("A worker process terminated unexpectedly");
+}
+
+static void read_full(int fd, char * buf, size_t size)
+{
+  while (size)
+  {
+    ssize_t n = read(fd, buf, size);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0)
+      peer_lost();
+
+    buf += n;
+    size -= (size_t)n;
+  }
+}
+
+static void write_full(int fd, const char * buf, size_t size)
+{
+  while (size)
+  {
+    ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0)
+      peer_lost();
+
+    buf += n;
+    size -= (size_t)n;
+  }
+}
+
+static void sock_open(size_t capacity)
+{
+  long r;
+
+  sock_fd = (int *)xmalloc((size_t)(2*procs) * sizeof(int));
+  for (r = 1; r < procs; ++r)
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fd+2*r))
+      fatal("Cannot create socket pair for process %ld", r);
+}
+
+static void sock_attach()
+{
+  long r;
+
+  /* keep only the ends of the sockets used by this process */
+  for (r = 1; r < procs; ++r)
+  {
+    if (rank == 0)
+      close(sock_fd[2*r+1]);
+    else
+    {
+      close(sock_fd[2*r]);
+      if (r != rank)
+        close(sock_fd[2*r+1]);
+    }
+  }
+}
+
+/* workers send their slice to the coordinator, which collects the slices in
+   process order and sends back the complete buffer */
+static void sock_allgather(char * buf, const size_t * offset)
+{
+  long r;
+
+  if (rank)
+  {
+    int fd = sock_fd[2*rank+1];
+
+    write_full(fd, buf+offset[rank], offset[rank+1]-offset[rank]);
+    read_full(fd, buf, offset[procs]);
+    return;
+  }
+
+  for (r = 1; r < procs; ++r)
+    read_full(sock_fd[2*r], buf+offset[r], offset[r+1]-offset[r]);
+  for (r = 1; r < procs; ++r)
+    write_full(sock_fd[2*r], buf, offset[procs]);
+}
+
+static void sock_close()
+{
+  long r;
+
+  if (rank)
+    close(sock_fd[2*rank+1]);
+  else
+    for (r = 1; r < procs; ++r)
+      close(sock_fd[2*r]);
+
+  free(sock_fd);
+  sock_fd = NULL;
+}
+
+static void shm_open_region(size_t capacity)
+{
+  pthread_mutexattr_t mattr;
+  pthread_condattr_t cattr;
+  void * p;
+
+  assert(sizeof(shm_header_t) <= MPROC_SHM_HEADER);
+
+  shm_size = MPROC_SHM_HEADER + capacity;
+  p = mmap(NULL,
+           shm_size,
+           PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS,
+           -1,
+           0);
+  if (p == MAP_FAILED)
+    fatal("Cannot allocate %ld bytes of shared memory", (long)shm_size);
+
+  shm = (shm_header_t *)p;
+  shm_data = (char *)p + MPROC_SHM_HEADER;
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&shm->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&shm->cond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  shm->arrived = 0;
+  shm->generation = 0;
+}
+
+static void shm_attach()
+{
+}
+
+/* wait until all processes arrive, checking every second that the others are
+   still alive */
+static void shm_barrier()
+{
+  unsigned long generation;
+
+  pthread_mutex_lock(&shm->mutex);
+  generation = shm->generation;
+  if (++shm->arrived == procs)
+  {
+    shm->arrived = 0;
+    shm->generation++;
+    pthread_cond_broadcast(&shm->cond);
+  }
+  else
+  {
+    while (shm->generation == generation)
+    {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      if (pthread_cond_timedwait(&shm->cond, &shm->mutex, &ts) == ETIMEDOUT &&
+          !peers_alive())
+      {
+        pthread_mutex_unlock(&shm->mutex);
+        peer_lost();
+      }
+    }
+  }
+  pthread_mutex_unlock(&shm->mutex);
+}
+
+static void shm_allgather(char * buf, const size_t * offset)
+{
+  memcpy(shm_data+offset[rank],
+         buf+offset[rank],
+         offset[rank+1]-offset[rank]);
+  shm_barrier();
+
+  memcpy(buf, shm_data, offset[rank]);
+  memcpy(buf+offset[rank+1],
+         shm_data+offset[rank+1],
+         offset[procs]-offset[rank+1]);
+
+  /* the region must not be overwritten before everyone has read it */
+  shm_barrier();
+}
+
+static void shm_close()
+{
+  munmap((void *)shm, shm_size);
+  shm = NULL;
+  shm_data = NULL;
+}
+
+static const transport_t transport_socket =
+  { "socket", sock_open, sock_attach, sock_allgather, sock_close };
+
+static const transport_t transport_shm =
+  { "shared memory", shm_open_region, shm_attach, shm_allgather, shm_close };
+
+static void redirect_output(FILE * fp_out, FILE * fp_mcmc)
+{
+  int fd = open("/dev/null", O_WRONLY);
+
+  if (fd < 0)
+    fatal("Process %ld: cannot open /dev/null", rank);
+
+  if (dup2(fd, fileno(stdout)) < 0 ||
+      dup2(fd, fileno(fp_out)) < 0 ||
+      dup2(fd, fileno(fp_mcmc)) < 0)
+    fatal("Process %ld: cannot redirect output", rank);
+
+  close(fd);
+}
+
+static void allgather(void * buf, size_t size, const long * bound)
+{
+  long r;
+
+  if (procs == 1) return;
+
+  for (r = 0; r <= procs; ++r)
+    offsets[r] = (size_t)bound[r] * size;
+
+  transport->allgather((char *)buf, offsets);
+}
+
+void mproc_start(FILE * fp_out, FILE * fp_mcmc)
+{
+  long r;
+  size_t capacity;
+  thread_info_t * ti = threads_ti();
+
+  if (opt_msci)
+    fatal("Option 'processes' cannot be used with introgression models");
+
+  procs = opt_procs;
+  thread_bound = (long *)xmalloc((size_t)(procs+1) * sizeof(long));
+  locus_bound = (long *)xmalloc((size_t)(procs+1) * sizeof(long));
+  offsets = (size_t *)xmalloc((size_t)(procs+1) * sizeof(size_t));
+
+  for (r = 0; r < procs; ++r)
+  {
+    thread_bound[r] = opt_threads * r / procs;
+    locus_bound[r] = ti[thread_bound[r]].locus_first;
+  }
+  thread_bound[procs] = opt_threads;
+  locus_bound[procs] = opt_locus_count;
+
+  transport = (opt_procs_transport == BPP_TRANSPORT_SHM) ?
+                &transport_shm : &transport_socket;
+
+  fprintf(stdout, "Running on %ld processes (%s transport):\n",
+          procs, transport->name);
+  fprintf(fp_out, "Running on %ld processes (%s transport):\n",
+          procs, transport->name);
+  for (r = 0; r < procs; ++r)
+  {
+    fprintf(stdout, "  Process %ld: threads %ld-%ld, loci %ld-%ld\n",
+            r, thread_bound[r]+1, thread_bound[r+1],
+            locus_bound[r]+1, locus_bound[r+1]);
+    fprintf(fp_out, "  Process %ld: threads %ld-%ld, loci %ld-%ld\n",
+            r, thread_bound[r]+1, thread_bound[r+1],
+            locus_bound[r]+1, locus_bound[r+1]);
+  }
+
+  /* largest exchanged buffer: one result per thread or two values per locus */
+  capacity = MAX((size_t)opt_threads * sizeof(thread_result_t),
+                 (size_t)opt_locus_count * 2 * sizeof(double));
+  transport->open(capacity);
+
+  locus_buffer = (double *)xmalloc((size_t)opt_locus_count * 2 *
+                                   sizeof(double));
+
+  /* unwritten buffers would otherwise be written once by each process */
+  fflush(NULL);
+
+  coordinator_pid = getpid();
+  pid = (pid_t *)xcalloc((size_t)procs, sizeof(pid_t));
+  for (r = 1; r < procs; ++r)
+  {
+    pid_t p = fork();
+
+    if (p < 0)
+      fatal("Cannot create process %ld", r);
+
+    if (p == 0)
+    {
+      rank = r;
+      break;
+    }
+    pid[r] = p;
+  }
+
+  if (rank)
+    redirect_output(fp_out, fp_mcmc);
+
+  transport->attach();
+}
+
+/* called after the MCMC loop; workers terminate here and the coordinator
+   waits for them */
+void mproc_finish()
+{
+  long r;
+  int status;
+
+  if (procs == 1) return;
+
+  transport->close();
+
+  if (rank)
+    exit(EXIT_SUCCESS);
+
+  for (r = 1; r < procs; ++r)
+  {
+    if (waitpid(pid[r], &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status))
+      fatal("Process %ld terminated abnormally", r);
+  }
+
+  free(pid);
+  free(thread_bound);
+  free(locus_bound);
+  free(offsets);
+  free(locus_buffer);
+  pid = NULL;
+  thread_bound = locus_bound = NULL;
+  offsets = NULL;
+  locus_buffer = NULL;
+  procs = 1;
+}
+
+#else
+
+static long rank = 0;
+static long procs = 1;
+static long * thread_bound = NULL;
+static long * locus_bound = NULL;
+static double * locus_buffer = NULL;
+
+static void allgather(void * buf, size_t size, const long * bound)
+{
+}
+
+void mproc_start(FILE * fp_out, FILE * fp_mcmc)
+{
+  fatal("Option 'processes' is not supported on Windows");
+}
+
+void mproc_finish()
+{
+}
+
+#endif
+
+long mproc_thread_first()
+{
+  return (procs > 1) ? thread_bound[rank] : 0;
+}
+
+long mproc_thread_end()
+{
+  return (procs > 1) ? thread_bound[rank+1] : opt_threads;
+}
+
+long mproc_locus_first()
+{
+  return (procs > 1) ? locus_bound[rank] : 0;
+}
+
+long mproc_locus_end()
+{
+  return (procs > 1) ? locus_bound[rank+1] : opt_locus_count;
+}
+
+/* exchange the result record of each thread, or one record of the given
+   size per locus */
+void mproc_gather_threads(thread_result_t * results)
+{
+  allgather(results, sizeof(thread_result_t), thread_bound);
+}
+
+void mproc_gather_loci(void * buf, size_t size)
+{
+  allgather(buf, size, locus_bound);
+}
+
+/* bring the log-likelihood and log-density of the gene trees of other shards
+   up to date, for the MCMC sample and the status line */
+void mproc_sync_gtrees(gtree_t ** gtree)
+{
+  long i;
+
+  if (procs == 1) return;
+
+  for (i = locus_bound[rank]; i < locus_bound[rank+1]; ++i)
+  {
+    locus_buffer[2*i]   = gtree[i]->logl;
+    locus_buffer[2*i+1] = gtree[i]->logpr;
+  }
+
+  mproc_gather_loci(locus_buffer, 2*sizeof(double));
+
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    gtree[i]->logl  = locus_buffer[2*i];
+    gtree[i]->logpr = locus_buffer[2*i+1];
+  }
+}
+
+/* same for the adapted per-locus finetune steps before they are printed */
+void mproc_sync_finetune(locus_t ** locus)
+{
+  long i;
+
+  if (procs == 1) return;
+
+  for (i = locus_bound[rank]; i < locus_bound[rank+1]; ++i)
+    locus_buffer[i] = locus[i]->finetune_gtspr;
+
+  mproc_gather_loci(locus_buffer, sizeof(double));
+
+  for (i = 0; i < opt_locus_count; ++i)
+    locus[i]->finetune_gtspr = locus_buffer[i];
+}
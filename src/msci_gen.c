@@ -1505,11 +1505,34 @@ static void process_hybrid(stree_t * stree, mscidefs_t * def)
 ***/
 extern long opt_msci_faketree_binarize;
 
-static char* msci_export_newick_recursive(const snode_t* root,
-                                          char* (*cb_serialize)(const snode_t*))
+static void msci_write_cb(strbuf_t * sb,
+                          const snode_t * node,
+                          char * (*cb_serialize)(const snode_t *))
+{
+  char * temp = cb_serialize(node);
+  strbuf_puts(sb,temp);
+  free(temp);
+}
+
+static void msci_write_hybrid_status(strbuf_t * sb, const snode_t * node)
+{
+  if (node->hphi >= 0)
+  {
+    strbuf_puts(sb,"[&phi=");
+    strbuf_putf(sb,node->hphi);
+    strbuf_putc(sb,',');
+  }
+  else
+    strbuf_putc(sb,'[');
+  strbuf_puts(sb,"tau-parent=");
+  strbuf_puts(sb,node->htau ? "yes" : "no");
+  strbuf_putc(sb,']');
+}
+
+static void msci_export_newick_recursive(strbuf_t * sb,
+                                         const snode_t* root,
+                                         char* (*cb_serialize)(const snode_t*))
 {
-  char* newick;
-  int size_alloced;
   assert(root != NULL);
 
   if (!(root->left) && !(root->right))
@@ -1522,47 +1545,31 @@ static char* msci_export_newick_recursive(const snode_t* root,
       if (cb_serialize)
       {
         if (opt_msci_faketree_binarize)
-          size_alloced = xasprintf(&newick,
-                                   "%s :%f",
-                                   root->label,
-                                   root->parent->tau);
-        else
         {
-          newick = cb_serialize(root);
-          size_alloced = strlen(newick);
+          strbuf_puts(sb,root->label);
+          strbuf_puts(sb," :");
+          strbuf_putf(sb,root->parent->tau);
         }
+        else
+          msci_write_cb(sb,root,cb_serialize);
       }
       else
       {
+        strbuf_puts(sb,root->label);
         if (node_is_hybridization(root))
         {
           /* hybridization event */
-          if (root->hphi >= 0)
-            size_alloced = xasprintf(&newick,
-                                     "%s[&phi=%f,tau-parent=%s]",
-                                     root->label,
-                                     root->hphi,
-                                     root->htau ? "yes" : "no");
-          else
-            size_alloced = xasprintf(&newick,
-                                     "%s[tau-parent=%s]",
-                                     root->label,
-                                     root->htau ? "yes" : "no");
+          msci_write_hybrid_status(sb,root);
         }
         else
         {
           /* bidirectional introgression */
-
-          size_alloced = xasprintf(&newick,"%s[&phi=%f]",root->label,root->hphi);
           if (root->hphi >= 0)
-            size_alloced = xasprintf(&newick,
-                                     "%s[&phi=%f]",
-                                     root->label,
-                                     root->hphi);
-          else
-            size_alloced = xasprintf(&newick,
-                                     "%s",
-                                     root->label);
+          {
+            strbuf_puts(sb,"[&phi=");
+            strbuf_putf(sb,root->hphi);
+            strbuf_putc(sb,']');
+          }
         }
       }
     }
@@ -1570,21 +1577,15 @@ static char* msci_export_newick_recursive(const snode_t* root,
     {
       /* tip node */
       if (cb_serialize)
-      {
-        newick = cb_serialize(root);
-        size_alloced = strlen(newick);
-      }
+        msci_write_cb(sb,root,cb_serialize);
       else
       {
+        strbuf_puts(sb,root->label);
         if (show_branches)
-          size_alloced = xasprintf(&newick,
-                                   "%s:%f",
-                                   root->label,
-                                   root->length);
-        else
-          size_alloced = xasprintf(&newick,
-                                   "%s",
-                                   root->label);
+        {
+          strbuf_putc(sb,':');
+          strbuf_putf(sb,root->length);
+        }
       }
     }
   }
@@ -1595,47 +1596,30 @@ static char* msci_export_newick_recursive(const snode_t* root,
     {
       /* hybrid non-mirror node */
       assert(!node_is_mirror(root));
-      char* subtree = NULL;
+      strbuf_putc(sb,'(');
       if (node_is_hybridization(root))
       {
         /* hybridization event */
         assert(root->left && !root->right);
-        subtree = msci_export_newick_recursive(root->left, cb_serialize);
-        if (!subtree)
-          return NULL;
+        msci_export_newick_recursive(sb,root->left,cb_serialize);
 
         if (cb_serialize)
         {
-          char* temp = cb_serialize(root);
-          if (!opt_msci_faketree_binarize)
-            size_alloced = xasprintf(&newick,
-                                     "(%s)%s",
-                                     subtree,
-                                     temp);
-          else
-            size_alloced = xasprintf(&newick,
-                                     "(%s, ghost_%s :%f)%s",
-                                     subtree,
-                                     root->label,
-                                     root->tau,
-                                     temp);
-          free(temp);
+          if (opt_msci_faketree_binarize)
+          {
+            strbuf_puts(sb,", ghost_");
+            strbuf_puts(sb,root->label);
+            strbuf_puts(sb," :");
+            strbuf_putf(sb,root->tau);
+          }
+          strbuf_putc(sb,')');
+          msci_write_cb(sb,root,cb_serialize);
         }
         else
         {
-          if (root->hphi >= 0)
-            size_alloced = xasprintf(&newick,
-                                     "(%s)%s[&phi=%f,tau-parent=%s]",
-                                     subtree,
-                                     root->label ? root->label : "",
-                                     root->hphi,
-                                     root->htau ? "yes" : "no");
-          else
-            size_alloced = xasprintf(&newick,
-                                     "(%s)%s[tau-parent=%s]",
-                                     subtree,
-                                     root->label ? root->label : "",
-                                     root->htau ? "yes" : "no");
+          strbuf_putc(sb,')');
+          strbuf_puts(sb,root->label ? root->label : "");
+          msci_write_hybrid_status(sb,root);
         }
       }
       else
@@ -1643,28 +1627,22 @@ static char* msci_export_newick_recursive(const snode_t* root,
         /* bidirectional introgression */
         assert(root->left && root->right);
         assert(root->right->hybrid && !root->right->left && !root->right->right);
-        subtree = msci_export_newick_recursive(root->left, cb_serialize);
-        if (!subtree)
-          return NULL;
+        msci_export_newick_recursive(sb,root->left,cb_serialize);
 
         if (cb_serialize)
         {
           /* assert(0); */
-          char* temp = cb_serialize(root);
+          strbuf_puts(sb,", ");
           if (!opt_msci_faketree_binarize)
-            size_alloced = xasprintf(&newick,
-                                     "(%s, %s)%s",
-                                     subtree,
-                                     root->right->label,
-                                     temp);
+            strbuf_puts(sb,root->right->label);
           else
-            size_alloced = xasprintf(&newick,
-                                     "(%s, %s_ghost : %f)%s",
-                                     subtree,
-                                     root->label,
-                                     root->tau,
-                                     temp);
-          free(temp);
+          {
+            strbuf_puts(sb,root->label);
+            strbuf_puts(sb,"_ghost : ");
+            strbuf_putf(sb,root->tau);
+          }
+          strbuf_putc(sb,')');
+          msci_write_cb(sb,root,cb_serialize);
         }
         else
         {
@@ -1677,85 +1655,46 @@ static char* msci_export_newick_recursive(const snode_t* root,
           assert(root->right && root->right->hybrid);
           assert(root->right->hybrid->hphi >= 0);
 
+          strbuf_putc(sb,',');
+          strbuf_puts(sb,root->right->label);
           if (root->hphi >= 0)
           {
-            if (show_branches)
-              size_alloced = xasprintf(&newick,
-                                       "(%s,%s[&phi=%f])%s:%f",
-                                       subtree,
-                                       root->right->label,
-                                       1-root->right->hybrid->hphi,
-                                       root->label,
-                                       root->length);
-            else
-              size_alloced = xasprintf(&newick,
-                                       "(%s,%s[&phi=%f])%s",
-                                       subtree,
-                                       root->right->label,
-                                       1-root->right->hybrid->hphi,
-                                       root->label);
+            strbuf_puts(sb,"[&phi=");
+            strbuf_putf(sb,1-root->right->hybrid->hphi);
+            strbuf_putc(sb,']');
           }
-          else
+          strbuf_putc(sb,')');
+          strbuf_puts(sb,root->label);
+          if (show_branches)
           {
-            if (show_branches)
-              size_alloced = xasprintf(&newick,
-                                       "(%s,%s)%s:%f",
-                                       subtree,
-                                       root->right->label,
-                                       root->label,
-                                       root->length);
-            else
-              size_alloced = xasprintf(&newick,
-                                       "(%s,%s)%s",
-                                       subtree,
-                                       root->right->label,
-                                       root->label);
+            strbuf_putc(sb,':');
+            strbuf_putf(sb,root->length);
           }
         }
       }
-      free(subtree);
-      if (size_alloced < 0)
-        fatal("Memory allocation during newick export failed");
     }
     else
     {
       /* inner node */
-      char* subtree1 = msci_export_newick_recursive(root->left, cb_serialize);
-      if (!subtree1)
-        return NULL;
-      char* subtree2 = msci_export_newick_recursive(root->right, cb_serialize);
-      if (!subtree2)
-        return NULL;
+      strbuf_putc(sb,'(');
+      msci_export_newick_recursive(sb,root->left,cb_serialize);
+      strbuf_puts(sb, cb_serialize ? ", " : ",");
+      msci_export_newick_recursive(sb,root->right,cb_serialize);
+      strbuf_putc(sb,')');
 
       if (cb_serialize)
-      {
-        char* temp = cb_serialize(root);
-        size_alloced = xasprintf(&newick, "(%s, %s)%s", subtree1, subtree2, temp);
-        free(temp);
-      }
+        msci_write_cb(sb,root,cb_serialize);
       else
       {
+        strbuf_puts(sb,root->label ? root->label : "");
         if (show_branches)
-          size_alloced = xasprintf(&newick,
-                                   "(%s,%s)%s:%f",
-                                   subtree1,
-                                   subtree2,
-                                   root->label ? root->label : "",
-                                   root->length);
-        else
-          size_alloced = xasprintf(&newick,
-                                   "(%s,%s)%s",
-                                   subtree1,
-                                   subtree2,
-                                   root->label ? root->label : "");
+        {
+          strbuf_putc(sb,':');
+          strbuf_putf(sb,root->length);
+        }
       }
-      free(subtree1);
-      free(subtree2);
-      if (size_alloced < 0)
-        fatal("Memory allocation during newick export failed");
     }
   }
-  return newick;
 }
 
 
@@ -1763,69 +1702,37 @@ static char* msci_export_newick_recursive(const snode_t* root,
 char * msci_export_newick(const snode_t * root,
                           char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
+  strbuf_t sb;
+
   if (!root) return NULL;
 
-  if (!(root->left) || !(root->right))
+  strbuf_init(&sb);
+
+  if (root->left && root->right)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      if (show_branches)
-        size_alloced = xasprintf(&newick,
-                                 "%s:%f",
-                                 root->label ? root->label : "",
-                                 root->length);
-      else
-        size_alloced = xasprintf(&newick,
-                                 "%s",
-                                 root->label ? root->label : "");
-    }
+    strbuf_putc(&sb,'(');
+    msci_export_newick_recursive(&sb,root->left,cb_serialize);
+    strbuf_puts(&sb,", ");
+    msci_export_newick_recursive(&sb,root->right,cb_serialize);
+    strbuf_putc(&sb,')');
   }
+
+  if (cb_serialize)
+    msci_write_cb(&sb,root,cb_serialize);
   else
   {
-    char* subtree1, * subtree2;
-    subtree1 = msci_export_newick_recursive(root->left, cb_serialize);
-    if (!subtree1)
-      fatal("Unable to allocate enough memory.");
-    subtree2 = msci_export_newick_recursive(root->right, cb_serialize);
-    if (!subtree2)
-      fatal("Unable to allocate enough memory.");
-
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,"(%s, %s)%s;", subtree1, subtree2, temp);
-      free(temp);
-    }
-    else
+    strbuf_puts(&sb,root->label ? root->label : "");
+    if (show_branches)
     {
-      if (show_branches)
-        size_alloced = xasprintf(&newick,
-                                 "(%s, %s)%s:%f;",
-                                 subtree1,
-                                 subtree2,
-                                 root->label ? root->label : "",
-                                 root->length);
-      else
-        size_alloced = xasprintf(&newick,
-                                 "(%s, %s)%s;",
-                                 subtree1,
-                                 subtree2,
-                                 root->label ? root->label : "");
+      strbuf_putc(&sb,':');
+      strbuf_putf(&sb,root->length);
     }
-    free(subtree1);
-    free(subtree2);
   }
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
 
-  return newick;
+  if (root->left && root->right)
+    strbuf_putc(&sb,';');
+
+  return sb.s;
 }
 
 void cmd_msci_create()
@@ -0,0 +1,479 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Online (streaming) summaries of the columns logged into the MCMC file for
+   the A00 method. Each column keeps a Welford accumulator for the mean and
+   variance, one P^2 sketch (Jain and Chlamtac, 1985) per quantile, the
+   first OSTATS_EXACT observations for exact quantiles of short runs, and a
+   batch-means estimate of the effective sample size. Memory is constant in
+   the number of samples, and the whole state is checkpointed. */
+
+static const double quantile_p[OSTATS_QUANTILES] = {0.025, 0.5, 0.975};
+
+static ostats_t * cols = NULL;
+static long cols_count = 0;
+static char ** labels = NULL;
+static double * values = NULL;
+
+static int cb_dblcmp(const void * a, const void * b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  if (x < y) return -1;
+  if (x > y) return 1;
+  return 0;
+}
+
+/* Columns of the MCMC sample file of methods A00 and A10 that follow the
+   generation (and delimitation) fields, in the order they are logged. This is
+   the only definition of the column list: mcmc_printheader() writes the names
+   and mcmc_logsample() the values, and the streaming summaries use both. The
+   values are stored in x and the (allocated) names in names unless NULL, and
+   the number of columns is returned */
+long ostats_columns(stree_t * stree, gtree_t ** gtree, double * x, char ** names)
+{
+  unsigned int i;
+  unsigned int snodes_total;
+  int print_labels = (stree->tip_count <= 10);
+  long k = 0;
+
+  if (opt_msci)
+    snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  else
+    snodes_total = stree->tip_count + stree->inner_count;
+
+  /* 1. thetas */
+  if (opt_est_theta)
+    for (i = 0; i < snodes_total; ++i)
+      if (stree->nodes[i]->theta >= 0)
+      {
+        if (x) x[k] = stree->nodes[i]->theta;
+        if (names)
+        {
+          if (print_labels)
+            xasprintf(names+k, "theta_%d%s", i+1, stree->nodes[i]->label);
+          else
+            xasprintf(names+k, "theta_%d", i+1);
+        }
+        ++k;
+      }
+
+  /* 2. taus for inner nodes */
+  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
+    if (stree->nodes[i]->tau)
+    {
+      if (x) x[k] = stree->nodes[i]->tau;
+      if (names)
+      {
+        if (print_labels)
+          xasprintf(names+k, "tau_%d%s", i+1, stree->nodes[i]->label);
+        else
+          xasprintf(names+k, "tau_%d", i+1);
+      }
+      ++k;
+    }
+
+  /* 3. phis for hybridization nodes */
+  if (opt_msci)
+  {
+    unsigned int offset = stree->tip_count+stree->inner_count;
+
+    for (i = 0; i < stree->hybrid_count; ++i)
+    {
+      snode_t * tmpnode = stree->nodes[offset+i];
+      if (node_is_bidirection(tmpnode))
+      {
+        if (names)
+          xasprintf(names+k, "phi_%s", tmpnode->label);
+      }
+      else
+      {
+        /* if main node htau==0 and mirror node htau==1 then that is the only
+           case we use the phi from the main node */
+        if (tmpnode->hybrid->htau == 0 && tmpnode->htau == 1)
+          tmpnode = tmpnode->hybrid;
+        if (names)
+          xasprintf(names+k,
+                    "phi_%s<-%s", tmpnode->label, tmpnode->parent->label);
+      }
+      if (x) x[k] = tmpnode->hphi;
+      ++k;
+    }
+  }
+
+  /* 4. mean locus rate and rate variation */
+  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+      opt_est_mubar &&
+      opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+  {
+    if (x) x[k] = stree->locusrate_mubar;
+    if (names) names[k] = xstrdup("mu_bar");
+    ++k;
+  }
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+  {
+    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+    {
+      if (x) x[k] = stree->locusrate_nubar;
+      if (names) names[k] = xstrdup("nu_bar");
+    }
+    else
+    {
+      if (x) x[k] = stree->nui_sum / opt_locus_count;
+      if (names) names[k] = xstrdup("nu");
+    }
+    ++k;
+  }
+
+  /* 5. log-likelihood */
+  if (opt_usedata)
+  {
+    if (x)
+    {
+      double logl = 0;
+      for (i = 0; i < stree->locus_count; ++i)
+        logl += gtree[i]->logl;
+      x[k] = logl/opt_bfbeta;
+    }
+    if (names) names[k] = xstrdup("lnL");
+    ++k;
+  }
+
+  return k;
+}
+
+static void p2_init(p2_t * sk, double p)
+{
+  sk->n[0] = 1; sk->n[1] = 2; sk->n[2] = 3; sk->n[3] = 4; sk->n[4] = 5;
+
+  sk->np[0] = 1;
+  sk->np[1] = 1 + 2*p;
+  sk->np[2] = 1 + 4*p;
+  sk->np[3] = 3 + 2*p;
+  sk->np[4] = 5;
+
+  sk->dn[0] = 0;
+  sk->dn[1] = p/2;
+  sk->dn[2] = p;
+  sk->dn[3] = (1+p)/2;
+  sk->dn[4] = 1;
+}
+
+static double p2_parabolic(p2_t * sk, long i, double d)
+{
+  double * q = sk->q;
+  double * n = sk->n;
+
+  return q[i] + d / (n[i+1] - n[i-1]) *
+         ((n[i] - n[i-1] + d) * (q[i+1] - q[i]) / (n[i+1] - n[i]) +
+          (n[i+1] - n[i] - d) * (q[i] - q[i-1]) / (n[i] - n[i-1]));
+}
+
+/* count is the number of observations including x */
+static void p2_update(p2_t * sk, double x, long count)
+{
+  long i,k;
+  double * q = sk->q;
+  double * n = sk->n;
+
+  /* the first five observations initialize the markers */
+  if (count <= 5)
+  {
+    q[count-1] = x;
+    if (count == 5)
+      qsort(q, 5, sizeof(double), cb_dblcmp);
+    return;
+  }
+
+  /* find cell k such that q[k] <= x < q[k+1] and adjust extreme markers */
+  if (x < q[0])
+  {
+    q[0] = x;
+    k = 0;
+  }
+  else if (x >= q[4])
+  {
+    q[4] = x;
+    k = 3;
+  }
+  else
+  {
+    for (k = 0; k < 3; ++k)
+      if (x < q[k+1]) break;
+  }
+
+  for (i = k+1; i < 5; ++i)
+    n[i] += 1;
+  for (i = 0; i < 5; ++i)
+    sk->np[i] += sk->dn[i];
+
+  /* adjust heights of the three middle markers if necessary */
+  for (i = 1; i < 4; ++i)
+  {
+    double d = sk->np[i] - n[i];
+
+    if ((d >= 1 && n[i+1] - n[i] > 1) || (d <= -1 && n[i-1] - n[i] < -1))
+    {
+      long ds = (d >= 0) ? 1 : -1;
+      double qp = p2_parabolic(sk,i,ds);
+
+      if (q[i-1] < qp && qp < q[i+1])
+        q[i] = qp;
+      else
+        q[i] = q[i] + ds * (q[i+ds] - q[i]) / (n[i+ds] - n[i]);
+
+      n[i] += ds;
+    }
+  }
+}
+
+/* quantile j of a column. The middle marker of a sketch estimates its
+   quantile only once the outer markers have moved away from the extreme
+   observations, hence up to OSTATS_EXACT observations the exact order
+   statistic of the stored observations is returned */
+static double col_quantile(const ostats_t * c, long j)
+{
+  double tmp[OSTATS_EXACT];
+  long k;
+
+  if (c->n > OSTATS_EXACT)
+    return c->quant[j].q[2];
+
+  memcpy(tmp, c->exact, (size_t)c->n * sizeof(double));
+  qsort(tmp, (size_t)c->n, sizeof(double), cb_dblcmp);
+  k = (long)(quantile_p[j]*(c->n-1) + 0.5);
+  return tmp[k];
+}
+
+static void col_init(ostats_t * c)
+{
+  long j;
+
+  memset(c, 0, sizeof(ostats_t));
+  for (j = 0; j < OSTATS_QUANTILES; ++j)
+    p2_init(c->quant+j, quantile_p[j]);
+  c->batch_size = 1;
+}
+
+static void col_update(ostats_t * c, double x)
+{
+  long j;
+  double delta;
+
+  /* Welford mean and sum of squared deviations */
+  c->n++;
+  delta = x - c->mean;
+  c->mean += delta / c->n;
+  c->m2 += delta * (x - c->mean);
+
+  if (c->n == 1 || x < c->min) c->min = x;
+  if (c->n == 1 || x > c->max) c->max = x;
+
+  if (c->n <= OSTATS_EXACT)
+    c->exact[c->n-1] = x;
+  for (j = 0; j < OSTATS_QUANTILES; ++j)
+    p2_update(c->quant+j, x, c->n);
+
+  /* batch means; when the buffer is full adjacent batches are merged and the
+     batch size doubles, so that the number of batches stays within
+     [OSTATS_BATCHES, 2*OSTATS_BATCHES) */
+  c->batch_sum += x;
+  if (++c->batch_fill == c->batch_size)
+  {
+    c->batch_mean[c->batch_count++] = c->batch_sum / c->batch_size;
+    c->batch_sum = 0;
+    c->batch_fill = 0;
+
+    if (c->batch_count == 2*OSTATS_BATCHES)
+    {
+      for (j = 0; j < OSTATS_BATCHES; ++j)
+        c->batch_mean[j] = (c->batch_mean[2*j] + c->batch_mean[2*j+1]) / 2;
+      c->batch_count = OSTATS_BATCHES;
+      c->batch_size *= 2;
+    }
+  }
+}
+
+static double col_ess(const ostats_t * c)
+{
+  long j;
+  double bmean = 0;
+  double bvar = 0;
+  double var;
+
+  if (c->n < 2 || c->batch_count < 2)
+    return c->n;
+
+  var = c->m2 / (c->n - 1);
+
+  for (j = 0; j < c->batch_count; ++j)
+    bmean += c->batch_mean[j];
+  bmean /= c->batch_count;
+  for (j = 0; j < c->batch_count; ++j)
+    bvar += (c->batch_mean[j] - bmean) * (c->batch_mean[j] - bmean);
+  bvar /= (c->batch_count - 1);
+
+  /* asymptotic variance of the mean is estimated as batch_size*bvar */
+  if (bvar == 0 || var == 0)
+    return c->n;
+
+  return c->n * var / (c->batch_size * bvar);
+}
+
+void ostats_init(stree_t * stree, gtree_t ** gtree)
+{
+  long i;
+  long count;
+
+  if (opt_method != METHOD_00) return;
+
+  count = ostats_columns(stree,gtree,NULL,NULL);
+
+  if (cols)
+  {
+    /* accumulators were restored from a checkpoint */
+    if (cols_count != count)
+      fatal("Checkpoint has %ld streaming summary columns, expected %ld",
+            cols_count, count);
+  }
+  else
+  {
+    cols_count = count;
+    cols = (ostats_t *)xmalloc((size_t)cols_count * sizeof(ostats_t));
+    for (i = 0; i < cols_count; ++i)
+      col_init(cols+i);
+  }
+
+  values = (double *)xmalloc((size_t)(cols_count+1) * sizeof(double));
+  labels = (char **)xcalloc((size_t)cols_count+1, sizeof(char *));
+  ostats_columns(stree,gtree,NULL,labels);
+}
+
+void ostats_update(stree_t * stree, gtree_t ** gtree)
+{
+  long i;
+
+  if (!cols) return;
+
+  ostats_columns(stree,gtree,values,NULL);
+  for (i = 0; i < cols_count; ++i)
+    col_update(cols+i, values[i]);
+}
+
+void ostats_print(FILE * fp)
+{
+  long i,j;
+
+  if (!cols || !cols_count || !cols[0].n) return;
+
+  fprintf(fp, "\nStreaming summary of %ld samples:\n", cols[0].n);
+
+  fprintf(fp, "        ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %s", labels[i]);
+  fprintf(fp, "\n");
+
+  fprintf(fp, "mean    ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", cols[i].mean);
+  fprintf(fp, "\n");
+
+  fprintf(fp, "median  ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", col_quantile(cols+i,1));
+  fprintf(fp, "\n");
+
+  fprintf(fp, "S.D     ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", cols[i].n > 1 ? sqrt(cols[i].m2/(cols[i].n-1)) : 0);
+  fprintf(fp, "\n");
+
+  fprintf(fp, "min     ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", cols[i].min);
+  fprintf(fp, "\n");
+
+  fprintf(fp, "max     ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", cols[i].max);
+  fprintf(fp, "\n");
+
+  for (j = 0; j < OSTATS_QUANTILES; j += 2)
+  {
+    fprintf(fp, "%-8s", j ? "97.5%" : "2.5%");
+    for (i = 0; i < cols_count; ++i)
+      fprintf(fp, "  %f", col_quantile(cols+i,j));
+    fprintf(fp, "\n");
+  }
+
+  fprintf(fp, "ESS*    ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %.0f", col_ess(cols+i));
+  fprintf(fp, "\n");
+
+  fprintf(fp, "Eff*    ");
+  for (i = 0; i < cols_count; ++i)
+    fprintf(fp, "  %f", col_ess(cols+i) / cols[i].n);
+  fprintf(fp, "\n");
+
+  fprintf(fp,
+          "Quantiles are %s; ESS is from batch means (batch size %ld).\n\n",
+          cols[0].n > OSTATS_EXACT ? "P^2 estimates" : "exact",
+          cols[0].batch_size);
+}
+
+ostats_t * ostats_cols(long * count)
+{
+  *count = cols_count;
+  return cols;
+}
+
+const char * ostats_label(long i)
+{
+  return labels[i];
+}
+
+void ostats_set_cols(ostats_t * c, long count)
+{
+  cols = c;
+  cols_count = count;
+}
+
+void ostats_fini(void)
+{
+  long i;
+
+  if (labels)
+    for (i = 0; i < cols_count; ++i)
+      free(labels[i]);
+
+  free(labels);
+  free(values);
+  free(cols);
+
+  labels = NULL;
+  values = NULL;
+  cols = NULL;
+  cols_count = 0;
+}
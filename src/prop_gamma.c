@@ -65,13 +65,16 @@ static long propose_alpha(stree_t * stree,
   double loga_old, loga_new;
   double * old_rates;
   gnode_t ** gt_nodes;
+  size_t scratch;
 
   double minv = -99;
   double maxv =  99;
 
-  /* allocate temporary space for gene tree traversal */
-  gt_nodes = (gnode_t **)xmalloc((gtree->tip_count+gtree->inner_count) *
-                                 sizeof(gnode_t *));
+  /* temporary space for gene tree traversal */
+  scratch = arena_mark(thread_index);
+  gt_nodes = (gnode_t **)arena_alloc(thread_index,
+                                     (gtree->tip_count+gtree->inner_count) *
+                                     sizeof(gnode_t *));
 
   alpha_old = locus->rates_alpha;
   loga_old  = log(alpha_old);
@@ -86,7 +89,8 @@ static long propose_alpha(stree_t * stree,
   locus->rates_alpha = alpha_new;
 
   /* store old rates */
-  old_rates = (double *)xmalloc((size_t)(locus->rate_cats) * sizeof(double));
+  old_rates = (double *)arena_alloc(thread_index,
+                                    (size_t)(locus->rate_cats) * sizeof(double));
   memcpy(old_rates,locus->rates,(size_t)(locus->rate_cats) * sizeof(double));
 
   /* update locus->rates with new rates */
@@ -166,8 +170,7 @@ static long propose_alpha(stree_t * stree,
     /* revert old rates */
     pll_set_category_rates(locus,old_rates);
   }
-  free(gt_nodes);
-  free(old_rates);
+  arena_release(thread_index,scratch);
 
   return accepted;
 }
@@ -88,9 +88,11 @@ void prop_mixing_update_gtrees(locus_t ** locus,
     }
 
     /* update pmatrices */
-    /* TODO: Remove this allocation */
-    gnode_t ** gt_nodes = (gnode_t **)xmalloc((gt->tip_count + gt->inner_count)*
-                                              sizeof(gnode_t *));
+    size_t scratch = arena_mark(thread_index);
+    gnode_t ** gt_nodes = (gnode_t **)arena_alloc(thread_index,
+                                                  (gt->tip_count +
+                                                   gt->inner_count) *
+                                                  sizeof(gnode_t *));
     k=0;
     for (j = 0; j < gt->tip_count + gt->inner_count; ++j)
       if (gt->nodes[j]->parent)
@@ -153,7 +155,7 @@ void prop_mixing_update_gtrees(locus_t ** locus,
     gt->old_logl = gt->logl;
     gt->logl = logl;
 
-    free(gt_nodes);
+    arena_release(thread_index,scratch);
 
   }
   /* return values */
@@ -177,11 +179,13 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
   double * notheta_old_logpr = NULL;
 
   size_t nodes_count = stree->tip_count+stree->inner_count+stree->hybrid_count; 
+  size_t scratch = arena_mark(thread_index);
 
 
   if (!opt_est_theta)
   {
-    notheta_old_logpr = (double *)xmalloc(nodes_count * sizeof(double));
+    notheta_old_logpr = (double *)arena_alloc(thread_index,
+                                              nodes_count * sizeof(double));
     for (i = 0; i < nodes_count; ++i)
       notheta_old_logpr[i] = stree->nodes[i]->notheta_logpr_contrib;
   }
@@ -225,8 +229,8 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
   /* TODO: This loop separation is for having the same traversal as old bpp */
 
   /* TODO: Why is this allocation here? Perhaps no longer needed? */
-  snode_t ** snodes = (snode_t **)xmalloc((nodes_count)*
-                                          sizeof(snode_t *));
+  snode_t ** snodes = (snode_t **)arena_alloc(thread_index,
+                                              nodes_count * sizeof(snode_t *));
   for (i = 0; i < nodes_count; ++i)
     snodes[i] = stree->nodes[i];
 
@@ -466,8 +470,8 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
       }
     }
 
-    /* go through all loci */
-    for (i = 0; i < stree->locus_count; ++i)
+    /* go through all loci (of this process) */
+    for (i = mproc_locus_first(); i < mproc_locus_end(); ++i)
     {
       /* restore logl and logpr */
       gtree[i]->logl  = gtree[i]->old_logl;
@@ -496,10 +500,7 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
         gtree[i]->lnprior_rates = gtree[i]->old_lnprior_rates;
     }
   }
-  free(snodes);
-
-  if (!opt_est_theta)
-    free(notheta_old_logpr);
+  arena_release(thread_index,scratch);
 
   return accepted;
 
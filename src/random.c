@@ -223,7 +223,7 @@ long legacy_rndpoisson(long index, double m)
    /* m is the rate parameter of the poisson
       Numerical Recipes in C, 2nd ed. pp. 293-295
    */
-   static double sq, alm, g, oldm = -1;
+   static __THREAD double sq, alm, g, oldm = -1;
    double em, t, y;
 
    /* search from the origin
@@ -21,7 +21,7 @@
 
 #include "bpp.h"
 
-void revolutionary_spr_tselect_logl(gnode_t * mnode, gnode_t ** target_list, long target_count, locus_t * locus, double * weights)
+void revolutionary_spr_tselect_logl(gnode_t * mnode, gnode_t ** target_list, long target_count, locus_t * locus, double * weights, long thread_index)
 {
   /*
                       *              if t1 is the selected target node, then
@@ -43,15 +43,16 @@ void revolutionary_spr_tselect_logl(gnode_t * mnode, gnode_t ** target_list, lon
    const double * mclv, *tclv;  /* CLV of moved and target node */
    double * nptr;
    const double * mmat = locus->pmatrix[mnode->pmatrix_index];       /* transition probability matrix for moved node */
+   size_t scratch = arena_mark(thread_index);
    /* space for new p-matrix for target: */
-   double * tmat = pll_aligned_alloc(locus->states * locus->states_padded * locus->rate_cats * sizeof(double), locus->alignment);
+   double * tmat = arena_alloc(thread_index, locus->states * locus->states_padded * locus->rate_cats * sizeof(double));
    /* allocate storage space for CLV subtree root, which is to be computed: */
-  double * clv = pll_aligned_alloc(locus->sites * locus->states_padded * locus->rate_cats * sizeof(double), locus->alignment);
+  double * clv = arena_alloc(thread_index, locus->sites * locus->states_padded * locus->rate_cats * sizeof(double));
   /* temp space for normalized CLV of moved node:  */
   //double * nmclv = pll_aligned_alloc(locus->sites * locus->states_padded * locus->rate_cats * sizeof(double), locus->alignment);
 
   /* space for normalized CLV of target node.  Ziheng: nclv is temp space, for scaled tclv for target. */
-  double * ntclv = pll_aligned_alloc(locus->sites * locus->states_padded * locus->rate_cats * sizeof(double), locus->alignment);
+  double * ntclv = arena_alloc(thread_index, locus->sites * locus->states_padded * locus->rate_cats * sizeof(double));
   double tlength[1] = { mnode->parent->time * 0.314 }; /* if(opt_revolutionary_spr_method == 2) */
   unsigned int matrix_indices[1] = { 0 };
   double * matrices[1] = { tmat };
@@ -131,10 +132,8 @@ void revolutionary_spr_tselect_logl(gnode_t * mnode, gnode_t ** target_list, lon
     }
   }
 
-  /* deallocate */
-  pll_aligned_free(clv);
-  pll_aligned_free(ntclv);
-  pll_aligned_free(tmat);
+  /* release scratch space */
+  arena_release(thread_index, scratch);
 }
 
 void rev_spr_tselect(gnode_t * mnode,
@@ -142,11 +141,13 @@ void rev_spr_tselect(gnode_t * mnode,
                      gnode_t ** targets,
                      unsigned int target_count,
                      locus_t * locus,
-                     double * weights)
+                     double * weights,
+                     long thread_index)
 {
   unsigned int i,j,k;
   size_t matsize;
   size_t clvsize;
+  size_t scratch;
   double * mmat;
   double * tmat;
   unsigned int matrix_indices[2] = {0,1};
@@ -158,13 +159,14 @@ void rev_spr_tselect(gnode_t * mnode,
   matsize = locus->states*locus->states_padded*locus->rate_cats*sizeof(double);
   clvsize = locus->sites*locus->states_padded*locus->rate_cats*sizeof(double);
 
-  /* allocate space for normalized CLV vectors and for subtree root */
-  double * ntclv = pll_aligned_alloc(clvsize,locus->alignment);
-  double * clv = pll_aligned_alloc(clvsize,locus->alignment);
+  /* space for normalized CLV vectors and for subtree root */
+  scratch = arena_mark(thread_index);
+  double * ntclv = arena_alloc(thread_index,clvsize);
+  double * clv = arena_alloc(thread_index,clvsize);
 
-  /* allocate memory for the two p-matrices (moved node and target) */
-  mmat = pll_aligned_alloc(matsize,locus->alignment);
-  tmat = pll_aligned_alloc(matsize,locus->alignment);
+  /* space for the two p-matrices (moved node and target) */
+  mmat = arena_alloc(thread_index,matsize);
+  tmat = arena_alloc(thread_index,matsize);
 
   /* TODO: we assume scaling for numerical underflow is disabled */
   assert(opt_scaling == 0);
@@ -244,9 +246,6 @@ void rev_spr_tselect(gnode_t * mnode,
                                              locus->attributes);
   }
 
-  /* deallocate */
-  pll_aligned_free(clv);
-  pll_aligned_free(ntclv);
-  pll_aligned_free(mmat);
-  pll_aligned_free(tmat);
+  /* release scratch space */
+  arena_release(thread_index,scratch);
 }
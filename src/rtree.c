@@ -268,110 +268,62 @@ void stree_show_ascii(const snode_t * root, int options)
   free(active_node_order);
 }
 
-static char * stree_export_newick_recursive(const snode_t * root,
-                                            char * (*cb_serialize)(const snode_t *))
+/* node annotations are written either by cb_write, appending to the buffer,
+   or by cb_serialize, returning an allocated string */
+static void stree_newick_recursive(strbuf_t * sb,
+                                   const snode_t * node,
+                                   char * (*cb_serialize)(const snode_t *),
+                                   void (*cb_write)(strbuf_t *,
+                                                    const snode_t *))
 {
-  char * newick;
-  int size_alloced;
-  assert(root != NULL);
+  if (node->left && node->right)
+  {
+    strbuf_putc(sb,'(');
+    stree_newick_recursive(sb,node->left,cb_serialize,cb_write);
+    strbuf_puts(sb,", ");
+    stree_newick_recursive(sb,node->right,cb_serialize,cb_write);
+    strbuf_putc(sb,')');
+  }
 
-  if (!(root->left) || !(root->right))
+  if (cb_write)
+    cb_write(sb,node);
+  else if (cb_serialize)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    char * temp = cb_serialize(node);
+    strbuf_puts(sb,temp);
+    free(temp);
   }
   else
   {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
-
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
-    }
-    free(subtree1);
-    free(subtree2);
+    strbuf_puts(sb, node->label ? node->label : "");
+    strbuf_putc(sb,':');
+    strbuf_putf(sb,node->length);
   }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed");
+}
 
-  return newick;
+/* append the newick string of the tree rooted at root to sb */
+void stree_write_newick(strbuf_t * sb,
+                        const snode_t * root,
+                        void (*cb_write)(strbuf_t *, const snode_t *))
+{
+  stree_newick_recursive(sb,root,NULL,cb_write);
+
+  if (root->left && root->right)
+    strbuf_putc(sb,';');
 }
 
 char * stree_export_newick(const snode_t * root, char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
-
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-  }
-  else
-  {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (!subtree1)
-      fatal("Unable to allocate enough memory.");
+  strbuf_t sb;
 
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (!subtree2)
-      fatal("Unable to allocate enough memory.");
+  if (!root) return NULL;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick, "(%s, %s)%s;", subtree1, subtree2, temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "(%s, %s)%s:%f;", subtree1, subtree2, root->label ? root->label : "", root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
+  strbuf_init(&sb);
+  stree_newick_recursive(&sb,root,cb_serialize,NULL);
+  if (root->left && root->right)
+    strbuf_putc(&sb,';');
 
-  return newick;
+  return sb.s;
 }
 
 
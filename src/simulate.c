@@ -29,17 +29,116 @@
 #define DNA_STATES_COUNT        4
 
 
-/* TODO: Simulation is at the moment single-threaded */
+/* random number stream of the master thread, used for parameters drawn jointly
+   for all loci before the loci are simulated */
 static const long thread_index_zero = 0;
 
-static long * g_order = NULL;
-
 static char charmap_nt_tcag[16] =
 {
   '\0', 'T', 'C', 'Y', 'A', 'W', 'M', 'H',
    'G', 'K', 'S', 'B', 'R', 'D', 'V', 'X'
 };
 
+/* output text of one locus, kept in memory until all preceding loci have been
+   written */
+typedef struct simbuf_s
+{
+  char * data;
+  size_t len;
+  size_t alloc;
+} simbuf_t;
+
+/* slot of the reorder buffer holding a simulated locus */
+typedef struct simslot_s
+{
+  long ready;
+
+  simbuf_t seq;
+  simbuf_t seqfull;
+  simbuf_t seqrand;
+  simbuf_t tree;
+  simbuf_t param;
+
+  double tmrca;
+  double H;
+  double md_full;
+  double md_rand;
+} simslot_t;
+
+typedef struct simdata_s
+{
+  stree_t * stree;
+  msa_t ** msa;
+  double * mui_array;
+  double * vi_array;
+  long hets;
+  long locus_seqcount;
+  unsigned int seed;
+
+  /* loci are simulated in any order by the worker threads, and written in
+     locus order by the master thread through a window of slot_count slots */
+  simslot_t * slot;
+  long slot_count;
+  long next;
+  long written;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} simdata_t;
+
+/* per-thread workspace */
+typedef struct simthread_s
+{
+  pthread_t thread;
+  long index;
+  simdata_t * sd;
+
+  long * siteorder;
+  long * order;
+  double * rates;
+  double * eigenvecs;
+  double * inv_eigenvecs;
+  double * eigenvals;
+} simthread_t;
+
+static void simbuf_grow(simbuf_t * buf, size_t size)
+{
+  if (buf->len + size < buf->alloc)
+    return;
+
+  buf->alloc = MAX(2*buf->alloc, buf->len+size+1);
+  buf->data = (char *)xrealloc(buf->data, buf->alloc*sizeof(char));
+}
+
+static void simbuf_printf(simbuf_t * buf, const char * format, ...)
+{
+  int len;
+  va_list ap;
+
+  va_start(ap, format);
+  len = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+
+  if (len < 0)
+    fatal("Cannot format output of simulated locus");
+
+  simbuf_grow(buf, (size_t)len);
+
+  va_start(ap, format);
+  vsnprintf(buf->data+buf->len, buf->alloc-buf->len, format, ap);
+  va_end(ap);
+
+  buf->len += (size_t)len;
+}
+
+static void simbuf_flush(simbuf_t * buf, FILE * fp)
+{
+  if (fp && buf->len)
+    if (fwrite(buf->data, sizeof(char), buf->len, fp) != buf->len)
+      fatal("Cannot write simulated data");
+
+  buf->len = 0;
+}
+
 static char * cb_serialize_branch(const snode_t * node)
 {
   char * s = NULL;
@@ -152,7 +251,12 @@ static int MultiNomialAliasSetTable(int ncat, double * prob, double * F, int * L
    return(0);
 }
 
-static int MultiNomialAlias(int n, int ncat, double * F, int * L, int * nobs)
+static int MultiNomialAlias(int n,
+                            int ncat,
+                            double * F,
+                            int * L,
+                            int * nobs,
+                            long thread_index)
 {
    /* This generates multinomial samples using the F and L tables set up before,
       using the alias algorithm (Walker 1974; Kronmal & Peterson 1979).
@@ -165,7 +269,7 @@ static int MultiNomialAlias(int n, int ncat, double * F, int * L, int * nobs)
 
    for (i = 0; i < ncat; i++)  nobs[i] = 0;
    for (i = 0; i < n; i++) {
-      r = legacy_rndu(thread_index_zero)*ncat;
+      r = legacy_rndu(thread_index)*ncat;
       k = (int)r;
       r -= k;
       if (r <= F[k]) nobs[k]++;
@@ -440,7 +544,9 @@ static int DiscreteGamma(double freqK[], double rK[], double alpha, double beta,
    return (0);
 }
 
-static double * rates4sites(double locus_siterate_alpha, int cdf)
+static double * rates4sites(double locus_siterate_alpha,
+                            int cdf,
+                            long thread_index)
 {
   long i,j,k;
   double * rates = NULL;
@@ -462,7 +568,12 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
 
     DiscreteGamma(freqK,rK,gamma_a,gamma_b,opt_siterate_cats,BPP_FALSE);
     MultiNomialAliasSetTable(opt_siterate_cats, freqK, Falias, Lalias);
-    MultiNomialAlias(opt_locus_simlen,opt_siterate_cats,Falias,Lalias,counts);
+    MultiNomialAlias(opt_locus_simlen,
+                     opt_siterate_cats,
+                     Falias,
+                     Lalias,
+                     counts,
+                     thread_index);
 
     for (i = 0, k = 0; i < opt_siterate_cats; ++i)
       for (j = 0; j < counts[i]; ++j)
@@ -471,7 +582,7 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
   else
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      rates[i] = legacy_rndgamma(thread_index_zero,locus_siterate_alpha) /
+      rates[i] = legacy_rndgamma(thread_index,locus_siterate_alpha) /
                  locus_siterate_alpha;
   }
   if (cdf)
@@ -493,7 +604,8 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
 
 static void evolve_jc69_recursive(gnode_t * node,
                                   double locus_siterate_alpha,
-                                  double * site_rates)
+                                  double * site_rates,
+                                  long thread_index)
 {
   long i,k;
   double r;
@@ -516,21 +628,21 @@ static void evolve_jc69_recursive(gnode_t * node,
   memcpy(x,xparent,opt_locus_simlen * sizeof(char));
     
   /* generate number of mutations */
-  long mut_count = legacy_rndpoisson(thread_index_zero,
+  long mut_count = legacy_rndpoisson(thread_index,
                                      node->length * opt_locus_simlen);
 
   for (i = 0; i < mut_count; ++i)
   {
     /* get a position for the mutation */
     if (locus_siterate_alpha == 0)
-      k = (int)(legacy_rndu(thread_index_zero) * opt_locus_simlen);
+      k = (int)(legacy_rndu(thread_index) * opt_locus_simlen);
     else
-      for (k = 0, r = legacy_rndu(thread_index_zero); k < opt_locus_simlen; ++k)
+      for (k = 0, r = legacy_rndu(thread_index); k < opt_locus_simlen; ++k)
         if (r < site_rates[k])
           break;
 
     /* generate new state */
-    int state = (int)(legacy_rndu(thread_index_zero) * 3);
+    int state = (int)(legacy_rndu(thread_index) * 3);
     if (state >= inverse[(int)x[k]])
       state++;
 
@@ -540,9 +652,15 @@ static void evolve_jc69_recursive(gnode_t * node,
 
   /* recursively process subtree */
   if (node->left)
-    evolve_jc69_recursive(node->left,  locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->left,
+                          locus_siterate_alpha,
+                          site_rates,
+                          thread_index);
   if (node->right)
-    evolve_jc69_recursive(node->right, locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->right,
+                          locus_siterate_alpha,
+                          site_rates,
+                          thread_index);
 }
 
 static void evolve_gtr_recursive(gnode_t * node,
@@ -550,7 +668,8 @@ static void evolve_gtr_recursive(gnode_t * node,
                                  double * site_rates,
                                  double * eigenvecs,
                                  double * inv_eigenvecs,
-                                 double * eigenvals)
+                                 double * eigenvals,
+                                 long thread_index)
 {
   long i,j,k;
   long states = 4;
@@ -602,7 +721,7 @@ static void evolve_gtr_recursive(gnode_t * node,
           pmatrix[j*states+k] += pmatrix[j*states+k-1];
     }
     
-    double r = legacy_rndu(thread_index_zero);
+    double r = legacy_rndu(thread_index);
     for (j = 0; j < states-1; j++)
       if (r < pmatrix[inverse[(int)x[i]]*states+j])
         break;
@@ -614,12 +733,12 @@ static void evolve_gtr_recursive(gnode_t * node,
 
   /* recursively process subtree */
   if (node->left)
-    evolve_gtr_recursive(node->left,  locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->left,  locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals, thread_index);
   if (node->right)
-    evolve_gtr_recursive(node->right, locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->right, locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals, thread_index);
 }
 
-static void make_root_seq(gnode_t * root, double * freqs)
+static void make_root_seq(gnode_t * root, double * freqs, long thread_index)
 {
   long i,j;
   double r;
@@ -636,7 +755,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
   if (opt_model == BPP_DNA_MODEL_JC69)
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index_zero)*4)]];
+      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index)*4)]];
   }
   else
   {
@@ -645,7 +764,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
 
     for (i = 0; i < opt_locus_simlen; ++i)
     {
-      for (j = 0, r = legacy_rndu(thread_index_zero); j < 4-1; ++j)
+      for (j = 0, r = legacy_rndu(thread_index); j < 4-1; ++j)
         if (r < p[j]) break;
       x[i] = pll_map_nt_tcag[(int)dna[j]];
     }
@@ -672,8 +791,12 @@ static list_t * create_maplist(stree_t * stree)
   return list;
 }
 
-/* correlated clock, lognormal */
-static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * gtree)
+/* correlated clock, lognormal. Branch rates are stored in rate[], indexed by
+   species tree node index */
+static void simulate_correlated_rates_logn_recursive(snode_t * node,
+                                                     gtree_t * gtree,
+                                                     double * rate,
+                                                     long thread_index)
 {
   /* We process inner nodes only. For each inner calculate y0 according to Eq. 3
      in Rannala & Yang 2007 and then the rates for the two daughter nodes.
@@ -682,7 +805,7 @@ static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * g
     return;
 
   if (node->tau == 0)
-    node->left->rate = node->right->rate = 0;
+    rate[node->left->node_index] = rate[node->right->node_index] = 0;
   else
   {
 
@@ -695,52 +818,60 @@ static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * g
     {
       /* y0 | yA ~ N(yA - tA*nui/2, tA*nui) */
       tA = (node->parent->tau - node->tau) / 2;
-      y0 = log(node->rate) - 0.5*tA*gtree->rate_nui +
-           sqrt(gtree->rate_nui*tA)*rndNormal(thread_index_zero);
+      y0 = log(rate[node->node_index]) - 0.5*tA*gtree->rate_nui +
+           sqrt(gtree->rate_nui*tA)*rndNormal(thread_index);
     }
 
     t1 = (node->tau - node->left->tau)/2;
     t2 = (node->tau - node->right->tau)/2;
 
     nv = y0 - 0.5*t1*gtree->rate_nui +
-         sqrt(gtree->rate_nui*t1)*rndNormal(thread_index_zero);
-    node->left->rate = exp(nv);
+         sqrt(gtree->rate_nui*t1)*rndNormal(thread_index);
+    rate[node->left->node_index] = exp(nv);
 
     nv = y0 - 0.5*t2*gtree->rate_nui +
-         sqrt(gtree->rate_nui*t2)*rndNormal(thread_index_zero);
-    node->right->rate = exp(nv);
+         sqrt(gtree->rate_nui*t2)*rndNormal(thread_index);
+    rate[node->right->node_index] = exp(nv);
   }
 
-  simulate_correlated_rates_logn_recursive(node->left,gtree);
-  simulate_correlated_rates_logn_recursive(node->right,gtree);
+  simulate_correlated_rates_logn_recursive(node->left,gtree,rate,thread_index);
+  simulate_correlated_rates_logn_recursive(node->right,gtree,rate,thread_index);
     
 }
 
 /* correlated clock, gamma */
-static void simulate_correlated_rates_gamma_recursive(snode_t * node, gtree_t * gtree)
+static void simulate_correlated_rates_gamma_recursive(snode_t * node,
+                                                      gtree_t * gtree,
+                                                      double * rate,
+                                                      long thread_index)
 {
   if (!node) return;
 
   assert(node->parent);
 
   if (node->parent->tau == 0)
-    node->rate = node->parent->rate;
+    rate[node->node_index] = rate[node->parent->node_index];
   else
   {
     /* gamma prior */
 
     double a = gtree->rate_mui * gtree->rate_mui / gtree->rate_nui;
-    node->rate = legacy_rndgamma(thread_index_zero,a) /
-                 a * node->parent->rate;
+    rate[node->node_index] = legacy_rndgamma(thread_index,a) /
+                             a * rate[node->parent->node_index];
   }
 
-  simulate_correlated_rates_gamma_recursive(node->left,gtree);
-  simulate_correlated_rates_gamma_recursive(node->right,gtree);
+  simulate_correlated_rates_gamma_recursive(node->left,gtree,rate,thread_index);
+  simulate_correlated_rates_gamma_recursive(node->right,gtree,rate,thread_index);
     
 }
 
 
-static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
+/* draw species tree branch rates for one locus into rate[] and set the gene
+   tree branch lengths accordingly */
+static void relaxed_clock_branch_lengths(stree_t * stree,
+                                         gtree_t * gtree,
+                                         double * rate,
+                                         long thread_index)
 {
   /* TODO: Implement networks */
   long i;
@@ -760,8 +891,8 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
       for (i = 0; i < total_nodes; ++i)
       {
         double nv = log(gtree->rate_mui) - 0.5*gtree->rate_nui +
-                    sqrt(gtree->rate_nui)*rndNormal(thread_index_zero);
-        stree->nodes[i]->rate = exp(nv);
+                    sqrt(gtree->rate_nui)*rndNormal(thread_index);
+        rate[i] = exp(nv);
       }
     }
     else
@@ -771,7 +902,7 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
       double a = gtree->rate_mui * gtree->rate_mui / gtree->rate_nui;
       double b = gtree->rate_mui / gtree->rate_nui;
       for (i = 0; i < total_nodes; ++i)
-        stree->nodes[i]->rate = legacy_rndgamma(thread_index_zero,a) / b;
+        rate[i] = legacy_rndgamma(thread_index,a) / b;
     }
   }
   else
@@ -781,17 +912,26 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
 
     /* correlated clock */
     
-    stree->root->rate = gtree->rate_mui;
+    rate[stree->root->node_index] = gtree->rate_mui;
 
     if (opt_rate_prior == BPP_BRATE_PRIOR_GAMMA)
     {
-      simulate_correlated_rates_gamma_recursive(stree->root->left,gtree);
-      simulate_correlated_rates_gamma_recursive(stree->root->right,gtree);
+      simulate_correlated_rates_gamma_recursive(stree->root->left,
+                                                gtree,
+                                                rate,
+                                                thread_index);
+      simulate_correlated_rates_gamma_recursive(stree->root->right,
+                                                gtree,
+                                                rate,
+                                                thread_index);
     }
     else
     {
       assert(opt_rate_prior == BPP_BRATE_PRIOR_LOGNORMAL);
-      simulate_correlated_rates_logn_recursive(stree->root,gtree);
+      simulate_correlated_rates_logn_recursive(stree->root,
+                                               gtree,
+                                               rate,
+                                               thread_index);
     }
   }
 
@@ -829,28 +969,25 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
 
       /* skip using branch rates on horizontal edges in hybridization events */
       if (!(pop->hybrid && pop->htau == 0))
-        x->length += (start->tau - t)*pop->rate;
+        x->length += (start->tau - t)*rate[pop->node_index];
       t = start->tau;
     }
-    x->length += (x->parent->time - t) * x->parent->pop->rate;
+    x->length += (x->parent->time - t) * rate[x->parent->pop->node_index];
   }
 }
 
-static void randomize_order(long * order, long n)
+static void randomize_order(long * order, long * work, long n, long thread_index)
 {
   long i,k;
 
-  if (!g_order)
-    g_order = (long *)xmalloc((size_t)n * sizeof(long));
-
   for (i = 0; i < n; ++i)
-    g_order[i] = i;
+    work[i] = i;
 
   for (i = 0; i < n; ++i)
   {
-    k = (long)((n-i)*legacy_rndu(thread_index_zero));
-    order[i] = g_order[i+k];
-    g_order[i+k] = g_order[i];
+    k = (long)((n-i)*legacy_rndu(thread_index));
+    order[i] = work[i+k];
+    work[i+k] = work[i];
   }
 }
 
@@ -1012,11 +1149,11 @@ double msa_mean_heterozygosity(long seq_count, long site_count, msa_t* msa)
   return(H);
 }
 
-static void write_seqs(FILE * fp, msa_t * msa, long species_count)
+static void write_seqs(simbuf_t * buf, msa_t * msa, long species_count)
 {
   long i,j;
 
-  fprintf(fp, "\n\n%d %ld \n\n", msa->count, opt_locus_simlen);
+  simbuf_printf(buf, "\n\n%d %ld \n\n", msa->count, opt_locus_simlen);
 
   long seq_sum = 0;
   for (i = 0; i < species_count; ++i)
@@ -1025,18 +1162,27 @@ static void write_seqs(FILE * fp, msa_t * msa, long species_count)
 
   for (i = 0; i < msa->count; ++i)
   {
-    fprintf(fp, "%-*s ", 10, msa->label[i]);
+    simbuf_printf(buf, "%-*s ", 10, msa->label[i]);
+
+    /* sequence in blocks of 10 characters, each preceded by a space */
+    simbuf_grow(buf, (size_t)(opt_locus_simlen + opt_locus_simlen/10 + 2));
+    char * p = buf->data + buf->len;
     for (j = 0; j < opt_locus_simlen; ++j)
     {
-      if (j % 10 == 0) fprintf(fp, " ");
-      fprintf(fp,"%c", charmap_nt_tcag[(int)msa->sequence[i][j]]);
+      if (j % 10 == 0) *p++ = ' ';
+      *p++ = charmap_nt_tcag[(int)msa->sequence[i][j]];
     }
-    fprintf(fp, "\n");
+    *p++ = '\n';
+    buf->len = (size_t)(p - buf->data);
   }
-  fprintf(fp, "\n\n");
+  simbuf_printf(buf, "\n\n");
 }
 
-static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t * msa, double *md_rand)
+static void write_diploid_rand_seqs(simbuf_t * buf,
+                                    stree_t * stree,
+                                    msa_t * msa,
+                                    double * md_rand,
+                                    long thread_index)
 {
   long i,j,k,m;
   char ** sequence;
@@ -1068,7 +1214,7 @@ static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t *
         for (k = 0; k < msa->length; ++k)
 
         /* randomly resolve */
-        if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index_zero)<0.5)
+        if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index)<0.5)
           SWAP(sequence[j][k],sequence[j+1][k]);
       }
     }
@@ -1082,7 +1228,7 @@ static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t *
 
   new_msa->sequence = sequence;
 
-  write_seqs(fp_seqrand, new_msa, stree->tip_count);
+  write_seqs(buf, new_msa, stree->tip_count);
   if(stree->tip_count == 1)
     *md_rand = msa_mean_distance(new_msa->count, opt_locus_simlen, new_msa);
 
@@ -1184,15 +1330,332 @@ static void set_migration_rates(stree_t * stree)
 }
 
 
+/* seed of the random number stream of locus i. Each locus is simulated with
+   its own stream, derived from the main stream, such that the simulated data
+   do not depend on the number of threads */
+static unsigned int locus_seed(unsigned int seed, long i)
+{
+  unsigned int z = seed + (unsigned int)(i+1) * 0x9E3779B9u;
+
+  z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+  z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+  z ^= z >> 16;
+
+  return z ? z : 12345671;
+}
+
+static void simulate_locus(simdata_t * sd, simthread_t * st, long i)
+{
+  long j,k,m;
+  double qrates[6];
+  double freqs[4];
+  double locus_siterate_alpha = opt_siterate_alpha;
+  double * siterates = NULL;
+  stree_t * stree = sd->stree;
+  simslot_t * slot = sd->slot + i % sd->slot_count;
+  const long thread_index = st->index;
+
+  set_legacy_rndu_status(thread_index, locus_seed(sd->seed,i));
+
+  msa_t * msa = (msa_t *)xcalloc(1,sizeof(msa_t));
+
+  slot->H = slot->md_full = slot->md_rand = -1;
+
+  if (opt_modelparafile)
+    simbuf_printf(&slot->param, "%ld", i+1);
+
+  if (opt_model == BPP_DNA_MODEL_GTR)
+  {
+    if (!opt_qrates_fixed)
+    {
+      legacy_rnddirichlet(thread_index,qrates,opt_qrates_params,6);
+      for (j = 0; j < 6; ++j)
+        qrates[j] /= qrates[5];
+    }
+    else
+      memcpy(qrates,opt_qrates_params,6*sizeof(double));
+
+    if (!opt_basefreqs_fixed)
+      legacy_rnddirichlet(thread_index,freqs,opt_basefreqs_params,4);
+    else
+      memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
+
+    /* print parameters in parameter file */
+    assert(opt_modelparafile);
+    if (opt_modelparafile)
+    {
+      for (j = 0; j < 6; ++j)
+        simbuf_printf(&slot->param," %9.6f", qrates[j]);
+      for (j = 0; j < 4; ++j)
+        simbuf_printf(&slot->param," %8.6f", freqs[j]);
+    }
+
+    pll_update_eigen(st->eigenvecs,
+                     st->inv_eigenvecs,
+                     st->eigenvals,
+                     freqs,
+                     qrates,
+                     4,
+                     4);
+  }
+
+  if (!opt_siterate_fixed)
+  {
+    locus_siterate_alpha = legacy_rndgamma(thread_index,opt_siterate_alpha) /
+                           opt_siterate_beta;
+    if (opt_modelparafile)
+      simbuf_printf(&slot->param, " %9.6f", locus_siterate_alpha);
+  }
+  if (opt_modelparafile)
+  {
+    if (opt_est_locusrate)
+      simbuf_printf(&slot->param, " %9.6f", sd->mui_array[i]);
+    if (opt_clock != BPP_CLOCK_GLOBAL)
+      simbuf_printf(&slot->param, " %9.6f", sd->vi_array[i]);
+  }
+
+  if (opt_msafile || opt_treefile)
+  {
+    msa->label    = (char**)xmalloc((size_t)sd->locus_seqcount*sizeof(char *));
+    msa->sequence = (char**)xmalloc((size_t)sd->locus_seqcount*sizeof(char *));
+
+    /* create sequence labels and populate msa structure */
+    for (j = 0, m = 0; j < stree->tip_count; ++j)
+    {
+      if (opt_diploid[j])
+        for (k = 0; k < opt_sp_seqcount[j]; ++k)
+          xasprintf(msa->label+m++,
+                    "%s%ld%c^%s",
+                    stree->nodes[j]->label, 
+                    k / 2 + 1,
+                    (char)('a' + k % 2),
+                    stree->nodes[j]->label);
+      else
+        for (k = 0; k < opt_sp_seqcount[j]; ++k)
+          xasprintf(msa->label+m++,
+                    "%s%ld^%s",
+                    stree->nodes[j]->label, 
+                    k + 1,
+                    stree->nodes[j]->label);
+
+      msa->count += opt_sp_seqcount[j];
+    }
+    msa->length = opt_locus_simlen;
+
+    /* change all sequence labels to lowercase */
+    for (j = 0; j < m; ++j)
+      for (k = 0; k < (long)strlen(msa->label[j]) && msa->label[j][k] != '^'; ++k)
+        msa->label[j][k] = xtolower(msa->label[j][k]);
+  }
+
+  /* simulate gene tree */
+  gtree_t * gtree = gtree_simulate(stree,msa,i,thread_index);
+  gtree->travbuffer = NULL;
+
+  if (opt_est_locusrate)
+    gtree->rate_mui = sd->mui_array[i];
+  else
+    gtree->rate_mui = 1;
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+    gtree->rate_nui = sd->vi_array[i];
+
+  slot->tmrca = gtree->root->time;
+
+  /* set branch lengths */
+  for (j = 0; j < gtree->tip_count+gtree->inner_count; ++j)
+  {
+    if (!gtree->nodes[j]->parent) continue;
+
+    gtree->nodes[j]->length = gtree->nodes[j]->parent->time -
+                              gtree->nodes[j]->time;
+  }
+    
+  assert(sd->locus_seqcount == gtree->tip_count);
+
+  /* TODO: Count 3S trees */
+
+  /* if clock is assumed, compute species tree branch rates and write them to
+     file */
+  if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
+  {
+    relaxed_clock_branch_lengths(stree, gtree, st->rates, thread_index);
+    if (opt_modelparafile)
+    {
+      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+        simbuf_printf(&slot->param, " %.6f", st->rates[j]);
+    }
+  }
+  if (opt_modelparafile)
+    simbuf_printf(&slot->param, "\n");
+
+  /* multiply branches with locus rate */
+  if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
+  {
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      gtree->nodes[j]->length *= sd->mui_array[i];
+  }
+
+  if (opt_treefile)
+  {
+    char * newick = gtree_export_newick(gtree->root, NULL);
+    simbuf_printf(&slot->tree, "%s [TH=%.6f]\n", newick, gtree->root->time);
+    free(newick);
+  }
+
+  if (opt_msafile)
+  {
+    /* calculate rates for each site */
+    if (locus_siterate_alpha)
+      siterates = rates4sites(locus_siterate_alpha,
+                              (opt_model == BPP_DNA_MODEL_JC69),
+                              thread_index);
+
+    /* allocate space for sequences and map each to a gene tree node */
+    char ** x = (char**)xmalloc((size_t)(gtree->tip_count+gtree->inner_count)*
+                                sizeof(char *));
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+    {
+      x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      gtree->nodes[j]->data = (void *)(x[j]);
+    }
+
+    /* map also gene tree tip node sequences to the msa alignment structure,
+       and free the placeholder */
+    for (j = 0; j < gtree->tip_count; ++j)
+      msa->sequence[j] = x[j];
+    free(x);
+
+    /* generate a sequence at the root */
+    make_root_seq(gtree->root, freqs, thread_index);
+
+    /* recursively generate ancestral sequences and tip sequences */
+    if (opt_model == BPP_DNA_MODEL_JC69)
+    {
+      evolve_jc69_recursive(gtree->root->left,
+                            locus_siterate_alpha,
+                            siterates,
+                            thread_index);
+      evolve_jc69_recursive(gtree->root->right,
+                            locus_siterate_alpha,
+                            siterates,
+                            thread_index);
+    }
+    else
+    {
+      evolve_gtr_recursive(gtree->root->left,locus_siterate_alpha,siterates,
+                           st->eigenvecs,st->inv_eigenvecs,st->eigenvals,
+                           thread_index);
+      evolve_gtr_recursive(gtree->root->right,locus_siterate_alpha,siterates,
+                           st->eigenvecs,st->inv_eigenvecs,st->eigenvals,
+                           thread_index);
+    }
+
+    /* shuffle order of sites */
+    if (locus_siterate_alpha && opt_siterate_cats > 1)
+    {
+      randomize_order(st->siteorder, st->order, opt_locus_simlen, thread_index);
+      char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      {
+        char * seq = (char *)(gtree->nodes[j]->data);   
+        memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
+        for (k = 0; k < opt_locus_simlen; ++k)
+          seq[k] = tmpseq[st->siteorder[k]];
+      }
+      free(tmpseq);
+    }
+
+    /* collapse diploid sequences */
+    if (sd->hets < msa->count)
+    {
+      /* write full data first */
+      write_seqs(&slot->seqfull, msa, stree->tip_count);
+      if (stree->tip_count == 1)
+        slot->md_full = msa_mean_distance(msa->count, opt_locus_simlen, msa);
+      write_diploid_rand_seqs(&slot->seqrand,
+                              stree,
+                              msa,
+                              &slot->md_rand,
+                              thread_index);
+
+      /* then collapse sequences */
+      collapse_diploid(stree,gtree,msa,sd->hets);
+    }
+
+    /* write sequences */
+    write_seqs(&slot->seq, msa, stree->tip_count);
+    slot->H = msa_mean_heterozygosity(msa->count, opt_locus_simlen, msa);
+
+    /* TODO: Instead of freeing and allocating, create siterates once and
+       fill it with ones, and use rates4sites to alter it */
+    if (siterates)
+      free(siterates);
+  }
+
+  /* keep the sequences for the concatenated alignment, and deallocate the
+     gene tree and the coalescent events of the locus */
+  if (opt_concatfile)
+  {
+    for (j = 0; j < gtree->tip_count; ++j)
+      gtree->nodes[j]->data = NULL;
+    sd->msa[i] = msa;
+  }
+  gtree_destroy(gtree,free);
+
+  for (j = 0; j < stree->tip_count+stree->inner_count+stree->hybrid_count; ++j)
+    dlist_clear(stree->nodes[j]->event[i],NULL);
+
+  if (!opt_concatfile)
+  {
+    for (j = 0; j < msa->count; ++j)
+      free(msa->label[j]);
+    if (msa->label)
+      free(msa->label);
+
+    /* sequences were already freed as they are mapped to the gene tree */
+    if (msa->sequence)
+      free(msa->sequence);
+    free(msa);
+  }
+}
+
+static void * simulate_worker(void * vp)
+{
+  long i;
+  simthread_t * st = (simthread_t *)vp;
+  simdata_t * sd = st->sd;
+
+  pthread_mutex_lock(&sd->mutex);
+  while (1)
+  {
+    /* wait until the slot of the next locus has been written */
+    while (sd->next < opt_locus_count &&
+           sd->next >= sd->written + sd->slot_count)
+      pthread_cond_wait(&sd->cond, &sd->mutex);
+
+    if (sd->next == opt_locus_count)
+      break;
+
+    i = sd->next++;
+    pthread_mutex_unlock(&sd->mutex);
+
+    simulate_locus(sd,st,i);
+
+    pthread_mutex_lock(&sd->mutex);
+    sd->slot[i % sd->slot_count].ready = 1;
+    pthread_cond_broadcast(&sd->cond);
+  }
+  pthread_mutex_unlock(&sd->mutex);
+
+  return NULL;
+}
+
 static void simulate(stree_t * stree)
 {
-  long i,j,k,m;
-  long hets;
+  long i,j;
+  long thread_count;
   double tmrca = 0;
-  long * siteorder = NULL;
-  double * eigenvecs = NULL;
-  double * inv_eigenvecs = NULL;
-  double * eigenvals = NULL;
   FILE * fp_seq = NULL;
   FILE * fp_concat = NULL;
   FILE * fp_tree = NULL;
@@ -1200,8 +1663,9 @@ static void simulate(stree_t * stree)
   FILE * fp_map = NULL;
   FILE * fp_seqfull = NULL;
   FILE * fp_seqrand = NULL;
+  simdata_t sd;
+  simthread_t * st;
 
-  double H = -1, md_full = -1, md_rand = -1;
   double mH = 0, meand_full = 0, meand_rand = 0;
 
   /* open output files */
@@ -1232,9 +1696,12 @@ static void simulate(stree_t * stree)
   if (opt_migration)
     set_migration_rates(stree);
 
-  hets = 0;
+  memset(&sd, 0, sizeof(simdata_t));
+  sd.stree = stree;
+
+  sd.hets = 0;
   for (i = 0; i < stree->tip_count; ++i)
-    hets += opt_sp_seqcount[i] / (opt_diploid[i] ? 2 : 1);
+    sd.hets += opt_sp_seqcount[i] / (opt_diploid[i] ? 2 : 1);
 
   /* print model parameter file header */
   if (opt_modelparafile)
@@ -1270,39 +1737,18 @@ static void simulate(stree_t * stree)
   for (i = 0; i < stree->tip_count; ++i)
     fprintf(fp_map, "%s\t%s\n", stree->nodes[i]->label, stree->nodes[i]->label);
 
-
-  /* allocate MSA structures */
-  msa_t ** msa = (msa_t **)xmalloc((size_t)opt_locus_count * sizeof(msa_t *));
-  for (i = 0; i < opt_locus_count; ++i)
-    msa[i] = (msa_t *)xcalloc(1,sizeof(msa_t));
-
-  /* allocate placeholder for gene trees */
-  gtree_t ** gtree = (gtree_t **)xmalloc((size_t)opt_locus_count *
-                                         sizeof(gtree_t *));
-
-  long locus_seqcount;
-  double qrates[6];
-  double freqs[4];
-  double locus_siterate_alpha = opt_siterate_alpha;
-  double * siterates = NULL;
-  double * mui_array = NULL;
-  double * vi_array = NULL;
-
-  /* allocate array used for shuffling order of sites */
-  if (opt_msafile)
-    siteorder = (long *)xmalloc((size_t)opt_locus_simlen * sizeof(long));
-
-//  if (opt_siterate_fixed)
-//    locus_siterate_alpha = opt_siterate_alpha;
+  /* alignments are kept only for writing the concatenated alignment */
+  if (opt_concatfile)
+    sd.msa = (msa_t **)xcalloc((size_t)opt_locus_count, sizeof(msa_t *));
 
   /* store number of sequences per locus (before collpasing diploid seqs) */
-  locus_seqcount = 0;
+  sd.locus_seqcount = 0;
   for (i = 0; i < stree->tip_count; ++i)
-    locus_seqcount += opt_sp_seqcount[i];
+    sd.locus_seqcount += opt_sp_seqcount[i];
 
   if (opt_msafile)
   {
-    if (hets < locus_seqcount)
+    if (sd.hets < sd.locus_seqcount)
     {
       char * filename = NULL;
       xasprintf(&filename, "%s.full", opt_msafile);
@@ -1316,6 +1762,15 @@ static void simulate(stree_t * stree)
     }
   }
 
+  for (j = 0; j < stree->tip_count; ++j)
+    if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
+      fatal("Missing theta value for species %s consisting of more than one "
+            "samples", stree->nodes[j]->label);
+
+  /* TODO: Check for hybridization nodes as well */
+  for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
+    if (stree->nodes[j]->theta == 0)
+      fatal("Missing theta values for some of the species tree inner nodes");
 
   /* 1. create maplist (Imap) and 2. initialize two hashtables which are used
      when calling gtree_simulate for quick access to a sequence population */
@@ -1324,24 +1779,16 @@ static void simulate(stree_t * stree)
   list_clear(maplist,map_dealloc);
   free(maplist);
 
-  /* allocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
-  {
-    eigenvecs = (double *)xmalloc(16*sizeof(double));
-    inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
-    eigenvals = (double *)xmalloc(4*sizeof(double));
-  }
-
   /* pre-generate mu_i and v_i */
   if (opt_est_locusrate)
   {
-    mui_array = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
+    sd.mui_array = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
     if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
     {
       /* generate locus rates from Gamma(a_mui,a_mui/mubar) */
       for (i = 0; i < opt_locus_count; ++i)
-        mui_array[i] = legacy_rndgamma(thread_index_zero,opt_mui_alpha) /
-                       (opt_mui_alpha/opt_locusrate_mubar);
+        sd.mui_array[i] = legacy_rndgamma(thread_index_zero,opt_mui_alpha) /
+                          (opt_mui_alpha/opt_locusrate_mubar);
     }
     else
     {
@@ -1350,26 +1797,26 @@ static void simulate(stree_t * stree)
       double tmp_sum = 0;
       for (i = 0; i < opt_locus_count; ++i)
       {
-        mui_array[i] = legacy_rndgamma(thread_index_zero,opt_mui_alpha);
-        tmp_sum += mui_array[i];
+        sd.mui_array[i] = legacy_rndgamma(thread_index_zero,opt_mui_alpha);
+        tmp_sum += sd.mui_array[i];
       }
       for (i = 0; i < opt_locus_count; ++i)
       {
-        mui_array[i] /= tmp_sum;
-        mui_array[i] *= opt_locusrate_mubar*opt_locus_count;
+        sd.mui_array[i] /= tmp_sum;
+        sd.mui_array[i] *= opt_locusrate_mubar*opt_locus_count;
       }
     }
   }
 
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
-    vi_array = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
+    sd.vi_array = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
     if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
     {
       /* generate v_i from Gamma(a_vi,a_vi/vbar) */
       for (i = 0; i < opt_locus_count; ++i)
-        vi_array[i] = legacy_rndgamma(thread_index_zero,opt_vi_alpha) /
-                      (opt_vi_alpha/opt_clock_vbar);
+        sd.vi_array[i] = legacy_rndgamma(thread_index_zero,opt_vi_alpha) /
+                         (opt_vi_alpha/opt_clock_vbar);
     }
     else
     {
@@ -1378,257 +1825,127 @@ static void simulate(stree_t * stree)
       double tmp_sum = 0;
       for (i = 0; i < opt_locus_count; ++i)
       {
-        vi_array[i] = legacy_rndgamma(thread_index_zero,opt_vi_alpha);
-        tmp_sum += vi_array[i];
+        sd.vi_array[i] = legacy_rndgamma(thread_index_zero,opt_vi_alpha);
+        tmp_sum += sd.vi_array[i];
       }
       for (i = 0; i < opt_locus_count; ++i)
       {
-        vi_array[i] /= tmp_sum;
-        vi_array[i] *= opt_clock_vbar*opt_locus_count;
+        sd.vi_array[i] /= tmp_sum;
+        sd.vi_array[i] *= opt_clock_vbar*opt_locus_count;
       }
     }
   }
 
-  /* start generating */
-  for (i = 0; i < opt_locus_count; ++i)
-  {
-    if (opt_modelparafile)
-      fprintf(fp_param, "%ld", i+1);
-
-
-    if (opt_model == BPP_DNA_MODEL_GTR)
-    {
-      if (!opt_qrates_fixed)
-      {
-        legacy_rnddirichlet(thread_index_zero,qrates,opt_qrates_params,6);
-        for (j = 0; j < 6; ++j)
-          qrates[j] /= qrates[5];
-      }
-      else
-        memcpy(qrates,opt_qrates_params,6*sizeof(double));
+  /* the random number streams of the loci are derived from the state of the
+     main stream at this point */
+  sd.seed = get_legacy_rndu_status(thread_index_zero);
 
-      if (!opt_basefreqs_fixed)
-        legacy_rnddirichlet(thread_index_zero,freqs,opt_basefreqs_params,4);
-      else
-        memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
+  thread_count = MIN(opt_threads,opt_locus_count);
+  if (thread_count > 1)
+    fprintf(stdout, "Simulating loci using %ld threads\n", thread_count);
 
-      /* print parameters in parameter file */
-      assert(opt_modelparafile);
-      if (opt_modelparafile)
-      {
-        for (j = 0; j < 6; ++j)
-          fprintf(fp_param," %9.6f", qrates[j]);
-        for (j = 0; j < 4; ++j)
-          fprintf(fp_param," %8.6f", freqs[j]);
-      }
-
-      pll_update_eigen(eigenvecs,inv_eigenvecs,eigenvals,freqs,qrates,4,4);
-    }
-
-    if (!opt_siterate_fixed)
-    {
-      locus_siterate_alpha = legacy_rndgamma(thread_index_zero,opt_siterate_alpha) /
-                             opt_siterate_beta;
-      if (opt_modelparafile)
-        fprintf(fp_param, " %9.6f", locus_siterate_alpha);
-    }
-    if (opt_modelparafile)
-    {
-      if (opt_est_locusrate)
-        fprintf(fp_param, " %9.6f", mui_array[i]);
-      if (opt_clock != BPP_CLOCK_GLOBAL)
-        fprintf(fp_param, " %9.6f", vi_array[i]);
-    }
+  /* one migration events matrix per thread */
+  if (opt_migration && thread_count > 1)
+  {
+    long matrix_size = opt_migration * opt_migration;
+    opt_migration_events = (double *)xrealloc(opt_migration_events,
+                                              (size_t)(thread_count*matrix_size)*
+                                              sizeof(double));
+    memset(opt_migration_events+matrix_size,
+           0,
+           (size_t)((thread_count-1)*matrix_size)*sizeof(double));
+  }
 
-    if (opt_msafile || opt_treefile)
+  /* allocate per-thread workspaces */
+  st = (simthread_t *)xcalloc((size_t)thread_count, sizeof(simthread_t));
+  for (i = 0; i < thread_count; ++i)
+  {
+    st[i].index = i;
+    st[i].sd = &sd;
+    st[i].rates = (double *)xcalloc((size_t)(stree->tip_count +
+                                             stree->inner_count +
+                                             stree->hybrid_count),
+                                    sizeof(double));
+    if (opt_msafile)
     {
-      msa[i]->label    = (char**)xmalloc((size_t)locus_seqcount*sizeof(char *));
-      msa[i]->sequence = (char**)xmalloc((size_t)locus_seqcount*sizeof(char *));
-
-      /* create sequence labels and populate msa structure */
-      for (j = 0, m = 0; j < stree->tip_count; ++j)
-      {
-        if (opt_diploid[j])
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s%ld%c^%s",
-                      stree->nodes[j]->label, 
-                      k / 2 + 1,
-                      (char)('a' + k % 2),
-                      stree->nodes[j]->label);
-        else
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s%ld^%s",
-                      stree->nodes[j]->label, 
-                      k + 1,
-                      stree->nodes[j]->label);
-
-        msa[i]->count += opt_sp_seqcount[j];
-      }
-      msa[i]->length = opt_locus_simlen;
-
-      /* change all sequence labels to lowercase */
-      for (j = 0; j < m; ++j)
-        for (k = 0; k < (long)strlen(msa[i]->label[j]) && msa[i]->label[j][k] != '^'; ++k)
-          msa[i]->label[j][k] = xtolower(msa[i]->label[j][k]);
+      st[i].siteorder = (long *)xmalloc((size_t)opt_locus_simlen*sizeof(long));
+      st[i].order = (long *)xmalloc((size_t)opt_locus_simlen*sizeof(long));
     }
-
-    for (j = 0; j < stree->tip_count; ++j)
-      if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
-        fatal("Missing theta value for species %s consisting of more than one "
-              "samples", stree->nodes[j]->label);
-
-    /* TODO: Check for hybridization nodes as well */
-    for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
-      if (stree->nodes[j]->theta == 0)
-        fatal("Missing theta values for some of the species tree inner nodes");
-
-    /* simulate gene tree */
-    gtree[i] = gtree_simulate(stree,msa[i],i);
-    gtree[i]->travbuffer = NULL;
-
-    if (opt_est_locusrate)
-      gtree[i]->rate_mui = mui_array[i];
-    else
-      gtree[i]->rate_mui = 1;
-
-    if (opt_clock != BPP_CLOCK_GLOBAL)
-      gtree[i]->rate_nui = vi_array[i];
-
-    tmrca += gtree[i]->root->time;
-
-    /* set branch lengths */
-    for (j = 0; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
+    if (opt_model == BPP_DNA_MODEL_GTR)
     {
-      if (!gtree[i]->nodes[j]->parent) continue;
-
-      gtree[i]->nodes[j]->length = gtree[i]->nodes[j]->parent->time -
-                                   gtree[i]->nodes[j]->time;
+      st[i].eigenvecs = (double *)xmalloc(16*sizeof(double));
+      st[i].inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
+      st[i].eigenvals = (double *)xmalloc(4*sizeof(double));
     }
-      
-    assert(locus_seqcount == gtree[i]->tip_count);
+  }
 
-    /* TODO: Count 3S trees */
+  /* reorder buffer of finished loci waiting to be written */
+  sd.slot_count = (thread_count > 1) ? 4*thread_count : 1;
+  sd.slot = (simslot_t *)xcalloc((size_t)sd.slot_count, sizeof(simslot_t));
 
-    /* if clock is assumed, compute species tree branch rates and write them to
-       file */
-    if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
-    {
-      relaxed_clock_branch_lengths(stree, gtree[i]);
-      if (opt_modelparafile)
-      {
-        for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-          fprintf(fp_param, " %.6f", stree->nodes[j]->rate);
-      }
-    }
-    if (opt_modelparafile)
-      fprintf(fp_param, "\n");
+  if (thread_count > 1)
+  {
+    if (pthread_mutex_init(&sd.mutex, NULL) ||
+        pthread_cond_init(&sd.cond, NULL))
+      fatal("Cannot initialize simulation threads");
 
-    /* multiply branches with locus rate */
-    if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
-    {
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-        gtree[i]->nodes[j]->length *= mui_array[i];
-    }
+    for (i = 0; i < thread_count; ++i)
+      if (pthread_create(&st[i].thread, NULL, simulate_worker, (void *)(st+i)))
+        fatal("Cannot create thread");
+  }
 
+  /* write loci in order as they become available */
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    simslot_t * slot = sd.slot + i % sd.slot_count;
 
-    if (opt_treefile)
+    if (thread_count > 1)
     {
-      char * newick = gtree_export_newick(gtree[i]->root, NULL);
-      fprintf(fp_tree, "%s [TH=%.6f]\n", newick, gtree[i]->root->time);
-      free(newick);
+      pthread_mutex_lock(&sd.mutex);
+      while (!slot->ready)
+        pthread_cond_wait(&sd.cond, &sd.mutex);
+      pthread_mutex_unlock(&sd.mutex);
     }
+    else
+      simulate_locus(&sd,st,i);
 
-    if (opt_msafile)
-    {
-      /* calculate rates for each site */
-      if (locus_siterate_alpha)
-        siterates = rates4sites(locus_siterate_alpha,
-                                (opt_model == BPP_DNA_MODEL_JC69));
-
-      /* allocate space for sequences and map each to a gene tree node */
-      char ** x = (char**)xmalloc((size_t)(gtree[i]->tip_count+gtree[i]->inner_count)*
-                                  sizeof(char *));
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-      {
-        x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        gtree[i]->nodes[j]->data = (void *)(x[j]);
-      }
-
-      /* map also gene tree tip node sequences to the msa alignment structure,
-         and free the placeholder */
-      for (j = 0; j < gtree[i]->tip_count; ++j)
-        msa[i]->sequence[j] = x[j];
-      free(x);
-
-      /* generate a sequence at the root */
-      make_root_seq(gtree[i]->root, freqs);
-
-      /* recursively generate ancestral sequences and tip sequences */
-      if (opt_model == BPP_DNA_MODEL_JC69)
-      {
-        evolve_jc69_recursive(gtree[i]->root->left, locus_siterate_alpha, siterates);
-        evolve_jc69_recursive(gtree[i]->root->right, locus_siterate_alpha, siterates);
-      }
-      else
-      {
-        evolve_gtr_recursive(gtree[i]->root->left,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
-        evolve_gtr_recursive(gtree[i]->root->right,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
-      }
-
-      /* shuffle order of sites */
-      if (locus_siterate_alpha && opt_siterate_cats > 1)
-      {
-        randomize_order(siteorder, opt_locus_simlen);
-        char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-        {
-          char * seq = (char *)(gtree[i]->nodes[j]->data);   
-          memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
-          for (k = 0; k < opt_locus_simlen; ++k)
-            seq[k] = tmpseq[siteorder[k]];
-        }
-        free(tmpseq);
-      }
-
-      /* collapse diploid sequences */
-      if (hets < msa[i]->count)
-      {
-        /* write full data first */
-        if (fp_seqfull)
-        {
-          write_seqs(fp_seqfull, msa[i], stree->tip_count);
-          if (stree->tip_count == 1)
-            md_full =  msa_mean_distance(msa[i]->count, opt_locus_simlen, msa[i]);
-        }
-        if (fp_seqrand)
-          write_diploid_rand_seqs(fp_seqrand,stree,msa[i], &md_rand);
-
-        /* then collapse sequences */
-        collapse_diploid(stree,gtree[i],msa[i],hets);
-      }
+    simbuf_flush(&slot->param, fp_param);
+    simbuf_flush(&slot->tree, fp_tree);
+    simbuf_flush(&slot->seqfull, fp_seqfull);
+    simbuf_flush(&slot->seqrand, fp_seqrand);
+    simbuf_flush(&slot->seq, fp_seq);
 
-      /* write sequences */
-      write_seqs(fp_seq, msa[i], stree->tip_count);
-      H = msa_mean_heterozygosity(msa[i]->count, opt_locus_simlen, msa[i]);
+    tmrca += slot->tmrca;
 
-      /* TODO: Instead of freeing and allocating, create siterates once and
-         fill it with ones, and use rates4sites to alter it */
-      if (siterates)
-        free(siterates);
-    }
     if (stree->tip_count == 1)
     {
-      mH += H;  meand_full += md_full;  meand_rand += md_rand;
+      mH += slot->H;
+      meand_full += slot->md_full;
+      meand_rand += slot->md_rand;
       printf("locus %3ld, H md_full md_rand: %9.6f %9.6f %9.6f\n",
-             i + 1, H, md_full, md_rand);
+             i + 1, slot->H, slot->md_full, slot->md_rand);
     }
     if ((i+1) % 1000 == 0 || (opt_locus_count > 1000 && i == opt_locus_count-1))
       printf("%10ld replicates done... mean tMRCA = %9.6f\n", i+1, tmrca/(i+1));
+
+    if (thread_count > 1)
+    {
+      pthread_mutex_lock(&sd.mutex);
+      slot->ready = 0;
+      sd.written = i+1;
+      pthread_cond_broadcast(&sd.cond);
+      pthread_mutex_unlock(&sd.mutex);
+    }
   }  /* end of locus loop */
+
+  if (thread_count > 1)
+  {
+    for (i = 0; i < thread_count; ++i)
+      pthread_join(st[i].thread, NULL);
+
+    pthread_mutex_destroy(&sd.mutex);
+    pthread_cond_destroy(&sd.cond);
+  }
   
   if (stree->tip_count == 1)
   {
@@ -1638,7 +1955,7 @@ static void simulate(stree_t * stree)
   if (opt_concatfile)
   {
     fprintf(stdout, "Generating concatenated sequence alignment...\n");
-    write_concat_seqs(fp_concat, msa);
+    write_concat_seqs(fp_concat, sd.msa);
 
   }
 
@@ -1646,6 +1963,11 @@ static void simulate(stree_t * stree)
   {
     long matrix_size = opt_migration * opt_migration;
 
+    /* sum the migration events counted by each thread */
+    for (j = 1; j < thread_count; ++j)
+      for (i = 0; i < matrix_size; ++i)
+        opt_migration_events[i] += opt_migration_events[j*matrix_size+i];
+
     for (i = 0; i < matrix_size; ++i)
       opt_migration_events[i] /= opt_locus_count;
 
@@ -1660,39 +1982,57 @@ static void simulate(stree_t * stree)
     }
   }
 
-  if (mui_array)
-    free(mui_array);
-  if (vi_array)
-    free(vi_array);
+  if (sd.mui_array)
+    free(sd.mui_array);
+  if (sd.vi_array)
+    free(sd.vi_array);
   
   /* deallocate hashtables used for mapping sequences to species */
   gtree_simulate_fini();
 
-  /* deallocate alignment structures and gene trees */
-  for (i = 0; i < opt_locus_count; ++i)
+  /* deallocate alignments kept for the concatenated alignment */
+  if (opt_concatfile)
   {
-    gtree_destroy(gtree[i],free);
-
-    for (j = 0; j < msa[i]->count; ++j)
-      free(msa[i]->label[j]);
-    free(msa[i]->label);
-
-    /* remember sequences were already freed as they are mapped to the gene tree */
-    free(msa[i]->sequence);
-    free(msa[i]);
+    for (i = 0; i < opt_locus_count; ++i)
+    {
+      for (j = 0; j < sd.msa[i]->count; ++j)
+      {
+        free(sd.msa[i]->label[j]);
+        free(sd.msa[i]->sequence[j]);
+      }
+      free(sd.msa[i]->label);
+      free(sd.msa[i]->sequence);
+      free(sd.msa[i]);
+    }
+    free(sd.msa);
   }
-  free(msa);
-  free(gtree);
-
 
+  /* deallocate reorder buffer and thread workspaces */
+  for (i = 0; i < sd.slot_count; ++i)
+  {
+    free(sd.slot[i].seq.data);
+    free(sd.slot[i].seqfull.data);
+    free(sd.slot[i].seqrand.data);
+    free(sd.slot[i].tree.data);
+    free(sd.slot[i].param.data);
+  }
+  free(sd.slot);
 
-  /* deallocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
+  for (i = 0; i < thread_count; ++i)
   {
-    free(eigenvecs);
-    free(inv_eigenvecs);
-    free(eigenvals);
+    free(st[i].rates);
+    if (st[i].siteorder)
+      free(st[i].siteorder);
+    if (st[i].order)
+      free(st[i].order);
+    if (st[i].eigenvecs)
+    {
+      free(st[i].eigenvecs);
+      free(st[i].inv_eigenvecs);
+      free(st[i].eigenvals);
+    }
   }
+  free(st);
 
   /* close all open output files */
   if (opt_msafile)
@@ -1711,11 +2051,6 @@ static void simulate(stree_t * stree)
     fclose(fp_seqfull);
   if (fp_seqrand)
     fclose(fp_seqrand);
-
-  if (g_order)
-    free(g_order);
-  if (siteorder)
-    free(siteorder);
 }
 
 static void assign_thetas(stree_t * stree)
@@ -389,6 +389,8 @@ static void snode_clone(snode_t * snode, snode_t * clone, stree_t * clone_stree)
   clone->has_theta = snode->has_theta;
   clone->constraint = snode->constraint;
   clone->constraint_lineno = snode->constraint_lineno;
+  clone->finetune_theta = snode->finetune_theta;
+  clone->finetune_tau = snode->finetune_tau;
 
   if (!clone->mark)
     clone->mark = (int *)xmalloc((size_t)opt_threads*sizeof(int));
@@ -2217,13 +2219,19 @@ static int propose_theta(gtree_t ** gtree,
   double lnacceptance = 0;
   double minv = -99;
   double maxv =  99;
+  double finetune = opt_finetune_adapt ?
+                      snode->finetune_theta : opt_finetune_theta;
+  double * logpr_diff;
+  long locus_first = mproc_locus_first();
+  long locus_end = mproc_locus_end();
+  size_t scratch = arena_mark(thread_index);
 
   thetaold = snode->theta;
 
   if (!opt_exp_theta)
   {
     /* original proposal for theta */
-    thetanew = thetaold + opt_finetune_theta*legacy_rnd_symmetrical(thread_index);
+    thetanew = thetaold + finetune*legacy_rnd_symmetrical(thread_index);
     if (opt_theta_dist == BPP_THETA_PRIOR_BETA)
       thetanew = reflect(thetanew, opt_theta_min, opt_theta_max, thread_index);
     else
@@ -2243,7 +2251,7 @@ static int propose_theta(gtree_t ** gtree,
     }
 
     logthetaold = log(thetaold);
-    logthetanew = logthetaold + opt_finetune_theta*legacy_rnd_symmetrical(thread_index);
+    logthetanew = logthetaold + finetune*legacy_rnd_symmetrical(thread_index);
     logthetanew = reflect(logthetanew, minv, maxv, thread_index);
 
     lnacceptance = logthetanew - logthetaold;
@@ -2267,7 +2275,11 @@ static int propose_theta(gtree_t ** gtree,
                     log((opt_theta_max-thetanew) / (opt_theta_max-thetaold));
   }
 
-  for (i = 0; i < opt_locus_count; ++i)
+  /* the differences of the loci of other processes are gathered and summed in
+     locus order, as with a single process */
+  logpr_diff = (double *)arena_alloc(thread_index,
+                                     opt_locus_count * sizeof(double));
+  for (i = locus_first; i < locus_end; ++i)
   {
     /* save a copy of old logpr */
     gtree[i]->old_logpr = gtree[i]->logpr;
@@ -2276,8 +2288,13 @@ static int propose_theta(gtree_t ** gtree,
     gtree_update_logprob_contrib(snode, locus[i]->heredity[0], i, thread_index);
     gtree[i]->logpr += snode->logpr_contrib[i];
 
-    lnacceptance += (gtree[i]->logpr - gtree[i]->old_logpr);
+    logpr_diff[i] = gtree[i]->logpr - gtree[i]->old_logpr;
   }
+  mproc_gather_loci(logpr_diff, sizeof(double));
+
+  for (i = 0; i < opt_locus_count; ++i)
+    lnacceptance += logpr_diff[i];
+  arena_release(thread_index,scratch);
 
   if (opt_debug_theta)
     printf("[Debug] (theta) lnacceptance = %f\n", lnacceptance);
@@ -2292,11 +2309,11 @@ static int propose_theta(gtree_t ** gtree,
      only update it when proposal is accepted */
 
      /* reject */
-  for (i = 0; i < opt_locus_count; ++i)
+  for (i = locus_first; i < locus_end; ++i)
     gtree[i]->logpr = gtree[i]->old_logpr;
 
   snode->theta = thetaold;
-  for (i = 0; i < opt_locus_count; ++i)
+  for (i = locus_first; i < locus_end; ++i)
     snode->logpr_contrib[i] = snode->old_logpr_contrib[i];
 
   return 0;
@@ -2316,7 +2333,17 @@ double stree_propose_theta(gtree_t ** gtree, locus_t ** locus, stree_t * stree)
     snode = stree->nodes[i];
     if (snode->theta >= 0 && snode->has_theta)
     {
-      accepted += propose_theta(gtree, locus, stree->nodes[i], thread_index);
+      int theta_accepted = propose_theta(gtree,
+                                         locus,
+                                         stree->nodes[i],
+                                         thread_index);
+      if (opt_finetune_adapt)
+        adapt_update(&(snode->finetune_theta),
+                     BPP_MOVE_THETA_INDEX,
+                     theta_accepted,
+                     1);
+
+      accepted += theta_accepted;
       theta_count++;
     }
   }
@@ -2839,7 +2866,10 @@ static long propose_tau(locus_t ** loci,
   }
 
   /* propose new tau */
-  newage = oldage + opt_finetune_tau * legacy_rnd_symmetrical(thread_index);
+  if (opt_finetune_adapt)
+    newage = oldage + snode->finetune_tau * legacy_rnd_symmetrical(thread_index);
+  else
+    newage = oldage + opt_finetune_tau * legacy_rnd_symmetrical(thread_index);
   newage = reflect(newage, minage, maxage, thread_index);
   snode->tau = newage;
 
@@ -3124,7 +3154,7 @@ static long propose_tau(locus_t ** loci,
     /* accepted */
     accepted++;
 
-    for (i = 0; i < stree->locus_count; ++i)
+    for (i = mproc_locus_first(); i < mproc_locus_end(); ++i)
     {
       k = __mark_count[i];
 
@@ -3175,7 +3205,7 @@ static long propose_tau(locus_t ** loci,
       }
     }
 
-    for (i = 0; i < stree->locus_count; ++i)
+    for (i = mproc_locus_first(); i < mproc_locus_end(); ++i)
     {
       k = __mark_count[i];
       gnode_t ** gt_nodesptr = __gt_nodes + __gt_nodes_index[i];
@@ -3315,12 +3345,21 @@ double stree_propose_tau(gtree_t ** gtree, stree_t * stree, locus_t ** loci)
   for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
   {
     if (stree->nodes[i]->tau > 0 && (!opt_msci || stree->nodes[i]->prop_tau))
-      accepted += propose_tau(loci,
-                              stree->nodes[i],
-                              gtree,
-                              stree,
-                              candidate_count,
-                              thread_index);
+    {
+      long tau_accepted = propose_tau(loci,
+                                      stree->nodes[i],
+                                      gtree,
+                                      stree,
+                                      candidate_count,
+                                      thread_index);
+      if (opt_finetune_adapt)
+        adapt_update(&(stree->nodes[i]->finetune_tau),
+                     BPP_MOVE_TAU_INDEX,
+                     tau_accepted,
+                     1);
+
+      accepted += tau_accepted;
+    }
   }
 
   return ((double)accepted / candidate_count);
@@ -3752,6 +3791,10 @@ long stree_propose_spr(stree_t ** streeptr,
     branch_update_count = 0;
     gtree_t * gtree = gtree_list[i];
 
+    /* target selection reads CLVs of the unpruned gene tree */
+    if (opt_revolutionary_spr_method && opt_lowmem)
+      locus_clv_validate(loci[i],gtree->root);
+
     /* mark all nodes in gene tree paths starting from some tip and end at Z
        (excluding nodes in Z), but which also include at least one node in A */
     for (j = 0; j < gtree->tip_count; ++j)
@@ -3882,11 +3925,13 @@ long stree_propose_spr(stree_t ** streeptr,
         /* if more than one target nodes, select according to likelihood */
         if (target_count > 1)
         {
-          /* allocate space for target nodes weights */
-          double * tweight = (double *)xmalloc(target_count * sizeof(double));
+          /* space for target nodes weights */
+          size_t scratch = arena_mark(thread_index);
+          double * tweight = (double *)arena_alloc(thread_index,
+                                                   target_count * sizeof(double));
 
           /* compute weights (logl) for each target node in gtarget_list and store them in tweight */
-          revolutionary_spr_tselect_logl(pruned, gtarget_list, target_count, loci[i], tweight);
+          revolutionary_spr_tselect_logl(pruned, gtarget_list, target_count, loci[i], tweight, thread_index);
 
           /* normalize target weights */
           double maxw = tweight[0];
@@ -3910,8 +3955,8 @@ long stree_propose_spr(stree_t ** streeptr,
 
           twgt = tweight[n]/sum;
 
-          /* free weights */
-          free(tweight);
+          /* release weights */
+          arena_release(thread_index, scratch);
         }
         else
           gtarget_nodes[moved_count[i] - 1] = gtarget_list[0];
@@ -3944,7 +3989,9 @@ long stree_propose_spr(stree_t ** streeptr,
         /* if if more than one sources, select according to likelihood */
         if (source_count > 1)
         {
-          double * tweight = (double *)xmalloc(source_count * sizeof(double));
+          size_t scratch = arena_mark(thread_index);
+          double * tweight = (double *)arena_alloc(thread_index,
+                                                   source_count * sizeof(double));
 
           /* if a moved node appears in the sources, then replace it by
              descending until we find a non-moved node (not in LINEAGE_A) */
@@ -3958,7 +4005,7 @@ long stree_propose_spr(stree_t ** streeptr,
           }
 
           /* compute weights and store in tweight */
-          revolutionary_spr_tselect_logl(pruned, gsources_list, source_count, loci[i], tweight);
+          revolutionary_spr_tselect_logl(pruned, gsources_list, source_count, loci[i], tweight, thread_index);
           /* normalize target node weights */
           double maxw = tweight[0];
           for (n = 1; n < source_count; ++n)
@@ -3979,8 +4026,8 @@ long stree_propose_spr(stree_t ** streeptr,
 
           swgt = tweight[n]/sum;
 
-          /* free weights */
-          free(tweight);
+          /* release weights */
+          arena_release(thread_index, scratch);
         }
 
         if (opt_revolutionary_spr_debug)
@@ -4807,6 +4854,170 @@ double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index)
   return logpr;
 }
 
+static double digamma(double x)
+{
+  double f;
+  double r = 0;
+
+  /* recurrence up to x >= 6, then the asymptotic expansion */
+  while (x < 6)
+  {
+    r -= 1/x;
+    x += 1;
+  }
+  f = 1/(x*x);
+
+  return r + log(x) - 0.5/x -
+         f*(1.0/12 - f*(1.0/120 - f*(1.0/252 - f*(1.0/240 - f/132))));
+}
+
+/* Gradient of lnprior_rates() with respect to the log branch rates
+   (grad[snode_index]), log(mu_i) and log(nu_i). Under the correlated clock
+   the root rate is mu_i, hence its derivative is added to that of mu_i */
+void lnprior_rates_gradient(gtree_t * gtree,
+                            stree_t * stree,
+                            long msa_index,
+                            double * grad,
+                            double * grad_mui,
+                            double * grad_nui)
+{
+  long i;
+  double mui,nui;
+  double alpha,beta;
+  double gmui = 0, gnui = 0;
+  snode_t * snode;
+
+  long total_nodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
+
+  assert(opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR);
+
+  memset(grad, 0, total_nodes*sizeof(double));
+
+  mui = gtree->rate_mui;
+  nui = gtree->rate_nui;
+
+  if (opt_clock == BPP_CLOCK_CORR && opt_rate_prior == BPP_BRATE_PRIOR_GAMMA)
+  {
+    for (i = stree->tip_count; i < total_nodes; ++i)
+    {
+      snode = stree->nodes[i];
+
+      double m = snode->brate[msa_index];
+      alpha = m*m / nui;
+      beta = alpha / m;
+      double r1 = snode->left->brate[msa_index];
+      double r2 = snode->right->brate[msa_index];
+      double psi = digamma(alpha);
+      double logr12 = log(r1*r2);
+
+      grad[snode->left->node_index]  += -beta*r1 + alpha - 1;
+      grad[snode->right->node_index] += -beta*r2 + alpha - 1;
+
+      double gm = -4*alpha*psi + 4*alpha*log(beta) + 2*alpha -
+                  beta*(r1+r2) + 2*alpha*logr12;
+      if (snode->parent)
+        grad[snode->node_index] += gm;
+      else
+        gmui += gm;
+
+      gnui += 2*alpha*psi - 2*alpha*log(beta) - 2*alpha + beta*(r1+r2) -
+              alpha*logr12;
+    }
+  }
+  else if (opt_clock == BPP_CLOCK_CORR &&
+           opt_rate_prior == BPP_BRATE_PRIOR_LOGNORMAL)
+  {
+    double Tinv[4], t1, t2, tA, detT;
+    double rA, y1, y2, zz, g1, g2;
+
+    for (i = stree->tip_count; i < total_nodes; ++i)
+    {
+      snode = stree->nodes[i];
+
+      tA = snode->parent ? (snode->parent->tau - snode->tau) / 2 : 0;
+      t1 = (snode->tau - snode->left->tau) / 2;
+      t2 = (snode->tau - snode->right->tau) / 2;
+
+      detT = t1*t2 + tA*(t1+t2);
+      Tinv[0] = (tA+t2) / detT;
+      Tinv[1] = Tinv[2] = -tA / detT;
+      Tinv[3] = (tA+t1) / detT;
+
+      rA = snode->parent ? snode->brate[msa_index] : mui;
+      y1 = log(snode->left->brate[msa_index]/rA) + (tA+t1)*nui / 2;
+      y2 = log(snode->right->brate[msa_index]/rA) + (tA+t2)*nui / 2;
+      zz = (y1*y1*Tinv[0] + 2*y1*y2*Tinv[1] + y2*y2*Tinv[3]);
+
+      /* g = Tinv y */
+      g1 = Tinv[0]*y1 + Tinv[1]*y2;
+      g2 = Tinv[2]*y1 + Tinv[3]*y2;
+
+      grad[snode->left->node_index]  += -g1/nui - 1;
+      grad[snode->right->node_index] += -g2/nui - 1;
+      if (snode->parent)
+        grad[snode->node_index] += (g1+g2)/nui;
+      else
+        gmui += (g1+g2)/nui;
+
+      gnui += -(g1*(tA+t1) + g2*(tA+t2))/2 + zz/(2*nui) - 1;
+    }
+  }
+  else if (opt_clock == BPP_CLOCK_IND && opt_rate_prior == BPP_BRATE_PRIOR_GAMMA)
+  {
+    alpha = mui * mui / nui;
+    beta  = mui / nui;
+    long rates_count = 0;
+
+    for (i = 0; i < total_nodes; ++i)
+    {
+      snode = stree->nodes[i];
+
+      if (opt_msci && snode->hybrid)
+      {
+        if (node_is_hybridization(snode) && !snode->htau) continue;
+        if (node_is_bidirection(snode) && node_is_mirror(snode)) continue;
+      }
+
+      double r = snode->brate[msa_index];
+      grad[snode->node_index] = -beta*r + alpha - 1;
+      gmui += -beta*r + 2*alpha*log(r);
+      gnui += beta*r - alpha*log(r);
+
+      ++rates_count;
+    }
+
+    double psi = digamma(alpha);
+    gmui += (2*alpha*log(beta) + alpha - 2*alpha*psi) * rates_count;
+    gnui += (-alpha*log(beta) - alpha + alpha*psi) * rates_count;
+  }
+  else if (opt_clock == BPP_CLOCK_IND &&
+           opt_rate_prior == BPP_BRATE_PRIOR_LOGNORMAL)
+  {
+    double logmui = log(mui);
+
+    for (i = 0; i < total_nodes; ++i)
+    {
+      snode = stree->nodes[i];
+
+      if (opt_msci && snode->hybrid)
+      {
+        if (node_is_hybridization(snode) && !snode->htau) continue;
+        if (node_is_bidirection(snode) && node_is_mirror(snode)) continue;
+      }
+
+      double z = log(snode->brate[msa_index]) - logmui + nui/2;
+      grad[snode->node_index] = -z/nui - 1;
+      gmui += z/nui;
+      gnui += -z/2 + z*z/(2*nui) - 0.5;
+    }
+  }
+  else
+    assert(0);
+
+  *grad_mui = gmui;
+  *grad_nui = gnui;
+}
+
 double prop_locusrate_nui(gtree_t ** gtree,
                           stree_t * stree,
                           locus_t ** locus,
@@ -5632,6 +5843,314 @@ static long prop_branch_rates(gtree_t * gtree,
   return accepted;
 }
 
+/* Hamiltonian Monte Carlo move for the branch rates of a locus. The
+   coordinates are the log rates of the populations proposed by
+   prop_branch_rates(), followed by log(mu_i) and log(nu_i) when they have
+   the hierarchical prior (under the Gamma-Dirichlet prior they are tied to
+   the other loci through their sum). The trajectory is opt_hmc_steps leapfrog
+   steps using the gradient of the log-likelihood from
+   locus_brate_derivatives() and that of the rates prior from
+   lnprior_rates_gradient(). The step length is the per-locus hmc_step, which
+   starts at opt_finetune_branchrate and is tuned during burn-in (adapt.c),
+   multiplied by a U(0.9,1.1) jitter drawn for each trajectory. The inverse
+   mass matrix is diag(hmc_scale^2), with the per-coordinate scales estimated
+   from the burn-in windows. The proposed state is
+   computed in the alternative p-matrix and CLV buffers, as in the other
+   moves, so a rejection only swaps the buffer indices back */
+
+typedef struct hmc_state_s
+{
+  gtree_t * gtree;
+  stree_t * stree;
+  locus_t * locus;
+  unsigned int msa_index;
+  snode_t ** pops;
+  long pop_count;
+  int move_mui;
+  int move_nui;
+  double * dlnl;
+  double * dprior;
+  double logl;
+  double lnprior;
+} hmc_state_t;
+
+/* unphased diploid loci, T92 loci and low-memory mode keep the random-walk
+   move */
+static int hmc_eligible(locus_t * locus)
+{
+  return opt_hmc_steps && !opt_lowmem && !locus->diploid &&
+         !(locus->dtype == BPP_DATA_DNA && locus->model == BPP_DNA_MODEL_T92);
+}
+
+static void hmc_set_position(hmc_state_t * hs, const double * x)
+{
+  long j;
+  unsigned int msa_index = hs->msa_index;
+
+  for (j = 0; j < hs->pop_count; ++j)
+    hs->pops[j]->brate[msa_index] = exp(x[j]);
+
+  if (hs->move_mui)
+  {
+    hs->gtree->rate_mui = exp(x[j++]);
+    if (opt_clock == BPP_CLOCK_CORR)
+      hs->stree->root->brate[msa_index] = hs->gtree->rate_mui;
+  }
+  if (hs->move_nui)
+    hs->gtree->rate_nui = exp(x[j]);
+}
+
+/* log-density of the position on the log scale, and its gradient */
+static double hmc_evaluate(hmc_state_t * hs, double * grad, long thread_index)
+{
+  long j;
+  unsigned int msa_index = hs->msa_index;
+  double logpost;
+  double gmui, gnui;
+  double alpha, beta;
+  gtree_t * gtree = hs->gtree;
+  stree_t * stree = hs->stree;
+
+  if (opt_usedata)
+  {
+    locus_update_all_matrices(hs->locus,gtree,stree,msa_index);
+    locus_update_all_partials(hs->locus,gtree);
+    hs->logl = locus_root_loglikelihood(hs->locus,
+                                        gtree->root,
+                                        hs->locus->param_indices,
+                                        NULL);
+    locus_brate_derivatives(hs->locus,
+                            gtree,
+                            stree,
+                            msa_index,
+                            hs->dlnl,
+                            thread_index);
+  }
+  else
+  {
+    hs->logl = 0;
+    memset(hs->dlnl,
+           0,
+           (stree->tip_count+stree->inner_count+stree->hybrid_count) *
+             sizeof(double));
+  }
+
+  hs->lnprior = lnprior_rates(gtree,stree,msa_index);
+  lnprior_rates_gradient(gtree,stree,msa_index,hs->dprior,&gmui,&gnui);
+
+  logpost = hs->logl + hs->lnprior;
+
+  /* the log-rates also contribute the Jacobian of the transformation */
+  for (j = 0; j < hs->pop_count; ++j)
+  {
+    snode_t * pop = hs->pops[j];
+    double r = pop->brate[msa_index];
+
+    grad[j] = r*hs->dlnl[pop->node_index] + hs->dprior[pop->node_index] + 1;
+    logpost += log(r);
+  }
+
+  if (hs->move_mui)
+  {
+    double mui = gtree->rate_mui;
+
+    alpha = opt_mui_alpha;
+    beta = opt_mui_alpha / stree->locusrate_mubar;
+
+    grad[j] = gmui + alpha - beta*mui;
+    if (opt_clock == BPP_CLOCK_CORR)
+      grad[j] += mui*hs->dlnl[stree->root->node_index];
+    logpost += alpha*log(mui) - beta*mui;
+    ++j;
+  }
+  if (hs->move_nui)
+  {
+    double nui = gtree->rate_nui;
+
+    alpha = opt_vi_alpha;
+    beta = opt_vi_alpha / stree->locusrate_nubar;
+
+    grad[j] = gnui + alpha - beta*nui;
+    logpost += alpha*log(nui) - beta*nui;
+  }
+
+  return logpost;
+}
+
+static void hmc_swap_buffers(gtree_t * gtree)
+{
+  unsigned int i;
+
+  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
+  {
+    gnode_t * node = gtree->nodes[i];
+
+    if (node->parent)
+      node->pmatrix_index = SWAP_PMAT_INDEX(gtree->edge_count,
+                                            node->pmatrix_index);
+    if (i >= gtree->tip_count)
+    {
+      node->clv_index = SWAP_CLV_INDEX(gtree->tip_count,node->clv_index);
+      if (opt_scaling)
+        node->scaler_index = SWAP_SCALER_INDEX(gtree->tip_count,
+                                               node->scaler_index);
+    }
+  }
+}
+
+static long prop_branch_rates_hmc(gtree_t * gtree,
+                                  stree_t * stree,
+                                  locus_t * locus,
+                                  unsigned int msa_index,
+                                  long thread_index)
+{
+  long j,k;
+  long dim;
+  long snodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
+  long accepted;
+  double eps;
+  double logpost0, logpost;
+  double kinetic0, kinetic;
+  double lnacceptance;
+  double old_mui = gtree->rate_mui;
+  double old_nui = gtree->rate_nui;
+  double * x0;
+  double * x;
+  double * p;
+  double * grad;
+  double * old_rates;
+  size_t mark;
+  hmc_state_t hs;
+
+  assert(opt_clock != BPP_CLOCK_GLOBAL);
+
+  mark = arena_mark(thread_index);
+  hs.pops = (snode_t **)arena_alloc(thread_index,snodes*sizeof(snode_t *));
+  hs.dlnl = (double *)arena_alloc(thread_index,snodes*sizeof(double));
+  hs.dprior = (double *)arena_alloc(thread_index,snodes*sizeof(double));
+  old_rates = (double *)arena_alloc(thread_index,snodes*sizeof(double));
+  x0 = (double *)arena_alloc(thread_index,(snodes+2)*sizeof(double));
+  x = (double *)arena_alloc(thread_index,(snodes+2)*sizeof(double));
+  p = (double *)arena_alloc(thread_index,(snodes+2)*sizeof(double));
+  grad = (double *)arena_alloc(thread_index,(snodes+2)*sizeof(double));
+
+  hs.gtree = gtree;
+  hs.stree = stree;
+  hs.locus = locus;
+  hs.msa_index = msa_index;
+  hs.pop_count = 0;
+
+  /* same populations as in prop_branch_rates() */
+  for (j = 0; j < snodes; ++j)
+  {
+    snode_t * node = stree->nodes[j];
+
+    old_rates[j] = node->brate[msa_index];
+
+    if (!node->parent && opt_clock == BPP_CLOCK_CORR) continue;
+
+    if (opt_msci && node->hybrid)
+    {
+      if (node_is_hybridization(node) && !node->htau) continue;
+      if (node_is_bidirection(node) && node_is_mirror(node)) continue;
+    }
+    x[hs.pop_count] = log(node->brate[msa_index]);
+    hs.pops[hs.pop_count++] = node;
+  }
+  dim = hs.pop_count;
+
+  hs.move_mui = (opt_est_locusrate == MUTRATE_ESTIMATE &&
+                 opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL);
+  hs.move_nui = (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL);
+  if (hs.move_mui)
+    x[dim++] = log(old_mui);
+  if (hs.move_nui)
+    x[dim++] = log(old_nui);
+  memcpy(x0,x,dim*sizeof(double));
+
+  adapt_hmc_window(locus,dim);
+
+  hmc_swap_buffers(gtree);
+
+  logpost0 = hmc_evaluate(&hs,grad,thread_index);
+
+  /* momenta are drawn for the coordinates scaled by hmc_scale, i.e. the
+     inverse mass matrix is diag(hmc_scale^2) */
+  kinetic0 = 0;
+  for (j = 0; j < dim; ++j)
+  {
+    p[j] = rndNormal(thread_index);
+    kinetic0 += p[j]*p[j] / 2;
+  }
+
+  /* jitter the step length to avoid periodic trajectories */
+  eps = locus->hmc_step * (0.9 + 0.2*legacy_rndu(thread_index));
+
+  /* leapfrog integration */
+  logpost = logpost0;
+  for (k = 0; k < opt_hmc_steps; ++k)
+  {
+    int diverged = 0;
+
+    for (j = 0; j < dim; ++j)
+    {
+      p[j] += eps/2 * locus->hmc_scale[j] * grad[j];
+      x[j] += eps * locus->hmc_scale[j] * p[j];
+      if (!(fabs(x[j]) < 99)) diverged = 1;
+    }
+    if (diverged)
+    {
+      logpost = -INFINITY;
+      break;
+    }
+
+    hmc_set_position(&hs,x);
+    logpost = hmc_evaluate(&hs,grad,thread_index);
+
+    for (j = 0; j < dim; ++j)
+      p[j] += eps/2 * locus->hmc_scale[j] * grad[j];
+  }
+
+  kinetic = 0;
+  for (j = 0; j < dim; ++j)
+    kinetic += p[j]*p[j] / 2;
+
+  lnacceptance = (logpost - kinetic) - (logpost0 - kinetic0);
+
+  if (opt_debug_br)
+    printf("[Debug] (br hmc) lnacceptance = %f\n", lnacceptance);
+
+  if (isfinite(lnacceptance) &&
+      (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance)))
+  {
+    /* accepted */
+    gtree->logl = hs.logl;
+    gtree->lnprior_rates = hs.lnprior;
+    accepted = 1;
+  }
+  else
+  {
+    /* rejected */
+    for (j = 0; j < snodes; ++j)
+      stree->nodes[j]->brate[msa_index] = old_rates[j];
+    gtree->rate_mui = old_mui;
+    gtree->rate_nui = old_nui;
+
+    hmc_swap_buffers(gtree);
+
+    memcpy(x,x0,dim*sizeof(double));
+    accepted = 0;
+  }
+
+  adapt_hmc_update(locus,
+                   x,
+                   dim,
+                   isfinite(lnacceptance) ? exp(MIN(lnacceptance,0)) : 0);
+
+  arena_release(thread_index,mark);
+  return accepted;
+}
+
 double prop_branch_rates_serial(gtree_t ** gtree,
                                 stree_t * stree,
                                 locus_t ** locus)
@@ -5670,10 +6189,18 @@ double prop_branch_rates_serial(gtree_t ** gtree,
   {
     prop_count = 0;
     #ifdef DEBUG_THREADS
-    accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,indices[i]);
+    long rng_index = indices[i];
     #else
-    accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,0);
+    long rng_index = 0;
     #endif
+    if (hmc_eligible(locus[i]))
+    {
+      accepted += prop_branch_rates_hmc(gtree[i],stree,locus[i],i,rng_index);
+      prop_count = 1;
+    }
+    else
+      accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,
+                                    rng_index);
     proposal_count += prop_count;
   }
 
@@ -5707,7 +6234,14 @@ void prop_branch_rates_parallel(gtree_t ** gtree,
   for (i = locus_start; i < locus_start+locus_count; ++i)
   {
     prop_count = 0;
-    accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,thread_index);
+    if (hmc_eligible(locus[i]))
+    {
+      accepted += prop_branch_rates_hmc(gtree[i],stree,locus[i],i,thread_index);
+      prop_count = 1;
+    }
+    else
+      accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,
+                                    thread_index);
     proposal_count += prop_count;
   }
 
@@ -25,15 +25,10 @@ static long ulong_bits;      /* number of bits in unsigned long */
 static long bitmask_bits;    /* number of bits in bitmask */
 static long bitmask_elms;    /* how many unsigned long a bitmask is made of */
 
-static hashtable_t * ht_trivial = NULL;  /* tip node bitmasks */
+/* tip node bitmasks as pair_t elements (species label, bitmask) */
+static hashtable_t * ht_trivial = NULL;
 static hashtable_t * ht_biparts = NULL;  /* bipartitions */
 
-struct bptrivial_s
-{
-  unsigned long * bitmask;
-  char * label;
-};
-
 struct bipartition_s
 {
   unsigned long * bitmask;
@@ -43,24 +38,16 @@ struct bipartition_s
 /* serialize hashtable of bipartitions to an array of bipartitions */
 static struct bipartition_s ** hashtable_serialize1p(hashtable_t * ht)
 {
-  unsigned long i,k;
+  unsigned long pos,k;
   struct bipartition_s ** blist;
+  struct bipartition_s * bp;
 
   blist = (struct bipartition_s **)xmalloc((ht->entries_count+1) *
                                            sizeof(struct bipartition_s *));
 
-  for (i = 0, k = 0; i < ht->table_size; ++i)
-  {
-    list_t * list = ht->entries[i];
-
-    list_item_t * head = list->head;
-    while (head)
-    {
-      ht_item_t * hi = (ht_item_t *)(head->data);
-      blist[k++] = (struct bipartition_s *)(hi->value);
-      head = head->next;
-    }
-  }
+  pos = k = 0;
+  while ((bp = (struct bipartition_s *)hashtable_iterate(ht,&pos)))
+    blist[k++] = bp;
 
   assert(k == ht->entries_count);
 
@@ -96,14 +83,6 @@ static int cb_cmp_bitmask(void * a, void * b)
 
   return 1;
 }
-static int cb_cmp_trivial(void * a, void * b)
-{
-  struct bptrivial_s * trivial = (struct bptrivial_s *)a;
-  char * label = (char *)b;
-
-  return (!strcmp(trivial->label,label));
-}
-
 /* returns an unary code with the i-th position set */
 static unsigned long * bitencode(long i, long count)
 {
@@ -125,16 +104,16 @@ static unsigned long * bitencode(long i, long count)
 static void hash_trivial_bp(char ** species, long count)
 {
   long i;
-  struct bptrivial_s * trivial;
+  pair_t * trivial;
 
   assert(ht_trivial);
   assert(count > 0);
 
   for (i = 0; i < count; ++i)
   {
-    trivial = (struct bptrivial_s *)xmalloc(sizeof(struct bptrivial_s));
+    trivial = (pair_t *)xmalloc(sizeof(pair_t));
     trivial->label = xstrdup(species[i]);
-    trivial->bitmask = bitencode(i,count);
+    trivial->data = (void *)bitencode(i,count);
 
     if (!hashtable_insert(ht_trivial,
                           (void *)(trivial),
@@ -175,16 +154,17 @@ void bipartitions_init(char ** species, long species_count)
   /* TODO - think of a better size to initialize hashtable */
 }
 
-static void bitmask_update_recursive(snode_t * node)
+static void bitmask_update_recursive(snode_t * node,
+                                     unsigned long * bitmasks,
+                                     unsigned int tip_count)
 {
   long i;
   if (!node->left) return;
 
-  bitmask_update_recursive(node->left);
-  bitmask_update_recursive(node->right);
+  bitmask_update_recursive(node->left,bitmasks,tip_count);
+  bitmask_update_recursive(node->right,bitmasks,tip_count);
 
-  node->bitmask = (unsigned long *)xmalloc((size_t)bitmask_elms *
-                                           sizeof(unsigned long));
+  node->bitmask = bitmasks + (node->node_index - tip_count)*bitmask_elms;
 
   for (i = 0; i < bitmask_elms; ++i)
     node->bitmask[i] = node->left->bitmask[i] | node->right->bitmask[i];
@@ -214,44 +194,54 @@ static void bitmask_print(FILE * fp_out, unsigned long * bitmask)
 }
 
 /* assign trivial bipartition bitmasks from hashtable to the tips of stree and
-then recursively compute bitmasks for all nodes */
-static void assign_bitmasks(stree_t * stree)
+then recursively compute bitmasks for all nodes, stored in bitmasks (one per
+inner node). Trees from stree_reader_parse() carry the tip bitmasks in data */
+static void assign_bitmasks(stree_t * stree, unsigned long * bitmasks)
 {
   long i;
-  struct bptrivial_s * trivial;
+  pair_t * trivial;
 
   /* attach bitmasks at tip nodes */
   for (i = 0; i < stree->tip_count; ++i)
   {
+    if (stree->nodes[i]->data)
+    {
+      stree->nodes[i]->bitmask = (unsigned long *)(stree->nodes[i]->data);
+      continue;
+    }
+
     trivial = hashtable_find(ht_trivial,
                              (void *)(stree->nodes[i]->label),
                              hash_fnv(stree->nodes[i]->label),
-                             cb_cmp_trivial);
+                             cb_cmp_pairlabel);
     if (!trivial)
       fatal("Internal error in locating tip label %s (assign_bitmasks())",
              stree->nodes[i]->label);
 
-    stree->nodes[i]->bitmask = trivial->bitmask;
+    stree->nodes[i]->bitmask = (unsigned long *)(trivial->data);
   }
 
   /* now recursively create bitmasks */
 
-  bitmask_update_recursive(stree->root);
+  bitmask_update_recursive(stree->root,bitmasks,stree->tip_count);
 }
 
-/* updates counts in hashtable with bipartitions of current tree */
-void bipartitions_update(stree_t * stree)
+/* updates counts in hashtable ht with bipartitions of current tree, using
+   bitmasks as storage for the bitmasks of inner nodes */
+static void bipartitions_count(hashtable_t * ht,
+                               stree_t * stree,
+                               unsigned long * bitmasks)
 {
   long i;
   struct bipartition_s * bp;
 
-  assign_bitmasks(stree);
+  assign_bitmasks(stree,bitmasks);
 
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
   {
     if (stree->nodes[i]->parent)
     {
-      bp = hashtable_find(ht_biparts,
+      bp = hashtable_find(ht,
                           (void *)(stree->nodes[i]->bitmask),
                           hash_fnv_long(stree->nodes[i]->bitmask,bitmask_elms),
                           cb_cmp_bitmask);
@@ -268,23 +258,31 @@ void bipartitions_update(stree_t * stree)
         memcpy(bp->bitmask,
                stree->nodes[i]->bitmask,
                (size_t)bitmask_elms*sizeof(unsigned long));
-        hashtable_insert_force(ht_biparts,
+        hashtable_insert_force(ht,
                                (void *)bp,
                                hash_fnv_long(stree->nodes[i]->bitmask,
                                              bitmask_elms));
       }
     }
   }
+}
 
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
-    if (stree->nodes[i]->bitmask)
-      free(stree->nodes[i]->bitmask);
+/* updates counts in global hashtable with bipartitions of current tree */
+void bipartitions_update(stree_t * stree)
+{
+  unsigned long * bitmasks;
+
+  bitmasks = (unsigned long *)xmalloc((size_t)(stree->inner_count *
+                                               bitmask_elms) *
+                                      sizeof(unsigned long));
+  bipartitions_count(ht_biparts,stree,bitmasks);
+  free(bitmasks);
 }
 
 static void cb_bptrivial_dealloc(void * data)
 {
-  struct bptrivial_s * trivial = data;
-  free(trivial->bitmask);
+  pair_t * trivial = data;
+  free(trivial->data);
   free(trivial->label);
   free(trivial);
 }
@@ -296,6 +294,32 @@ static void cb_bipartition_dealloc(void * data)
   free(bp);
 }
 
+/* move bipartition counts from hashtable ht into the global hashtable and
+   destroy ht. Merging per-thread tables in chunk order preserves the order in
+   which bipartitions are first encountered in the MCMC file */
+static void bipartitions_merge(hashtable_t * ht)
+{
+  unsigned long pos = 0;
+  struct bipartition_s * bp;
+  struct bipartition_s * query;
+
+  while ((bp = (struct bipartition_s *)hashtable_iterate(ht,&pos)))
+  {
+    unsigned long hash = hash_fnv_long(bp->bitmask,bitmask_elms);
+
+    query = hashtable_find(ht_biparts,(void *)(bp->bitmask),hash,cb_cmp_bitmask);
+    if (query)
+    {
+      query->count += bp->count;
+      cb_bipartition_dealloc(bp);
+    }
+    else
+      hashtable_insert_force(ht_biparts,(void *)bp,hash);
+  }
+
+  hashtable_destroy(ht,NULL);
+}
+
 
 static char * cb_serialize_support(const snode_t * node)
 {
@@ -328,7 +352,10 @@ static void print_stree_with_support(FILE * fp_out,
     fatal("Internal error while parsing species tree");
 
   /* assign bitmasks to tree nodes (present bits indicate species in subtree) */
-  assign_bitmasks(stree);
+  unsigned long * bitmasks = (unsigned long *)xmalloc((size_t)(stree->inner_count *
+                                                               bitmask_elms) *
+                                                      sizeof(unsigned long));
+  assign_bitmasks(stree,bitmasks);
 
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
   {
@@ -350,9 +377,10 @@ static void print_stree_with_support(FILE * fp_out,
   fprintf(fp_out, "%s   [P = %f]\n", newick, freq / (double)trees_count);
   free(newick);
 
-  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
-    if (stree->nodes[i]->bitmask)
-      free(stree->nodes[i]->bitmask);
+  /* tip bitmasks are owned by ht_trivial */
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+    stree->nodes[i]->bitmask = NULL;
+  free(bitmasks);
 
   stree_destroy(stree,NULL);
 }
@@ -539,16 +567,21 @@ struct distinct_s
   size_t count;
 };
 
+struct treefreq_s
+{
+  char * newick;
+  long count;
+};
+
 static char buffer[LINEALLOC];
 static char * line = NULL;
 static size_t line_size = 0;
 static size_t line_maxsize = 0;
 
-static char * cb_serialize_none(const snode_t * snode)
+static void cb_write_topology(strbuf_t * sb, const snode_t * snode)
 {
-  if (!snode->left) return xstrdup(snode->label);
-
-  return xstrdup("");
+  if (!snode->left)
+    strbuf_puts(sb,snode->label);
 }
 
 static void reallocline(size_t newmaxsize)
@@ -611,56 +644,284 @@ static char * getnextline(FILE * fp)
   return line;
 }
 
-static void strip_attributes(char * s)
+long summary_threads_count()
+{
+  long n = opt_threads_override ? opt_threads_override : opt_threads;
+
+  return n > 0 ? n : 1;
+}
+
+/* split file into count chunks of roughly equal size. Chunk boundaries are
+   moved forward to the beginning of the next line, such that each line is
+   processed by exactly one chunk */
+summary_chunk_t * summary_chunks_create(const char * filename, long count)
 {
-  char * p = s;
+  long i;
+  long filesize;
+  long * offset;
+  int c;
+  FILE * fp;
+  summary_chunk_t * chunks;
+
+  assert(count > 0);
 
-  while (*s)
+  fp = xopen(filename,"r");
+  if (fseek(fp, 0L, SEEK_END))
+    fatal("Cannot seek in file %s", filename);
+  filesize = ftell(fp);
+  if (filesize < 0)
+    fatal("Cannot determine size of file %s", filename);
+
+  offset = (long *)xmalloc((size_t)(count+1)*sizeof(long));
+  offset[0] = 0;
+  offset[count] = filesize;
+  for (i = 1; i < count; ++i)
   {
-    if (*s == '#' || *s == ':')
+    long pos = (long)((double)filesize * i / count);
+
+    if (pos <= offset[i-1])
     {
-      while (*s && *s != ',' && *s != ')' && *s != ';')
-        ++s;
+      offset[i] = offset[i-1];
+      continue;
     }
-    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
-      ++s;
-    else
-      *p++ = *s++;
+
+    /* move to the first line starting at or after pos */
+    if (fseek(fp, pos-1, SEEK_SET))
+      fatal("Cannot seek in file %s", filename);
+    while ((c = fgetc(fp)) != EOF && c != '\n')
+      ++pos;
+    offset[i] = (c == EOF) ? filesize : pos;
+  }
+  fclose(fp);
+
+  chunks = (summary_chunk_t *)xcalloc((size_t)count,sizeof(summary_chunk_t));
+  for (i = 0; i < count; ++i)
+  {
+    chunks[i].fp = xopen(filename,"r");
+    if (fseek(chunks[i].fp, offset[i], SEEK_SET))
+      fatal("Cannot seek in file %s", filename);
+    chunks[i].offset = offset[i];
+    chunks[i].offset_end = offset[i+1];
   }
-  *p = 0;
+  free(offset);
+
+  return chunks;
 }
 
-static int cb_strcmp(const void * a, const void * b)
+/* thread-safe equivalent of getnextline() restricted to the chunk range */
+char * summary_chunk_getline(summary_chunk_t * chunk)
 {
-  const char ** pa = (const char **)a;
-  const char ** pb = (const char **)b;
+  char buf[LINEALLOC];
+  size_t len;
+  size_t size = 0;
 
-  return strcmp(*pa,*pb);
+  if (chunk->offset >= chunk->offset_end)
+    return NULL;
+
+  while (fgets(buf, LINEALLOC, chunk->fp))
+  {
+    len = strlen(buf);
+    chunk->offset += (long)len;
+
+    if (size + len + 1 > chunk->line_maxsize)
+    {
+      chunk->line_maxsize = size + len + LINEALLOC;
+      chunk->line = (char *)xrealloc(chunk->line,chunk->line_maxsize);
+    }
+    memcpy(chunk->line+size,buf,len*sizeof(char));
+    size += len;
+
+    if (buf[len-1] == '\n')
+    {
+      chunk->line[size-1] = 0;
+      return chunk->line;
+    }
+  }
+
+  if (!size)
+    return NULL;
+
+  chunk->line[size] = 0;
+  return chunk->line;
 }
 
-static void stree_sort_recursive(snode_t * node)
+/* process each chunk with callback cb on a separate thread */
+void summary_chunks_run(summary_chunk_t * chunks,
+                        long count,
+                        void * (*cb)(void *))
 {
-  if (!node->left)
+  long i;
+  pthread_t * threads;
+
+  if (count == 1)
+  {
+    cb((void *)chunks);
     return;
+  }
+
+  threads = (pthread_t *)xmalloc((size_t)count*sizeof(pthread_t));
+  for (i = 0; i < count; ++i)
+    if (pthread_create(threads+i, NULL, cb, (void *)(chunks+i)))
+      fatal("Cannot create thread");
+
+  for (i = 0; i < count; ++i)
+    pthread_join(threads[i],NULL);
+
+  free(threads);
+}
+
+void summary_chunks_destroy(summary_chunk_t * chunks, long count)
+{
+  long i;
+
+  for (i = 0; i < count; ++i)
+  {
+    fclose(chunks[i].fp);
+    if (chunks[i].line)
+      free(chunks[i].line);
+  }
+  free(chunks);
+}
+
+static size_t stree_labels_size(const snode_t * node, size_t * size)
+{
+  size_t len;
+
+  if (!node->left)
+    return strlen(node->label);
+
+  len = stree_labels_size(node->left,size) + stree_labels_size(node->right,size);
+  *size += len + 1;
+
+  return len;
+}
 
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
+static char * stree_sort_recursive(snode_t * node, char * p)
+{
+  size_t len;
+
+  if (!node->left)
+    return p;
+
+  p = stree_sort_recursive(node->left,p);
+  p = stree_sort_recursive(node->right,p);
 
   if (strcmp(node->left->label, node->right->label) > 0)
     SWAP(node->left,node->right);
 
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
-
   /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
+  node->label = p;
+  len = strlen(node->left->label);
+  memcpy(p,node->left->label,len);
+  strcpy(p+len,node->right->label);
+
+  return p + len + strlen(node->right->label) + 1;
+}
+
+/* unambiguously order the children of each inner node by the concatenated
+   labels of their subtrees. The labels of inner nodes are stored in *buffer
+   (of *size bytes), which is grown as needed and owned by the caller */
+void stree_sort_labels(stree_t * stree, char ** buffer, size_t * size)
+{
+  size_t needed = 0;
+
+  stree_labels_size(stree->root,&needed);
+  if (needed > *size)
+  {
+    *buffer = (char *)xrealloc(*buffer,needed);
+    *size = needed;
+  }
+
+  stree_sort_recursive(stree->root,*buffer);
+}
+
+static int cb_treefreq_strcmp(const void * a, const void * b)
+{
+  const struct treefreq_s * pa = *((const struct treefreq_s **)a);
+  const struct treefreq_s * pb = *((const struct treefreq_s **)b);
+
+  return strcmp(pa->newick,pb->newick);
 }
 
-static void stree_sort(stree_t * stree)
+static int cb_cmp_treefreq(void * a, void * b)
 {
-  stree_sort_recursive(stree->root); 
+  struct treefreq_s * tf = (struct treefreq_s *)a;
+  char * newick = (char *)b;
+
+  return !strcmp(tf->newick,newick);
+}
+
+static void cb_treefreq_dealloc(void * data)
+{
+  struct treefreq_s * tf = data;
+  free(tf->newick);
+  free(tf);
+}
+
+/* increase frequency of topology newick by count; a copy of newick is stored
+   in the hashtable the first time it is seen */
+static void treefreq_update(hashtable_t * ht, char * newick, long count)
+{
+  unsigned long hash = hash_fnv(newick);
+  struct treefreq_s * tf;
+
+  tf = hashtable_find(ht,(void *)newick,hash,cb_cmp_treefreq);
+  if (tf)
+  {
+    tf->count += count;
+  }
+  else
+  {
+    tf = (struct treefreq_s *)xmalloc(sizeof(struct treefreq_s));
+    tf->newick = xstrdup(newick);
+    tf->count = count;
+    hashtable_insert_force(ht,(void *)tf,hash);
+  }
+}
+
+static void * stree_summary_worker(void * vp)
+{
+  char * s;
+  char * labels = NULL;
+  size_t labels_size = 0;
+  unsigned long * bitmasks;
+  strbuf_t sb;
+  stree_reader_t * reader;
+  summary_chunk_t * chunk = (summary_chunk_t *)vp;
+
+  /* the tree, inner node labels, bitmasks and newick string are reused for
+     all lines, such that no allocations take place per sample */
+  reader = stree_reader_create(chunk->species_count,chunk->ht_species);
+  bitmasks = (unsigned long *)xmalloc((size_t)(chunk->species_count *
+                                               bitmask_elms) *
+                                      sizeof(unsigned long));
+  strbuf_init(&sb);
+
+  /* ignore all thetas and branch lengths such that only the tree topology and
+     tip names remain, and count topologies and bipartitions */
+  while ((s = summary_chunk_getline(chunk)))
+  {
+    stree_t * t = stree_reader_parse(reader,s,NULL);
+    if (!t)
+      fatal("Cannot parse species tree in %s", opt_mcmcfile);
+    stree_sort_labels(t,&labels,&labels_size);
+
+    sb.len = 0;
+    stree_write_newick(&sb,t->root,cb_write_topology);
+    treefreq_update(chunk->ht_trees,sb.s,1);
+
+    bipartitions_count(chunk->ht_biparts,t,bitmasks);
+
+    chunk->line_count++;
+  }
+
+  free(sb.s);
+  free(bitmasks);
+  if (labels)
+    free(labels);
+  stree_reader_destroy(reader);
+
+  return NULL;
 }
 
 static int cb_dtree_cmp(const void * a, const void * b)
@@ -676,39 +937,57 @@ static int cb_dtree_cmp(const void * a, const void * b)
 
 void stree_summary(FILE * fp_out, char ** species_names, long species_count)
 {
+  long t;
+  long thread_count;
   size_t i,distinct;
   size_t line_count = 0;
-  FILE * fp_mcmc;
-  char ** treelist;
+  unsigned long pos;
+  hashtable_t * ht_trees;
+  summary_chunk_t * chunks;
+  struct treefreq_s ** treelist;
   struct distinct_s * dtree;
 
-  /* allocate space for holding all species tree samples */
-  treelist = (char **)xmalloc((size_t)(opt_samples+1)*sizeof(char *));
+  bipartitions_init(species_names,species_count);
 
-  /* open mcmc file */
+  /* split the mcmc file into one chunk per thread */
+  thread_count = summary_threads_count();
   #ifndef DEBUG_MAJORITY
-  fp_mcmc = xopen(opt_mcmcfile,"r");
+  chunks = summary_chunks_create(opt_mcmcfile,thread_count);
   #else
-  fp_mcmc = xopen("test.txt","r");
+  chunks = summary_chunks_create("test.txt",thread_count);
   #endif
 
-  bipartitions_init(species_names,species_count);
+  for (t = 0; t < thread_count; ++t)
+  {
+    chunks[t].species_count = species_count;
+    chunks[t].ht_species = ht_trivial;
+    chunks[t].ht_trees = hashtable_create(100*(size_t)species_count);
+    chunks[t].ht_biparts = hashtable_create(100*(size_t)species_count);
+  }
 
-  /* read each line from the file, and strip all thetas and branch lengths
-     such that only the tree topology and tip names remain, and store them
-     in treelist */
-  while (getnextline(fp_mcmc))
+  /* parse and canonicalize trees of each chunk in parallel */
+  summary_chunks_run(chunks,thread_count,stree_summary_worker);
+
+  /* merge per-thread topology and bipartition frequencies in chunk order */
+  ht_trees = hashtable_create(100*(size_t)species_count);
+  for (t = 0; t < thread_count; ++t)
   {
-    strip_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
-    if (!t)
-      fatal("Internal error while parsing species tree");
-    stree_sort(t);
-    treelist[line_count++] = stree_export_newick(t->root,cb_serialize_none);
+    struct treefreq_s * tf;
+
+    pos = 0;
+    while ((tf = (struct treefreq_s *)hashtable_iterate(chunks[t].ht_trees,&pos)))
+    {
+      treefreq_update(ht_trees,tf->newick,tf->count);
+      free(tf->newick);
+      free(tf);
+    }
+    hashtable_destroy(chunks[t].ht_trees,NULL);
 
-    bipartitions_update(t);
-    stree_destroy(t,NULL);
+    bipartitions_merge(chunks[t].ht_biparts);
+
+    line_count += (size_t)(chunks[t].line_count);
   }
+  summary_chunks_destroy(chunks,thread_count);
   assert(line_count);
 
 
@@ -722,27 +1001,22 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  qsort(treelist,(size_t)line_count,sizeof(char *), cb_strcmp);
+  /* list distinct topologies in lexicographic order */
+  distinct = ht_trees->entries_count;
+  assert(distinct > 0);
 
-  distinct = 1;
-  size_t * uniquepos = (size_t *)xmalloc(line_count*sizeof(size_t));
-  uniquepos[0] = 0;
-  for (i = 1; i < line_count; ++i)
-  {
-    if (strcmp(treelist[i],treelist[i-1]))
-    {
-      uniquepos[distinct++] = i;
-    }
-  }
+  treelist = (struct treefreq_s **)xmalloc(distinct*sizeof(struct treefreq_s *));
+  pos = 0;
+  for (i = 0; i < distinct; ++i)
+    treelist[i] = (struct treefreq_s *)hashtable_iterate(ht_trees,&pos);
 
-  assert(distinct > 0);
+  qsort(treelist,distinct,sizeof(struct treefreq_s *), cb_treefreq_strcmp);
 
   dtree = (struct distinct_s *)xmalloc(distinct * sizeof(struct distinct_s));
   for (i = 0; i < distinct; ++i)
   {
-    dtree[i].start = uniquepos[i];
-    dtree[i].count = (i == distinct - 1) ?
-                      line_count - uniquepos[i] : uniquepos[i+1] - uniquepos[i];
+    dtree[i].start = i;
+    dtree[i].count = (size_t)(treelist[i]->count);
   }
 
   qsort(dtree, distinct, sizeof(struct distinct_s), cb_dtree_cmp);
@@ -754,9 +1028,9 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
     double pdf = dtree[i].count / (double)line_count;
     cdf += pdf;
     fprintf(stdout, " %8ld %8.5f %8.5f %s\n",
-            dtree[i].count, pdf, cdf, treelist[dtree[i].start]);
+            dtree[i].count, pdf, cdf, treelist[dtree[i].start]->newick);
     fprintf(fp_out, " %8ld %8.5f %8.5f %s\n",
-            dtree[i].count, pdf, cdf, treelist[dtree[i].start]);
+            dtree[i].count, pdf, cdf, treelist[dtree[i].start]->newick);
   }
 
   bipartitions_finalize(fp_out,line_count,species_names);
@@ -771,21 +1045,17 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
       break;
 
     print_stree_with_support(fp_out,
-                             treelist[dtree[i].start],
+                             treelist[dtree[i].start]->newick,
                              dtree[i].count,
                              line_count);
   }
 
   summary_dealloc_hashtables();
-  free(uniquepos);
   free(dtree);
  
   /* deallocate list of trees */
-  for (i = 0; i < line_count; ++i)
-    free(treelist[i]);
   free(treelist);
-
-  fclose(fp_mcmc);
+  hashtable_destroy(ht_trees,cb_treefreq_dealloc);
 }
 
 long getlinecount(const char * filename)
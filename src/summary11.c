@@ -22,95 +22,6 @@
 #include "bpp.h"
 
 /* A11 method summary */
-static char buffer[LINEALLOC];
-static char * line = NULL;
-static size_t line_size = 0;
-static size_t line_maxsize = 0;
-
-static void reallocline(size_t newmaxsize)
-{
-  char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
-
-  if (line)
-  {
-    memcpy(temp,line,line_size*sizeof(char));
-    free(line);
-  }
-  line = temp;
-  line_maxsize = newmaxsize;
-}
-
-static char * getnextline(FILE * fp)
-{
-  size_t len = 0;
-
-  line_size = 0;
-
-  /* read from file until newline or eof */
-  while (fgets(buffer, LINEALLOC, fp))
-  {
-    len = strlen(buffer);
-
-    if (line_size + len > line_maxsize)
-      reallocline(line_maxsize + LINEALLOC);
-
-    memcpy(line+line_size,buffer,len*sizeof(char));
-    line_size += len;
-
-    if (buffer[len-1] == '\n')
-    {
-      #if 0
-      if (line_size+1 > line_maxsize)
-        reallocline(line_maxsize+1);
-
-      line[line_size] = 0;
-      #else
-        line[line_size-1] = 0;
-      #endif
-
-      return line;
-    }
-  }
-
-  if (!line_size)
-  {
-    free(line);
-    line_maxsize = 0;
-    line = NULL;
-    return NULL;
-  }
-
-  if (line_size == line_maxsize)
-    reallocline(line_maxsize+1);
-
-  line[line_size] = 0;
-  return line;
-}
-
-static void stree_sort_recursive(snode_t * node)
-{
-  if (!node->left)
-    return;
-
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
-
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
-
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
-
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
-}
-
-static void stree_sort(stree_t * stree)
-{
-  stree_sort_recursive(stree->root); 
-}
 
 typedef struct db_bitvector_s
 {
@@ -144,26 +55,18 @@ static void cb_stringfreq_dealloc(void * data)
 /* serialize hashtable of string frequencies into an array */
 static stringfreq_t ** hashtable_serialize(hashtable_t * ht)
 {
-  unsigned long i,k;
+  unsigned long pos,k;
   stringfreq_t ** sflist;
+  stringfreq_t * sf;
 
   /* allocate the array to hold all items in the hash table */
   sflist = (stringfreq_t **)xmalloc((size_t)(ht->entries_count+1) *
                                    sizeof(stringfreq_t *));
 
   /* go through all entries of the hashtable and serialize */
-  for (i = 0, k = 0; i < ht->table_size; ++i)
-  {
-    list_t * list = ht->entries[i];
-
-    list_item_t * head = list->head;
-    while (head)
-    {
-      ht_item_t * hi = (ht_item_t *)(head->data);
-      sflist[k++] = (stringfreq_t *)(hi->value);
-      head = head->next;
-    }
-  }
+  pos = k = 0;
+  while ((sf = (stringfreq_t *)hashtable_iterate(ht,&pos)))
+    sflist[k++] = sf;
 
   /* serialized items must equal the number of items in hashtable */
   assert(k == ht->entries_count);
@@ -180,13 +83,13 @@ static int cb_delimit_strcmp(const void * s1, const void * s2)
   return strcmp(a, b);
 }
 
-/* recursively fill buf (starting at position index) with all tip nodes of
-   subtree rooted at node */
-static void snode_getleaves(const snode_t * node, int * index, char ** buf)
+/* recursively fill buf (starting at position index) with the labels of all
+   tip nodes of subtree rooted at node */
+static void snode_getleaves(const snode_t * node, int * index, const char ** buf)
 {
   if (!(node->left))
   {
-    buf[*index] = xstrdup(node->label);
+    buf[*index] = node->label;
     *index = *index+1;
     return;
   }
@@ -195,114 +98,54 @@ static void snode_getleaves(const snode_t * node, int * index, char ** buf)
   snode_getleaves(node->right,index,buf);
 }
 
-static char * delimit_string(const snode_t * root)
+/* append the sorted labels of all tips of the subtree rooted at root to sb,
+   using labels as scratch space */
+static void delimit_write(strbuf_t * sb,
+                          const snode_t * root,
+                          const char ** labels)
 {
   int index = 0;
   long i;
-  char ** labels = (char **)xmalloc((size_t)(root->leaves) * sizeof(char *));
 
   snode_getleaves(root,&index,labels);
 
   qsort(labels,root->leaves,sizeof(char *),cb_delimit_strcmp);
 
-  long sumsize = 0;
-  for (i = 0; i < root->leaves; ++i)
-    sumsize += strlen(labels[i]);
-  sumsize++;
-
-  char * l = (char *)xmalloc((size_t)sumsize * sizeof(char));
-  l[0] = 0;
-
-  char * p = l;
-  for (i = 0; i < root->leaves; ++i)
-  {
-    size_t len = strlen(labels[i]);
-    memcpy(p,labels[i],len*sizeof(char));
-    p+=len;
-  }
-  *p = 0;
-
   for (i = 0; i < root->leaves; ++i)
-    free(labels[i]);
-  free(labels);
-  
-  return l;
+    strbuf_puts(sb,labels[i]);
 }
 
-static char * stree_export_delimitation_recursive(const snode_t * root)
+static void stree_write_delimitation_recursive(strbuf_t * sb,
+                                               const snode_t * root,
+                                               const char ** labels)
 {
-  char * newick;
-  int size_alloced;
   assert(root != NULL);
 
   if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
-  else
+    strbuf_puts(sb,root->label);
+  else if (root->tau)
   {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
-
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
-
-      size_alloced = xasprintf(&newick, "(%s, %s)", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
-    else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s", subtree);
-      free(subtree);
-    }
+    strbuf_putc(sb,'(');
+    stree_write_delimitation_recursive(sb,root->left,labels);
+    strbuf_puts(sb,", ");
+    stree_write_delimitation_recursive(sb,root->right,labels);
+    strbuf_putc(sb,')');
   }
-
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
-
-  return newick;
-}
-
-static char * stree_export_delimitation(const snode_t * root)
-{
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
-
-  if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
   else
-  {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
-
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
+    delimit_write(sb,root,labels);
+}
 
-      size_alloced = xasprintf(&newick, "(%s, %s);", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
-    else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s;", subtree);
-      free(subtree);
-    }
-  }
+/* append the delimited tree of root to sb, e.g.:
 
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
+   ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB, (C, D)); */
+static void stree_write_delimitation(strbuf_t * sb,
+                                     const snode_t * root,
+                                     const char ** labels)
+{
+  stree_write_delimitation_recursive(sb,root,labels);
 
-  return newick;
+  if (root->left && root->right)
+    strbuf_putc(sb,';');
 }
 
 static int logint64_len(int64_t x)
@@ -351,22 +194,19 @@ static char * create_delim_string(stree_t * stree)
   return s;
 }
 
-static int64_t get_int64(const char * pline, int64_t * value)
+static int64_t get_int64(char * pline, int64_t * value)
 {
   int ret,len=0;
   size_t ws;
-  char * s = xstrdup(pline);
-  char * p = s;
+  char * p = pline;
+  char c;
 
   /* skip all white-space */
   ws = strspn(p, " \t\r\n");
 
   /* is it a blank line or comment ? */
   if (!p[ws] || p[ws] == '*' || p[ws] == '#')
-  {
-    free(s);
     return 0;
-  }
 
   /* store address of value's beginning */
   char * start = p+ws;
@@ -374,16 +214,15 @@ static int64_t get_int64(const char * pline, int64_t * value)
   /* skip all characters except star, hash and whitespace */
   char * end = start + strcspn(start," \t\r\n*#");
 
+  /* terminate the value in place and restore the line after reading */
+  c = *end;
   *end = 0;
 
   ret = sscanf(start, "%" PRIu64 "%n", value, &len);
-  if ((ret == 0) || (((unsigned int)(len)) < strlen(start)))
-  {
-    free(s);
+  *end = c;
+  if ((ret == 0) || (len < end - start))
     return 0;
-  }
 
-  free(s);
   return ws + end - start;
 }
 
@@ -441,11 +280,6 @@ static int cb_cmp_label(void * a, void * b)
 
   return !strcmp(sf->label,label);
 }
-static char * get_delimit_string(stree_t * stree)
-{
-  recursive_age(stree->root);
-  return stree_export_delimitation(stree->root);
-}
 
 static int cb_countcmp(const void * a, const void * b)
 {
@@ -458,25 +292,6 @@ static int cb_countcmp(const void * a, const void * b)
   return 0;
 }
 
-static void strip_theta_attributes(char * s)
-{
-  char * p = s;
-
-  while (*s)
-  {
-    if (*s == '#')
-    {
-      while (*s && *s != ',' && *s != ')' && *s != ';' && *s != ':')
-        ++s;
-    }
-    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
-      ++s;
-    else
-      *p++ = *s++;
-  }
-  *p = 0;
-}
-
 static stree_t * parse_tree(const char * s)
 {
   stree_t * t;
@@ -524,70 +339,76 @@ static stree_t * parse_tree(const char * s)
   return t;
 }
 
-static void replace(db_stree_t * treelist,
-                    int64_t index,
-                    int64_t start,
-                    int64_t freq)
+static int cb_stree_species_strcmp(const void * pa, const void * pb)
 {
-  if (index != start)
-  {
-    if (treelist[index].newick)
-      free(treelist[index].newick);
-    treelist[index].newick = treelist[start].newick;
-    treelist[start].newick = NULL;
+  int cmp = cb_stree_species(pa,pb);
 
-    treelist[index].species = treelist[start].species;
-  }
-  treelist[index].count = freq;
+  return cmp ? cmp : cb_stree_strcmp(pa,pb);
 }
 
-void mixed_summary(FILE * fp_out, unsigned int sp_count)
+static int cb_cmp_stree(void * a, void * b)
 {
-  int64_t line_count = 0;
-  int64_t i,j;
-  FILE * fp_mcmc;
-  db_stree_t * treelist;
-  snode_t ** inner;
+  db_stree_t * x = (db_stree_t *)a;
+  db_stree_t * y = (db_stree_t *)b;
 
-  /* TODO: Ugly hack to make bpp_parse_newick_string. The issue is that if
-     opt_diploid is set, the program checks whether opt_diploid_size matches
-     stree->tip_count. If the first MCMC sample has a different number of
-     species than the initial tree in the guide tree, the check will fail.
-     To 'fix' this issue I disable 'opt_diploid' before calling 
-     bpp_parse_newick_string, but we should come up with a better solution */
-  long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
+  return (x->species == y->species) && !strcmp(x->newick,y->newick);
+}
 
-  /* open MCMC file for reading */
-  fp_mcmc = xopen(opt_mcmcfile,"r");
+/* increase frequency of delimited tree 'query' by query->count. A copy of the
+   newick string of query is stored in the hashtable the first time it is
+   seen */
+static void streefreq_update(hashtable_t * ht, db_stree_t * query)
+{
+  unsigned long hash = hash_fnv(query->newick) ^ (unsigned long)query->species;
+  db_stree_t * st;
 
-  /* allocate space for storing inner nodes */
-  inner = (snode_t **)xmalloc((size_t)opt_max_species_count*sizeof(snode_t *));
+  st = hashtable_find(ht,(void *)query,hash,cb_cmp_stree);
+  if (st)
+  {
+    st->count += query->count;
+  }
+  else
+  {
+    st = (db_stree_t *)xmalloc(sizeof(db_stree_t));
+    memcpy(st,query,sizeof(db_stree_t));
+    st->newick = xstrdup(query->newick);
+    hashtable_insert_force(ht,(void *)st,hash);
+  }
+}
 
-  /* allocate space for reading trees from MCMC file */
-  treelist = (db_stree_t *)xmalloc((size_t)(opt_samples+1)*sizeof(db_stree_t));
+static void * mixed_summary_worker(void * vp)
+{
+  long i;
+  char * line;
+  char * tmp;
+  char * labels = NULL;
+  size_t labels_size = 0;
+  const char ** leaves;
+  strbuf_t sb;
+  stree_reader_t * reader;
+  summary_chunk_t * chunk = (summary_chunk_t *)vp;
+  int64_t sp_count = chunk->species_count;
+  db_stree_t query;
+
+  /* the tree, inner node labels and delimitation string are reused for all
+     lines, such that no allocations take place per sample */
+  reader = stree_reader_create(sp_count,chunk->ht_species);
+  leaves = (const char **)xmalloc((size_t)sp_count*sizeof(char *));
+  strbuf_init(&sb);
 
   /* read trees and species counts from MCMC file */
-  while (getnextline(fp_mcmc))
+  while ((line = summary_chunk_getline(chunk)))
   {
-    /* separate line into two zero-terminated strings, the first one (line)
-       contains the newick tree string and the second (tmp) holds the species
-       count */
-    char * tmp =  strchr(line,';');
-    tmp++;
-    *tmp = 0;
-    tmp++;
-
-    /* parse newick string and unambiguously sort tree by its labels */
-    if (opt_est_theta)
-      strip_theta_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
+    /* parse newick string up to the semicolon, after which (tmp) the species
+       count follows, and unambiguously sort tree by its labels */
+    stree_t * t = stree_reader_parse(reader,line,&tmp);
     if (!t)
-      fatal("Internal error while parsing tree");
-    stree_sort(t);
+      fatal("Cannot parse species tree in %s", opt_mcmcfile);
+    stree_sort_labels(t,&labels,&labels_size);
 
     int64_t species_count;
     if (!get_int64(tmp,&species_count))
-      fatal("Cannot read number of species; line %ld of %s",line_count+1,opt_mcmcfile);
+      fatal("Cannot read number of species in %s",opt_mcmcfile);
 
     /* In case the number of delimited species in the sample log is equal to the
        number of species we add a small number to the branch lengths of tips in
@@ -600,11 +421,10 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
         t->nodes[i]->length += 0.1;
     }
 
-    /* convert expanded tree into delimited tree, e.g.:
-
-       ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB,(C,D)); */
-    char * dnewick = get_delimit_string(t);
-
+    /* convert expanded tree into delimited tree */
+    recursive_age(t->root);
+    sb.len = 0;
+    stree_write_delimitation(&sb,t->root,leaves);
 
     /* count the number of delimited species in current species tree when the
        logged number of species does not equal the species count.
@@ -622,59 +442,107 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
           ++species_count;
     }
 
-    treelist[line_count].newick = dnewick;
-    treelist[line_count].species = species_count;
-    treelist[line_count].count = 1;
-    line_count++;
+    query.newick = sb.s;
+    query.species = species_count;
+    query.count = 1;
+    streefreq_update(chunk->ht_trees,&query);
+    chunk->line_count++;
+  }
 
-   // if (species_count > max_species_count)
-   //   max_species_count = species_count;
+  free(sb.s);
+  free(leaves);
+  if (labels)
+    free(labels);
+  stree_reader_destroy(reader);
 
-    stree_destroy(t,NULL);
-  }
-  assert(line_count);
+  return NULL;
+}
+
+void mixed_summary(FILE * fp_out, stree_t * stree)
+{
+  unsigned int sp_count = stree->tip_count;
+  int64_t line_count = 0;
+  int64_t i,j,index;
+  long t,thread_count;
+  unsigned long pos;
+  hashtable_t * ht_trees;
+  hashtable_t * ht_labels;
+  summary_chunk_t * chunks;
+  db_stree_t * treelist;
+  snode_t ** inner;
+
+  /* TODO: Ugly hack to make bpp_parse_newick_string. The issue is that if
+     opt_diploid is set, the program checks whether opt_diploid_size matches
+     stree->tip_count. If the first MCMC sample has a different number of
+     species than the initial tree in the guide tree, the check will fail.
+     To 'fix' this issue I disable 'opt_diploid' before calling 
+     bpp_parse_newick_string, but we should come up with a better solution */
+  long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
+
+  /* allocate space for storing inner nodes */
+  inner = (snode_t **)xmalloc((size_t)opt_max_species_count*sizeof(snode_t *));
 
-  /* sort by number of species (ascending order - not relevant) */
-  qsort(treelist,(size_t)line_count, sizeof(db_stree_t), cb_stree_species);
+  /* index species labels for reading the sampled trees */
+  ht_labels = hashtable_create(sp_count);
+  for (i = 0; i < sp_count; ++i)
+  {
+    pair_t * pair = (pair_t *)xmalloc(sizeof(pair_t));
+    pair->label = stree->nodes[i]->label;
+    pair->data = NULL;
+
+    if (!hashtable_insert(ht_labels,
+                          (void *)pair,
+                          hash_fnv(pair->label),
+                          cb_cmp_pairlabel))
+      fatal("Duplicate taxon (%s)", pair->label);
+  }
 
-  /* now sort by newick each range of trees having the same number of species */
-  int64_t start = 0;
-  int64_t freq = 1; 
-  for (i = 1; i < line_count; ++i)
+  /* split the MCMC file into one chunk per thread and count the distinct
+     delimited trees of each chunk in parallel */
+  thread_count = summary_threads_count();
+  chunks = summary_chunks_create(opt_mcmcfile,thread_count);
+  for (t = 0; t < thread_count; ++t)
   {
-    if (treelist[i].species == treelist[i-1].species)
-      ++freq;
-    else
-    {
-      qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
-      start = i;
-      freq = 1;
-    }
+    chunks[t].species_count = sp_count;
+    chunks[t].ht_species = ht_labels;
+    chunks[t].ht_trees = hashtable_create(100*sp_count);
   }
-  if (freq > 1)
-    qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
 
-  /* now keep only the unique trees in treelist */
-  int64_t index = 0;
-  start = 0; freq = 1;
-  for (i = 1; i < line_count; ++i)
+  summary_chunks_run(chunks,thread_count,mixed_summary_worker);
+
+  /* merge per-thread frequencies */
+  ht_trees = hashtable_create(100*sp_count);
+  for (t = 0; t < thread_count; ++t)
   {
-    if (!strcmp(treelist[i].newick,treelist[i-1].newick))
+    db_stree_t * st;
+
+    pos = 0;
+    while ((st = (db_stree_t *)hashtable_iterate(chunks[t].ht_trees,&pos)))
     {
-      ++freq;
+      streefreq_update(ht_trees,st);
+      free(st->newick);
+      free(st);
     }
-    else
-    {
-      replace(treelist,index,start,freq);
-      ++index;
-
-      start = i;
-      freq = 1;
+    hashtable_destroy(chunks[t].ht_trees,NULL);
 
-    }
+    line_count += chunks[t].line_count;
   }
-  replace(treelist,index,start,freq);
-  ++index;
+  summary_chunks_destroy(chunks,thread_count);
+  hashtable_destroy(ht_labels,free);
+  assert(line_count);
+
+  /* serialize distinct trees sorted by number of species, and then by newick
+     string */
+  index = (int64_t)(ht_trees->entries_count);
+  treelist = (db_stree_t *)xmalloc((size_t)index*sizeof(db_stree_t));
+  pos = 0;
+  for (i = 0; i < index; ++i)
+    memcpy(treelist+i,
+           hashtable_iterate(ht_trees,&pos),
+           sizeof(db_stree_t));
+  hashtable_destroy(ht_trees,free);
+
+  qsort(treelist,(size_t)index,sizeof(db_stree_t),cb_stree_species_strcmp);
 
   /* Print summary statistics (A) with the following columns: 
   
@@ -696,7 +564,6 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   int maxlen = logint64_len(treelist[0].count);
   double prob;
   double cum = 0;
-  start = 0; freq = 1;
   fprintf(stdout,
           "\n(A) List of best models (count postP #species SpeciesTree)\n");
   fprintf(fp_out,
@@ -769,11 +636,8 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
     }
     stree_destroy(t,NULL);
   }
-  for (i = 0; i < line_count; ++i)
-  {
-    if (treelist[i].newick)
-      free(treelist[i].newick);
-  }
+  for (i = 0; i < index; ++i)
+    free(treelist[i].newick);
   free(treelist);
 
   /* Print delimitation summary statistics (B) with the following columns:
@@ -892,7 +756,6 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   hashtable_destroy(ht_delims,cb_stringfreq_dealloc);
                  
   free(inner);   
-  fclose(fp_mcmc);
 
   opt_diploid = debug_opt_diploid;
 }                
@@ -27,8 +27,22 @@ typedef struct qsort_wrapper_s
   long comp;
 } qsort_wrapper_t;
 
+typedef struct team_member_s
+{
+  team_t * team;
+  long index;
+  long core;
+} team_member_t;
+
 static thread_info_t * ti = NULL;
 static pthread_attr_t attr;
+static thread_result_t * results = NULL;
+static long slot_offset = 0;
+
+/* site-parallel teams, one per locus that was assigned helper threads */
+static team_t * teams = NULL;
+static team_member_t * members = NULL;
+static long team_count = 0;
 
 static int cb_asc_comp(const void * x, const void * y)
 {
@@ -58,15 +72,100 @@ static void pin_to_core(long t)
     fatal("Error while pinning thread to core. "
           "Probably used more threads than available cores?");
 }
+
+/* Logical CPU of thread slot s. Slot 0 is shared by the master thread and the
+   first worker, and the site-parallel helpers follow the locus threads. If
+   the first slot and step are given in the control file (threads = N start
+   step) they are used verbatim, otherwise threads are placed according to the
+   machine topology, one per physical core first. Slots are shifted by the
+   offset set with threads_set_slot_offset() when several chains run */
+static long thread_cpu(long s)
+{
+  s += slot_offset;
+
+  if (opt_threads_start)
+    return (opt_threads_start-1) + s*opt_threads_step;
+
+  return topology_cpu(s);
+}
 #endif
 
+void threads_set_slot_offset(long offset)
+{
+  slot_offset = offset;
+}
+
+/* Run a sequence of per-locus moves on the loci of one thread, in the same
+   order as separate dispatches would. The moves of one thread only touch the
+   gene trees and substitution models of its own loci and the species tree is
+   not modified between them, hence the result is identical */
+static void threads_fused_moves(thread_info_t * tip, long t)
+{
+  long i;
+  thread_data_t * td = &tip->td;
+
+  for (i = 0; i <= BPP_MOVE_INDEX_MAX; ++i)
+    td->move_proposals[i] = td->move_accepted[i] = 0;
+
+  if (td->moves & (1l << BPP_MOVE_GTAGE_INDEX))
+    gtree_propose_ages_parallel(td->locus,
+                                td->gtree,
+                                td->stree,
+                                tip->locus_first,
+                                tip->locus_count,
+                                t,
+                                td->move_proposals+BPP_MOVE_GTAGE_INDEX,
+                                td->move_accepted+BPP_MOVE_GTAGE_INDEX);
+
+  if (td->moves & (1l << BPP_MOVE_GTSPR_INDEX))
+    gtree_propose_spr_parallel(td->locus,
+                               td->gtree,
+                               td->stree,
+                               tip->locus_first,
+                               tip->locus_count,
+                               t,
+                               td->move_proposals+BPP_MOVE_GTSPR_INDEX,
+                               td->move_accepted+BPP_MOVE_GTSPR_INDEX);
+
+  if (td->moves & (1l << BPP_MOVE_FREQS_INDEX))
+    locus_propose_freqs_parallel(td->stree,
+                                 td->locus,
+                                 td->gtree,
+                                 tip->locus_first,
+                                 tip->locus_count,
+                                 t,
+                                 td->move_proposals+BPP_MOVE_FREQS_INDEX,
+                                 td->move_accepted+BPP_MOVE_FREQS_INDEX);
+
+  if (td->moves & (1l << BPP_MOVE_QRATES_INDEX))
+    locus_propose_qrates_parallel(td->stree,
+                                  td->locus,
+                                  td->gtree,
+                                  tip->locus_first,
+                                  tip->locus_count,
+                                  t,
+                                  td->move_proposals+BPP_MOVE_QRATES_INDEX,
+                                  td->move_accepted+BPP_MOVE_QRATES_INDEX);
+
+  if (td->moves & (1l << BPP_MOVE_ALPHA_INDEX))
+    locus_propose_alpha_parallel(td->stree,
+                                 td->locus,
+                                 td->gtree,
+                                 tip->locus_first,
+                                 tip->locus_count,
+                                 t,
+                                 td->move_proposals+BPP_MOVE_ALPHA_INDEX,
+                                 td->move_accepted+BPP_MOVE_ALPHA_INDEX);
+}
+
 static void * threads_worker(void * vp)
 {
+  long i;
   long t = (long)vp;
   thread_info_t * tip = ti + t;
 
 #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-  pin_to_core((opt_threads_start-1)+(t*opt_threads_step));
+  pin_to_core(thread_cpu(t));
 #endif
 
   pthread_mutex_lock(&tip->mutex);
@@ -174,6 +273,25 @@ static void * threads_worker(void * vp)
                                      &tip->td.proposals,
                                      &tip->td.accepted);
           break;
+        case THREAD_WORK_FUSED:
+          threads_fused_moves(tip,t);
+          break;
+        case THREAD_WORK_PLACE:
+          for (i = 0; i < tip->locus_count; ++i)
+            locus_first_touch(tip->td.locus[tip->locus_first+i]);
+          break;
+        case THREAD_WORK_LRHT:
+          prop_locusrate_and_heredity_parallel(tip->td.gtree,
+                                               tip->td.stree,
+                                               tip->td.locus,
+                                               tip->td.pairs,
+                                               tip->td.pair_count,
+                                               tip->locus_first,
+                                               tip->locus_count,
+                                               t,
+                                               &tip->td.proposals,
+                                               &tip->td.accepted);
+          break;
         default:
           fatal("Unknown work function assigned to thread worker %ld", t);
                              
@@ -191,7 +309,9 @@ static void * threads_worker(void * vp)
 void threads_pin_master()
 {
   #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-    pin_to_core(opt_threads_start-1);
+    /* read the available CPUs before the first thread is pinned */
+    topology_init();
+    pin_to_core(thread_cpu(0));
   #endif
 }
 
@@ -200,13 +320,7 @@ thread_info_t * threads_ti()
   return ti;
 }
 
-/* this is only used when resuming from a checkpoint */
-void threads_set_ti(thread_info_t * tip)
-{
-  ti = tip;
-}
-
-static void load_balance_none(msa_t ** msa_list)
+static void load_balance_none()
 {
   long t;
   long loci_per_thread = opt_locus_count / opt_threads;
@@ -237,14 +351,13 @@ static void load_balance_none(msa_t ** msa_list)
   }
 }
 
-static long * load_balance_zigzag(msa_t ** msa_list)
+static long * load_balance_zigzag(const long * load)
 {
   long i,t;
   long core, increment;
   long * assign;
   long * shuffle_indices;
   qsort_wrapper_t ** loadi;
-  msa_t ** reorder_msa;
 
   loadi = (qsort_wrapper_t **)xmalloc((size_t)opt_locus_count *
                                       sizeof(qsort_wrapper_t *));
@@ -252,7 +365,7 @@ static long * load_balance_zigzag(msa_t ** msa_list)
   {
     loadi[i] = (qsort_wrapper_t *)xmalloc(sizeof(qsort_wrapper_t));
     loadi[i]->index = i;
-    loadi[i]->comp  = msa_list[i]->count * msa_list[i]->length;  /* load */
+    loadi[i]->comp  = load[i];
   }
   qsort(loadi,opt_locus_count,sizeof(loadi),cb_asc_comp);
 
@@ -282,23 +395,11 @@ static long * load_balance_zigzag(msa_t ** msa_list)
     loadi[i]->comp = assign[i];
   qsort(loadi,opt_locus_count,sizeof(loadi),cb_desc_comp);
 
-  /* reorder loci and gene tree arrays according to thread assignments */
-  reorder_msa = (msa_t **)xmalloc((size_t)opt_locus_count * sizeof(msa_t *));
-  for (i = 0; i < opt_locus_count; ++i)
-    reorder_msa[i] = msa_list[loadi[i]->index];
-
+  /* keep the shuffling order for the arrays that need to be reordered */
   shuffle_indices = (long *)xmalloc((size_t)opt_locus_count * sizeof(long));
-
   for (i = 0; i < opt_locus_count; ++i)
-  {
-    /* keep the shuffling order for other arrays that need to be reordered */
     shuffle_indices[i] = loadi[i]->index;
 
-    /* reoder msa_list */
-    msa_list[i] = reorder_msa[i];
-  }
-
-  free(reorder_msa);
   for (i = 0; i < opt_locus_count; ++i)
     free(loadi[i]);
   free(loadi);
@@ -327,7 +428,13 @@ static long * load_balance_zigzag(msa_t ** msa_list)
   return shuffle_indices;
 }
 
-long * threads_load_balance(msa_t ** msa_list)
+/* Assign loci to threads given the load of each locus (patterns times
+   sequences) in the original order of the loci. Returns the original index
+   of the locus placed at each position, or NULL if the order is unchanged.
+   The layout depends only on the loads, the number of threads and the load
+   balancing scheme, hence resuming from a checkpoint with the same settings
+   reproduces it exactly */
+long * threads_layout(const long * load)
 {
   long * shuffle_indices = NULL;
 
@@ -335,9 +442,36 @@ long * threads_load_balance(msa_t ** msa_list)
   ti = (thread_info_t *)xmalloc((size_t)opt_threads * sizeof(thread_info_t));
 
   if (opt_load_balance == BPP_LB_ZIGZAG)
-    shuffle_indices = load_balance_zigzag(msa_list);
+    shuffle_indices = load_balance_zigzag(load);
   else
-    load_balance_none(msa_list);
+    load_balance_none();
+
+  return shuffle_indices;
+}
+
+long * threads_load_balance(msa_t ** msa_list)
+{
+  long i;
+  long * load;
+  long * shuffle_indices;
+  msa_t ** reorder_msa;
+
+  load = (long *)xmalloc((size_t)opt_locus_count * sizeof(long));
+  for (i = 0; i < opt_locus_count; ++i)
+    load[i] = msa_list[i]->count * msa_list[i]->length;
+
+  shuffle_indices = threads_layout(load);
+  free(load);
+
+  /* reorder msa_list according to thread assignments */
+  if (shuffle_indices)
+  {
+    reorder_msa = (msa_t **)xmalloc((size_t)opt_locus_count * sizeof(msa_t *));
+    for (i = 0; i < opt_locus_count; ++i)
+      reorder_msa[i] = msa_list[shuffle_indices[i]];
+    memcpy(msa_list, reorder_msa, (size_t)opt_locus_count * sizeof(msa_t *));
+    free(reorder_msa);
+  }
 
   return shuffle_indices;
 }
@@ -398,6 +532,23 @@ void threads_lb_stats(locus_t ** locus, FILE * fp_out)
       l_digits = n;
   }
 
+  #if (defined(__linux__) && !defined(DISABLE_COREPIN))
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+  topology_print(stdout);
+  topology_print(fp_out);
+  if (!opt_threads_start &&
+      slot_offset + opt_threads + opt_site_threads > topology_cpu_count())
+  {
+    fprintf(stdout, "WARNING: %ld threads share %ld available CPUs\n",
+            slot_offset + opt_threads + opt_site_threads,
+            topology_cpu_count());
+    fprintf(fp_out, "WARNING: %ld threads share %ld available CPUs\n",
+            slot_offset + opt_threads + opt_site_threads,
+            topology_cpu_count());
+  }
+  #endif
+
   fprintf(stdout, "\nDistributing workload to threads:\n");
   fprintf(fp_out, "\nDistributing workload to threads:\n");
   for (t = 0; t < opt_threads; ++t)
@@ -405,7 +556,7 @@ void threads_lb_stats(locus_t ** locus, FILE * fp_out)
     thread_info_t * tip = ti + t;
 
     fprintf(stdout,
-            " Thread %*ld : loci [%*ld - %*ld), Patterns/Seqs/Load : %*ld / %*ld / %*ld\n",
+            " Thread %*ld : loci [%*ld - %*ld), Patterns/Seqs/Load : %*ld / %*ld / %*ld",
             t_digits, t,
             ls_digits, tip->locus_first+1,
             le_digits, tip->locus_first+1+tip->locus_count,
@@ -413,13 +564,21 @@ void threads_lb_stats(locus_t ** locus, FILE * fp_out)
             s_digits, seqs[t],
             l_digits, load[t]);
     fprintf(fp_out,
-            " Thread %*ld : loci [%*ld - %*ld), Patterns/Seqs/Load : %*ld / %*ld / %*ld\n",
+            " Thread %*ld : loci [%*ld - %*ld), Patterns/Seqs/Load : %*ld / %*ld / %*ld",
             t_digits, t,
             ls_digits, tip->locus_first+1,
             le_digits, tip->locus_first+1+tip->locus_count,
             p_digits, patterns[t],
             s_digits, seqs[t],
             l_digits, load[t]);
+    #if (defined(__linux__) && !defined(DISABLE_COREPIN))
+    fprintf(stdout, ", CPU %ld (node %ld)",
+            thread_cpu(t), topology_cpu_node(thread_cpu(t)));
+    fprintf(fp_out, ", CPU %ld (node %ld)",
+            thread_cpu(t), topology_cpu_node(thread_cpu(t)));
+    #endif
+    fprintf(stdout, "\n");
+    fprintf(fp_out, "\n");
   }
 
   free(patterns);
@@ -427,16 +586,28 @@ void threads_lb_stats(locus_t ** locus, FILE * fp_out)
   free(load);
 }
 
-void threads_init()
+/* Split the requested number of threads into locus threads, at most one per
+   locus, and site-parallel helpers for the threads exceeding the number of
+   loci (see threads_teams_init) */
+void threads_split(long threads)
 {
-  long t;
+  opt_threads = threads;
+  opt_site_threads = 0;
 
   if (opt_threads > opt_locus_count)
-    fatal("The number of threads cannot be greater than the number of loci");
-  assert(opt_threads <= opt_locus_count);
+  {
+    opt_site_threads = opt_threads - opt_locus_count;
+    opt_threads = opt_locus_count;
+  }
+}
+
+void threads_init()
+{
+  long t;
 
 #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-  pin_to_core(opt_threads_start-1);
+  topology_init();
+  pin_to_core(thread_cpu(mproc_thread_first()));
 #endif
 
   pthread_attr_init(&attr);
@@ -445,8 +616,12 @@ void threads_init()
   if (!ti)
     fatal("Internal error - call load balance routine");
 
-  /* init and create worker threads */
-  for (t = 0; t < opt_threads; ++t)
+  if (opt_procs > 1)
+    results = (thread_result_t *)xmalloc((size_t)opt_threads *
+                                         sizeof(thread_result_t));
+
+  /* init and create the worker threads of this process */
+  for (t = mproc_thread_first(); t < mproc_thread_end(); ++t)
   {
     thread_info_t * tip = ti + t;
     tip->work = 0;
@@ -461,6 +636,106 @@ void threads_init()
   }
 }
 
+/* Move the likelihood buffers of the loci to the NUMA node of the thread that
+   owns them (they were written by the master thread during initialization),
+   and report where the pages reside on machines with several nodes */
+void threads_first_touch(locus_t ** locus, FILE * fp_out)
+{
+  #if (defined(__linux__) && !defined(DISABLE_COREPIN))
+  long i,t;
+  long pages = 0;
+  long local = 0;
+  thread_data_t td;
+
+  memset(&td,0,sizeof(thread_data_t));
+  td.locus = locus;
+  threads_wakeup(THREAD_WORK_PLACE,&td);
+
+  if (topology_node_count() < 2) return;
+
+  for (t = mproc_thread_first(); t < mproc_thread_end() && pages >= 0; ++t)
+  {
+    thread_info_t * tip = ti + t;
+    long node = topology_cpu_node(thread_cpu(t));
+
+    for (i = 0; i < tip->locus_count; ++i)
+    {
+      long l;
+      long n = locus_numa_pages(locus[tip->locus_first+i], node, &l);
+
+      if (n < 0)
+      {
+        pages = -1;
+        break;
+      }
+      pages += n;
+      local += l;
+    }
+  }
+
+  if (pages < 0)
+  {
+    fprintf(stdout, "NUMA placement of likelihood buffers: not available\n");
+    fprintf(fp_out, "NUMA placement of likelihood buffers: not available\n");
+  }
+  else if (pages)
+  {
+    fprintf(stdout, "NUMA placement of likelihood buffers: %ld of %ld pages "
+            "(%.1f%%) on the node of the owning thread\n",
+            local, pages, 100.0*local/pages);
+    fprintf(fp_out, "NUMA placement of likelihood buffers: %ld of %ld pages "
+            "(%.1f%%) on the node of the owning thread\n",
+            local, pages, 100.0*local/pages);
+  }
+  #endif
+}
+
+/* copy the results and random number generator states of the threads of
+   the other processes into ti, such that the reductions below and all further
+   random numbers are identical in all processes */
+static void threads_exchange()
+{
+  long t;
+
+  for (t = mproc_thread_first(); t < mproc_thread_end(); ++t)
+  {
+    thread_data_t * td = &ti[t].td;
+    thread_result_t * r = results + t;
+
+    r->proposals    = td->proposals;
+    r->accepted     = td->accepted;
+    r->count_above  = td->count_above;
+    r->count_below  = td->count_below;
+    r->logl_diff    = td->logl_diff;
+    r->logpr_diff   = td->logpr_diff;
+    r->lnacceptance = td->lnacceptance;
+    memcpy(r->move_proposals,td->move_proposals,sizeof(r->move_proposals));
+    memcpy(r->move_accepted,td->move_accepted,sizeof(r->move_accepted));
+    r->rndu_status  = get_legacy_rndu_status(t);
+  }
+
+  mproc_gather_threads(results);
+
+  for (t = 0; t < opt_threads; ++t)
+  {
+    thread_data_t * td = &ti[t].td;
+    thread_result_t * r = results + t;
+
+    if (t >= mproc_thread_first() && t < mproc_thread_end()) continue;
+
+    td->proposals    = r->proposals;
+    td->accepted     = r->accepted;
+    td->count_above  = r->count_above;
+    td->count_below  = r->count_below;
+    td->logl_diff    = r->logl_diff;
+    td->logpr_diff   = r->logpr_diff;
+    td->lnacceptance = r->lnacceptance;
+    memcpy(td->move_proposals,r->move_proposals,sizeof(r->move_proposals));
+    memcpy(td->move_accepted,r->move_accepted,sizeof(r->move_accepted));
+    set_legacy_rndu_status(t, r->rndu_status);
+  }
+}
+
 void threads_wakeup(int work_type, thread_data_t * data)
 {
   long t; 
@@ -470,7 +745,7 @@ void threads_wakeup(int work_type, thread_data_t * data)
      workload at initialization, which then never changes */
 
 
-  for (t = 0; t < opt_threads; ++t)
+  for (t = mproc_thread_first(); t < mproc_thread_end(); ++t)
   {
     thread_info_t * tip = ti + t;
 
@@ -485,7 +760,7 @@ void threads_wakeup(int work_type, thread_data_t * data)
   }
 
   /* wait for threads to finish their work */
-  for (t = 0; t < opt_threads; ++t)
+  for (t = mproc_thread_first(); t < mproc_thread_end(); ++t)
   {
     thread_info_t * tip = ti+t;
 
@@ -496,12 +771,16 @@ void threads_wakeup(int work_type, thread_data_t * data)
     pthread_mutex_unlock(&tip->mutex);
   }
 
+  if (opt_procs > 1 && work_type != THREAD_WORK_PLACE)
+    threads_exchange();
+
   if (work_type == THREAD_WORK_GTAGE ||
       work_type == THREAD_WORK_GTSPR ||
       work_type == THREAD_WORK_ALPHA ||
       work_type == THREAD_WORK_RATES ||
       work_type == THREAD_WORK_FREQS ||
-      work_type == THREAD_WORK_BRATE)
+      work_type == THREAD_WORK_BRATE ||
+      work_type == THREAD_WORK_LRHT)
   {
     long proposals = 0;
     long accepted = 0;
@@ -531,6 +810,23 @@ void threads_wakeup(int work_type, thread_data_t * data)
       data->logpr_diff  += tip->td.logpr_diff;
     }
   }
+  else if (work_type == THREAD_WORK_FUSED)
+  {
+    long i;
+
+    for (i = 0; i <= BPP_MOVE_INDEX_MAX; ++i)
+    {
+      data->move_proposals[i] = 0;
+      data->move_accepted[i] = 0;
+      for (t = 0; t < opt_threads; ++t)
+      {
+        thread_info_t * tip = ti+t;
+
+        data->move_proposals[i] += tip->td.move_proposals[i];
+        data->move_accepted[i]  += tip->td.move_accepted[i];
+      }
+    }
+  }
   else if (work_type == THREAD_WORK_MIXING)
   {
     data->lnacceptance = 0;
@@ -540,15 +836,267 @@ void threads_wakeup(int work_type, thread_data_t * data)
       data->lnacceptance += tip->td.lnacceptance;
     }
   }
-  else
+  else if (work_type != THREAD_WORK_PLACE)
     assert(0);
 }
 
+static void * team_worker(void * vp)
+{
+  team_member_t * member = (team_member_t *)vp;
+  team_t * team = member->team;
+  unsigned long generation = 0;
+  unsigned int start, end;
+
+#if (defined(__linux__) && !defined(DISABLE_COREPIN))
+  pin_to_core(member->core);
+#endif
+
+  pthread_mutex_lock(&team->mutex);
+
+  while (1)
+  {
+    /* wait for a new task */
+    while (team->generation == generation && !team->quit)
+      pthread_cond_wait(&team->cond_work, &team->mutex);
+
+    if (team->quit) break;
+
+    generation = team->generation;
+
+    /* block 0 is processed by the thread that owns the locus */
+    if (member->index + 1 < team->blocks)
+    {
+      start = (unsigned int)((unsigned long)team->sites * (member->index+1) /
+                             team->blocks);
+      end   = (unsigned int)((unsigned long)team->sites * (member->index+2) /
+                             team->blocks);
+
+      pthread_mutex_unlock(&team->mutex);
+      team->cb_range(team->data, start, end - start);
+      pthread_mutex_lock(&team->mutex);
+
+      if (--team->pending == 0)
+        pthread_cond_signal(&team->cond_done);
+    }
+  }
+  pthread_mutex_unlock(&team->mutex);
+
+  pthread_exit(NULL);
+}
+
+#if (defined(__linux__) && !defined(DISABLE_COREPIN))
+/* Logical CPU for each helper of locus i. Helpers take the slots following
+   the locus threads, in the order of the machine topology, and prefer slots
+   on the NUMA node of the thread that computes locus i */
+static void team_place(long i, long size, char * slot_used, long * cpu)
+{
+  long j,k;
+  long owner = 0;
+  long node;
+
+  if (ti)
+    for (owner = 0; owner < opt_threads - 1; ++owner)
+      if (i < ti[owner].locus_first + ti[owner].locus_count)
+        break;
+  node = topology_cpu_node(thread_cpu(owner));
+
+  for (j = 0; j < size; ++j)
+  {
+    long slot = -1;
+
+    for (k = 0; k < opt_site_threads && slot < 0; ++k)
+      if (!slot_used[k] && topology_cpu_node(thread_cpu(opt_threads+k)) == node)
+        slot = k;
+    for (k = 0; k < opt_site_threads && slot < 0; ++k)
+      if (!slot_used[k])
+        slot = k;
+
+    assert(slot >= 0);
+    slot_used[slot] = 1;
+    cpu[j] = thread_cpu(opt_threads+slot);
+  }
+}
+#endif
+
+/* Distribute the threads exceeding the number of loci to the loci as helpers
+   for computing likelihoods in parallel over site patterns. Each additional
+   thread goes to the locus with the highest load per thread, where the load
+   is the number of site patterns times the number of sequences */
+void threads_teams_init(locus_t ** locus, long locus_count, FILE * fp_out)
+{
+  long i,j,k;
+  long * helpers;
+  long * cpu;
+  char * slot_used;
+  pthread_attr_t team_attr;
+
+  if (!opt_site_threads) return;
+
+  helpers = (long *)xcalloc((size_t)locus_count, sizeof(long));
+  for (j = 0; j < opt_site_threads; ++j)
+  {
+    double maxload = 0;
+    long maxindex = 0;
+
+    for (i = 0; i < locus_count; ++i)
+    {
+      double load = (double)(locus[i]->sites) * locus[i]->tips / (helpers[i]+1);
+      if (load > maxload)
+      {
+        maxload = load;
+        maxindex = i;
+      }
+    }
+    helpers[maxindex]++;
+  }
+
+  teams = (team_t *)xcalloc((size_t)locus_count, sizeof(team_t));
+  members = (team_member_t *)xmalloc((size_t)opt_site_threads *
+                                     sizeof(team_member_t));
+
+  pthread_attr_init(&team_attr);
+  pthread_attr_setdetachstate(&team_attr, PTHREAD_CREATE_JOINABLE);
+
+  fprintf(stdout, "\nDistributing site patterns of loci to %ld additional "
+          "threads:\n", opt_site_threads);
+  fprintf(fp_out, "\nDistributing site patterns of loci to %ld additional "
+          "threads:\n", opt_site_threads);
+
+  cpu = (long *)xmalloc((size_t)opt_site_threads * sizeof(long));
+  slot_used = (char *)xcalloc((size_t)opt_site_threads, sizeof(char));
+
+  for (k = 0, i = 0; i < locus_count; ++i)
+  {
+    team_t * team = teams+i;
+
+    if (!helpers[i]) continue;
+
+    team->size = helpers[i];
+    team->thread = (pthread_t *)xmalloc((size_t)(team->size) *
+                                        sizeof(pthread_t));
+    pthread_mutex_init(&team->mutex, NULL);
+    pthread_cond_init(&team->cond_work, NULL);
+    pthread_cond_init(&team->cond_done, NULL);
+
+    locus[i]->team = team;
+    locus[i]->team_persite_lnl = (double *)xmalloc((size_t)(locus[i]->sites) *
+                                                   sizeof(double));
+
+    #if (defined(__linux__) && !defined(DISABLE_COREPIN))
+    team_place(i,team->size,slot_used,cpu);
+    #else
+    for (j = 0; j < team->size; ++j)
+      cpu[j] = opt_threads+k+j;
+    #endif
+
+    for (j = 0; j < team->size; ++j, ++k)
+    {
+      members[k].team  = team;
+      members[k].index = j;
+      members[k].core  = cpu[j];
+
+      if (pthread_create(team->thread+j,
+                         &team_attr,
+                         team_worker,
+                         (void *)(members+k)))
+        fatal("Cannot create thread");
+    }
+
+    fprintf(stdout, " Locus %ld : %ld threads, %u patterns\n",
+            i+1, team->size+1, locus[i]->sites);
+    fprintf(fp_out, " Locus %ld : %ld threads, %u patterns\n",
+            i+1, team->size+1, locus[i]->sites);
+  }
+  team_count = locus_count;
+
+  pthread_attr_destroy(&team_attr);
+  free(slot_used);
+  free(cpu);
+  free(helpers);
+}
+
+/* Run cb_range on blocks of site patterns of a locus using its team. The
+   calling thread processes the first block. Returns 0 if the locus has no
+   team or too few patterns to split, in which case nothing is executed */
+int threads_team_run(locus_t * locus,
+                     void (*cb_range)(void *, unsigned int, unsigned int),
+                     void * data)
+{
+  team_t * team = locus->team;
+  long blocks;
+
+  if (!team) return 0;
+
+  blocks = MIN(team->size+1, (long)(locus->sites / BPP_TEAM_MIN_SITES));
+  if (blocks < 2) return 0;
+
+  pthread_mutex_lock(&team->mutex);
+  team->cb_range = cb_range;
+  team->data = data;
+  team->sites = locus->sites;
+  team->blocks = blocks;
+  team->pending = blocks-1;
+  team->generation++;
+  pthread_cond_broadcast(&team->cond_work);
+  pthread_mutex_unlock(&team->mutex);
+
+  cb_range(data, 0, (unsigned int)((unsigned long)locus->sites / blocks));
+
+  /* wait for the helpers to finish their blocks */
+  pthread_mutex_lock(&team->mutex);
+  while (team->pending)
+    pthread_cond_wait(&team->cond_done, &team->mutex);
+  pthread_mutex_unlock(&team->mutex);
+
+  return 1;
+}
+
+void threads_teams_exit(locus_t ** locus, long locus_count)
+{
+  long i,j;
+
+  if (!teams) return;
+
+  for (i = 0; i < team_count; ++i)
+  {
+    team_t * team = teams+i;
+
+    if (!team->size) continue;
+
+    pthread_mutex_lock(&team->mutex);
+    team->quit = 1;
+    pthread_cond_broadcast(&team->cond_work);
+    pthread_mutex_unlock(&team->mutex);
+
+    for (j = 0; j < team->size; ++j)
+      if (pthread_join(team->thread[j], 0))
+        fatal("Cannot join thread");
+
+    pthread_cond_destroy(&team->cond_work);
+    pthread_cond_destroy(&team->cond_done);
+    pthread_mutex_destroy(&team->mutex);
+    free(team->thread);
+  }
+
+  for (i = 0; i < locus_count; ++i)
+  {
+    free(locus[i]->team_persite_lnl);
+    locus[i]->team = NULL;
+    locus[i]->team_persite_lnl = NULL;
+  }
+
+  free(teams);
+  free(members);
+  teams = NULL;
+  members = NULL;
+  team_count = 0;
+}
+
 void threads_exit()
 {
   long t;
 
-  for (t = 0; t < opt_threads; ++t)
+  for (t = mproc_thread_first(); t < mproc_thread_end(); ++t)
   {
     thread_info_t * tip = ti + t;
 
@@ -567,5 +1115,12 @@ void threads_exit()
   }
 
   free(ti);
+  if (results)
+    free(results);
+  results = NULL;
   pthread_attr_destroy(&attr);
+
+  #if (defined(__linux__) && !defined(DISABLE_COREPIN))
+  topology_fini();
+  #endif
 }
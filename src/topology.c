@@ -0,0 +1,262 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* CPU and NUMA topology of the machine, read from /sys/devices/system. The
+   logical CPUs the process may run on are ordered such that the first logical
+   CPU of each physical core comes first, grouped by NUMA node and socket,
+   followed by the remaining SMT siblings in the same order. Threads are
+   placed on the CPUs in this order, hence on distinct physical cores as long
+   as there are enough of them. */
+
+#if (defined(__linux__) && !defined(DISABLE_COREPIN))
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#define TOPOLOGY_SYSFS_CPU      "/sys/devices/system/cpu"
+#define TOPOLOGY_PAGE_BATCH     1024
+
+typedef struct cpuinfo_s
+{
+  long cpu;
+  long node;
+  long package;
+  long core;
+  long smt;             /* index among the logical CPUs of a physical core */
+} cpuinfo_t;
+
+static cpuinfo_t * cpus = NULL;
+static long cpu_count = 0;
+static long node_count = 0;
+static long package_count = 0;
+static long core_count = 0;
+
+static long sysfs_read_long(long cpu, const char * file, long defval)
+{
+  char path[256];
+  FILE * fp;
+  long x;
+
+  snprintf(path, 256, TOPOLOGY_SYSFS_CPU "/cpu%ld/topology/%s", cpu, file);
+  if (!(fp = fopen(path,"r")))
+    return defval;
+  if (fscanf(fp, "%ld", &x) != 1)
+    x = defval;
+  fclose(fp);
+
+  return x;
+}
+
+/* the NUMA node of a CPU is given by a nodeN entry in its sysfs directory */
+static long sysfs_cpu_node(long cpu)
+{
+  char path[256];
+  DIR * dir;
+  struct dirent * entry;
+  long node = 0;
+
+  snprintf(path, 256, TOPOLOGY_SYSFS_CPU "/cpu%ld", cpu);
+  if (!(dir = opendir(path)))
+    return 0;
+
+  while ((entry = readdir(dir)))
+  {
+    if (!strncmp(entry->d_name,"node",4) && isdigit(entry->d_name[4]))
+    {
+      node = atol(entry->d_name+4);
+      break;
+    }
+  }
+  closedir(dir);
+
+  return node;
+}
+
+static int cb_cpu_cmp(const void * x, const void * y)
+{
+  const cpuinfo_t * a = (const cpuinfo_t *)x;
+  const cpuinfo_t * b = (const cpuinfo_t *)y;
+
+  if (a->smt != b->smt) return (a->smt < b->smt) ? -1 : 1;
+  if (a->node != b->node) return (a->node < b->node) ? -1 : 1;
+  if (a->package != b->package) return (a->package < b->package) ? -1 : 1;
+  if (a->core != b->core) return (a->core < b->core) ? -1 : 1;
+  if (a->cpu != b->cpu) return (a->cpu < b->cpu) ? -1 : 1;
+
+  return 0;
+}
+
+static long count_distinct(long (*key)(const cpuinfo_t *))
+{
+  long i,j;
+  long n = 0;
+
+  for (i = 0; i < cpu_count; ++i)
+  {
+    for (j = 0; j < i; ++j)
+      if (key(cpus+j) == key(cpus+i)) break;
+    if (j == i) ++n;
+  }
+
+  return n;
+}
+
+static long key_node(const cpuinfo_t * c) { return c->node; }
+static long key_package(const cpuinfo_t * c) { return c->package; }
+
+/* must be called before any thread is pinned, as the available CPUs are those
+   of the affinity mask of the calling thread */
+void topology_init()
+{
+  long i,j;
+  cpu_set_t mask;
+
+  if (cpus) return;
+
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &mask) || !CPU_COUNT(&mask))
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&mask);
+    for (i = 0; i < MAX(n,1) && i < CPU_SETSIZE; ++i)
+      CPU_SET(i, &mask);
+  }
+
+  cpus = (cpuinfo_t *)xmalloc((size_t)CPU_COUNT(&mask) * sizeof(cpuinfo_t));
+  cpu_count = 0;
+  for (i = 0; i < CPU_SETSIZE; ++i)
+  {
+    cpuinfo_t * c;
+
+    if (!CPU_ISSET(i, &mask)) continue;
+
+    c = cpus + cpu_count++;
+    c->cpu = i;
+    c->node = sysfs_cpu_node(i);
+    c->package = sysfs_read_long(i, "physical_package_id", 0);
+    c->core = sysfs_read_long(i, "core_id", i);
+
+    /* CPUs are visited in increasing order, hence the lowest numbered logical
+       CPU of each physical core gets index 0 */
+    c->smt = 0;
+    for (j = 0; j < cpu_count-1; ++j)
+      if (cpus[j].package == c->package && cpus[j].core == c->core)
+        c->smt++;
+  }
+
+  qsort(cpus, cpu_count, sizeof(cpuinfo_t), cb_cpu_cmp);
+
+  node_count = count_distinct(key_node);
+  package_count = count_distinct(key_package);
+  for (core_count = 0; core_count < cpu_count; ++core_count)
+    if (cpus[core_count].smt) break;
+}
+
+void topology_fini()
+{
+  free(cpus);
+  cpus = NULL;
+  cpu_count = node_count = package_count = core_count = 0;
+}
+
+long topology_cpu_count()
+{
+  return cpu_count;
+}
+
+long topology_node_count()
+{
+  return node_count;
+}
+
+/* logical CPU for thread slot s; slots wrap around if there are more threads
+   than available CPUs */
+long topology_cpu(long s)
+{
+  assert(cpus && s >= 0);
+
+  return cpus[s % cpu_count].cpu;
+}
+
+long topology_cpu_node(long cpu)
+{
+  long i;
+
+  for (i = 0; i < cpu_count; ++i)
+    if (cpus[i].cpu == cpu)
+      return cpus[i].node;
+
+  return sysfs_cpu_node(cpu);
+}
+
+void topology_print(FILE * fp)
+{
+  fprintf(fp, "CPU topology: %ld logical CPU%s available on %ld physical "
+          "core%s, %ld socket%s, %ld NUMA node%s\n",
+          cpu_count, cpu_count > 1 ? "s" : "",
+          core_count, core_count > 1 ? "s" : "",
+          package_count, package_count > 1 ? "s" : "",
+          node_count, node_count > 1 ? "s" : "");
+}
+
+/* Count the pages of buffer p of the given size that reside on NUMA node
+   'node'. Pages are queried with move_pages(2) without moving them. Returns
+   0 if the kernel does not support the query */
+int topology_pages_on_node(const void * p,
+                           size_t size,
+                           long node,
+                           long * local,
+                           long * total)
+{
+  long i,n;
+  long pagesize = sysconf(_SC_PAGESIZE);
+  uintptr_t addr = (uintptr_t)p & ~(uintptr_t)(pagesize-1);
+  uintptr_t end = (uintptr_t)p + size;
+  void * pages[TOPOLOGY_PAGE_BATCH];
+  int status[TOPOLOGY_PAGE_BATCH];
+
+  while (addr < end)
+  {
+    for (n = 0; n < TOPOLOGY_PAGE_BATCH && addr < end; ++n, addr += pagesize)
+      pages[n] = (void *)addr;
+
+    if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0))
+      return 0;
+
+    for (i = 0; i < n; ++i)
+    {
+      /* negative status for pages not yet touched */
+      if (status[i] < 0) continue;
+
+      *total += 1;
+      if (status[i] == node)
+        *local += 1;
+    }
+  }
+
+  return 1;
+}
+
+#endif
@@ -2184,3 +2184,205 @@ l_unwind:
 
   return tree;
 }
+
+/* Reader for species trees in bulk, e.g. the MCMC sample of A01/A11. Each
+   newick string is parsed in a single pass into one preallocated stree_t,
+   without lexing into tokens and without any allocation. Tip labels are
+   looked up in a hash table of pair_t elements (species label, data); the
+   tip nodes point to the label and data of the matching element. Inner node
+   labels are skipped, and comments in brackets are ignored */
+
+stree_reader_t * stree_reader_create(long max_tips, hashtable_t * ht_species)
+{
+  stree_reader_t * reader;
+
+  assert(max_tips > 0);
+
+  reader = (stree_reader_t *)xmalloc(sizeof(stree_reader_t));
+  reader->max_tips = max_tips;
+  reader->ht_species = ht_species;
+  reader->pool = (snode_t *)xmalloc((size_t)(2*max_tips-1)*sizeof(snode_t));
+  reader->pool_used = 0;
+
+  /* inner nodes are stored after position max_tips while parsing, and are
+     moved next to the tips once the number of tips is known */
+  reader->stree = (stree_t *)xcalloc(1,sizeof(stree_t));
+  reader->stree->nodes = (snode_t **)xmalloc((size_t)(2*max_tips-1) *
+                                             sizeof(snode_t *));
+
+  return reader;
+}
+
+void stree_reader_destroy(stree_reader_t * reader)
+{
+  free(reader->stree->nodes);
+  free(reader->stree);
+  free(reader->pool);
+  free(reader);
+}
+
+static int reader_islabel(int c)
+{
+  return c && !strchr("(),:;#[] \t\r\n", c);
+}
+
+static char * reader_skipws(char * p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    ++p;
+
+  return p;
+}
+
+static snode_t * reader_node(stree_reader_t * reader, snode_t * parent)
+{
+  snode_t * node;
+
+  if (reader->pool_used == 2*reader->max_tips-1)
+    return NULL;
+
+  node = reader->pool + reader->pool_used++;
+  memset(node,0,sizeof(snode_t));
+  node->parent = parent;
+
+  return node;
+}
+
+/* theta (#), branch length (:) and comments, in any order */
+static char * reader_attributes(snode_t * node, char * p)
+{
+  char * end;
+
+  while (1)
+  {
+    p = reader_skipws(p);
+
+    if (*p == '#' || *p == ':')
+    {
+      double x = strtod(p+1,&end);
+      if (end == p+1)
+        return NULL;
+
+      if (*p == '#')
+        node->theta = x;
+      else
+        node->length = x;
+      p = end;
+    }
+    else if (*p == '[')
+    {
+      if (!(p = strchr(p,']')))
+        return NULL;
+      ++p;
+    }
+    else
+      return p;
+  }
+}
+
+static char * reader_subtree(stree_reader_t * reader, snode_t * node, char * p)
+{
+  stree_t * stree = reader->stree;
+
+  p = reader_skipws(p);
+
+  if (*p == '(')
+  {
+    /* a binary tree of at most max_tips tips has max_tips-1 inner nodes */
+    if (stree->inner_count == reader->max_tips-1)
+      return NULL;
+
+    /* inner nodes are numbered in preorder as in stree_from_ntree() */
+    stree->nodes[reader->max_tips + stree->inner_count++] = node;
+
+    if (!(node->left = reader_node(reader,node)))
+      return NULL;
+    if (!(p = reader_subtree(reader,node->left,p+1)))
+      return NULL;
+
+    p = reader_skipws(p);
+    if (*p != ',')
+      return NULL;
+
+    if (!(node->right = reader_node(reader,node)))
+      return NULL;
+    if (!(p = reader_subtree(reader,node->right,p+1)))
+      return NULL;
+
+    p = reader_skipws(p);
+    if (*p != ')')
+      return NULL;
+    ++p;
+
+    node->leaves = node->left->leaves + node->right->leaves;
+
+    while (reader_islabel(*p))
+      ++p;
+  }
+  else
+  {
+    char * label = p;
+    pair_t * pair;
+
+    while (reader_islabel(*p))
+      ++p;
+    if (p == label || stree->tip_count == reader->max_tips)
+      return NULL;
+
+    /* terminate the label in place for the lookup */
+    char c = *p;
+    *p = 0;
+    pair = (pair_t *)hashtable_find(reader->ht_species,
+                                    (void *)label,
+                                    hash_fnv(label),
+                                    cb_cmp_pairlabel);
+    *p = c;
+    if (!pair)
+      return NULL;
+
+    node->label = pair->label;
+    node->data = pair->data;
+    node->leaves = 1;
+    stree->nodes[stree->tip_count++] = node;
+  }
+
+  return reader_attributes(node,p);
+}
+
+/* parse the newick string s into the tree of reader and return it, or NULL
+   if s is not a rooted binary tree of known species. Tip labels are
+   terminated in place during the lookup, hence s must be writable, but its
+   contents are restored before returning. If endp is given, it is set to the
+   character after the semicolon */
+stree_t * stree_reader_parse(stree_reader_t * reader, char * s, char ** endp)
+{
+  unsigned int i;
+  char * p;
+  stree_t * stree = reader->stree;
+
+  reader->pool_used = 0;
+  stree->tip_count = 0;
+  stree->inner_count = 0;
+  stree->hybrid_count = 0;
+
+  stree->root = reader_node(reader,NULL);
+  if (!(p = reader_subtree(reader,stree->root,s)))
+    return NULL;
+
+  p = reader_skipws(p);
+  if (*p != ';')
+    return NULL;
+
+  memmove(stree->nodes + stree->tip_count,
+          stree->nodes + reader->max_tips,
+          stree->inner_count * sizeof(snode_t *));
+  stree->edge_count = stree->tip_count + stree->inner_count - 1;
+
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+    stree->nodes[i]->node_index = i;
+
+  if (endp)
+    *endp = p+1;
+
+  return stree;
+}
@@ -69,9 +69,35 @@ void progress_done()
     fprintf(stderr, "  \r%s %.0f%%\n", progress_prompt, 100.0);
 }
 
+#ifdef CHECK_ALLOC
+static long alloc_count = 0;
+static pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void alloc_count_inc(void)
+{
+  pthread_mutex_lock(&alloc_mutex);
+  ++alloc_count;
+  pthread_mutex_unlock(&alloc_mutex);
+}
+
+long debug_alloc_count(void)
+{
+  long count;
+
+  pthread_mutex_lock(&alloc_mutex);
+  count = alloc_count;
+  pthread_mutex_unlock(&alloc_mutex);
+
+  return count;
+}
+#endif
+
 void * xmalloc(size_t size)
 {
   void * t;
+  #ifdef CHECK_ALLOC
+  alloc_count_inc();
+  #endif
   t = malloc(size);
   if (!t)
     fatal("Unable to allocate enough memory.");
@@ -82,6 +108,9 @@ void * xmalloc(size_t size)
 void * xcalloc(size_t nmemb, size_t size)
 {
   void * t;
+  #ifdef CHECK_ALLOC
+  alloc_count_inc();
+  #endif
   t = calloc(nmemb,size);
   if (!t)
     fatal("Unable to allocate enough memory.");
@@ -91,6 +120,9 @@ void * xcalloc(size_t nmemb, size_t size)
 
 void * xrealloc(void *ptr, size_t size)
 {
+  #ifdef CHECK_ALLOC
+  alloc_count_inc();
+  #endif
   void * t = realloc(ptr, size);
   if (!t)
     fatal("Unable to allocate enough memory.");
@@ -122,6 +154,100 @@ char * xstrndup(const char * s, size_t len)
   return p;
 }
 
+/* growable string buffer used for writing trees; sb->s is kept NUL-terminated
+   and may be handed over to the caller */
+void strbuf_init(strbuf_t * sb)
+{
+  sb->s = NULL;
+  sb->len = 0;
+  sb->alloc = 0;
+}
+
+static void strbuf_grow(strbuf_t * sb, size_t n)
+{
+  if (sb->len + n + 1 <= sb->alloc) return;
+
+  size_t alloc = sb->alloc ? sb->alloc : 256;
+  while (sb->len + n + 1 > alloc)
+    alloc *= 2;
+
+  sb->s = (char *)xrealloc(sb->s, alloc);
+  sb->alloc = alloc;
+}
+
+void strbuf_putc(strbuf_t * sb, char c)
+{
+  strbuf_grow(sb,1);
+  sb->s[sb->len++] = c;
+  sb->s[sb->len] = 0;
+}
+
+void strbuf_puts(strbuf_t * sb, const char * s)
+{
+  size_t n = strlen(s);
+
+  strbuf_grow(sb,n);
+  memcpy(sb->s+sb->len, s, n+1);
+  sb->len += n;
+}
+
+/* append x formatted exactly as printf("%f") would. Values below 10^6 are
+   rounded to six decimals with one multiplication, unless the product lies
+   too close to a rounding boundary, in which case printf decides */
+void strbuf_putf(strbuf_t * sb, double x)
+{
+  char buf[32];
+  char * p = buf + sizeof(buf);
+  double a = fabs(x);
+  long i;
+
+  if (a < 1e6)
+  {
+    double y = a * 1e6;
+    double r = floor(y);
+
+    if (fabs(y - r - 0.5) > 1e-3)
+    {
+      if (y - r > 0.5)
+        r += 1;
+
+      double ip = floor(r / 1e6);
+      long ipart = (long)ip;
+      long fpart = (long)(r - ip*1e6);
+
+      *--p = 0;
+      for (i = 0; i < 6; ++i)
+      {
+        *--p = (char)('0' + fpart % 10);
+        fpart /= 10;
+      }
+      *--p = '.';
+      do
+      {
+        *--p = (char)('0' + ipart % 10);
+        ipart /= 10;
+      }
+      while (ipart);
+      if (signbit(x))
+        *--p = '-';
+
+      strbuf_puts(sb,p);
+      return;
+    }
+  }
+
+  snprintf(buf, sizeof(buf), "%f", x);
+  if (strlen(buf) == sizeof(buf)-1)
+  {
+    char * s;
+    xasprintf(&s, "%f", x);
+    strbuf_puts(sb,s);
+    free(s);
+  }
+  else
+    strbuf_puts(sb,buf);
+}
+
 #if 0
 long getusec(void)
 {
@@ -144,6 +270,10 @@ void * pll_aligned_alloc(size_t size, size_t alignment)
 {
   void * mem;
 
+  #ifdef CHECK_ALLOC
+  alloc_count_inc();
+  #endif
+
 #if (defined(_WIN32) || defined(_WIN64))
   mem = _aligned_malloc(size, alignment);
 #else
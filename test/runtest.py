@@ -1,4 +1,4 @@
-#!/usr/bin/env python
+#!/usr/bin/env python3
 
 # Copyright (C) 2016-2018 Tomas Flouri, Bruce Rannala and Ziheng Yang
 #
@@ -19,15 +19,23 @@
 # Department of Genetics, Evolution and Environment,
 # University College London, Gower Street, London WC1E 6BT, England
 
+from __future__ import print_function
 from subprocess import Popen, PIPE, call
 
 import sys, stat, os
+import shutil
 import time
 
-# define path to BPP binary
+# define path to BPP binary: the first command-line argument, otherwise the
+# environment variable BPP_BIN, otherwise the binary built in this checkout
 
-opt_bpp_bin = "$HOME/DEV/bpp/src/bpp"
-# opt_bpp_bin = "$HOME/DELETE/bpp/src/bpp"
+opt_test_dir = os.path.dirname(os.path.abspath(__file__))
+opt_bpp_bin = os.path.join(opt_test_dir, "..", "src", "bpp")
+if len(sys.argv) > 1:
+  opt_bpp_bin = sys.argv[1]
+elif "BPP_BIN" in os.environ:
+  opt_bpp_bin = os.environ["BPP_BIN"]
+opt_bpp_bin = os.path.abspath(os.path.expandvars(opt_bpp_bin))
 
 # define each testbed and 
 
@@ -218,11 +226,44 @@ opt_testsuite_ziheng = [                 # [path-to-test,description]
    ["testbed/ziheng/3",  "ziheng-3"],
    ["testbed/ziheng/4",  "ziheng-4"]
 ]
+
+# Tests of features without reference output from the stable version. Unless
+# a test has its own data/bpp.ctl, its control file is the shared
+# testbed/features/common/bpp.ctl followed by the options of
+# data/options.txt, which override the shared ones. The third field selects
+# the check:
+#   same  - mcmc.txt equals the one of the shared control file followed by
+#           data/base.txt (if it exists) run with the same binary;
+#           data/same.txt may list other pairs of files (one pair per line,
+#           relative to the test directory) to compare instead
+#   fail  - bpp exits with an error and prints each line of data/expected.txt
+#   grep  - out.txt contains each line of data/expected.txt, except lines
+#           starting with '!' whose remainder must not appear
+#   mc3   - swaps traced by --debug_mc3 follow b_k = 1/(1+k*delta) and
+#           lnacceptance = (b_k - b_{k+1})*(lnL_b - lnL_a), those with
+#           lnacceptance >= 0 are accepted, and the counts of the sampling
+#           phase match the swap table of out.txt
+# Extra command-line options are read from data/args.txt if it exists
+
+opt_testsuite_features_desc = "features"
+opt_testsuite_features = [               # [path-to-test,description,check]
+   ["testbed/features/1", "summary-malformed-tree", "fail"],
+   ["testbed/features/2", "lowmem",                 "same"],
+   ["testbed/features/3", "lowmem-threads",         "same"],
+   ["testbed/features/4", "adaptfinetune-clamp",    "grep"],
+   ["testbed/features/5", "processes-socket",       "same"],
+   ["testbed/features/6", "processes-shm",          "same"],
+   ["testbed/features/7", "processes-A01-rejected", "fail"],
+   ["testbed/features/8", "chains-replicates",      "same"],
+   ["testbed/features/9", "heatedchains-swaps",     "mc3"]
+]
+
 # define test collections
 
 opt_testbeds = [
    [opt_testsuite_small,opt_testsuite_small_desc],
-   [opt_testsuite_ziheng,opt_testsuite_ziheng_desc]
+   [opt_testsuite_ziheng,opt_testsuite_ziheng_desc],
+   [opt_testsuite_features,opt_testsuite_features_desc]
 ]
 
 ## define architectures to test
@@ -253,7 +294,7 @@ def header():
   sys.stdout.write(" _                   _  _   \n"
                    "| |                 | || |  \n"
                    "| |__  _ __  _ __   | || |_ \n"
-                   "| '_ \| '_ \| '_ \  |__   _|\n"
+                   "| '_ \\| '_ \\| '_ \\  |__   _|\n"
                    "| |_) | |_) | |_) |    | |  \n"
                    "|_.__/| .__/| .__/     |_|  \n"
                    "      | |   | |             \n"
@@ -294,26 +335,126 @@ def difftest(test):
 
   refmcmcfile = test + "/ref/mcmc.txt"
 
-  p = Popen(["diff","-q",mcmcfile,refmcmcfile], stdout=PIPE)
+  p = Popen(["diff","-q",mcmcfile,refmcmcfile], stdout=PIPE,
+            universal_newlines=True)
   output = p.communicate()[0]
   return output
 
-def testf(curtest,numtest,t,desc,arch):
+def sametest(test):
+  pairs = [["out/mcmc.txt", "out-base/mcmc.txt"]]
+  if os.path.exists(test + "/data/same.txt"):
+    pairs = [line.split() for line in open(test + "/data/same.txt")
+             if line.strip()]
+
+  for pair in pairs:
+    mcmcfile = test + "/" + pair[0]
+    basemcmcfile = test + "/" + pair[1]
+
+    if not os.path.exists(mcmcfile) or not os.path.exists(basemcmcfile):
+      return "missing output"
+
+    p = Popen(["diff","-q",mcmcfile,basemcmcfile], stdout=PIPE,
+              universal_newlines=True)
+    output = p.communicate()[0]
+    if output:
+      return output
+  return ""
+
+def expecttest(test,textfile):
+  if not os.path.exists(textfile):
+    return "missing output"
+
+  text = open(textfile).read()
+  for line in open(test + "/data/expected.txt"):
+    line = line.rstrip("\n")
+    if line.startswith("!"):
+      if line[1:] in text:
+        return "unexpected: " + line[1:]
+    elif line and line not in text:
+      return "missing: " + line
+  return ""
+
+def mc3test(test):
+  tried = {}
+  accepted = {}
+  for line in open("tmperr"):
+    if not line.startswith("[Debug] (mc3)"):
+      continue
+    f = line.split()
+    step = int(f[4])
+    k = int(f[7])
+    delta = float(f[10])
+    b1 = float(f[13])
+    b2 = float(f[16])
+    lnl1 = float(f[19])
+    lnl2 = float(f[22])
+    lnacc = float(f[25])
+    if abs(b1 - 1/(1+k*delta)) > 1e-8 or abs(b2 - 1/(1+(k+1)*delta)) > 1e-8:
+      return "wrong beta: " + line
+    if abs(lnacc - (b1-b2)*(lnl2-lnl1)) > 1e-6:
+      return "wrong lnacceptance: " + line
+    if lnacc >= 0 and f[26] != "accepted":
+      return "rejected: " + line
+    if step >= 0:
+      tried[k] = tried.get(k,0) + 1
+      accepted[k] = accepted.get(k,0) + (f[26] == "accepted")
+  if not tried:
+    return "no swaps"
+
+  rows = [line.split() for line in open(test + "/out/out.txt")]
+  rows = [r for r in rows if len(r) == 5 and r[2].isdigit()]
+  for k in tried:
+    if k >= len(rows) or int(rows[k][2]) != tried[k] or \
+       int(rows[k][3]) != accepted[k]:
+      return "swap counts differ for k = %d" % k
+  return ""
+
+opt_features_common = "testbed/features/common/bpp.ctl"
+
+# write the control file of a features test into outdir
+def makectl(t,outdir,options):
+  ctl = outdir + "/bpp.ctl"
+  f = open(ctl,"w")
+  f.write(open(opt_features_common).read())
+  f.write("outfile = " + outdir + "/out.txt\n")
+  f.write("mcmcfile = " + outdir + "/mcmc.txt\n")
+  if os.path.exists(t + "/data/" + options):
+    f.write(open(t + "/data/" + options).read())
+  f.close()
+  return ctl
+
+def runbpp(ctl,arch,args):
+  cmd = opt_bpp_bin + " --cfile " + ctl + " --arch "  + arch + " " + args + \
+        " 2>tmperr >tmp"
+
+  p1 = Popen(cmd, shell=True)
+  return os.waitpid(p1.pid,0)[1]
+
+def testf(curtest,numtest,t,desc,arch,check):
   
   # create output directory
   outdir = t + "/out";
   if not os.path.exists(outdir):
     os.makedirs(outdir)
 
+  args = ""
+  if os.path.exists(t + "/data/args.txt"):
+    args = open(t + "/data/args.txt").read().strip()
+
   ctl = t + "/data/bpp.ctl"
-  cmd = opt_bpp_bin + " --cfile " + ctl + " --arch "  + arch + " 2>tmperr >tmp"
+  if not os.path.exists(ctl):
+    ctl = makectl(t,outdir,"options.txt")
 
   now = time.strftime("  %H:%M:%S")
 
   tstart = time.time()
 
-  p1 = Popen(cmd, shell=True)
-  os.waitpid(p1.pid,0)
+  if check == "same":
+    if not os.path.exists(t + "/out-base"):
+      os.makedirs(t + "/out-base")
+    runbpp(makectl(t,t + "/out-base","base.txt"),arch,args)
+
+  status = runbpp(ctl,arch,args)
 
   tend = time.time()
   runtime = tend - tstart
@@ -322,18 +463,27 @@ def testf(curtest,numtest,t,desc,arch):
   ansiprint("cyan", " {:<39} ".format(desc))
 
   runtime = "%.2f" % runtime
-  result = difftest(t)
+  if check == "same":
+    result = sametest(t)
+  elif check == "fail":
+    result = expecttest(t,"tmperr") if status else "no error"
+  elif check == "grep":
+    result = expecttest(t,outdir + "/out.txt")
+  elif check == "mc3":
+    result = mc3test(t)
+  else:
+    result = difftest(t)
   ansiprint("cyan", "{:<14} ".format(runtime))
   if result == "":
     test_ok()
   else:
     test_fail()
-  print
+  print()
 
-  # delete output directory and files
-  os.remove(outdir + "/mcmc.txt")
-  os.remove(outdir + "/out.txt")
-  os.rmdir(outdir)
+  # delete output directories and files
+  shutil.rmtree(outdir)
+  if os.path.exists(t + "/out-base"):
+    shutil.rmtree(t + "/out-base")
    
 def runtests():
   total = 0;
@@ -346,7 +496,7 @@ def runtests():
 
   for arch in opt_testarch:
     ansiprint("bluebg", "{:<80}"
-               .format(arch.rjust(40+len(arch)/2)), True)
+               .format(arch.rjust(40+len(arch)//2)), True)
     ansiprint("yellowbg", "{:<7}   {:<8} {:<39} {:<14} Result"
                .format(" ","Start", "Test", "Time [s]"),True)
 
@@ -357,14 +507,20 @@ def runtests():
       for t in testlist:
         test = t[0]
         testdesc = t[1];
+        check = t[2] if len(t) > 2 else "ref"
         current = current+1
-        testf(current,total,test,testdesc,arch)
+        testf(current,total,test,testdesc,arch,check)
 
 if __name__ == "__main__":
   
   header()
 
-  if not os.path.isfile(os.path.expandvars(opt_bpp_bin)):
-    print "BPP binary not found. Please update variable 'opt_bpp_bin' (line 29)"
+  if not os.path.isfile(opt_bpp_bin):
+    print("BPP binary not found: %s. Pass its path as the first argument or "
+          "in the environment variable BPP_BIN" % opt_bpp_bin)
+    sys.exit(1)
+
+  # test paths are relative to the directory of this script
+  os.chdir(opt_test_dir)
 
   runtests()